@@ -1,6 +1,7 @@
 #version 330
 layout(location = 0) in vec3 position;
 layout(location = 1) in vec2 texCoord;
+layout(location = 2) in vec3 instancePos; //world-space position of the plant, one per instance
 smooth out vec3 outputColor;
 smooth out vec2 colorCoord;
 uniform mat4 perspectiveMatrix;
@@ -10,7 +11,7 @@ const vec3 ambientIntensity = vec3(1.0, 1.0, 1.0);
 
 void main()
 {
-	vec4 full_pos = vec4(position.xyz, 1.0);
+	vec4 full_pos = vec4((position.xyz + instancePos), 1.0);
 	vec4 pos_in_cameraspace = modelToCameraMatrix * full_pos;
 	//use the texture coordinate to place where the final vertex should go
 	pos_in_cameraspace.x += (texCoord.x - 0.5)*billboardSize.x; //bias the x coord so that it centers the billboard
@@ -100,6 +100,8 @@ struct character_struct
 	unsigned int flags;		//these are broad state flags of the character
 	unsigned int events;	//these events control flags
 	struct character_animation_struct anim;
+	float * skinned_verts;	//this character's posed copy of p_common->new_vert_data, see SkinCharacterModel()
+	float * skinned_bones;	//bone transforms skinned_verts was posed with
 };
 
 //These are flags for the character_struct flags element and the events element:
@@ -0,0 +1,604 @@
+/*
+ESRI ASCII grid (.asc) DEM reader. The file is mapped read-only, the
+elevation body is split at line boundaries, and each block of lines is
+parsed on its own thread with DEMParseFloat() (no stdio, no per-value
+allocation).
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "my_dem.h"
+
+/*
+State for one worker thread of DEMParseRows(). start always sits at the
+beginning of a line. Rows are found by counting values, not lines, so a
+row can be wrapped over several lines and blank lines don't count.
+*/
+struct dem_worker_struct
+{
+	struct DEM_info_struct * pDemInfo;
+	dem_row_func func;
+	void * user;
+	int thread_i;
+	const char * start;
+	const char * end;
+	const char * body_end;	//a row that starts in [start, end) is read on past end if it has to
+	long long first_value;	//index of the first value in [start, end)
+	long long num_values;	//# of values in [start, end), filled in by DEMWorkerCountValues
+	int result;
+};
+
+/*
+state shared by the DEMGetMinMaxElevation() row callback
+*/
+struct dem_minmax_struct
+{
+	float min[DEM_MAX_THREADS];
+	float max[DEM_MAX_THREADS];
+	int found[DEM_MAX_THREADS];
+};
+
+static int DEMLoadInfo(struct DEM_info_struct * pDemInfo);
+static const char * DEMReadHeaderToken(const char * p, const char * end, char * s, int s_len);
+static const char * DEMSkipSpace(const char * p, const char * end);
+static void * DEMWorkerCountValues(void * arg);
+static void * DEMWorkerParseRows(void * arg);
+static void DEMMinMaxRowFunc(void * user, int thread_i, int row, float * values, int num_values);
+
+#define DEM_IS_SPACE(c) ((c) == ' ' || (c) == '\t' || (c) == '\r' || (c) == '\n')
+
+static const double g_dem_pow10[23] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+/*
+DEMOpen
+Maps the DEM file and reads the header.
+returns 1 on success, 0 on failure
+*/
+int DEMOpen(struct DEM_info_struct * pDemInfo, char * filename)
+{
+	struct stat st;
+	int r;
+
+	memset(pDemInfo, 0, sizeof(struct DEM_info_struct));
+	pDemInfo->fd = open(filename, O_RDONLY);
+	if(pDemInfo->fd == -1)
+	{
+		printf("DEMOpen: error. could not open %s\n", filename);
+		return 0;
+	}
+	if(fstat(pDemInfo->fd, &st) == -1 || st.st_size == 0)
+	{
+		printf("DEMOpen: error. could not stat %s or it is empty\n", filename);
+		close(pDemInfo->fd);
+		pDemInfo->fd = -1;
+		return 0;
+	}
+
+	pDemInfo->pData = (char*)mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, pDemInfo->fd, 0);
+	if(pDemInfo->pData == MAP_FAILED)
+	{
+		printf("DEMOpen: mmap failed for %s\n", filename);
+		pDemInfo->pData = 0;
+		close(pDemInfo->fd);
+		pDemInfo->fd = -1;
+		return 0;
+	}
+	pDemInfo->data_len = st.st_size;
+	madvise(pDemInfo->pData, pDemInfo->data_len, MADV_SEQUENTIAL);
+
+	r = DEMLoadInfo(pDemInfo);
+	if(r == 0)
+	{
+		DEMClose(pDemInfo);
+		return 0;
+	}
+	return 1;
+}
+
+void DEMClose(struct DEM_info_struct * pDemInfo)
+{
+	if(pDemInfo->pData != 0)
+		munmap(pDemInfo->pData, pDemInfo->data_len);
+	if(pDemInfo->fd != -1)
+		close(pDemInfo->fd);
+	pDemInfo->pData = 0;
+	pDemInfo->data_len = 0;
+	pDemInfo->fd = -1;
+}
+
+/*
+DEMReadHeaderToken
+Copies the next whitespace separated token at p into s.
+returns a pointer just past the token.
+*/
+static const char * DEMReadHeaderToken(const char * p, const char * end, char * s, int s_len)
+{
+	int n = 0;
+
+	while(p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+		p++;
+	while(p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n')
+	{
+		if(n < (s_len-1))
+		{
+			s[n] = *p;
+			n += 1;
+		}
+		p++;
+	}
+	s[n] = '\0';
+	return p;
+}
+
+/*
+DEMLoadInfo
+Reads the 6 header lines (ncols, nrows, xllcenter, yllcenter, cellsize,
+nodata_value) and records where the elevation rows start.
+returns 1 on success, 0 on a format error
+*/
+static int DEMLoadInfo(struct DEM_info_struct * pDemInfo)
+{
+	static const char * keys[6] = {"ncols", "nrows", "xllcenter", "yllcenter", "cellsize", "nodata_value"};
+	char s[64];
+	char value[64];
+	const char * p;
+	const char * end;
+	int i;
+
+	p = pDemInfo->pData;
+	end = pDemInfo->pData + pDemInfo->data_len;
+	for(i = 0; i < 6; i++)
+	{
+		p = DEMReadHeaderToken(p, end, s, 64);
+		if(strcasecmp(s, keys[i]) != 0)
+		{
+			printf("DEMLoadInfo: format error. '%s' missing.\n", keys[i]);
+			return 0;
+		}
+		p = DEMReadHeaderToken(p, end, value, 64);
+		switch(i)
+		{
+		case 0:
+			pDemInfo->num_col = atoi(value);
+			break;
+		case 1:
+			pDemInfo->num_row = atoi(value);
+			break;
+		case 2:
+			pDemInfo->x_llcenter = (float)atof(value);
+			break;
+		case 3:
+			pDemInfo->y_llcenter = (float)atof(value);
+			break;
+		case 4:
+			pDemInfo->cellsize = (float)atof(value);
+			break;
+		case 5:
+			pDemInfo->nodata_value = (float)atof(value);
+			break;
+		}
+	}
+	if(pDemInfo->num_col <= 0 || pDemInfo->num_row <= 0)
+	{
+		printf("DEMLoadInfo: format error. bad ncols/nrows %d %d\n", pDemInfo->num_col, pDemInfo->num_row);
+		return 0;
+	}
+	pDemInfo->num_total = pDemInfo->num_col*pDemInfo->num_row;
+
+	//the elevation rows start on the line after nodata_value
+	while(p < end && *p != '\n')
+		p++;
+	if(p < end)
+		p++;
+	pDemInfo->data_start_pos = p - pDemInfo->pData;
+
+	printf("ncols: %d\nnrows: %d\n", pDemInfo->num_col, pDemInfo->num_row);
+	printf("xllcenter: %f\nyllcenter: %f\n", pDemInfo->x_llcenter, pDemInfo->y_llcenter);
+
+	return 1;
+}
+
+/*
+DEMGetNumThreads
+returns the # of worker threads to use for parsing (one per online cpu).
+*/
+int DEMGetNumThreads(void)
+{
+	long n;
+
+	n = sysconf(_SC_NPROCESSORS_ONLN);
+	if(n < 1)
+		n = 1;
+	if(n > DEM_MAX_THREADS)
+		n = DEM_MAX_THREADS;
+	return (int)n;
+}
+
+/*
+DEMParseFloat
+Parses a decimal number ([+-]digits[.digits][(e|E)[+-]digits]) starting
+at *pp. Up to 19 significant digits are accumulated in an integer and
+scaled once by an exact power of ten, which matches strtof() for the
+short values found in DEM files.
+On success *pp is moved past the number. If there is no number at *pp,
+*pp is left unchanged and 0 is returned.
+*/
+float DEMParseFloat(const char ** pp, const char * end)
+{
+	const char * p = *pp;
+	const char * q;
+	unsigned long long mant = 0;
+	int num_digits = 0; //significant digits held in mant
+	int exp10 = 0;
+	int e = 0;
+	int neg = 0;
+	int eneg = 0;
+	int any = 0;
+	double d;
+
+	if(p < end && (*p == '-' || *p == '+'))
+	{
+		neg = (*p == '-');
+		p++;
+	}
+	while(p < end && (unsigned)(*p - '0') < 10)
+	{
+		if(num_digits < 19)
+		{
+			mant = (mant*10) + (*p - '0');
+			if(mant != 0)
+				num_digits += 1;
+		}
+		else
+		{
+			exp10 += 1; //digit doesn't fit, just keep the magnitude
+		}
+		any = 1;
+		p++;
+	}
+	if(p < end && *p == '.')
+	{
+		p++;
+		while(p < end && (unsigned)(*p - '0') < 10)
+		{
+			if(num_digits < 19)
+			{
+				mant = (mant*10) + (*p - '0');
+				if(mant != 0)
+					num_digits += 1;
+				exp10 -= 1;
+			}
+			any = 1;
+			p++;
+		}
+	}
+	if(any == 0)
+		return 0.0f;
+
+	if(p < end && (*p == 'e' || *p == 'E'))
+	{
+		q = p+1;
+		if(q < end && (*q == '-' || *q == '+'))
+		{
+			eneg = (*q == '-');
+			q++;
+		}
+		if(q < end && (unsigned)(*q - '0') < 10)
+		{
+			while(q < end && (unsigned)(*q - '0') < 10)
+			{
+				if(e < 10000)
+					e = (e*10) + (*q - '0');
+				q++;
+			}
+			exp10 += (eneg) ? -e : e;
+			p = q;
+		}
+	}
+
+	d = (double)mant;
+	while(exp10 > 22)
+	{
+		d *= 1e22;
+		exp10 -= 22;
+	}
+	while(exp10 < -22)
+	{
+		d /= 1e22;
+		exp10 += 22;
+	}
+	if(exp10 > 0)
+		d *= g_dem_pow10[exp10];
+	else if(exp10 < 0)
+		d /= g_dem_pow10[-exp10];
+
+	*pp = p;
+	return (neg) ? -(float)d : (float)d;
+}
+
+/*
+DEMSkipSpace
+returns p moved past any spaces, tabs and line breaks
+*/
+static const char * DEMSkipSpace(const char * p, const char * end)
+{
+	while(p < end && DEM_IS_SPACE(*p))
+		p++;
+	return p;
+}
+
+/*
+DEMWorkerCountValues
+Counts the values (whitespace separated tokens) in a worker's chunk so
+every worker knows the index of its first value.
+*/
+static void * DEMWorkerCountValues(void * arg)
+{
+	struct dem_worker_struct * worker = (struct dem_worker_struct*)arg;
+	const char * p = worker->start;
+	long long n = 0;
+
+	while(1)
+	{
+		p = DEMSkipSpace(p, worker->end);
+		if(p == worker->end)
+			break;
+		n += 1;
+		while(p < worker->end && !DEM_IS_SPACE(*p))
+			p++;
+	}
+	worker->num_values = n;
+	return 0;
+}
+
+/*
+DEMWorkerParseRows
+Parses every row that starts in a worker's chunk into a row buffer and
+hands it to the row callback. The row of value i is i/num_col, whatever
+line the value is on. A row that runs past the end of the chunk is
+finished here, and the worker of the next chunk skips the values of it
+it has. Values past num_row rows are ignored.
+*/
+static void * DEMWorkerParseRows(void * arg)
+{
+	struct dem_worker_struct * worker = (struct dem_worker_struct*)arg;
+	int num_col = worker->pDemInfo->num_col;
+	int num_row = worker->pDemInfo->num_row;
+	const char * p = worker->start;
+	const char * prev;
+	long long num_skip;
+	float * values;
+	int row;
+	int n;
+
+	values = (float*)malloc(num_col*sizeof(float));
+	if(values == 0)
+	{
+		printf("DEMWorkerParseRows: malloc failed for row buffer\n");
+		worker->result = 0;
+		return 0;
+	}
+
+	//skip the end of a row the previous chunk started
+	num_skip = (num_col - (worker->first_value % num_col)) % num_col;
+	if(num_skip > worker->num_values)
+		num_skip = worker->num_values;
+	while(num_skip > 0)
+	{
+		p = DEMSkipSpace(p, worker->end);
+		while(p < worker->end && !DEM_IS_SPACE(*p))
+			p++;
+		num_skip -= 1;
+	}
+
+	row = (int)((worker->first_value + num_col - 1)/num_col);
+	while(row < num_row)
+	{
+		p = DEMSkipSpace(p, worker->body_end);
+		if(p >= worker->end) //the next row starts in the next chunk
+			break;
+		for(n = 0; n < num_col; n++)
+		{
+			p = DEMSkipSpace(p, worker->body_end);
+			if(p == worker->body_end)
+				break;
+			prev = p;
+			values[n] = DEMParseFloat(&p, worker->body_end);
+			if(p == prev || (p < worker->body_end && !DEM_IS_SPACE(*p)))
+			{
+				printf("DEMWorkerParseRows: format error. value %d of row %d is not a number.\n", n, row);
+				free(values);
+				worker->result = 0;
+				return 0;
+			}
+		}
+		worker->func(worker->user, worker->thread_i, row, values, n);
+		row += 1;
+	}
+
+	free(values);
+	worker->result = 1;
+	return 0;
+}
+
+/*
+DEMParseRows
+Splits the elevation body of the DEM into num_threads blocks of rows and
+calls func for every row from the worker threads. The calling thread
+does the work of block 0. Rows are handed out in order within a block
+but blocks run concurrently, so func must only write to locations
+owned by the row it is given (or to per-thread state).
+returns 1 on success, 0 on failure
+*/
+int DEMParseRows(struct DEM_info_struct * pDemInfo, int num_threads, dem_row_func func, void * user)
+{
+	struct dem_worker_struct workers[DEM_MAX_THREADS];
+	pthread_t threads[DEM_MAX_THREADS];
+	int started[DEM_MAX_THREADS]; //1 if threads[i] needs to be joined
+	const char * body_start;
+	const char * body_end;
+	const char * p;
+	long long body_len;
+	long long num_values;
+	int r;
+	int i;
+
+	if(num_threads < 1)
+		num_threads = 1;
+	if(num_threads > DEM_MAX_THREADS)
+		num_threads = DEM_MAX_THREADS;
+
+	body_start = pDemInfo->pData + pDemInfo->data_start_pos;
+	body_end = pDemInfo->pData + pDemInfo->data_len;
+	body_len = body_end - body_start;
+
+	//split the body into chunks that begin on line boundaries
+	for(i = 0; i < num_threads; i++)
+	{
+		workers[i].pDemInfo = pDemInfo;
+		workers[i].func = func;
+		workers[i].user = user;
+		workers[i].thread_i = i;
+		workers[i].body_end = body_end;
+		workers[i].result = 0;
+		if(i == 0)
+		{
+			workers[i].start = body_start;
+		}
+		else
+		{
+			p = body_start + ((body_len*i)/num_threads);
+			if(p < workers[i-1].start)
+				p = workers[i-1].start;
+			while(p < body_end && p[-1] != '\n')
+				p++;
+			workers[i].start = p;
+		}
+	}
+	for(i = 0; i < num_threads; i++)
+		workers[i].end = (i == (num_threads-1)) ? body_end : workers[i+1].start;
+
+	//pass 1: count values per chunk to find each chunk's first value
+	for(i = 1; i < num_threads; i++)
+	{
+		r = pthread_create(&threads[i], 0, DEMWorkerCountValues, &workers[i]);
+		started[i] = (r == 0);
+		if(r != 0)
+		{
+			printf("DEMParseRows: pthread_create failed (%d)\n", r);
+			DEMWorkerCountValues(&workers[i]);
+		}
+	}
+	DEMWorkerCountValues(&workers[0]);
+	for(i = 1; i < num_threads; i++)
+	{
+		if(started[i])
+			pthread_join(threads[i], 0);
+	}
+	num_values = 0;
+	for(i = 0; i < num_threads; i++)
+	{
+		workers[i].first_value = num_values;
+		num_values += workers[i].num_values;
+	}
+
+	//pass 2: parse
+	for(i = 1; i < num_threads; i++)
+	{
+		r = pthread_create(&threads[i], 0, DEMWorkerParseRows, &workers[i]);
+		started[i] = (r == 0);
+		if(r != 0)
+		{
+			printf("DEMParseRows: pthread_create failed (%d)\n", r);
+			DEMWorkerParseRows(&workers[i]);
+		}
+	}
+	DEMWorkerParseRows(&workers[0]);
+	for(i = 1; i < num_threads; i++)
+	{
+		if(started[i])
+			pthread_join(threads[i], 0);
+	}
+
+	for(i = 0; i < num_threads; i++)
+	{
+		if(workers[i].result == 0)
+			return 0;
+	}
+	if(num_values < pDemInfo->num_total)
+		printf("DEMParseRows: warning. found %lld of %d values\n", num_values, pDemInfo->num_total);
+	return 1;
+}
+
+static void DEMMinMaxRowFunc(void * user, int thread_i, int row, float * values, int num_values)
+{
+	struct dem_minmax_struct * minmax = (struct dem_minmax_struct*)user;
+	float min, max;
+	int i;
+
+	(void)row;
+	if(minmax->found[thread_i] == 0)
+	{
+		minmax->min[thread_i] = values[0];
+		minmax->max[thread_i] = values[0];
+		minmax->found[thread_i] = 1;
+	}
+	min = minmax->min[thread_i];
+	max = minmax->max[thread_i];
+	for(i = 0; i < num_values; i++)
+	{
+		if(values[i] < min)
+			min = values[i];
+		if(values[i] > max)
+			max = values[i];
+	}
+	minmax->min[thread_i] = min;
+	minmax->max[thread_i] = max;
+}
+
+/*
+DEMGetMinMaxElevation
+Finds the min and max elevation in the DEM.
+returns 1 on success, 0 on failure
+*/
+int DEMGetMinMaxElevation(struct DEM_info_struct * pDemInfo, float * pMin, float * pMax)
+{
+	struct dem_minmax_struct minmax;
+	int found = 0;
+	int num_threads;
+	int r;
+	int i;
+
+	memset(&minmax, 0, sizeof(struct dem_minmax_struct));
+	num_threads = DEMGetNumThreads();
+	r = DEMParseRows(pDemInfo, num_threads, DEMMinMaxRowFunc, &minmax);
+	if(r == 0)
+		return 0;
+
+	for(i = 0; i < num_threads; i++)
+	{
+		if(minmax.found[i] == 0)
+			continue;
+		if(found == 0 || minmax.min[i] < *pMin)
+			*pMin = minmax.min[i];
+		if(found == 0 || minmax.max[i] > *pMax)
+			*pMax = minmax.max[i];
+		found = 1;
+	}
+	if(found == 0)
+	{
+		printf("DEMGetMinMaxElevation: error. no elevation data found\n");
+		return 0;
+	}
+
+	printf("found min %f\nfound max %f\n", *pMin, *pMax);
+	return 1;
+}
@@ -0,0 +1,42 @@
+/*
+This file holds functions for reading ESRI ASCII grid (.asc) DEM files.
+The file is memory-mapped and the elevation body is parsed on several
+worker threads, one block of rows per thread.
+*/
+#ifndef MY_DEM_H
+#define MY_DEM_H
+
+#define DEM_MAX_THREADS 32
+
+struct DEM_info_struct
+{
+	int fd;
+	char * pData;		//start of the mapped file
+	long long data_len;	//size of the mapped file
+	int num_col;
+	int num_row;
+	int num_total;
+	float x_llcenter;
+	float y_llcenter;
+	float cellsize;
+	float nodata_value;
+	long long data_start_pos; //offset in pData where the elevation rows start
+};
+
+/*
+Called by the worker threads once per row of the DEM. values holds the
+num_values elevations parsed from row. A row is the next num_col values
+whatever lines they are on, so num_values is num_col except for the last
+row of a file that ends early. thread_i is in [0, num_threads) so the
+callback can keep per-thread state without locking.
+*/
+typedef void (*dem_row_func)(void * user, int thread_i, int row, float * values, int num_values);
+
+int DEMOpen(struct DEM_info_struct * pDemInfo, char * filename);
+void DEMClose(struct DEM_info_struct * pDemInfo);
+int DEMGetNumThreads(void);
+int DEMParseRows(struct DEM_info_struct * pDemInfo, int num_threads, dem_row_func func, void * user);
+int DEMGetMinMaxElevation(struct DEM_info_struct * pDemInfo, float * pMin, float * pMax);
+float DEMParseFloat(const char ** pp, const char * end);
+
+#endif
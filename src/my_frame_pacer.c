@@ -0,0 +1,198 @@
+/*
+Frame pacer. See my_frame_pacer.h.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/timerfd.h>
+#include "my_frame_pacer.h"
+
+static int fpAdvance(struct fp_pacer_struct * pacer, long long now_ns);
+
+/*
+fpGetTime
+returns CLOCK_MONOTONIC in nanoseconds
+*/
+long long fpGetTime(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec*1000000000LL) + now.tv_nsec;
+}
+
+/*
+fpInit
+Makes the timerfd. The first frame is due right away.
+returns 1 on success, 0 on failure
+*/
+int fpInit(struct fp_pacer_struct * pacer, long long period_ns)
+{
+	memset(pacer, 0, sizeof(struct fp_pacer_struct));
+	pacer->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if(pacer->timer_fd == -1)
+	{
+		printf("fpInit: timerfd_create failed (errno=%d)\n", errno);
+		return 0;
+	}
+	pacer->fds[0].fd = pacer->timer_fd;
+	pacer->fds[0].events = POLLIN;
+	pacer->period_ns = period_ns;
+	pacer->next_ns = fpGetTime();
+	return 1;
+}
+
+void fpFree(struct fp_pacer_struct * pacer)
+{
+	if(pacer->timer_fd != -1)
+		close(pacer->timer_fd);
+	pacer->timer_fd = -1;
+}
+
+/*
+fpAddFd
+Adds an fd for fpWait() to wake on when it has something to read.
+returns the bit fpWait() sets for it, or 0 if there is no room
+*/
+int fpAddFd(struct fp_pacer_struct * pacer, int fd)
+{
+	if(pacer->num_fds == FP_MAX_FDS)
+	{
+		printf("fpAddFd: no room for fd %d\n", fd);
+		return 0;
+	}
+	pacer->num_fds += 1;
+	pacer->fds[pacer->num_fds].fd = fd;
+	pacer->fds[pacer->num_fds].events = POLLIN;
+	return (1 << pacer->num_fds);
+}
+
+int fpIsFrameDue(struct fp_pacer_struct * pacer, long long now_ns)
+{
+	return (now_ns >= pacer->next_ns);
+}
+
+/*
+fpAdvance
+Moves next_ns to the first deadline on the grid after now_ns.
+returns the # of deadlines passed on top of the one that was due
+*/
+static int fpAdvance(struct fp_pacer_struct * pacer, long long now_ns)
+{
+	long long n;
+
+	if(now_ns < pacer->next_ns)
+		return 0;
+	n = ((now_ns - pacer->next_ns)/pacer->period_ns) + 1;
+	pacer->next_ns += n*pacer->period_ns;
+	return (int)(n - 1);
+}
+
+/*
+fpBeginFrame
+Call when starting a frame that fpIsFrameDue(). A frame that starts
+after the next deadline also passed is late, and the frames that would
+have been due in between are missed rather than drawn back to back.
+returns how long after its deadline the frame started, in nanoseconds
+*/
+long long fpBeginFrame(struct fp_pacer_struct * pacer, long long now_ns)
+{
+	long long late_ns;
+	int missed;
+
+	late_ns = now_ns - pacer->next_ns;
+	missed = fpAdvance(pacer, now_ns);
+	if(missed > 0)
+	{
+		pacer->num_late += 1;
+		pacer->num_missed += missed;
+	}
+	if(late_ns > pacer->max_late_ns)
+		pacer->max_late_ns = late_ns;
+	pacer->num_frames += 1;
+	return late_ns;
+}
+
+/*
+fpSkipFrame
+Call instead of fpBeginFrame() when a frame is due but nothing changed
+since the last one, to wait for the next deadline.
+*/
+void fpSkipFrame(struct fp_pacer_struct * pacer, long long now_ns)
+{
+	fpAdvance(pacer, now_ns);
+	pacer->num_skipped += 1;
+}
+
+/*
+fpWait
+Sleeps until the next frame is due, or until wake_ns if that is sooner
+(-1 for none), or until one of the added fds has something to read.
+Returns right away if the time has already come. Anything the caller
+buffers itself (e.g. Xlib's event queue) must be checked before calling.
+If the timerfd can't be set it waits on the fds with a poll() timeout
+rounded up to the ms instead, and says so the first time.
+returns a mask: bit 0 if the timer went off, and the bits from fpAddFd()
+of the fds that are ready
+*/
+int fpWait(struct fp_pacer_struct * pacer, long long wake_ns)
+{
+	struct itimerspec its;
+	unsigned long long expirations;
+	long long deadline_ns;
+	long long timeout_ns;
+	int timeout_ms = -1;
+	int first_fd = 0;
+	int mask = 0;
+	int r;
+	int i;
+
+	deadline_ns = pacer->next_ns;
+	if(wake_ns >= 0 && wake_ns < deadline_ns)
+		deadline_ns = wake_ns;
+	if(deadline_ns <= fpGetTime())
+		return 1;
+
+	memset(&its, 0, sizeof(struct itimerspec));
+	its.it_value.tv_sec = (time_t)(deadline_ns/1000000000LL);
+	its.it_value.tv_nsec = (long)(deadline_ns%1000000000LL);
+	r = timerfd_settime(pacer->timer_fd, TFD_TIMER_ABSTIME, &its, 0);
+	if(r == -1) //leave the timerfd out and time the poll instead
+	{
+		if(pacer->timer_failed == 0)
+			printf("fpWait: timerfd_settime failed (errno=%d), using poll timeouts\n", errno);
+		pacer->timer_failed = 1;
+		timeout_ns = deadline_ns - fpGetTime();
+		timeout_ms = 0;
+		if(timeout_ns > 0)
+			timeout_ms = (int)((timeout_ns + 999999)/1000000);
+		first_fd = 1;
+	}
+
+	r = poll(pacer->fds + first_fd, (pacer->num_fds + 1 - first_fd), timeout_ms);
+	if(r == -1)
+	{
+		if(errno != EINTR)
+			printf("fpWait: poll failed (errno=%d)\n", errno);
+		return 0;
+	}
+	pacer->num_waits += 1;
+	if(first_fd == 0 && (pacer->fds[0].revents & POLLIN))
+	{
+		r = read(pacer->timer_fd, &expirations, sizeof(expirations)); //clears it
+		mask |= 1;
+	}
+	if(first_fd == 1 && fpGetTime() >= deadline_ns)
+		mask |= 1;
+	for(i = 1; i <= pacer->num_fds; i++)
+	{
+		if(pacer->fds[i].revents != 0)
+			mask |= (1 << i);
+	}
+	if(mask & ~1)
+		pacer->num_input_wakes += 1;
+	return mask;
+}
@@ -0,0 +1,42 @@
+/*
+This file holds a frame pacer for the main loop. Frames are due every
+period_ns on a fixed grid of deadlines. In between, the loop sleeps in
+fpWait() on a timerfd set to the next deadline, together with the file
+descriptors it gets input from (e.g. the X connection and the mouse), so
+it wakes as soon as input arrives and uses no cpu while waiting. Frames
+that start after the next one was due are counted as late.
+*/
+#ifndef MY_FRAME_PACER_H
+#define MY_FRAME_PACER_H
+
+#include <poll.h>
+
+#define FP_MAX_FDS 8	//input fds, on top of the timerfd
+
+struct fp_pacer_struct
+{
+	int timer_fd;
+	struct pollfd fds[FP_MAX_FDS+1];	//fds[0] is timer_fd
+	int num_fds;			//# of input fds added, not counting timer_fd
+	long long period_ns;
+	long long next_ns;		//when the next frame is due, CLOCK_MONOTONIC
+	int num_frames;			//# of frames started with fpBeginFrame()
+	int num_skipped;		//# of due frames the caller had nothing to draw for
+	int num_late;			//# of frames started after the frame after them was due
+	int num_missed;			//# of deadlines the late frames went past
+	long long max_late_ns;	//latest a frame started after its deadline
+	int num_waits;			//# of fpWait() calls that slept
+	int num_input_wakes;	//# of those woken by an input fd
+	int timer_failed;		//1 once setting the timerfd failed, fpWait() then times its poll() instead
+};
+
+long long fpGetTime(void);
+int fpInit(struct fp_pacer_struct * pacer, long long period_ns);
+void fpFree(struct fp_pacer_struct * pacer);
+int fpAddFd(struct fp_pacer_struct * pacer, int fd);
+int fpIsFrameDue(struct fp_pacer_struct * pacer, long long now_ns);
+long long fpBeginFrame(struct fp_pacer_struct * pacer, long long now_ns);
+void fpSkipFrame(struct fp_pacer_struct * pacer, long long now_ns);
+int fpWait(struct fp_pacer_struct * pacer, long long wake_ns);
+
+#endif
@@ -0,0 +1,390 @@
+/*
+Whole-map heightfield helpers. The normal kernel uses central differences
+on the height grid (one-sided at the map border) and does 4 verts at a
+time with SSE. Rows are split across worker threads.
+Also has the 16-bit height quantizer used for compact tile storage and a
+kernel that samples heights and normals of many points at once.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <pthread.h>
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+#include "my_heightfield.h"
+
+/*
+State for one worker thread of hfCalcNormals().
+*/
+struct hf_normal_worker_struct
+{
+	const float * heights;
+	int num_x;
+	int num_z;
+	float dx;
+	float dz;
+	int first_row;
+	int end_row;
+	hf_normal_row_func func;
+	void * user;
+	int result;
+};
+
+static void hfCalcNormalAt(const float * h, const float * ha, const float * hb, int num_x, int c, float inv_dx2, float inv_dx1, float inv_dz, float * n);
+static void * hfNormalWorker(void * arg);
+static void hfSampleQuadAt(const float * h00, const float * h10, const float * h01, const float * h11, const float * u, const float * v, int i, float inv_spacing, float * y, float * n);
+
+/*
+hfGetNumThreads
+returns the # of worker threads to use (one per online cpu).
+*/
+int hfGetNumThreads(void)
+{
+	long n;
+
+	n = sysconf(_SC_NPROCESSORS_ONLN);
+	if(n < 1)
+		n = 1;
+	if(n > HF_MAX_THREADS)
+		n = HF_MAX_THREADS;
+	return (int)n;
+}
+
+/*
+hfCalcNormalAt
+Scalar normal for column c of a row. h, ha, hb are the row, the row
+above and the row below.
+*/
+static void hfCalcNormalAt(const float * h, const float * ha, const float * hb, int num_x, int c, float inv_dx2, float inv_dx1, float inv_dz, float * n)
+{
+	float gx, gz;
+	float len;
+
+	if(c > 0 && c < (num_x-1))
+		gx = (h[c+1] - h[c-1])*inv_dx2;
+	else if(num_x < 2)
+		gx = 0.0f;
+	else if(c == 0)
+		gx = (h[1] - h[0])*inv_dx1;
+	else
+		gx = (h[c] - h[c-1])*inv_dx1;
+	gz = (hb[c] - ha[c])*inv_dz;
+	len = sqrtf(((gx*gx) + (gz*gz)) + 1.0f);
+	n[0] = (-gx)/len;
+	n[1] = 1.0f/len;
+	n[2] = (-gz)/len;
+}
+
+/*
+hfCalcNormalRow
+Calculates the normals of one row of the heightfield. dx and dz are the
+distances between verts in x and z. The normal of a heightfield y(x,z)
+is (-dy/dx, 1, -dy/dz) normalized. The scalar and SSE paths do the same
+float operations in the same order so they give the same bits.
+*/
+void hfCalcNormalRow(const float * heights, int num_x, int num_z, int row, float dx, float dz, float * nx, float * ny, float * nz)
+{
+	const float * h;	//this row
+	const float * ha;	//row above (-z)
+	const float * hb;	//row below (+z)
+	float inv_dx2;		//1/(2*dx), for interior columns
+	float inv_dx1;		//1/dx, for the first and last column
+	float inv_dz;
+	float n[3];
+	int above, below;
+	int c;
+#ifdef __SSE__
+	__m128 v_inv_dx2;
+	__m128 v_inv_dz;
+	__m128 v_one;
+	__m128 v_sign;
+	__m128 v_gx, v_gz;
+	__m128 v_len;
+#endif
+
+	above = (row > 0) ? (row-1) : row;
+	below = (row < (num_z-1)) ? (row+1) : row;
+	h = heights + ((size_t)row*num_x);
+	ha = heights + ((size_t)above*num_x);
+	hb = heights + ((size_t)below*num_x);
+	inv_dz = (below != above) ? (1.0f/((below-above)*dz)) : 0.0f;
+	inv_dx2 = 1.0f/(2.0f*dx);
+	inv_dx1 = 1.0f/dx;
+
+	//column 0 is one-sided
+	c = 0;
+	if(num_x > 0)
+	{
+		hfCalcNormalAt(h, ha, hb, num_x, 0, inv_dx2, inv_dx1, inv_dz, n);
+		nx[0] = n[0];
+		ny[0] = n[1];
+		nz[0] = n[2];
+		c = 1;
+	}
+#ifdef __SSE__
+	//interior columns, 4 at a time
+	v_inv_dx2 = _mm_set1_ps(inv_dx2);
+	v_inv_dz = _mm_set1_ps(inv_dz);
+	v_one = _mm_set1_ps(1.0f);
+	v_sign = _mm_set1_ps(-0.0f);
+	for(; (c+4) <= (num_x-1); c += 4)
+	{
+		v_gx = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(h+c+1), _mm_loadu_ps(h+c-1)), v_inv_dx2);
+		v_gz = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(hb+c), _mm_loadu_ps(ha+c)), v_inv_dz);
+		v_len = _mm_add_ps(_mm_add_ps(_mm_mul_ps(v_gx, v_gx), _mm_mul_ps(v_gz, v_gz)), v_one);
+		v_len = _mm_sqrt_ps(v_len);
+		_mm_storeu_ps(nx+c, _mm_div_ps(_mm_xor_ps(v_gx, v_sign), v_len));
+		_mm_storeu_ps(ny+c, _mm_div_ps(v_one, v_len));
+		_mm_storeu_ps(nz+c, _mm_div_ps(_mm_xor_ps(v_gz, v_sign), v_len));
+	}
+#endif
+	//remaining columns, including the one-sided last column
+	for(; c < num_x; c++)
+	{
+		hfCalcNormalAt(h, ha, hb, num_x, c, inv_dx2, inv_dx1, inv_dz, n);
+		nx[c] = n[0];
+		ny[c] = n[1];
+		nz[c] = n[2];
+	}
+}
+
+static void * hfNormalWorker(void * arg)
+{
+	struct hf_normal_worker_struct * worker = (struct hf_normal_worker_struct*)arg;
+	float * buf;
+	int row;
+
+	buf = (float*)malloc(3*worker->num_x*sizeof(float));
+	if(buf == 0)
+	{
+		printf("hfNormalWorker: malloc failed for row buffer\n");
+		worker->result = 0;
+		return 0;
+	}
+	for(row = worker->first_row; row < worker->end_row; row++)
+	{
+		hfCalcNormalRow(worker->heights, worker->num_x, worker->num_z, row, worker->dx, worker->dz,
+			buf,
+			(buf+worker->num_x),
+			(buf+(2*worker->num_x)));
+		worker->func(worker->user, row, buf, (buf+worker->num_x), (buf+(2*worker->num_x)), worker->num_x);
+	}
+	free(buf);
+	worker->result = 1;
+	return 0;
+}
+
+/*
+hfCalcNormals
+Calculates the normals of every vert in the heightfield and hands them
+to func one row at a time. Rows are split into num_threads blocks and
+the calling thread does block 0.
+returns 1 on success, 0 on failure
+*/
+int hfCalcNormals(const float * heights, int num_x, int num_z, float dx, float dz, int num_threads, hf_normal_row_func func, void * user)
+{
+	struct hf_normal_worker_struct workers[HF_MAX_THREADS];
+	pthread_t threads[HF_MAX_THREADS];
+	int started[HF_MAX_THREADS];
+	int r;
+	int i;
+
+	if(num_threads < 1)
+		num_threads = 1;
+	if(num_threads > HF_MAX_THREADS)
+		num_threads = HF_MAX_THREADS;
+
+	for(i = 0; i < num_threads; i++)
+	{
+		workers[i].heights = heights;
+		workers[i].num_x = num_x;
+		workers[i].num_z = num_z;
+		workers[i].dx = dx;
+		workers[i].dz = dz;
+		workers[i].first_row = (int)(((long long)num_z*i)/num_threads);
+		workers[i].end_row = (int)(((long long)num_z*(i+1))/num_threads);
+		workers[i].func = func;
+		workers[i].user = user;
+		workers[i].result = 0;
+	}
+
+	for(i = 1; i < num_threads; i++)
+	{
+		r = pthread_create(&threads[i], 0, hfNormalWorker, &workers[i]);
+		started[i] = (r == 0);
+		if(r != 0)
+		{
+			printf("hfCalcNormals: pthread_create failed (%d)\n", r);
+			hfNormalWorker(&workers[i]);
+		}
+	}
+	hfNormalWorker(&workers[0]);
+	for(i = 1; i < num_threads; i++)
+	{
+		if(started[i])
+			pthread_join(threads[i], 0);
+	}
+
+	for(i = 0; i < num_threads; i++)
+	{
+		if(workers[i].result == 0)
+			return 0;
+	}
+	return 1;
+}
+
+/*
+hfQuantizeHeights
+Packs num heights into 16-bit values so that h = bias + (q*scale). bias
+is the min height and scale spreads the max-min range over 0..65535.
+The worst-case error of the packed heights is written to perror.
+returns 1 if the error is within max_error, 0 if the range is too big
+to hold at that error in 16 bits (q is still filled in).
+*/
+int hfQuantizeHeights(const float * heights, int num, float max_error, unsigned short * q, float * pscale, float * pbias, float * perror)
+{
+	float min, max;
+	float scale;
+	float inv_scale;
+	float err;
+	float e;
+	long v;
+	int i;
+
+	min = heights[0];
+	max = heights[0];
+	for(i = 1; i < num; i++)
+	{
+		if(heights[i] < min)
+			min = heights[i];
+		if(heights[i] > max)
+			max = heights[i];
+	}
+	scale = (max - min)/HF_QUANT_MAX;
+	inv_scale = (scale > 0.0f) ? (1.0f/scale) : 0.0f;
+
+	//measure the real error since float rounding can add a little to scale/2
+	err = 0.0f;
+	for(i = 0; i < num; i++)
+	{
+		v = lrintf((heights[i] - min)*inv_scale);
+		if(v < 0)
+			v = 0;
+		if(v > HF_QUANT_MAX)
+			v = HF_QUANT_MAX;
+		q[i] = (unsigned short)v;
+		e = fabsf((min + (q[i]*scale)) - heights[i]);
+		if(e > err)
+			err = e;
+	}
+
+	*pscale = scale;
+	*pbias = min;
+	*perror = err;
+	return (err <= max_error);
+}
+
+/*
+hfSampleQuadAt
+Scalar height and normal of point i for hfSampleQuads().
+*/
+static void hfSampleQuadAt(const float * h00, const float * h10, const float * h01, const float * h11, const float * u, const float * v, int i, float inv_spacing, float * y, float * n)
+{
+	float base;
+	float du, dv;
+	float gx, gz;
+	float sx, sz;
+	float len;
+
+	if((u[i] + v[i]) >= 1.0f) //triangle at the +x+z corner
+	{
+		base = h11[i];
+		du = u[i] - 1.0f;
+		dv = v[i] - 1.0f;
+		gx = h11[i] - h01[i];
+		gz = h11[i] - h10[i];
+	}
+	else //triangle at the origin corner
+	{
+		base = h00[i];
+		du = u[i] - 0.0f;
+		dv = v[i] - 0.0f;
+		gx = h10[i] - h00[i];
+		gz = h01[i] - h00[i];
+	}
+	*y = (base + (du*gx)) + (dv*gz);
+	sx = gx*inv_spacing;
+	sz = gz*inv_spacing;
+	len = sqrtf(((sx*sx) + (sz*sz)) + 1.0f);
+	n[0] = (-sx)/len;
+	n[1] = 1.0f/len;
+	n[2] = (-sz)/len;
+}
+
+/*
+hfSampleQuads
+Heights and normals of n points, each inside a heightfield quad with
+corner heights h00 (origin), h10 (+x), h01 (+z) and h11 (+x+z), at u,v
+(0 to 1) across the quad in x and z. The quad is split into two
+triangles along the h10-h01 diagonal, like the terrain mesh. spacing is
+the distance between verts. nx, ny and nz are skipped if nx is 0.
+Does 4 points at a time with SSE. The scalar and SSE paths do the same
+float operations in the same order so they give the same bits.
+*/
+void hfSampleQuads(const float * h00, const float * h10, const float * h01, const float * h11, const float * u, const float * v, int n, float spacing, float * y, float * nx, float * ny, float * nz)
+{
+	float inv_spacing;
+	float norm[3];
+	int i = 0;
+#ifdef __SSE__
+	__m128 v_one;
+	__m128 v_sign;
+	__m128 v_inv_spacing;
+	__m128 v_mask;		//all bits set for points in the +x+z triangle
+	__m128 v_a, v_b;
+	__m128 v_base, v_du, v_dv;
+	__m128 v_gx, v_gz;
+	__m128 v_len;
+#endif
+
+	inv_spacing = 1.0f/spacing;
+#ifdef __SSE__
+	v_one = _mm_set1_ps(1.0f);
+	v_sign = _mm_set1_ps(-0.0f);
+	v_inv_spacing = _mm_set1_ps(inv_spacing);
+	for(; (i+4) <= n; i += 4)
+	{
+		v_du = _mm_loadu_ps(u+i);
+		v_dv = _mm_loadu_ps(v+i);
+		v_mask = _mm_cmpge_ps(_mm_add_ps(v_du, v_dv), v_one);
+		v_a = _mm_loadu_ps(h00+i);
+		v_b = _mm_loadu_ps(h11+i);
+		v_base = _mm_or_ps(_mm_and_ps(v_mask, v_b), _mm_andnot_ps(v_mask, v_a));
+		v_du = _mm_sub_ps(v_du, _mm_and_ps(v_mask, v_one));
+		v_dv = _mm_sub_ps(v_dv, _mm_and_ps(v_mask, v_one));
+		v_gx = _mm_or_ps(_mm_and_ps(v_mask, _mm_sub_ps(v_b, _mm_loadu_ps(h01+i))), _mm_andnot_ps(v_mask, _mm_sub_ps(_mm_loadu_ps(h10+i), v_a)));
+		v_gz = _mm_or_ps(_mm_and_ps(v_mask, _mm_sub_ps(v_b, _mm_loadu_ps(h10+i))), _mm_andnot_ps(v_mask, _mm_sub_ps(_mm_loadu_ps(h01+i), v_a)));
+		_mm_storeu_ps(y+i, _mm_add_ps(_mm_add_ps(v_base, _mm_mul_ps(v_du, v_gx)), _mm_mul_ps(v_dv, v_gz)));
+		if(nx == 0)
+			continue;
+		v_gx = _mm_mul_ps(v_gx, v_inv_spacing);
+		v_gz = _mm_mul_ps(v_gz, v_inv_spacing);
+		v_len = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(v_gx, v_gx), _mm_mul_ps(v_gz, v_gz)), v_one));
+		_mm_storeu_ps(nx+i, _mm_div_ps(_mm_xor_ps(v_gx, v_sign), v_len));
+		_mm_storeu_ps(ny+i, _mm_div_ps(v_one, v_len));
+		_mm_storeu_ps(nz+i, _mm_div_ps(_mm_xor_ps(v_gz, v_sign), v_len));
+	}
+#endif
+	for(; i < n; i++)
+	{
+		hfSampleQuadAt(h00, h10, h01, h11, u, v, i, inv_spacing, (y+i), norm);
+		if(nx == 0)
+			continue;
+		nx[i] = norm[0];
+		ny[i] = norm[1];
+		nz[i] = norm[2];
+	}
+}
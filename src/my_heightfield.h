@@ -0,0 +1,24 @@
+/*
+This file holds functions that work on a whole-map, row-major heightfield
+(one float per vertex, evenly spaced in x and z).
+*/
+#ifndef MY_HEIGHTFIELD_H
+#define MY_HEIGHTFIELD_H
+
+#define HF_MAX_THREADS 32
+#define HF_QUANT_MAX 65535	//largest quantized height value
+#define HF_SAMPLE_CHUNK 64	//# of points callers of hfSampleQuads() usually gather at once
+
+/*
+Called from the worker threads of hfCalcNormals() once per heightfield
+row. nx, ny, nz each hold num_x normal components for that row.
+*/
+typedef void (*hf_normal_row_func)(void * user, int row, float * nx, float * ny, float * nz, int num_x);
+
+int hfGetNumThreads(void);
+void hfCalcNormalRow(const float * heights, int num_x, int num_z, int row, float dx, float dz, float * nx, float * ny, float * nz);
+int hfCalcNormals(const float * heights, int num_x, int num_z, float dx, float dz, int num_threads, hf_normal_row_func func, void * user);
+int hfQuantizeHeights(const float * heights, int num, float max_error, unsigned short * q, float * pscale, float * pbias, float * perror);
+void hfSampleQuads(const float * h00, const float * h10, const float * h01, const float * h11, const float * u, const float * v, int n, float spacing, float * y, float * nx, float * ny, float * nz);
+
+#endif
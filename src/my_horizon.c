@@ -0,0 +1,235 @@
+/*
+Horizon occlusion. Directions around the camera are split into
+HZ_NUM_BUCKETS buckets by angle in the x,z plane. An occluder is a
+solid column: an x,z rectangle with everything under top_y filled in,
+e.g. a block of terrain lowered to its lowest vert. Every ray that goes
+through the rectangle under the column's slope ends up in the ground,
+so the column raises the horizon of each bucket it wholly covers.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#include "my_horizon.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+static int hzGetSpan(const struct horizon_struct * hz, const float * rect_min, const float * rect_max, float * u, float * dist);
+
+/*
+hzGetSpan
+Finds the buckets a rectangle in x,z covers, as a range u[0] to u[1] in
+bucket units (u[1]-u[0] is less than half the buckets, and the range can
+go past either end), and the nearest and farthest distance of the
+rectangle from the camera in x,z.
+returns 1, or 0 if the camera is in the rectangle
+*/
+static int hzGetSpan(const struct horizon_struct * hz, const float * rect_min, const float * rect_max, float * u, float * dist)
+{
+	float corners[4][2];
+	float ref;
+	float a;
+	float a_min;
+	float a_max;
+	float dx;
+	float dz;
+	int i;
+
+	corners[0][0] = rect_min[0] - hz->camera[0];
+	corners[0][1] = rect_min[1] - hz->camera[2];
+	corners[1][0] = rect_max[0] - hz->camera[0];
+	corners[1][1] = rect_min[1] - hz->camera[2];
+	corners[2][0] = rect_max[0] - hz->camera[0];
+	corners[2][1] = rect_max[1] - hz->camera[2];
+	corners[3][0] = rect_min[0] - hz->camera[0];
+	corners[3][1] = rect_max[1] - hz->camera[2];
+
+	//nearest point
+	dx = 0.0f;
+	if(corners[0][0] > 0.0f)
+		dx = corners[0][0];
+	else if(corners[2][0] < 0.0f)
+		dx = -corners[2][0];
+	dz = 0.0f;
+	if(corners[0][1] > 0.0f)
+		dz = corners[0][1];
+	else if(corners[2][1] < 0.0f)
+		dz = -corners[2][1];
+	if(dx <= 0.0f && dz <= 0.0f)
+		return 0;
+	dist[0] = sqrtf((dx*dx) + (dz*dz));
+
+	//farthest corner
+	dx = fmaxf(fabsf(corners[0][0]), fabsf(corners[2][0]));
+	dz = fmaxf(fabsf(corners[0][1]), fabsf(corners[2][1]));
+	dist[1] = sqrtf((dx*dx) + (dz*dz));
+
+	//corner angles relative to the center's, so the range doesn't wrap
+	ref = atan2f((corners[0][1] + corners[2][1])*0.5f, (corners[0][0] + corners[2][0])*0.5f);
+	a_min = 0.0f;
+	a_max = 0.0f;
+	for(i = 0; i < 4; i++)
+	{
+		a = atan2f(corners[i][1], corners[i][0]) - ref;
+		if(a > (float)M_PI)
+			a -= (float)(2.0*M_PI);
+		else if(a < (float)-M_PI)
+			a += (float)(2.0*M_PI);
+		if(a < a_min)
+			a_min = a;
+		if(a > a_max)
+			a_max = a;
+	}
+	u[0] = (ref + a_min + (float)M_PI)*(HZ_NUM_BUCKETS/(float)(2.0*M_PI));
+	u[1] = (ref + a_max + (float)M_PI)*(HZ_NUM_BUCKETS/(float)(2.0*M_PI));
+	return 1;
+}
+
+/*
+hzBegin
+Clears the horizon for a new camera position.
+*/
+void hzBegin(struct horizon_struct * hz, const float * camera)
+{
+	int k;
+	int b;
+
+	hz->camera[0] = camera[0];
+	hz->camera[1] = camera[1];
+	hz->camera[2] = camera[2];
+	hz->ring_dist[0] = HZ_FIRST_RING_DIST;
+	for(k = 1; k < HZ_NUM_RINGS; k++)
+	{
+		hz->ring_dist[k] = hz->ring_dist[(k-1)]*HZ_RING_GROWTH;
+	}
+	for(k = 0; k < HZ_NUM_RINGS; k++)
+	{
+		for(b = 0; b < HZ_NUM_BUCKETS; b++)
+		{
+			hz->slopes[k][b] = -FLT_MAX;
+		}
+	}
+	hz->num_occluders = 0;
+}
+
+/*
+hzAddOccluder
+Adds a solid column over the x,z rectangle rect_min to rect_max (x in
+[0], z in [1]) that is filled in from top_y down. Columns the camera is
+in, or that are farther than the last ring, are ignored. Call
+hzFinish() after the last occluder.
+*/
+void hzAddOccluder(struct horizon_struct * hz, const float * rect_min, const float * rect_max, float top_y)
+{
+	float u[2];
+	float dist[2];
+	float slope;
+	float * ring;
+	int k;
+	int b;
+	int b_end;
+	int r;
+
+	r = hzGetSpan(hz, rect_min, rect_max, u, dist);
+	if(r == 0)
+		return;
+	for(k = 0; k < HZ_NUM_RINGS; k++)
+	{
+		if(dist[1] <= hz->ring_dist[k])
+			break;
+	}
+	if(k == HZ_NUM_RINGS)
+		return;
+
+	//a ray through the column is in the ground at some distance between
+	//dist[0] and dist[1] if its slope is under the lowest slope to the top
+	if(top_y >= hz->camera[1])
+		slope = (top_y - hz->camera[1])/dist[1];
+	else
+		slope = (top_y - hz->camera[1])/dist[0];
+
+	//only buckets the rectangle wholly covers
+	ring = hz->slopes[k];
+	b_end = (int)floorf(u[1]);
+	for(b = (int)ceilf(u[0]); b < b_end; b++)
+	{
+		if(slope > ring[((b + HZ_NUM_BUCKETS) % HZ_NUM_BUCKETS)])
+			ring[((b + HZ_NUM_BUCKETS) % HZ_NUM_BUCKETS)] = slope;
+	}
+	hz->num_occluders += 1;
+}
+
+/*
+hzFinish
+Copies the occluders of each ring into the rings after it, since an
+occluder hides everything past its own ring too.
+*/
+void hzFinish(struct horizon_struct * hz)
+{
+	int k;
+	int b;
+
+	for(k = 1; k < HZ_NUM_RINGS; k++)
+	{
+		for(b = 0; b < HZ_NUM_BUCKETS; b++)
+		{
+			if(hz->slopes[(k-1)][b] > hz->slopes[k][b])
+				hz->slopes[k][b] = hz->slopes[(k-1)][b];
+		}
+	}
+}
+
+/*
+hzIsBoxOccluded
+Tests a box against the occluders that are all nearer than it is. The
+horizon is only read, so boxes can be tested from several threads at once.
+returns 1 if the whole box is under the horizon, else 0
+*/
+int hzIsBoxOccluded(const struct horizon_struct * hz, const float * box_min, const float * box_max)
+{
+	float rect_min[2];
+	float rect_max[2];
+	float u[2];
+	float dist[2];
+	float slope;
+	const float * ring;
+	int k;
+	int b;
+	int b_end;
+	int r;
+
+	rect_min[0] = box_min[0];
+	rect_min[1] = box_min[2];
+	rect_max[0] = box_max[0];
+	rect_max[1] = box_max[2];
+	r = hzGetSpan(hz, rect_min, rect_max, u, dist);
+	if(r == 0)
+		return 0;
+
+	//the last ring that is wholly nearer than the box
+	for(k = HZ_NUM_RINGS-1; k >= 0; k--)
+	{
+		if(hz->ring_dist[k] <= dist[0])
+			break;
+	}
+	if(k < 0)
+		return 0;
+
+	//steepest slope from the camera to any point of the box
+	if(box_max[1] >= hz->camera[1])
+		slope = (box_max[1] - hz->camera[1])/dist[0];
+	else
+		slope = (box_max[1] - hz->camera[1])/dist[1];
+
+	//every bucket the box touches
+	ring = hz->slopes[k];
+	b_end = (int)floorf(u[1]);
+	for(b = (int)floorf(u[0]); b <= b_end; b++)
+	{
+		if(!(slope < ring[((b + HZ_NUM_BUCKETS) % HZ_NUM_BUCKETS)]))
+			return 0;
+	}
+	return 1;
+}
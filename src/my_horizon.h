@@ -0,0 +1,35 @@
+/*
+This file holds horizon-based occlusion culling for a heightfield. The
+horizon stores, for each direction around the camera, the steepest
+slope (height over distance) under which every ray is known to pass
+into the ground. Boxes that stay under the horizon in every direction
+they cover are hidden. Only heights and x,z distances are used, so the
+result doesn't depend on the camera's pitch or roll, and nothing here
+touches GL.
+
+Occluders only hide things farther away than they are, so the horizon
+is kept in rings of growing distance: ring k only holds occluders whose
+farthest point is within ring_dist[k] of the camera.
+*/
+#ifndef MY_HORIZON_H
+#define MY_HORIZON_H
+
+#define HZ_NUM_BUCKETS 512	//directions around the camera
+#define HZ_NUM_RINGS 16
+#define HZ_FIRST_RING_DIST 100.0f	//distance of ring 0, each ring is HZ_RING_GROWTH times farther
+#define HZ_RING_GROWTH 1.5f
+
+struct horizon_struct
+{
+	float camera[3];
+	float ring_dist[HZ_NUM_RINGS];
+	float slopes[HZ_NUM_RINGS][HZ_NUM_BUCKETS];	//-FLT_MAX where nothing is known to be hidden
+	int num_occluders;	//# added since hzBegin()
+};
+
+void hzBegin(struct horizon_struct * hz, const float * camera);
+void hzAddOccluder(struct horizon_struct * hz, const float * rect_min, const float * rect_max, float top_y);
+void hzFinish(struct horizon_struct * hz);
+int hzIsBoxOccluded(const struct horizon_struct * hz, const float * box_min, const float * box_max);
+
+#endif
@@ -17,6 +17,8 @@ struct item_common_struct
 	float debugRot[3]; //degs for rotation about X,Y,Z axis. TODO: Remove this when no longer needed.
 	float debugTrans[3]; //translation for x,y,z. TODO: Remove this when no longer needed.
 	float y_AboveGroundOffset; //When item on ground, use this offset to translate item above ground.
+	float cull_center_y;	//bounding sphere for culling items on the ground
+	float cull_radius;
 };
 
 /*this represents an inventory item. This struct will be used
@@ -70,6 +72,7 @@ struct moveable_object_struct
 	float pos[3];
 	float yrot;
 	char moveable_type;	//index of type used to render/physics. 0=crate, 1=barrel
+	int batch;	//index of the static batch that draws it, -1 if it is drawn on its own
 };
 #define MOVEABLE_TYPE_CRATE 	0
 #define MOVEABLE_TYPE_BARREL 	1
@@ -0,0 +1,173 @@
+/*
+Job pool. jpRun() posts a group of jobs, the workers and the calling
+thread take jobs in order until there are none left, and the calling
+thread waits for the ones still running. See my_job_pool.h.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include "my_job_pool.h"
+
+static void jpRunJob(struct jp_job_struct * job, int thread_i);
+static void * jpWorker(void * arg);
+
+/*
+jpGetNumThreads
+returns the # of worker threads to start, one per online cpu other than
+the one the calling thread runs on
+*/
+int jpGetNumThreads(void)
+{
+	long n;
+
+	n = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+	if(n < 0)
+		n = 0;
+	if(n > JP_MAX_THREADS)
+		n = JP_MAX_THREADS;
+	return (int)n;
+}
+
+static void jpRunJob(struct jp_job_struct * job, int thread_i)
+{
+	struct timespec start;
+	struct timespec end;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	job->func(job->user);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	job->ms = ((end.tv_sec - start.tv_sec)*1000.0) + ((end.tv_nsec - start.tv_nsec)/1000000.0);
+	job->thread_i = thread_i;
+}
+
+static void * jpWorker(void * arg)
+{
+	struct jp_worker_struct * worker = (struct jp_worker_struct*)arg;
+	struct jp_pool_struct * pool = worker->pool;
+	struct jp_job_struct * job;
+
+	pthread_mutex_lock(&pool->lock);
+	while(pool->quit == 0)
+	{
+		if(pool->jobs == 0 || pool->next_job >= pool->num_jobs)
+		{
+			pthread_cond_wait(&pool->work_cond, &pool->lock);
+			continue;
+		}
+		job = pool->jobs + pool->next_job;
+		pool->next_job += 1;
+		pthread_mutex_unlock(&pool->lock);
+
+		jpRunJob(job, worker->thread_i);
+
+		pthread_mutex_lock(&pool->lock);
+		pool->num_done += 1;
+		if(pool->num_done == pool->num_jobs)
+			pthread_cond_signal(&pool->done_cond);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return 0;
+}
+
+/*
+jpInit
+Starts num_threads worker threads (capped at JP_MAX_THREADS). With 0
+threads, or if none could be started, jpRun() runs every job itself.
+returns 1 on success, 0 on failure
+*/
+int jpInit(struct jp_pool_struct * pool, int num_threads)
+{
+	int r;
+	int i;
+
+	memset(pool, 0, sizeof(struct jp_pool_struct));
+	if(num_threads > JP_MAX_THREADS)
+		num_threads = JP_MAX_THREADS;
+	pthread_mutex_init(&pool->lock, 0);
+	pthread_cond_init(&pool->work_cond, 0);
+	pthread_cond_init(&pool->done_cond, 0);
+	for(i = 0; i < num_threads; i++)
+	{
+		pool->workers[i].pool = pool;
+		pool->workers[i].thread_i = i + 1;
+		r = pthread_create(&pool->threads[i], 0, jpWorker, &pool->workers[i]);
+		if(r != 0)
+		{
+			printf("jpInit: pthread_create failed (%d), running with %d worker threads\n", r, i);
+			break;
+		}
+		pool->num_threads += 1;
+	}
+	return 1;
+}
+
+/*
+jpShutdown
+Stops the worker threads. Call it between groups.
+*/
+void jpShutdown(struct jp_pool_struct * pool)
+{
+	int i;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->quit = 1;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->lock);
+	for(i = 0; i < pool->num_threads; i++)
+	{
+		pthread_join(pool->threads[i], 0);
+	}
+	pool->num_threads = 0;
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->work_cond);
+	pthread_cond_destroy(&pool->done_cond);
+}
+
+/*
+jpRun
+Runs a group of jobs on the workers and the calling thread, and returns
+when they are all done. Jobs are started in the order given, so the
+longest ones should come first. Each job's ms and thread_i are set.
+*/
+void jpRun(struct jp_pool_struct * pool, struct jp_job_struct * jobs, int num_jobs)
+{
+	struct jp_job_struct * job;
+	int i;
+
+	if(pool->num_threads == 0)
+	{
+		for(i = 0; i < num_jobs; i++)
+		{
+			jpRunJob(jobs + i, 0);
+		}
+		return;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->jobs = jobs;
+	pool->num_jobs = num_jobs;
+	pool->next_job = 0;
+	pool->num_done = 0;
+	pthread_cond_broadcast(&pool->work_cond);
+	while(pool->next_job < pool->num_jobs)
+	{
+		job = pool->jobs + pool->next_job;
+		pool->next_job += 1;
+		pthread_mutex_unlock(&pool->lock);
+
+		jpRunJob(job, 0);
+
+		pthread_mutex_lock(&pool->lock);
+		pool->num_done += 1;
+	}
+	while(pool->num_done < pool->num_jobs)
+	{
+		pthread_cond_wait(&pool->done_cond, &pool->lock);
+	}
+	pool->jobs = 0;
+	pool->num_jobs = 0;
+	pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,51 @@
+/*
+This file holds a small pool of worker threads for running a group of
+independent jobs at once, e.g. the culling passes that prepare a frame.
+The thread that calls jpRun() runs jobs too and only returns once every
+job of the group is done, so jobs can write their own results without
+locks as long as no two jobs of a group write the same data.
+*/
+#ifndef MY_JOB_POOL_H
+#define MY_JOB_POOL_H
+
+#include <pthread.h>
+
+#define JP_MAX_THREADS 31	//worker threads, on top of the thread calling jpRun()
+
+typedef void (*jp_job_func)(void * user);
+
+struct jp_job_struct
+{
+	jp_job_func func;
+	void * user;
+	double ms;		//how long the job took the last time it ran
+	int thread_i;	//thread that ran it, 0 for the thread calling jpRun() and 1 on for the workers
+};
+
+struct jp_worker_struct
+{
+	struct jp_pool_struct * pool;
+	int thread_i;
+};
+
+struct jp_pool_struct
+{
+	pthread_t threads[JP_MAX_THREADS];
+	struct jp_worker_struct workers[JP_MAX_THREADS];
+	int num_threads;	//# of worker threads started
+	pthread_mutex_t lock;
+	pthread_cond_t work_cond;	//signalled when a group is posted, or to quit
+	pthread_cond_t done_cond;	//signalled when the last job of a group finishes
+	struct jp_job_struct * jobs;	//the group being run, 0 between groups
+	int num_jobs;
+	int next_job;	//next job for a thread to take
+	int num_done;
+	int quit;
+};
+
+int jpGetNumThreads(void);
+int jpInit(struct jp_pool_struct * pool, int num_threads);
+void jpShutdown(struct jp_pool_struct * pool);
+void jpRun(struct jp_pool_struct * pool, struct jp_job_struct * jobs, int num_jobs);
+
+#endif
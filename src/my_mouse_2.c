@@ -180,7 +180,8 @@ static int OpenMouseHandler(int event_num)
 /*
 This function reads the event handler and returns the sum of any relative mouse events received.
 -Assumes that in_InitMouseInput() has already been called.
--only collects mouse input for 1ms
+-reads the events that are queued and returns, it doesn't wait for more
+ (see in_GetMouseFd() to wait for them)
 
 arguments:
 	mouse_rel - array of two integers
@@ -188,32 +189,22 @@ arguments:
 */
 int in_MouseRelPos(int * mouse_rel, char * pmouseState)
 {
-	struct timespec start_time;
-	struct timespec curr_time;
 	struct input_event m_input;
 	int was_down_event=0;
-	int is_elapsed = 0;
-	long elapsed_nsec;
 	int r;
-	
-	//get the start time
-	r = clock_gettime(CLOCK_MONOTONIC, &start_time);
-	if(r == -1)
-	{
-		printf("in_MouseRelPos: error clock_gettime() failed.\n");
-		return 0;
-	}
 
 	//Reset the flag marking a mouse-down event happening
 	*pmouseState = 0;
 	
-	//read events until time is up
+	//read events until there are no more
 	while(1)
 	{
 		r = read(mouse_fd, &m_input, sizeof(m_input));
-		if(r == -1 && errno != EAGAIN)
+		if(r == -1 && errno == EAGAIN)
+			break;
+		if(r != sizeof(m_input))
 		{
-			printf("in_MouseRelPos: error read() errno=%d\n", errno);
+			printf("in_MouseRelPos: error read() r=%d errno=%d\n", r, errno);
 			return 0;
 		}
 		switch(m_input.type)
@@ -239,37 +230,6 @@ int in_MouseRelPos(int * mouse_rel, char * pmouseState)
 			}
 			break;
 		}
-		
-		//if we have spent all the time, read until the next event 
-		//as marked by a EV_SYN.
-		if(is_elapsed == 1 && m_input.type == EV_SYN)
-			break;
-		
-		//check the time
-		r = clock_gettime(CLOCK_MONOTONIC, &curr_time);
-		if(r == -1)
-		{
-			printf("in_MouseRelPos: error clock_gettime() failed\n");
-			return 0;
-		}
-		
-		//check for rollover. calculate elapsed time
-		if(curr_time.tv_sec > (start_time.tv_sec+1)) //if more than a second has elapsed don't even bother
-		{
-			is_elapsed = 1;
-			continue;
-		}
-		else if(curr_time.tv_sec != start_time.tv_sec) //is there rollover?
-		{
-			elapsed_nsec = curr_time.tv_nsec + (1000000000-start_time.tv_nsec);
-		}
-		else
-		{
-			elapsed_nsec = curr_time.tv_nsec - start_time.tv_nsec; //normal subtract no-rollover
-		}
-		
-		if(elapsed_nsec >= 1000000) //1 millisecond = 1,000,000 nanoseconds
-			is_elapsed = 1;
 	}
 
 	//update pmouseState with the final mouse state:
@@ -280,6 +240,15 @@ int in_MouseRelPos(int * mouse_rel, char * pmouseState)
 	return 1;
 }
 
+/*
+This function returns the mouse evdev's file descriptor, for poll() to
+wait on. It is non-blocking and only in_MouseRelPos() should read it.
+*/
+int in_GetMouseFd(void)
+{
+	return mouse_fd;
+}
+
 static int CheckKeycodeBit(char * bitArray, int keyCode)
 {
 	int byteIndex;
@@ -8,6 +8,7 @@ handling function.
 int in_InitMouseInput(void);
 int in_CloseMouseInput(void);
 int in_MouseRelPos(int * mouse_rel, char * pmouseState);
+int in_GetMouseFd(void);
 
 /*Mouse Flags*/
 #define IN_MOUSE_UP_STATE 	0
@@ -0,0 +1,313 @@
+/*
+Per-object culling of bounding spheres against the 6 planes of a view
+frustum and a per-object draw distance. The SSE (4 wide) and AVX (8
+wide, in my_object_cull_avx.c) paths do the same float operations as the
+scalar path, so every path gives the same visible set.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+#include "my_object_cull.h"
+
+static int ocIsSphereVisible(float planes[6][4], const float * camera, const struct oc_spheres_struct * spheres, int i);
+
+/*
+ocSpheresAdd
+Adds an object to the end of the set, growing the arrays if needed.
+returns 1 on success, 0 on failure
+*/
+int ocSpheresAdd(struct oc_spheres_struct * spheres, const float * center, float radius, float max_dist, int type)
+{
+	float * new_x;
+	float * new_y;
+	float * new_z;
+	float * new_radius;
+	float * new_max_dist;
+	unsigned char * new_type;
+	int new_max;
+	int i;
+
+	if(type < 0 || type >= OC_MAX_TYPES)
+	{
+		printf("ocSpheresAdd: error. type %d is out of range\n", type);
+		return 0;
+	}
+	if(spheres->num == spheres->max)
+	{
+		new_max = (spheres->max > 0) ? (spheres->max*2) : 64;
+		new_x = (float*)realloc(spheres->x, new_max*sizeof(float));
+		if(new_x != 0)
+			spheres->x = new_x;
+		new_y = (float*)realloc(spheres->y, new_max*sizeof(float));
+		if(new_y != 0)
+			spheres->y = new_y;
+		new_z = (float*)realloc(spheres->z, new_max*sizeof(float));
+		if(new_z != 0)
+			spheres->z = new_z;
+		new_radius = (float*)realloc(spheres->radius, new_max*sizeof(float));
+		if(new_radius != 0)
+			spheres->radius = new_radius;
+		new_max_dist = (float*)realloc(spheres->max_dist, new_max*sizeof(float));
+		if(new_max_dist != 0)
+			spheres->max_dist = new_max_dist;
+		new_type = (unsigned char*)realloc(spheres->type, new_max*sizeof(unsigned char));
+		if(new_type != 0)
+			spheres->type = new_type;
+		if(new_x == 0 || new_y == 0 || new_z == 0 || new_radius == 0 || new_max_dist == 0 || new_type == 0)
+		{
+			printf("ocSpheresAdd: realloc failed for %d objects\n", new_max);
+			return 0;
+		}
+		spheres->max = new_max;
+	}
+
+	i = spheres->num;
+	spheres->x[i] = center[0];
+	spheres->y[i] = center[1];
+	spheres->z[i] = center[2];
+	spheres->radius[i] = radius;
+	spheres->max_dist[i] = max_dist;
+	spheres->type[i] = (unsigned char)type;
+	spheres->type_count[type] += 1;
+	spheres->num += 1;
+	return 1;
+}
+
+/*
+ocSpheresClear
+Empties the set but keeps the arrays for the next objects.
+*/
+void ocSpheresClear(struct oc_spheres_struct * spheres)
+{
+	spheres->num = 0;
+	memset(spheres->type_count, 0, sizeof(spheres->type_count));
+}
+
+void ocSpheresFree(struct oc_spheres_struct * spheres)
+{
+	free(spheres->x);
+	free(spheres->y);
+	free(spheres->z);
+	free(spheres->radius);
+	free(spheres->max_dist);
+	free(spheres->type);
+	memset(spheres, 0, sizeof(struct oc_spheres_struct));
+}
+
+void ocVisibleFree(struct oc_visible_struct * visible)
+{
+	free(visible->ids);
+	memset(visible, 0, sizeof(struct oc_visible_struct));
+}
+
+/*
+ocIsSphereVisible
+Scalar test of object i.
+returns 1 if it is within its draw distance and not wholly outside any
+plane, else 0
+*/
+static int ocIsSphereVisible(float planes[6][4], const float * camera, const struct oc_spheres_struct * spheres, int i)
+{
+	float neg_radius;
+	float d;
+	int j;
+
+	if(!(fabsf(spheres->x[i] - camera[0]) < spheres->max_dist[i]))
+		return 0;
+	if(!(fabsf(spheres->z[i] - camera[2]) < spheres->max_dist[i]))
+		return 0;
+	neg_radius = -spheres->radius[i];
+	for(j = 0; j < 6; j++)
+	{
+		d = (((planes[j][0]*spheres->x[i]) + (planes[j][1]*spheres->y[i])) + (planes[j][2]*spheres->z[i])) + planes[j][3];
+		if(d < neg_radius)
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ocGetSimd
+returns the widest path ocCullSpheres() can use on this cpu, OC_SIMD_AVX,
+OC_SIMD_SSE or OC_SIMD_SCALAR
+*/
+int ocGetSimd(void)
+{
+	if(ocAvxAvailable() == 1)
+		return OC_SIMD_AVX;
+#if defined(__SSE__)
+	return OC_SIMD_SSE;
+#else
+	return OC_SIMD_SCALAR;
+#endif
+}
+
+/*
+ocCullSpheres
+Tests every object in spheres against the frustum planes ((a,b,c,d) with
+a*x + b*y + c*z + d >= 0 inside) and its draw distance from camera, and
+fills visible with the indexes of the objects that pass, by type. Uses
+the widest path the cpu has (see ocGetSimd).
+returns 1 on success, 0 on failure (visible is left empty)
+*/
+int ocCullSpheres(float planes[6][4], const float * camera, const struct oc_spheres_struct * spheres, struct oc_visible_struct * visible)
+{
+	return ocCullSpheresSimd(planes, camera, spheres, visible, ocGetSimd());
+}
+
+/*
+ocCullSpheresSimd
+ocCullSpheres() with the path capped at simd (OC_SIMD_*), to compare the
+paths. A path the cpu doesn't have falls back to the next narrower one.
+returns 1 on success, 0 on failure (visible is left empty)
+*/
+int ocCullSpheresSimd(float planes[6][4], const float * camera, const struct oc_spheres_struct * spheres, struct oc_visible_struct * visible, int simd)
+{
+	int next[OC_MAX_TYPES];	//where the next visible object of each type goes in ids
+	int * new_ids;
+	int mask;
+	int first;
+	int t;
+	int i = 0;
+	int j;
+#if defined(__SSE__)
+	__m128 v_in;
+	__m128 v_d;
+	__m128 v_sign;
+#endif
+
+	if(visible->max < spheres->num)
+	{
+		new_ids = (int*)realloc(visible->ids, spheres->num*sizeof(int));
+		if(new_ids == 0)
+		{
+			printf("ocCullSpheres: realloc failed for %d objects\n", spheres->num);
+			memset(visible->num, 0, sizeof(visible->num)); //don't leave a stale list behind
+			visible->num_tests = 0;
+			visible->num_visible = 0;
+			return 0;
+		}
+		visible->ids = new_ids;
+		visible->max = spheres->num;
+	}
+	first = 0;
+	for(t = 0; t < OC_MAX_TYPES; t++)
+	{
+		visible->first[t] = first;
+		next[t] = first;
+		first += spheres->type_count[t];
+	}
+
+	if(simd >= OC_SIMD_AVX && ocAvxAvailable() == 1)
+		i = ocCullSpheresAvx(planes, camera, spheres, visible->ids, next);
+#if defined(__SSE__)
+	v_sign = _mm_set1_ps(-0.0f);
+	for(; simd >= OC_SIMD_SSE && (i+4) <= spheres->num; i += 4)
+	{
+		v_d = _mm_loadu_ps(spheres->max_dist+i);
+		v_in = _mm_and_ps(
+			_mm_cmplt_ps(_mm_andnot_ps(v_sign, _mm_sub_ps(_mm_loadu_ps(spheres->x+i), _mm_set1_ps(camera[0]))), v_d),
+			_mm_cmplt_ps(_mm_andnot_ps(v_sign, _mm_sub_ps(_mm_loadu_ps(spheres->z+i), _mm_set1_ps(camera[2]))), v_d));
+		if(_mm_movemask_ps(v_in) == 0) //all 4 are too far away
+			continue;
+		for(j = 0; j < 6; j++)
+		{
+			v_d = _mm_add_ps(_mm_add_ps(_mm_add_ps(
+				_mm_mul_ps(_mm_set1_ps(planes[j][0]), _mm_loadu_ps(spheres->x+i)),
+				_mm_mul_ps(_mm_set1_ps(planes[j][1]), _mm_loadu_ps(spheres->y+i))),
+				_mm_mul_ps(_mm_set1_ps(planes[j][2]), _mm_loadu_ps(spheres->z+i))),
+				_mm_set1_ps(planes[j][3]));
+			v_in = _mm_and_ps(v_in, _mm_cmpge_ps(v_d, _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(spheres->radius+i))));
+		}
+		mask = _mm_movemask_ps(v_in);
+		while(mask != 0)
+		{
+			j = i + __builtin_ctz(mask);
+			t = spheres->type[j];
+			visible->ids[next[t]] = j;
+			next[t] += 1;
+			mask &= (mask - 1);
+		}
+	}
+#endif
+	for(; i < spheres->num; i++)
+	{
+		if(ocIsSphereVisible(planes, camera, spheres, i) == 0)
+			continue;
+		t = spheres->type[i];
+		visible->ids[next[t]] = i;
+		next[t] += 1;
+	}
+
+	visible->num_visible = 0;
+	for(t = 0; t < OC_MAX_TYPES; t++)
+	{
+		visible->num[t] = next[t] - visible->first[t];
+		visible->num_visible += visible->num[t];
+	}
+	visible->num_tests = spheres->num;
+	return 1;
+}
+
+/*
+ocSimdName
+returns the name of an OC_SIMD_* path, "AVX", "SSE" or "scalar"
+*/
+const char * ocSimdName(int simd)
+{
+	if(simd == OC_SIMD_AVX)
+		return "AVX";
+	if(simd == OC_SIMD_SSE)
+		return "SSE";
+	return "scalar";
+}
+
+/*
+ocGrowAxisBounds
+Grows bounds (min y, max y, furthest distance from the y axis) to hold
+num_verts verts, the x,y,z of each vert is at the start of every stride
+floats. Start bounds out as {FLT_MAX, -FLT_MAX, 0}. Bounds around the
+y axis hold for any rotation about y.
+*/
+void ocGrowAxisBounds(const float * verts, int num_verts, int stride, float * bounds)
+{
+	const float * v;
+	float r;
+	int i;
+
+	for(i = 0; i < num_verts; i++)
+	{
+		v = verts + (i*stride);
+		if(v[1] < bounds[0])
+			bounds[0] = v[1];
+		if(v[1] > bounds[1])
+			bounds[1] = v[1];
+		r = sqrtf((v[0]*v[0]) + (v[2]*v[2]));
+		if(r > bounds[2])
+			bounds[2] = r;
+	}
+}
+
+/*
+ocAxisBoundsToSphere
+Sphere on the y axis that holds the bounds from ocGrowAxisBounds().
+*/
+void ocAxisBoundsToSphere(const float * bounds, float * center_y, float * radius)
+{
+	float half_y;
+
+	if(bounds[0] > bounds[1]) //no verts
+	{
+		*center_y = 0.0f;
+		*radius = bounds[2];
+		return;
+	}
+	*center_y = (bounds[0] + bounds[1])*0.5f;
+	half_y = (bounds[1] - bounds[0])*0.5f;
+	*radius = sqrtf((bounds[2]*bounds[2]) + (half_y*half_y));
+}
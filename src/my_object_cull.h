@@ -0,0 +1,66 @@
+/*
+This file holds per-object culling. Objects are bounding spheres kept in
+separate x, y, z, radius and distance arrays (structure of arrays), so
+the frustum and distance tests run on 4 objects at a time with SSE, or 8
+with AVX when the cpu has it. The objects that pass go into a compact list per type that any
+draw pass can walk.
+*/
+#ifndef MY_OBJECT_CULL_H
+#define MY_OBJECT_CULL_H
+
+#define OC_MAX_TYPES 8	//types are 0 to OC_MAX_TYPES-1
+
+/*
+Paths ocCullSpheres() can take, widest last
+*/
+#define OC_SIMD_SCALAR 0
+#define OC_SIMD_SSE 1
+#define OC_SIMD_AVX 2
+
+/*
+A set of objects to cull, e.g. the plants of one tile.
+*/
+struct oc_spheres_struct
+{
+	float * x;			//sphere centers
+	float * y;
+	float * z;
+	float * radius;
+	float * max_dist;	//culled when the center is this far from the camera in x or z
+	unsigned char * type;
+	int type_count[OC_MAX_TYPES]; //# of objects of each type
+	int num;
+	int max;	//allocated length of the arrays
+};
+
+/*
+Objects that passed the last ocCullSpheres(). The indexes of the visible
+objects of type t are ids[first[t]] to ids[first[t]+num[t]-1], in the
+order they were added to the set.
+*/
+struct oc_visible_struct
+{
+	int * ids;
+	int first[OC_MAX_TYPES];
+	int num[OC_MAX_TYPES];
+	int max;	//length of ids
+	int num_tests;	//# of objects tested in the last ocCullSpheres()
+	int num_visible;	//# that passed, the sum of num[]
+};
+
+int ocSpheresAdd(struct oc_spheres_struct * spheres, const float * center, float radius, float max_dist, int type);
+void ocSpheresClear(struct oc_spheres_struct * spheres);
+void ocSpheresFree(struct oc_spheres_struct * spheres);
+void ocVisibleFree(struct oc_visible_struct * visible);
+int ocGetSimd(void);
+int ocCullSpheres(float planes[6][4], const float * camera, const struct oc_spheres_struct * spheres, struct oc_visible_struct * visible);
+int ocCullSpheresSimd(float planes[6][4], const float * camera, const struct oc_spheres_struct * spheres, struct oc_visible_struct * visible, int simd);
+const char * ocSimdName(int simd);
+void ocGrowAxisBounds(const float * verts, int num_verts, int stride, float * bounds);
+void ocAxisBoundsToSphere(const float * bounds, float * center_y, float * radius);
+
+//AVX path, in my_object_cull_avx.c
+int ocAvxAvailable(void);
+int ocCullSpheresAvx(float planes[6][4], const float * camera, const struct oc_spheres_struct * spheres, int * ids, int * next);
+
+#endif
@@ -0,0 +1,75 @@
+/*
+AVX path of ocCullSpheres(), 8 objects at a time. This file is built
+with -mavx (see the Makefile) and the rest of the module without it, so
+ocCullSpheres() only comes here after ocAvxAvailable() says the cpu can
+run it. Does the same float operations as the SSE and scalar paths.
+*/
+#include <stdio.h>
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+#include "my_object_cull.h"
+
+/*
+ocAvxAvailable
+returns 1 if this file was built with AVX and the cpu has it, else 0
+*/
+int ocAvxAvailable(void)
+{
+#if defined(__AVX__)
+	return (__builtin_cpu_supports("avx") != 0);
+#else
+	return 0;
+#endif
+}
+
+/*
+ocCullSpheresAvx
+Tests the objects of spheres 8 at a time, from the first, and adds the
+ones that pass to ids by type (see ocCullSpheres). Stops before the last
+spheres->num % 8 objects, which the caller tests another way.
+-next: per type, where the next visible object goes in ids. Updated.
+returns the # of objects tested
+*/
+int ocCullSpheresAvx(float planes[6][4], const float * camera, const struct oc_spheres_struct * spheres, int * ids, int * next)
+{
+	int i = 0;
+#if defined(__AVX__)
+	__m256 v_in;
+	__m256 v_d;
+	__m256 v_sign;
+	int mask;
+	int j;
+	int t;
+
+	v_sign = _mm256_set1_ps(-0.0f);
+	for(; (i+8) <= spheres->num; i += 8)
+	{
+		v_d = _mm256_loadu_ps(spheres->max_dist+i);
+		v_in = _mm256_and_ps(
+			_mm256_cmp_ps(_mm256_andnot_ps(v_sign, _mm256_sub_ps(_mm256_loadu_ps(spheres->x+i), _mm256_set1_ps(camera[0]))), v_d, _CMP_LT_OQ),
+			_mm256_cmp_ps(_mm256_andnot_ps(v_sign, _mm256_sub_ps(_mm256_loadu_ps(spheres->z+i), _mm256_set1_ps(camera[2]))), v_d, _CMP_LT_OQ));
+		if(_mm256_movemask_ps(v_in) == 0) //all 8 are too far away
+			continue;
+		for(j = 0; j < 6; j++)
+		{
+			v_d = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(
+				_mm256_mul_ps(_mm256_set1_ps(planes[j][0]), _mm256_loadu_ps(spheres->x+i)),
+				_mm256_mul_ps(_mm256_set1_ps(planes[j][1]), _mm256_loadu_ps(spheres->y+i))),
+				_mm256_mul_ps(_mm256_set1_ps(planes[j][2]), _mm256_loadu_ps(spheres->z+i))),
+				_mm256_set1_ps(planes[j][3]));
+			v_in = _mm256_and_ps(v_in, _mm256_cmp_ps(v_d, _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(spheres->radius+i)), _CMP_GE_OQ));
+		}
+		mask = _mm256_movemask_ps(v_in);
+		while(mask != 0)
+		{
+			j = i + __builtin_ctz(mask);
+			t = spheres->type[j];
+			ids[next[t]] = j;
+			next[t] += 1;
+			mask &= (mask - 1);
+		}
+	}
+#endif
+	return i;
+}
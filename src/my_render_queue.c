@@ -0,0 +1,155 @@
+/*
+Render queue: draw packets with a sort key, sorted before they are
+submitted. See my_render_queue.h.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "my_render_queue.h"
+
+static int rqCompareKeys(const void * a, const void * b);
+
+/*
+rqClear
+Empties the queue for a new frame. The arrays are kept.
+*/
+void rqClear(struct rq_queue_struct * queue)
+{
+	queue->num = 0;
+	queue->num_changes_added = 0;
+	queue->num_changes_sorted = 0;
+}
+
+void rqFree(struct rq_queue_struct * queue)
+{
+	free(queue->packets);
+	free(queue->order);
+	queue->packets = 0;
+	queue->order = 0;
+	queue->num = 0;
+	queue->max = 0;
+}
+
+/*
+rqAdd
+Adds a packet to the end of the queue, growing it if needed. The packet
+is zeroed, with no uniforms set, for the caller to fill in.
+returns the packet, or 0 on failure
+*/
+struct rq_packet_struct * rqAdd(struct rq_queue_struct * queue)
+{
+	struct rq_packet_struct * new_packets;
+	struct rq_sort_struct * new_order;
+	struct rq_packet_struct * packet;
+	int new_max;
+
+	if(queue->num == queue->max)
+	{
+		new_max = (queue->max > 0) ? (queue->max*2) : 256;
+		new_packets = (struct rq_packet_struct*)realloc(queue->packets, new_max*sizeof(struct rq_packet_struct));
+		if(new_packets != 0)
+			queue->packets = new_packets;
+		new_order = (struct rq_sort_struct*)realloc(queue->order, new_max*sizeof(struct rq_sort_struct));
+		if(new_order != 0)
+			queue->order = new_order;
+		if(new_packets == 0 || new_order == 0)
+		{
+			printf("rqAdd: realloc failed for %d packets\n", new_max);
+			return 0;
+		}
+		queue->max = new_max;
+	}
+	packet = &(queue->packets[queue->num]);
+	memset(packet, 0, sizeof(struct rq_packet_struct));
+	packet->matrix_unif = -1;
+	packet->vec2_unif = -1;
+	queue->num += 1;
+	return packet;
+}
+
+/*
+rqMakeKey
+Packs a sort key. Packets sort by pass first, then program, texture and
+vao, then from near to far so the depth test rejects more.
+returns the key
+*/
+unsigned long long rqMakeKey(int pass, unsigned int program, unsigned int texture, unsigned int vao, float depth)
+{
+	unsigned long long key;
+	unsigned long long d;
+
+	if(depth <= 0.0f)
+		d = 0;
+	else if(depth*RQ_DEPTH_SCALE >= (float)0xFFFFFF)
+		d = 0xFFFFFF;
+	else
+		d = (unsigned long long)(depth*RQ_DEPTH_SCALE);
+
+	key = ((unsigned long long)(pass & 0xF)) << 60;
+	key |= ((unsigned long long)(program & 0xFF)) << 52;
+	key |= ((unsigned long long)(texture & 0xFFF)) << 40;
+	key |= ((unsigned long long)(vao & 0xFFFF)) << 24;
+	key |= d;
+	return key;
+}
+
+static int rqCompareKeys(const void * a, const void * b)
+{
+	const struct rq_sort_struct * sa = (const struct rq_sort_struct*)a;
+	const struct rq_sort_struct * sb = (const struct rq_sort_struct*)b;
+
+	if(sa->key < sb->key)
+		return -1;
+	if(sa->key > sb->key)
+		return 1;
+	return sa->packet - sb->packet; //keep the order packets were added in
+}
+
+/*
+rqCountStateChanges
+returns the # of GL state changes (program, texture, sampler, vao and
+face culling) to go from drawing prev to drawing next. prev is 0 for the
+first packet, then everything it uses is set.
+*/
+int rqCountStateChanges(const struct rq_packet_struct * prev, const struct rq_packet_struct * next)
+{
+	int n = 0;
+
+	if(prev == 0)
+		return (next->two_sided == 1) ? 5 : 4;
+	if(prev->program != next->program)
+		n += 1;
+	if(prev->texture != next->texture)
+		n += 1;
+	if(prev->sampler != next->sampler)
+		n += 1;
+	if(prev->vao != next->vao)
+		n += 1;
+	if(prev->two_sided != next->two_sided)
+		n += 1;
+	return n;
+}
+
+/*
+rqSort
+Sorts the packets by key into order, and counts the state changes it
+takes to submit them in the order they were added and sorted.
+*/
+void rqSort(struct rq_queue_struct * queue)
+{
+	int i;
+
+	queue->num_changes_added = 0;
+	queue->num_changes_sorted = 0;
+	for(i = 0; i < queue->num; i++)
+	{
+		queue->order[i].key = queue->packets[i].key;
+		queue->order[i].packet = i;
+		queue->num_changes_added += rqCountStateChanges(((i > 0) ? &(queue->packets[(i-1)]) : 0), &(queue->packets[i]));
+	}
+	qsort(queue->order, queue->num, sizeof(struct rq_sort_struct), rqCompareKeys);
+	for(i = 0; i < queue->num; i++)
+	{
+		queue->num_changes_sorted += rqCountStateChanges(((i > 0) ? &(queue->packets[queue->order[(i-1)].packet]) : 0), &(queue->packets[queue->order[i].packet]));
+	}
+}
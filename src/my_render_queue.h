@@ -0,0 +1,70 @@
+/*
+This file holds a render queue. Draw passes add draw packets, each with
+the GL state it needs and a 64-bit sort key, instead of drawing right
+away. The queue is then sorted by key so packets that share a program,
+texture and vao end up next to each other, and the caller submits them
+in that order, changing GL state only when the next packet needs it.
+Nothing here calls GL, the GL names are only compared.
+*/
+#ifndef MY_RENDER_QUEUE_H
+#define MY_RENDER_QUEUE_H
+
+/*
+Key layout, high bits first: pass (4 bits), program (8 bits), texture
+(12 bits), vao (16 bits), depth (24 bits). GL names are masked to their
+field, which only affects how well packets group, not what is drawn.
+*/
+#define RQ_MAX_PASSES 16
+#define RQ_DEPTH_SCALE 16.0f	//depth units per world unit, so 1/16 unit steps out to about a million units
+
+#define RQ_DRAW_ARRAYS 0	//glDrawArrays(Instanced)
+#define RQ_DRAW_ELEMENTS 1	//glDrawElements(Instanced)
+
+struct rq_packet_struct
+{
+	unsigned long long key;
+	unsigned int program;
+	unsigned int texture;
+	unsigned int sampler;	//bound to texture unit 0
+	unsigned int vao;
+	int two_sided;			//1 to draw with face culling off
+	int draw_type;			//RQ_DRAW_*
+	int count;				//# of verts or indices
+	unsigned int index_type;	//e.g. GL_UNSIGNED_INT, for RQ_DRAW_ELEMENTS
+	long offset;			//byte offset of the first index
+	int num_instances;		//0 if not instanced
+	unsigned int instance_vbo;	//per-instance attributes are read from here
+	int instance_attrib;	//location of the first per-instance attribute
+	int instance_columns;	//# of per-instance attributes from instance_attrib on, e.g. 4 for a mat4
+	int instance_size;		//floats per attribute
+	long instance_offset;	//byte offset of the first instance
+	int matrix_unif;		//mat4 uniform to set to matrix, -1 for none
+	float matrix[16];
+	int vec2_unif;			//vec2 uniform to set to vec2, -1 for none
+	float vec2[2];
+};
+
+struct rq_sort_struct
+{
+	unsigned long long key;
+	int packet;
+};
+
+struct rq_queue_struct
+{
+	struct rq_packet_struct * packets;	//in the order they were added
+	struct rq_sort_struct * order;		//packets sorted by rqSort()
+	int num;
+	int max;	//allocated length of packets and order
+	int num_changes_added;	//state changes to submit the packets in the order they were added
+	int num_changes_sorted;	//state changes to submit them sorted
+};
+
+void rqClear(struct rq_queue_struct * queue);
+void rqFree(struct rq_queue_struct * queue);
+struct rq_packet_struct * rqAdd(struct rq_queue_struct * queue);
+unsigned long long rqMakeKey(int pass, unsigned int program, unsigned int texture, unsigned int vao, float depth);
+void rqSort(struct rq_queue_struct * queue);
+int rqCountStateChanges(const struct rq_packet_struct * prev, const struct rq_packet_struct * next);
+
+#endif
@@ -0,0 +1,268 @@
+/*
+Binary terrain cache. Stores the per-tile heights and normals that
+InitTerrain() derives from the .asc DEM file so later starts can mmap
+the result instead of re-parsing the text file.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "my_terrain_cache.h"
+
+static long long tcAlignToPage(long long n);
+
+static long long tcAlignToPage(long long n)
+{
+	return ((n + (TCACHE_PAGE_SIZE-1))/TCACHE_PAGE_SIZE)*TCACHE_PAGE_SIZE;
+}
+
+/*
+tcChecksumFile
+Computes a 64-bit FNV-1a style checksum over the whole file, 8 bytes
+at a time. Used to detect when the .asc file has changed since the
+cache was written.
+returns 1 on success, 0 on failure
+*/
+int tcChecksumFile(char * filename, unsigned long long * pchecksum, long long * pfile_size)
+{
+	unsigned long long h = 0xcbf29ce484222325ULL;
+	unsigned long long w;
+	unsigned char * buf;
+	long long total = 0;
+	ssize_t n;
+	ssize_t i;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if(fd == -1)
+	{
+		printf("tcChecksumFile: error. could not open %s\n", filename);
+		return 0;
+	}
+
+	buf = (unsigned char*)malloc(1 << 20);
+	if(buf == 0)
+	{
+		printf("tcChecksumFile: malloc failed for buf\n");
+		close(fd);
+		return 0;
+	}
+
+	while((n = read(fd, buf, (1 << 20))) > 0)
+	{
+		//hash whole words, then any trailing bytes
+		for(i = 0; (i+8) <= n; i += 8)
+		{
+			memcpy(&w, (buf+i), 8);
+			h = (h ^ w) * 0x100000001b3ULL;
+		}
+		for(; i < n; i++)
+		{
+			h = (h ^ buf[i]) * 0x100000001b3ULL;
+		}
+		total += n;
+	}
+	free(buf);
+	close(fd);
+
+	if(n == -1)
+	{
+		printf("tcChecksumFile: read failed for %s\n", filename);
+		return 0;
+	}
+
+	*pchecksum = h;
+	*pfile_size = total;
+	return 1;
+}
+
+/*
+tcOpenCache
+Maps an existing cache file and checks that it matches the given DEM.
+returns 1 if the cache is valid and mapped, 0 if it is missing, stale
+or corrupt (the caller should rebuild it).
+*/
+int tcOpenCache(struct tcache_struct * cache, char * cache_filename, unsigned long long dem_checksum, long long dem_size)
+{
+	struct tcache_header_struct * header;
+	struct stat st;
+	long long expected_len;
+	int fd;
+
+	memset(cache, 0, sizeof(struct tcache_struct));
+	cache->fd = -1;
+
+	fd = open(cache_filename, O_RDONLY);
+	if(fd == -1) //no cache yet, not an error
+		return 0;
+
+	if(fstat(fd, &st) == -1 || st.st_size < (long long)sizeof(struct tcache_header_struct))
+	{
+		printf("tcOpenCache: %s is too small, ignoring.\n", cache_filename);
+		close(fd);
+		return 0;
+	}
+
+	cache->map_base = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if(cache->map_base == MAP_FAILED)
+	{
+		printf("tcOpenCache: mmap failed for %s\n", cache_filename);
+		cache->map_base = 0;
+		close(fd);
+		return 0;
+	}
+	cache->fd = fd;
+	cache->map_len = st.st_size;
+	header = (struct tcache_header_struct*)cache->map_base;
+
+	if(header->magic != TCACHE_MAGIC || header->version != TCACHE_VERSION)
+	{
+		printf("tcOpenCache: %s has wrong magic or version, ignoring.\n", cache_filename);
+		tcCloseCache(cache);
+		return 0;
+	}
+	if(header->dem_checksum != dem_checksum || header->dem_size != dem_size)
+	{
+		printf("tcOpenCache: %s is stale (DEM changed), ignoring.\n", cache_filename);
+		tcCloseCache(cache);
+		return 0;
+	}
+	expected_len = header->data_offset + ((long long)header->num_rows*header->num_cols*header->tile_block_size);
+	if(expected_len != cache->map_len)
+	{
+		printf("tcOpenCache: %s is truncated (%lld of %lld bytes), ignoring.\n", cache_filename, cache->map_len, expected_len);
+		tcCloseCache(cache);
+		return 0;
+	}
+
+	madvise(cache->map_base, cache->map_len, MADV_WILLNEED);
+	cache->header = header;
+	return 1;
+}
+
+float * tcGetTileHeights(struct tcache_struct * cache, int i_tile)
+{
+	return (float*)((char*)cache->map_base + cache->header->data_offset + ((long long)i_tile*cache->header->tile_block_size));
+}
+
+short * tcGetTileNormals(struct tcache_struct * cache, int i_tile)
+{
+	return (short*)(tcGetTileHeights(cache, i_tile) + (cache->header->tile_num_x*cache->header->tile_num_z));
+}
+
+/*
+tcReleaseTile
+Tells the kernel the pages of a tile block can be dropped from this
+process. Used by the tile pager after copying a tile so the mapping
+doesn't keep the whole file resident.
+*/
+void tcReleaseTile(struct tcache_struct * cache, int i_tile)
+{
+	madvise((char*)tcGetTileHeights(cache, i_tile), cache->header->tile_block_size, MADV_DONTNEED);
+}
+
+void tcCloseCache(struct tcache_struct * cache)
+{
+	if(cache->map_base != 0)
+		munmap(cache->map_base, cache->map_len);
+	if(cache->fd != -1)
+		close(cache->fd);
+	cache->map_base = 0;
+	cache->map_len = 0;
+	cache->fd = -1;
+	cache->header = 0;
+}
+
+/*
+tcCreateCache
+Opens a temporary file next to cache_filename and writes the header.
+The caller fills in everything except magic, version, tile_block_size
+and data_offset, then writes every tile in order with tcWriteTile() and
+calls tcFinishCache(). The temp file is renamed over the real name only
+once complete so a crash never leaves a half-written cache behind.
+returns the open file, or 0 on failure.
+*/
+FILE * tcCreateCache(char * cache_filename, struct tcache_header_struct * header)
+{
+	char tmp_filename[512];
+	FILE * pFile;
+	long long num_verts;
+
+	snprintf(tmp_filename, 512, "%s.tmp", cache_filename);
+	pFile = fopen(tmp_filename, "wb");
+	if(pFile == 0)
+	{
+		printf("tcCreateCache: error. could not open %s for writing\n", tmp_filename);
+		return 0;
+	}
+
+	num_verts = (long long)header->tile_num_x*header->tile_num_z;
+	header->magic = TCACHE_MAGIC;
+	header->version = TCACHE_VERSION;
+	header->tile_block_size = tcAlignToPage(num_verts*(sizeof(float) + (2*sizeof(short)))); //1 height + 2 packed normal shorts per vert
+	header->data_offset = tcAlignToPage(sizeof(struct tcache_header_struct));
+
+	if(fwrite(header, sizeof(struct tcache_header_struct), 1, pFile) != 1
+		|| fseek(pFile, header->data_offset, SEEK_SET) != 0)
+	{
+		printf("tcCreateCache: failed writing header to %s\n", tmp_filename);
+		fclose(pFile);
+		remove(tmp_filename);
+		return 0;
+	}
+	return pFile;
+}
+
+/*
+tcWriteTile
+Appends one tile block. heights has tile_num_x*tile_num_z floats,
+normals has 2 packed shorts per vert.
+returns 1 on success, 0 on failure
+*/
+int tcWriteTile(FILE * pFile, struct tcache_header_struct * header, float * heights, short * normals)
+{
+	static const char zeros[TCACHE_PAGE_SIZE] = {0};
+	long long num_verts;
+	long long pad;
+
+	num_verts = (long long)header->tile_num_x*header->tile_num_z;
+	if(fwrite(heights, sizeof(float), num_verts, pFile) != (size_t)num_verts)
+		return 0;
+	if(fwrite(normals, sizeof(short), (num_verts*2), pFile) != (size_t)(num_verts*2))
+		return 0;
+	pad = header->tile_block_size - (num_verts*(sizeof(float) + (2*sizeof(short))));
+	if(pad > 0 && fwrite(zeros, 1, pad, pFile) != (size_t)pad)
+		return 0;
+	return 1;
+}
+
+/*
+tcFinishCache
+Closes the temp file written by tcCreateCache() and moves it into place.
+returns 1 on success, 0 on failure
+*/
+int tcFinishCache(FILE * pFile, char * cache_filename)
+{
+	char tmp_filename[512];
+	int r;
+
+	snprintf(tmp_filename, 512, "%s.tmp", cache_filename);
+	r = fclose(pFile);
+	if(r != 0)
+	{
+		printf("tcFinishCache: fclose failed for %s\n", tmp_filename);
+		remove(tmp_filename);
+		return 0;
+	}
+	r = rename(tmp_filename, cache_filename);
+	if(r != 0)
+	{
+		printf("tcFinishCache: could not rename %s to %s\n", tmp_filename, cache_filename);
+		remove(tmp_filename);
+		return 0;
+	}
+	return 1;
+}
@@ -0,0 +1,61 @@
+/*
+This file holds the on-disk terrain cache format. The cache is built
+once from the .asc DEM file and then memory-mapped on later starts so
+the DEM doesn't have to be re-parsed.
+
+File layout:
+	tcache_header_struct
+	(padding up to data_offset)
+	tile block 0: heights[tile_num_x*tile_num_z] floats, normals[2*tile_num_x*tile_num_z] packed shorts, padding
+	tile block 1: ...
+Each tile block starts on a TCACHE_PAGE_SIZE boundary so a single tile
+can be paged in without touching its neighbours.
+*/
+#ifndef MY_TERRAIN_CACHE_H
+#define MY_TERRAIN_CACHE_H
+
+#include <stdio.h>
+
+#define TCACHE_MAGIC		0x48435254	//"TRCH"
+#define TCACHE_VERSION		4
+#define TCACHE_PAGE_SIZE	4096
+
+struct tcache_header_struct
+{
+	unsigned int magic;
+	unsigned int version;
+	unsigned long long dem_checksum;	//checksum of the source .asc file
+	long long dem_size;					//size in bytes of the source .asc file
+	int num_rows;		//# of tile rows in the map
+	int num_cols;		//# of tile columns in the map
+	int tile_num_x;		//# of verts along a tile's x edge
+	int tile_num_z;		//# of verts along a tile's z edge
+	float tile_len[2];	//world-space length of a tile (0=x, 1=z)
+	float min_elevation;
+	float max_elevation;
+	long long tile_block_size;	//bytes in one tile block (multiple of TCACHE_PAGE_SIZE)
+	long long data_offset;		//file offset of the first tile block (multiple of TCACHE_PAGE_SIZE)
+};
+
+/*
+This holds an open, memory-mapped cache file.
+*/
+struct tcache_struct
+{
+	int fd;
+	void * map_base;
+	long long map_len;
+	struct tcache_header_struct * header;	//points into the mapping
+};
+
+int tcChecksumFile(char * filename, unsigned long long * pchecksum, long long * pfile_size);
+int tcOpenCache(struct tcache_struct * cache, char * cache_filename, unsigned long long dem_checksum, long long dem_size);
+float * tcGetTileHeights(struct tcache_struct * cache, int i_tile);
+short * tcGetTileNormals(struct tcache_struct * cache, int i_tile);
+void tcReleaseTile(struct tcache_struct * cache, int i_tile);
+void tcCloseCache(struct tcache_struct * cache);
+FILE * tcCreateCache(char * cache_filename, struct tcache_header_struct * header);
+int tcWriteTile(FILE * pFile, struct tcache_header_struct * header, float * heights, short * normals);
+int tcFinishCache(FILE * pFile, char * cache_filename);
+
+#endif
@@ -0,0 +1,563 @@
+/*
+Geomipmapped terrain tiles. Every level of a tile has 16 index lists, one
+per combination of edges that border a coarser tile. On such an edge the
+verts the coarser neighbour doesn't have are moved onto a vert it does
+have, which collapses the triangles in between. Verts move toward the
+nearer corner of the tile so the corner cells fold away cleanly when two
+sides are stitched. This only works if neighbouring tiles are at most one
+level apart, tlConstrainLevels() makes sure of that.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "my_terrain_lod.h"
+
+static int tlGetNumSamples(int num_quads, int stride);
+static int tlGetSample(int k, int num_quads, int stride);
+static int tlIsSample(int c, int num_quads, int stride);
+static int tlSnapSample(int c, int num_quads, int stride, int to_end);
+static int tlAddVariant(struct tl_elements_struct * lod, int level, int mask, int pos);
+static int tlCompareEdges(const void * a, const void * b);
+static int tlCheckVariant(struct tl_elements_struct * lod, int level, int mask, unsigned long long * edges, char * marks);
+
+/*
+tlGetNumSamples
+returns the # of verts along a side of num_quads quads at a stride.
+*/
+static int tlGetNumSamples(int num_quads, int stride)
+{
+	return ((num_quads + (stride-1))/stride) + 1;
+}
+
+/*
+tlGetSample
+returns the vert position of the k'th vert along a side at a stride.
+The last vert is always the edge of the tile.
+*/
+static int tlGetSample(int k, int num_quads, int stride)
+{
+	int c;
+
+	c = k*stride;
+	if(c > num_quads)
+		c = num_quads;
+	return c;
+}
+
+static int tlIsSample(int c, int num_quads, int stride)
+{
+	return ((c % stride) == 0 || c == num_quads);
+}
+
+/*
+tlSnapSample
+returns c if a side drawn at stride has that vert, otherwise the vert on
+either side of c that is toward the nearer end of the side. A vert in
+the middle goes to the end if to_end is set: the -x and -z sides send it
+to the (0,0) corner and the +x and +z sides to the far corner, so two
+stitched sides always fold onto the corner they share.
+*/
+static int tlSnapSample(int c, int num_quads, int stride, int to_end)
+{
+	int prev;
+	int next;
+
+	if(tlIsSample(c, num_quads, stride))
+		return c;
+	prev = (c/stride)*stride;
+	next = tlGetSample(((c/stride)+1), num_quads, stride);
+	if((2*c) == num_quads)
+		return to_end ? next : prev;
+	return ((2*c) < num_quads) ? prev : next;
+}
+
+/*
+tlAddVariant
+Writes the triangles of one level and edge mask starting at element pos.
+Triangles use the same diagonal as the full res tile:
+	1st triangle: (origin, vert in +z dir, vert in +x dir)
+	2nd triangle: (vert in +z dir, vert opposite origin, vert in +x dir)
+returns the # of elements written
+*/
+static int tlAddVariant(struct tl_elements_struct * lod, int level, int mask, int pos)
+{
+	unsigned short * elements;
+	int stride;
+	int num_quads_x, num_quads_z;
+	int num_cells_x, num_cells_z;
+	int corner_x[4];	//O, +z, +x, opposite O
+	int corner_z[4];
+	int v[4];
+	int i, j, k;
+	int n;
+
+	elements = lod->elements + pos;
+	stride = 1 << level;
+	num_quads_x = lod->num_x - 1;
+	num_quads_z = lod->num_z - 1;
+	num_cells_x = tlGetNumSamples(num_quads_x, stride) - 1;
+	num_cells_z = tlGetNumSamples(num_quads_z, stride) - 1;
+	n = 0;
+
+	for(i = 0; i < num_cells_z; i++)
+	{
+		for(j = 0; j < num_cells_x; j++)
+		{
+			corner_x[0] = tlGetSample(j, num_quads_x, stride);
+			corner_z[0] = tlGetSample(i, num_quads_z, stride);
+			corner_x[1] = corner_x[0];
+			corner_z[1] = tlGetSample((i+1), num_quads_z, stride);
+			corner_x[2] = tlGetSample((j+1), num_quads_x, stride);
+			corner_z[2] = corner_z[0];
+			corner_x[3] = corner_x[2];
+			corner_z[3] = corner_z[1];
+
+			//move edge verts the coarser neighbour doesn't have
+			for(k = 0; k < 4; k++)
+			{
+				if(corner_z[k] == 0 && (mask & TL_EDGE_NEG_Z))
+					corner_x[k] = tlSnapSample(corner_x[k], num_quads_x, (stride*2), 0);
+				if(corner_z[k] == num_quads_z && (mask & TL_EDGE_POS_Z))
+					corner_x[k] = tlSnapSample(corner_x[k], num_quads_x, (stride*2), 1);
+				if(corner_x[k] == 0 && (mask & TL_EDGE_NEG_X))
+					corner_z[k] = tlSnapSample(corner_z[k], num_quads_z, (stride*2), 0);
+				if(corner_x[k] == num_quads_x && (mask & TL_EDGE_POS_X))
+					corner_z[k] = tlSnapSample(corner_z[k], num_quads_z, (stride*2), 1);
+				v[k] = (corner_z[k]*lod->num_x) + corner_x[k];
+			}
+
+			//collapsed triangles are dropped
+			if(v[0] != v[1] && v[1] != v[2] && v[0] != v[2])
+			{
+				elements[n] = (unsigned short)v[0];
+				elements[(n+1)] = (unsigned short)v[1];
+				elements[(n+2)] = (unsigned short)v[2];
+				n += 3;
+			}
+			if(v[1] != v[3] && v[3] != v[2] && v[1] != v[2])
+			{
+				elements[n] = (unsigned short)v[1];
+				elements[(n+1)] = (unsigned short)v[3];
+				elements[(n+2)] = (unsigned short)v[2];
+				n += 3;
+			}
+		}
+	}
+	lod->offset[level][mask] = pos;
+	lod->count[level][mask] = n;
+	return n;
+}
+
+/*
+tlMakeElements
+Builds the index lists of every level and edge mask for a num_x by num_z
+vert tile. Level 0 with no coarser neighbours comes first and is the
+same as the full res element array.
+returns 1 on success, 0 on failure
+*/
+int tlMakeElements(struct tl_elements_struct * lod, int num_x, int num_z)
+{
+	int max_elements;
+	int num_cells;
+	int level;
+	int mask;
+	int pos;
+
+	memset(lod, 0, sizeof(struct tl_elements_struct));
+	if(num_x < 2 || num_z < 2 || (num_x*num_z) > 65536)
+	{
+		printf("tlMakeElements: error. can't index a %dx%d vert tile with unsigned shorts\n", num_x, num_z);
+		return 0;
+	}
+	lod->num_x = num_x;
+	lod->num_z = num_z;
+
+	max_elements = 0;
+	for(level = 0; level < TL_NUM_LEVELS; level++)
+	{
+		num_cells = (tlGetNumSamples((num_x-1), (1 << level)) - 1)*(tlGetNumSamples((num_z-1), (1 << level)) - 1);
+		max_elements += num_cells*6*TL_NUM_MASKS;
+	}
+	lod->elements = (unsigned short*)malloc(max_elements*sizeof(unsigned short));
+	if(lod->elements == 0)
+	{
+		printf("tlMakeElements: malloc failed for elements array.\n");
+		return 0;
+	}
+
+	pos = 0;
+	for(level = 0; level < TL_NUM_LEVELS; level++)
+	{
+		for(mask = 0; mask < TL_NUM_MASKS; mask++)
+		{
+			pos += tlAddVariant(lod, level, mask, pos);
+		}
+	}
+	lod->num_elements = pos;
+	return 1;
+}
+
+void tlFreeElements(struct tl_elements_struct * lod)
+{
+	free(lod->elements);
+	lod->elements = 0;
+	lod->num_elements = 0;
+}
+
+static int tlCompareEdges(const void * a, const void * b)
+{
+	unsigned long long ea = *(const unsigned long long*)a;
+	unsigned long long eb = *(const unsigned long long*)b;
+
+	if(ea < eb)
+		return -1;
+	if(ea > eb)
+		return 1;
+	return 0;
+}
+
+/*
+tlCheckVariant
+Checks one level and edge mask:
+-every triangle has the winding of the full res triangles (none are
+ flipped or collapsed)
+-the triangles cover the tile's area exactly
+-every inside edge is shared by 2 triangles with opposite winding, so
+ there are no holes or overlaps
+-the verts on each side of the tile are the samples of this level, or
+ only the samples of the next level on a stitched side, so the side
+ matches the neighbour's side
+edges and marks are scratch space: 3 entries per triangle, and
+2*(num_x+num_z)
+returns 1 if the variant is good, 0 if not
+*/
+static int tlCheckVariant(struct tl_elements_struct * lod, int level, int mask, unsigned long long * edges, char * marks)
+{
+	unsigned short * elements;
+	unsigned long long a, b;
+	long long area;
+	long long cross;
+	int side_base[4];	//first entry in marks of each side, in TL_EDGE_* bit order
+	int side_len[4];
+	int num_quads_x, num_quads_z;
+	int num_tris;
+	int num_edges;
+	int x[3], z[3];
+	int stride;
+	int side;
+	int expected;
+	int count;
+	int c;
+	int i, k;
+
+	elements = lod->elements + lod->offset[level][mask];
+	num_tris = lod->count[level][mask]/3;
+	num_quads_x = lod->num_x - 1;
+	num_quads_z = lod->num_z - 1;
+	stride = 1 << level;
+	area = 0;
+	num_edges = 0;
+
+	for(i = 0; i < num_tris; i++)
+	{
+		for(k = 0; k < 3; k++)
+		{
+			x[k] = elements[((i*3)+k)] % lod->num_x;
+			z[k] = elements[((i*3)+k)] / lod->num_x;
+		}
+		cross = ((long long)(x[1]-x[0])*(z[2]-z[0])) - ((long long)(z[1]-z[0])*(x[2]-x[0]));
+		if(cross >= 0)
+		{
+			printf("tlCheckVariant: level %d mask %d: triangle %d is flipped or collapsed\n", level, mask, i);
+			return 0;
+		}
+		area -= cross;
+
+		//edges as ((low vert << 16) | high vert) << 1 | direction
+		for(k = 0; k < 3; k++)
+		{
+			a = elements[((i*3)+k)];
+			b = elements[((i*3)+((k+1)%3))];
+			if(a < b)
+				edges[num_edges] = ((a << 16) | b) << 1;
+			else
+				edges[num_edges] = (((b << 16) | a) << 1) | 1;
+			num_edges += 1;
+		}
+	}
+	if(area != (2LL*num_quads_x*num_quads_z))
+	{
+		printf("tlCheckVariant: level %d mask %d: triangles cover %lld half quads instead of %lld\n", level, mask, area, (2LL*num_quads_x*num_quads_z));
+		return 0;
+	}
+
+	side_len[0] = lod->num_x;
+	side_len[1] = lod->num_z;
+	side_len[2] = lod->num_x;
+	side_len[3] = lod->num_z;
+	side_base[0] = 0;
+	for(side = 1; side < 4; side++)
+		side_base[side] = side_base[(side-1)] + side_len[(side-1)];
+	memset(marks, 0, (2*(lod->num_x+lod->num_z)));
+
+	qsort(edges, num_edges, sizeof(unsigned long long), tlCompareEdges);
+	for(i = 0; i < num_edges; i += count)
+	{
+		count = 1;
+		while((i+count) < num_edges && (edges[(i+count)] >> 1) == (edges[i] >> 1))
+			count += 1;
+		a = edges[i] >> 17;
+		b = (edges[i] >> 1) & 0xffff;
+		if(count == 2 && (edges[i] & 1) != (edges[(i+1)] & 1))
+			continue;
+		if(count != 1)
+		{
+			printf("tlCheckVariant: level %d mask %d: edge %llu-%llu is shared by %d triangles\n", level, mask, a, b, count);
+			return 0;
+		}
+
+		//an edge with one triangle has to lie along a side of the tile. mark its verts
+		x[0] = a % lod->num_x;
+		z[0] = a / lod->num_x;
+		x[1] = b % lod->num_x;
+		z[1] = b / lod->num_x;
+		if(z[0] == 0 && z[1] == 0)
+			side = 0;
+		else if(x[0] == num_quads_x && x[1] == num_quads_x)
+			side = 1;
+		else if(z[0] == num_quads_z && z[1] == num_quads_z)
+			side = 2;
+		else if(x[0] == 0 && x[1] == 0)
+			side = 3;
+		else
+		{
+			printf("tlCheckVariant: level %d mask %d: hole at edge %llu-%llu\n", level, mask, a, b);
+			return 0;
+		}
+		if(side == 0 || side == 2)
+		{
+			marks[(side_base[side] + x[0])] = 1;
+			marks[(side_base[side] + x[1])] = 1;
+		}
+		else
+		{
+			marks[(side_base[side] + z[0])] = 1;
+			marks[(side_base[side] + z[1])] = 1;
+		}
+	}
+
+	for(side = 0; side < 4; side++)
+	{
+		for(c = 0; c < side_len[side]; c++)
+		{
+			if(mask & (1 << side))
+				expected = tlIsSample(c, (side_len[side]-1), (stride*2));
+			else
+				expected = tlIsSample(c, (side_len[side]-1), stride);
+			if(marks[(side_base[side] + c)] != expected)
+			{
+				printf("tlCheckVariant: level %d mask %d: side %d vert %d %s\n", level, mask, side, c, expected ? "is missing" : "isn't on the neighbour's side");
+				return 0;
+			}
+		}
+	}
+	return 1;
+}
+
+/*
+tlCheckElements
+Runs tlCheckVariant() on every level and edge mask.
+returns 1 if all are good, 0 if not
+*/
+int tlCheckElements(struct tl_elements_struct * lod)
+{
+	unsigned long long * edges;
+	char * marks;
+	int max_count;
+	int level;
+	int mask;
+	int r = 1;
+
+	max_count = 0;
+	for(level = 0; level < TL_NUM_LEVELS; level++)
+	{
+		for(mask = 0; mask < TL_NUM_MASKS; mask++)
+		{
+			if(lod->count[level][mask] > max_count)
+				max_count = lod->count[level][mask];
+		}
+	}
+	edges = (unsigned long long*)malloc(max_count*sizeof(unsigned long long));
+	marks = (char*)malloc(2*(lod->num_x+lod->num_z));
+	if(edges == 0 || marks == 0)
+	{
+		printf("tlCheckElements: malloc failed for scratch space\n");
+		free(edges);
+		free(marks);
+		return 0;
+	}
+
+	for(level = 0; level < TL_NUM_LEVELS; level++)
+	{
+		for(mask = 0; mask < TL_NUM_MASKS; mask++)
+		{
+			if(tlCheckVariant(lod, level, mask, edges, marks) == 0)
+				r = 0;
+		}
+	}
+	free(edges);
+	free(marks);
+	return r;
+}
+
+/*
+tlCalcLevelErrors
+Calculates how far (in height) each level of a tile is off from the full
+res heights: the largest difference between a vert's height and the
+height of the level's triangles under it. errors gets TL_NUM_LEVELS
+floats and never gets smaller from one level to the next.
+*/
+void tlCalcLevelErrors(const float * heights, int num_x, int num_z, float * errors)
+{
+	const float * h[4];	//O, +z, +x, opposite O
+	float fx, fz;
+	float interp;
+	float err;
+	float e;
+	int num_quads_x, num_quads_z;
+	int x0, x1, z0, z1;
+	int stride;
+	int level;
+	int i, j;
+
+	num_quads_x = num_x - 1;
+	num_quads_z = num_z - 1;
+	errors[0] = 0.0f;
+	for(level = 1; level < TL_NUM_LEVELS; level++)
+	{
+		stride = 1 << level;
+		err = 0.0f;
+		for(i = 0; i < num_z; i++)
+		{
+			z0 = (i/stride)*stride;
+			if(z0 == num_quads_z) //last row belongs to the cell before it
+				z0 = tlGetSample((tlGetNumSamples(num_quads_z, stride)-2), num_quads_z, stride);
+			z1 = tlGetSample(((z0/stride)+1), num_quads_z, stride);
+			fz = (float)(i - z0)/(float)(z1 - z0);
+			for(j = 0; j < num_x; j++)
+			{
+				x0 = (j/stride)*stride;
+				if(x0 == num_quads_x)
+					x0 = tlGetSample((tlGetNumSamples(num_quads_x, stride)-2), num_quads_x, stride);
+				x1 = tlGetSample(((x0/stride)+1), num_quads_x, stride);
+				fx = (float)(j - x0)/(float)(x1 - x0);
+
+				h[0] = heights + ((z0*num_x) + x0);
+				h[1] = heights + ((z1*num_x) + x0);
+				h[2] = heights + ((z0*num_x) + x1);
+				h[3] = heights + ((z1*num_x) + x1);
+				if((fx + fz) <= 1.0f)
+					interp = *h[0] + (fx*(*h[2] - *h[0])) + (fz*(*h[1] - *h[0]));
+				else
+					interp = *h[3] + ((1.0f-fx)*(*h[1] - *h[3])) + ((1.0f-fz)*(*h[2] - *h[3]));
+				e = fabsf(interp - heights[((i*num_x) + j)]);
+				if(e > err)
+					err = e;
+			}
+		}
+		if(err < errors[(level-1)])
+			err = errors[(level-1)];
+		errors[level] = err;
+	}
+}
+
+/*
+tlPickLevel
+Picks the coarsest level whose height error is at most max_pixel_error
+pixels on screen. pixels_per_unit is how many pixels 1 unit is at a
+distance of 1 ((screen height/2) / tan(fov/2)) and dist is the distance
+from the camera to the tile.
+returns the level
+*/
+int tlPickLevel(const float * errors, float dist, float pixels_per_unit, float max_pixel_error)
+{
+	int level;
+
+	if(dist < 1.0f)
+		dist = 1.0f;
+	for(level = (TL_NUM_LEVELS-1); level > 0; level--)
+	{
+		if((errors[level]*pixels_per_unit) <= (max_pixel_error*dist))
+			break;
+	}
+	return level;
+}
+
+/*
+tlConstrainLevels
+Lowers levels until no tile is more than one level coarser than the
+tiles next to it, since the stitched edges only bridge one level.
+levels is row-major num_cols by num_rows.
+*/
+void tlConstrainLevels(char * levels, int num_cols, int num_rows)
+{
+	int changed = 1;
+	int row, col;
+	int i;
+
+	while(changed)
+	{
+		changed = 0;
+		for(row = 0; row < num_rows; row++)
+		{
+			for(col = 0; col < num_cols; col++)
+			{
+				i = (row*num_cols) + col;
+				if(col > 0 && levels[i] > (levels[(i-1)]+1))
+				{
+					levels[i] = levels[(i-1)]+1;
+					changed = 1;
+				}
+				if(col < (num_cols-1) && levels[i] > (levels[(i+1)]+1))
+				{
+					levels[i] = levels[(i+1)]+1;
+					changed = 1;
+				}
+				if(row > 0 && levels[i] > (levels[(i-num_cols)]+1))
+				{
+					levels[i] = levels[(i-num_cols)]+1;
+					changed = 1;
+				}
+				if(row < (num_rows-1) && levels[i] > (levels[(i+num_cols)]+1))
+				{
+					levels[i] = levels[(i+num_cols)]+1;
+					changed = 1;
+				}
+			}
+		}
+	}
+}
+
+/*
+tlGetEdgeMask
+returns the TL_EDGE_* bits of the sides of tile_i whose neighbour is at
+a coarser level. The map border counts as the same level.
+*/
+int tlGetEdgeMask(const char * levels, int num_cols, int num_rows, int tile_i)
+{
+	int row, col;
+	int mask = 0;
+
+	row = tile_i/num_cols;
+	col = tile_i%num_cols;
+	if(row > 0 && levels[(tile_i-num_cols)] > levels[tile_i])
+		mask |= TL_EDGE_NEG_Z;
+	if(col < (num_cols-1) && levels[(tile_i+1)] > levels[tile_i])
+		mask |= TL_EDGE_POS_X;
+	if(row < (num_rows-1) && levels[(tile_i+num_cols)] > levels[tile_i])
+		mask |= TL_EDGE_POS_Z;
+	if(col > 0 && levels[(tile_i-1)] > levels[tile_i])
+		mask |= TL_EDGE_NEG_X;
+	return mask;
+}
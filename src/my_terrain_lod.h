@@ -0,0 +1,48 @@
+/*
+This file holds the CPU side of geomipmapped terrain: the index lists for
+each level of detail of a tile (with edge-stitching variants), per-level
+height errors, and picking a level per tile. Nothing here touches GL so
+it can be checked without a window (--check-terrain-lod).
+
+Level L draws every (1 << L)'th vert of a tile. Tiles don't need a power
+of two # of quads: the last vert of a row or column is always the tile
+edge, so the last step of a level can be shorter.
+*/
+#ifndef MY_TERRAIN_LOD_H
+#define MY_TERRAIN_LOD_H
+
+#define TL_NUM_LEVELS 5		//strides 1, 2, 4, 8, 16
+#define TL_NUM_MASKS 16		//one variant per combination of coarser neighbours
+
+/*
+Edge mask bits. A set bit means the neighbour on that side is one level
+coarser, so that edge of the tile only uses the neighbour's verts.
+*/
+#define TL_EDGE_NEG_Z 1		//row 0
+#define TL_EDGE_POS_X 2		//last column
+#define TL_EDGE_POS_Z 4		//last row
+#define TL_EDGE_NEG_X 8		//column 0
+
+/*
+Index lists for every level and edge mask of a num_x by num_z vert tile,
+packed in one array so they fit in one element buffer.
+*/
+struct tl_elements_struct
+{
+	unsigned short * elements;
+	int num_elements;
+	int num_x;
+	int num_z;
+	int offset[TL_NUM_LEVELS][TL_NUM_MASKS];	//first element of each variant
+	int count[TL_NUM_LEVELS][TL_NUM_MASKS];		//# of elements of each variant (3 per triangle)
+};
+
+int tlMakeElements(struct tl_elements_struct * lod, int num_x, int num_z);
+void tlFreeElements(struct tl_elements_struct * lod);
+int tlCheckElements(struct tl_elements_struct * lod);
+void tlCalcLevelErrors(const float * heights, int num_x, int num_z, float * errors);
+int tlPickLevel(const float * errors, float dist, float pixels_per_unit, float max_pixel_error);
+void tlConstrainLevels(char * levels, int num_cols, int num_rows);
+int tlGetEdgeMask(const char * levels, int num_cols, int num_rows, int tile_i);
+
+#endif
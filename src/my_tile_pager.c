@@ -0,0 +1,333 @@
+/*
+Generic tile pager. The main thread decides which tiles it wants and
+queues them with tpRequest(). One worker thread calls the load func for
+each queued tile and parks the result until the main thread picks it up
+with tpGetLoaded(). Installing and evicting tile data is left to the
+caller so the worker never touches data the main thread is reading.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "my_tile_pager.h"
+
+static void * tpWorker(void * arg);
+
+static void * tpWorker(void * arg)
+{
+	struct tile_pager_struct * pager = (struct tile_pager_struct*)arg;
+	long long bytes;
+	void * data;
+	int tile_i;
+
+	pthread_mutex_lock(&pager->lock);
+	while(pager->quit == 0)
+	{
+		if(pager->queue_pos >= pager->queue_len)
+		{
+			pthread_cond_wait(&pager->cond, &pager->lock);
+			continue;
+		}
+		tile_i = pager->queue[pager->queue_pos];
+		pager->queue_pos += 1;
+		if(pager->state[tile_i] != TP_STATE_QUEUED) //request was dropped
+			continue;
+		pager->state[tile_i] = TP_STATE_LOADING;
+		pthread_mutex_unlock(&pager->lock);
+
+		bytes = 0;
+		data = pager->load(pager->user, tile_i, &bytes);
+
+		pthread_mutex_lock(&pager->lock);
+		if(data == 0)
+		{
+			if(pager->state[tile_i] == TP_STATE_LOADING)
+				pager->state[tile_i] = TP_STATE_NONE;
+			continue;
+		}
+		if(pager->state[tile_i] != TP_STATE_LOADING) //main thread loaded it in the meantime
+		{
+			pager->free_data(pager->user, data);
+			continue;
+		}
+		pager->state[tile_i] = TP_STATE_LOADED;
+		pager->loaded_data[tile_i] = data;
+		pager->tile_bytes[tile_i] = bytes;
+		pager->loaded[pager->num_loaded] = tile_i;
+		pager->num_loaded += 1;
+	}
+	pthread_mutex_unlock(&pager->lock);
+	return 0;
+}
+
+/*
+tpInit
+Allocates the per-tile state for num_tiles tiles (all start out not
+resident) and starts the worker thread.
+returns 1 on success, 0 on failure
+*/
+int tpInit(struct tile_pager_struct * pager, int num_tiles, long long budget_bytes, tp_load_func load, tp_free_func free_data, void * user)
+{
+	int r;
+
+	memset(pager, 0, sizeof(struct tile_pager_struct));
+	pager->num_tiles = num_tiles;
+	pager->budget_bytes = budget_bytes;
+	pager->load = load;
+	pager->free_data = free_data;
+	pager->user = user;
+	pager->last_used = (unsigned int*)calloc(num_tiles, sizeof(unsigned int));
+	pager->tile_bytes = (long long*)calloc(num_tiles, sizeof(long long));
+	pager->state = (char*)calloc(num_tiles, sizeof(char));
+	pager->loaded_data = (void**)calloc(num_tiles, sizeof(void*));
+	pager->queue = (int*)malloc(num_tiles*sizeof(int));
+	pager->loaded = (int*)malloc(num_tiles*sizeof(int));
+	if(pager->last_used == 0 || pager->tile_bytes == 0 || pager->state == 0
+		|| pager->loaded_data == 0 || pager->queue == 0 || pager->loaded == 0)
+	{
+		printf("tpInit: malloc failed for tile state\n");
+		tpShutdown(pager);
+		return 0;
+	}
+
+	pthread_mutex_init(&pager->lock, 0);
+	pthread_cond_init(&pager->cond, 0);
+	r = pthread_create(&pager->thread, 0, tpWorker, pager);
+	if(r != 0)
+	{
+		printf("tpInit: pthread_create failed (%d)\n", r);
+		pthread_mutex_destroy(&pager->lock);
+		pthread_cond_destroy(&pager->cond);
+		tpShutdown(pager);
+		return 0;
+	}
+	pager->thread_started = 1;
+	return 1;
+}
+
+/*
+tpShutdown
+Stops the worker thread and frees the pager's state. Data still waiting
+to be picked up is freed with the free func. Resident tile data is left
+alone since it belongs to the caller.
+*/
+void tpShutdown(struct tile_pager_struct * pager)
+{
+	int i;
+
+	if(pager->thread_started)
+	{
+		pthread_mutex_lock(&pager->lock);
+		pager->quit = 1;
+		pthread_cond_broadcast(&pager->cond);
+		pthread_mutex_unlock(&pager->lock);
+		pthread_join(pager->thread, 0);
+		pthread_mutex_destroy(&pager->lock);
+		pthread_cond_destroy(&pager->cond);
+		pager->thread_started = 0;
+
+		for(i = 0; i < pager->num_loaded; i++)
+		{
+			pager->free_data(pager->user, pager->loaded_data[pager->loaded[i]]);
+		}
+		pager->num_loaded = 0;
+	}
+
+	free(pager->last_used);
+	free(pager->tile_bytes);
+	free(pager->state);
+	free(pager->loaded_data);
+	free(pager->queue);
+	free(pager->loaded);
+	pager->last_used = 0;
+	pager->tile_bytes = 0;
+	pager->state = 0;
+	pager->loaded_data = 0;
+	pager->queue = 0;
+	pager->loaded = 0;
+}
+
+/*
+tpNextFrame
+Advances the LRU clock. Tiles touched before the current frame are
+older than tiles touched during it.
+*/
+void tpNextFrame(struct tile_pager_struct * pager)
+{
+	pager->frame += 1;
+}
+
+void tpTouch(struct tile_pager_struct * pager, int tile_i)
+{
+	pager->last_used[tile_i] = pager->frame;
+}
+
+int tpGetState(struct tile_pager_struct * pager, int tile_i)
+{
+	int state;
+
+	pthread_mutex_lock(&pager->lock);
+	state = pager->state[tile_i];
+	pthread_mutex_unlock(&pager->lock);
+	return state;
+}
+
+/*
+tpClearRequests
+Drops every request the worker hasn't started yet. Call this before
+queueing the tiles wanted this frame so the queue stays in the new order.
+*/
+void tpClearRequests(struct tile_pager_struct * pager)
+{
+	int i;
+
+	pthread_mutex_lock(&pager->lock);
+	for(i = pager->queue_pos; i < pager->queue_len; i++)
+	{
+		if(pager->state[pager->queue[i]] == TP_STATE_QUEUED)
+			pager->state[pager->queue[i]] = TP_STATE_NONE;
+	}
+	pager->queue_pos = 0;
+	pager->queue_len = 0;
+	pthread_mutex_unlock(&pager->lock);
+}
+
+/*
+tpRequest
+Queues an asynchronous load of a tile.
+returns 1 if queued, 0 if the tile is already resident, queued or loading
+*/
+int tpRequest(struct tile_pager_struct * pager, int tile_i)
+{
+	pthread_mutex_lock(&pager->lock);
+	if(pager->state[tile_i] != TP_STATE_NONE)
+	{
+		pthread_mutex_unlock(&pager->lock);
+		return 0;
+	}
+	//each tile is in the queue at most once, so compacting always makes room
+	if(pager->queue_len == pager->num_tiles)
+	{
+		memmove(pager->queue, (pager->queue+pager->queue_pos), (pager->queue_len-pager->queue_pos)*sizeof(int));
+		pager->queue_len -= pager->queue_pos;
+		pager->queue_pos = 0;
+	}
+	pager->state[tile_i] = TP_STATE_QUEUED;
+	pager->queue[pager->queue_len] = tile_i;
+	pager->queue_len += 1;
+	pthread_cond_signal(&pager->cond);
+	pthread_mutex_unlock(&pager->lock);
+	return 1;
+}
+
+/*
+tpGetLoaded
+Picks up the oldest finished load. The tile is counted as resident from
+here on and the caller owns the data.
+returns 1 if a tile was returned, 0 if none are waiting
+*/
+int tpGetLoaded(struct tile_pager_struct * pager, int * ptile_i, void ** pdata, long long * pbytes)
+{
+	int tile_i;
+
+	pthread_mutex_lock(&pager->lock);
+	if(pager->num_loaded == 0)
+	{
+		pthread_mutex_unlock(&pager->lock);
+		return 0;
+	}
+	tile_i = pager->loaded[0];
+	pager->num_loaded -= 1;
+	memmove(pager->loaded, (pager->loaded+1), pager->num_loaded*sizeof(int));
+	pager->state[tile_i] = TP_STATE_RESIDENT;
+	pager->resident_bytes += pager->tile_bytes[tile_i];
+	pager->last_used[tile_i] = pager->frame;
+	*ptile_i = tile_i;
+	*pdata = pager->loaded_data[tile_i];
+	*pbytes = pager->tile_bytes[tile_i];
+	pager->loaded_data[tile_i] = 0;
+	pthread_mutex_unlock(&pager->lock);
+	return 1;
+}
+
+/*
+tpSetResident
+Marks a tile the caller loaded itself as resident, or updates the byte
+count of a resident tile. A queued request for the tile is dropped, a
+load running on the worker is thrown away when it finishes, and a
+finished load that wasn't picked up yet is freed.
+*/
+void tpSetResident(struct tile_pager_struct * pager, int tile_i, long long bytes)
+{
+	int i;
+
+	pthread_mutex_lock(&pager->lock);
+	if(pager->state[tile_i] == TP_STATE_RESIDENT)
+		pager->resident_bytes -= pager->tile_bytes[tile_i];
+	if(pager->state[tile_i] == TP_STATE_LOADED)
+	{
+		for(i = 0; i < pager->num_loaded; i++)
+		{
+			if(pager->loaded[i] == tile_i)
+				break;
+		}
+		pager->num_loaded -= 1;
+		memmove((pager->loaded+i), (pager->loaded+i+1), (pager->num_loaded-i)*sizeof(int));
+		pager->free_data(pager->user, pager->loaded_data[tile_i]);
+		pager->loaded_data[tile_i] = 0;
+	}
+	pager->state[tile_i] = TP_STATE_RESIDENT;
+	pager->tile_bytes[tile_i] = bytes;
+	pager->resident_bytes += bytes;
+	pager->last_used[tile_i] = pager->frame;
+	pthread_mutex_unlock(&pager->lock);
+}
+
+/*
+tpSetEvicted
+Marks a resident tile as not resident. The caller frees the data.
+*/
+void tpSetEvicted(struct tile_pager_struct * pager, int tile_i)
+{
+	pthread_mutex_lock(&pager->lock);
+	if(pager->state[tile_i] == TP_STATE_RESIDENT)
+	{
+		pager->resident_bytes -= pager->tile_bytes[tile_i];
+		pager->tile_bytes[tile_i] = 0;
+		pager->state[tile_i] = TP_STATE_NONE;
+	}
+	pthread_mutex_unlock(&pager->lock);
+}
+
+/*
+tpFindEvictTile
+keep has a flag per tile (or is 0), tiles with a non-zero flag are never
+picked.
+returns the least recently used resident tile if the resident bytes are
+over budget, or -1 if nothing needs to (or can) be evicted.
+*/
+int tpFindEvictTile(struct tile_pager_struct * pager, const char * keep)
+{
+	unsigned int oldest = 0;
+	int tile_i = -1;
+	int i;
+
+	pthread_mutex_lock(&pager->lock);
+	if(pager->resident_bytes > pager->budget_bytes)
+	{
+		for(i = 0; i < pager->num_tiles; i++)
+		{
+			if(pager->state[i] != TP_STATE_RESIDENT)
+				continue;
+			if(keep != 0 && keep[i] != 0)
+				continue;
+			if(tile_i == -1 || pager->last_used[i] < oldest)
+			{
+				oldest = pager->last_used[i];
+				tile_i = i;
+			}
+		}
+	}
+	pthread_mutex_unlock(&pager->lock);
+	return tile_i;
+}
@@ -0,0 +1,68 @@
+/*
+This file holds a generic tile pager. It keeps track of which tiles of a
+grid are resident, loads tiles on a worker thread and picks the least
+recently used tile to evict when the resident bytes go over a budget.
+The tile data itself belongs to the caller: the pager only hands back
+whatever the load function returned.
+*/
+#ifndef MY_TILE_PAGER_H
+#define MY_TILE_PAGER_H
+
+#include <pthread.h>
+
+#define TP_STATE_NONE 0		//not resident, not queued
+#define TP_STATE_QUEUED 1	//waiting for the worker thread
+#define TP_STATE_LOADING 2	//being loaded by the worker thread
+#define TP_STATE_LOADED 3	//loaded, waiting to be picked up with tpGetLoaded()
+#define TP_STATE_RESIDENT 4
+
+/*
+Called on the worker thread to load a tile. Returns the tile's data (or
+0 on failure) and the # of bytes it holds in pbytes.
+*/
+typedef void * (*tp_load_func)(void * user, int tile_i, long long * pbytes);
+
+/*
+Called to free data from the load func that was never picked up (the
+tile was made resident some other way, or the pager shut down).
+*/
+typedef void (*tp_free_func)(void * user, void * data);
+
+struct tile_pager_struct
+{
+	int num_tiles;
+	long long budget_bytes;		//tpFindEvictTile() returns tiles while resident_bytes is over this
+	long long resident_bytes;
+	unsigned int frame;			//LRU clock, advanced by tpNextFrame()
+	unsigned int * last_used;	//per tile, frame the tile was last touched
+	long long * tile_bytes;		//per tile, bytes held while resident
+	char * state;				//per tile, TP_STATE_*
+	void ** loaded_data;		//per tile, data from the load func while TP_STATE_LOADED
+	int * queue;				//tiles waiting for the worker, in load order
+	int queue_len;
+	int queue_pos;				//next queue entry for the worker
+	int * loaded;				//tiles in TP_STATE_LOADED, in the order they finished
+	int num_loaded;
+	tp_load_func load;
+	tp_free_func free_data;
+	void * user;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int thread_started;
+	int quit;
+};
+
+int tpInit(struct tile_pager_struct * pager, int num_tiles, long long budget_bytes, tp_load_func load, tp_free_func free_data, void * user);
+void tpShutdown(struct tile_pager_struct * pager);
+void tpNextFrame(struct tile_pager_struct * pager);
+void tpTouch(struct tile_pager_struct * pager, int tile_i);
+int tpGetState(struct tile_pager_struct * pager, int tile_i);
+void tpClearRequests(struct tile_pager_struct * pager);
+int tpRequest(struct tile_pager_struct * pager, int tile_i);
+int tpGetLoaded(struct tile_pager_struct * pager, int * ptile_i, void ** pdata, long long * pbytes);
+void tpSetResident(struct tile_pager_struct * pager, int tile_i, long long bytes);
+void tpSetEvicted(struct tile_pager_struct * pager, int tile_i);
+int tpFindEvictTile(struct tile_pager_struct * pager, const char * keep);
+
+#endif
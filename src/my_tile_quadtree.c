@@ -0,0 +1,194 @@
+/*
+Static quadtree over a tile grid. The grid doesn't need to be a power of
+two: a node's rectangle is split at its middle row and column, and halves
+with no tiles are left out, so every node has 2 to 4 children or is a
+single tile.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "my_tile_quadtree.h"
+
+static int qtBuildNode(struct tile_quadtree_struct * tree, int parent, int first_col, int first_row, int end_col, int end_row, float tile_len_x, float tile_len_z);
+static void qtCollectNode(struct tile_quadtree_struct * tree, int node_i, qt_classify_func classify, void * user);
+
+/*
+qtBuildNode
+Adds the node for a rectangle of tiles and then its children.
+returns the index of the node
+*/
+static int qtBuildNode(struct tile_quadtree_struct * tree, int parent, int first_col, int first_row, int end_col, int end_row, float tile_len_x, float tile_len_z)
+{
+	struct qt_node_struct * node;
+	int cols[3];
+	int rows[3];
+	int node_i;
+	int child;
+	int i, j;
+
+	node_i = tree->num_nodes;
+	tree->num_nodes += 1;
+	node = &(tree->nodes[node_i]);
+	node->first_col = first_col;
+	node->first_row = first_row;
+	node->end_col = end_col;
+	node->end_row = end_row;
+	node->box_min[0] = first_col*tile_len_x;
+	node->box_min[1] = 0.0f;
+	node->box_min[2] = first_row*tile_len_z;
+	node->box_max[0] = end_col*tile_len_x;
+	node->box_max[1] = 0.0f;
+	node->box_max[2] = end_row*tile_len_z;
+	node->parent = parent;
+	node->num_children = 0;
+
+	if((end_col - first_col) == 1 && (end_row - first_row) == 1)
+	{
+		tree->leaf_nodes[((first_row*tree->num_cols) + first_col)] = node_i;
+		return node_i;
+	}
+
+	cols[0] = first_col;
+	cols[1] = first_col + ((end_col - first_col + 1)/2);
+	cols[2] = end_col;
+	rows[0] = first_row;
+	rows[1] = first_row + ((end_row - first_row + 1)/2);
+	rows[2] = end_row;
+	for(i = 0; i < 2; i++)
+	{
+		for(j = 0; j < 2; j++)
+		{
+			if(rows[i] == rows[(i+1)] || cols[j] == cols[(j+1)])
+				continue;
+			child = qtBuildNode(tree, node_i, cols[j], rows[i], cols[(j+1)], rows[(i+1)], tile_len_x, tile_len_z);
+			node = &(tree->nodes[node_i]);
+			node->children[node->num_children] = child;
+			node->num_children += 1;
+		}
+	}
+	return node_i;
+}
+
+/*
+qtInit
+Builds the tree over a num_cols by num_rows grid of tiles. Tiles are
+tile_len_x by tile_len_z with tile (0,0) at the origin, and start out
+with a height range of 0 (see qtSetTileHeights).
+returns 1 on success, 0 on failure
+*/
+int qtInit(struct tile_quadtree_struct * tree, int num_cols, int num_rows, float tile_len_x, float tile_len_z)
+{
+	memset(tree, 0, sizeof(struct tile_quadtree_struct));
+	if(num_cols < 1 || num_rows < 1)
+	{
+		printf("qtInit: error. can't build a tree over %dx%d tiles\n", num_cols, num_rows);
+		return 0;
+	}
+	tree->num_cols = num_cols;
+	tree->num_rows = num_rows;
+	tree->num_tiles = num_cols*num_rows;
+
+	//every node that isn't a tile has at least 2 children, so there are fewer than 2 nodes per tile
+	tree->nodes = (struct qt_node_struct*)malloc(2*tree->num_tiles*sizeof(struct qt_node_struct));
+	tree->leaf_nodes = (int*)malloc(tree->num_tiles*sizeof(int));
+	tree->visible = (int*)malloc(tree->num_tiles*sizeof(int));
+	if(tree->nodes == 0 || tree->leaf_nodes == 0 || tree->visible == 0)
+	{
+		printf("qtInit: malloc failed for %d tiles\n", tree->num_tiles);
+		qtFree(tree);
+		return 0;
+	}
+	qtBuildNode(tree, -1, 0, 0, num_cols, num_rows, tile_len_x, tile_len_z);
+	return 1;
+}
+
+void qtFree(struct tile_quadtree_struct * tree)
+{
+	free(tree->nodes);
+	free(tree->leaf_nodes);
+	free(tree->visible);
+	tree->nodes = 0;
+	tree->leaf_nodes = 0;
+	tree->visible = 0;
+	tree->num_nodes = 0;
+	tree->num_visible = 0;
+}
+
+/*
+qtSetTileHeights
+Sets the height range of a tile and grows or shrinks the boxes of the
+nodes above it to match.
+*/
+void qtSetTileHeights(struct tile_quadtree_struct * tree, int tile_i, float min_y, float max_y)
+{
+	struct qt_node_struct * node;
+	struct qt_node_struct * child;
+	int node_i;
+	int i;
+
+	node_i = tree->leaf_nodes[tile_i];
+	tree->nodes[node_i].box_min[1] = min_y;
+	tree->nodes[node_i].box_max[1] = max_y;
+
+	node_i = tree->nodes[node_i].parent;
+	while(node_i != -1)
+	{
+		node = &(tree->nodes[node_i]);
+		child = &(tree->nodes[node->children[0]]);
+		node->box_min[1] = child->box_min[1];
+		node->box_max[1] = child->box_max[1];
+		for(i = 1; i < node->num_children; i++)
+		{
+			child = &(tree->nodes[node->children[i]]);
+			if(child->box_min[1] < node->box_min[1])
+				node->box_min[1] = child->box_min[1];
+			if(child->box_max[1] > node->box_max[1])
+				node->box_max[1] = child->box_max[1];
+		}
+		node_i = node->parent;
+	}
+}
+
+static void qtCollectNode(struct tile_quadtree_struct * tree, int node_i, qt_classify_func classify, void * user)
+{
+	struct qt_node_struct * node;
+	int row, col;
+	int r;
+	int i;
+
+	node = &(tree->nodes[node_i]);
+	tree->num_tests += 1;
+	r = classify(user, node);
+	if(r == QT_OUTSIDE)
+		return;
+	if(r == QT_PARTIAL && node->num_children > 0)
+	{
+		for(i = 0; i < node->num_children; i++)
+		{
+			qtCollectNode(tree, node->children[i], classify, user);
+		}
+		return;
+	}
+
+	for(row = node->first_row; row < node->end_row; row++)
+	{
+		for(col = node->first_col; col < node->end_col; col++)
+		{
+			tree->visible[tree->num_visible] = (row*tree->num_cols) + col;
+			tree->num_visible += 1;
+		}
+	}
+}
+
+/*
+qtCollect
+Walks the tree from the root and fills visible with every tile that
+passes classify. Subtrees that are wholly outside or inside are not
+walked any further.
+*/
+void qtCollect(struct tile_quadtree_struct * tree, qt_classify_func classify, void * user)
+{
+	tree->num_visible = 0;
+	tree->num_tests = 0;
+	qtCollectNode(tree, 0, classify, user);
+}
@@ -0,0 +1,52 @@
+/*
+This file holds a static quadtree over a grid of tiles. Every node covers
+a rectangle of tiles and has a bounding box that holds all of them, so a
+whole subtree can be accepted or rejected with one test. The caller
+supplies the test; the tree only walks the nodes and collects the tiles
+that pass.
+*/
+#ifndef MY_TILE_QUADTREE_H
+#define MY_TILE_QUADTREE_H
+
+#define QT_OUTSIDE 0	//no tile under the node passes
+#define QT_INSIDE 1		//every tile under the node passes
+#define QT_PARTIAL 2	//some might, test the children
+
+struct qt_node_struct
+{
+	int first_col;		//tiles covered: cols first_col..end_col-1, rows first_row..end_row-1
+	int first_row;
+	int end_col;
+	int end_row;
+	float box_min[3];	//bounding box of every tile under the node
+	float box_max[3];
+	int parent;			//-1 for the root
+	int children[4];
+	int num_children;	//0 for a node with a single tile
+};
+
+struct tile_quadtree_struct
+{
+	int num_cols;
+	int num_rows;
+	int num_tiles;
+	struct qt_node_struct * nodes;	//root is nodes[0], children always come after their parent
+	int num_nodes;
+	int * leaf_nodes;	//per tile, index of the tile's node
+	int * visible;		//tiles that passed the last qtCollect()
+	int num_visible;
+	int num_tests;		//# of times the test ran in the last qtCollect()
+};
+
+/*
+Called on each node qtCollect() visits. Must return QT_INSIDE or
+QT_OUTSIDE for a node with a single tile (num_children == 0).
+*/
+typedef int (*qt_classify_func)(void * user, struct qt_node_struct * node);
+
+int qtInit(struct tile_quadtree_struct * tree, int num_cols, int num_rows, float tile_len_x, float tile_len_z);
+void qtFree(struct tile_quadtree_struct * tree);
+void qtSetTileHeights(struct tile_quadtree_struct * tree, int tile_i, float min_y, float max_y);
+void qtCollect(struct tile_quadtree_struct * tree, qt_classify_func classify, void * user);
+
+#endif
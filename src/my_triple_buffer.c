@@ -0,0 +1,96 @@
+/*
+Triple buffer. The three slots are always split between the writer
+(back), the reader (front) and the hand-off (middle). Publishing swaps
+the back slot with the middle one, picking up swaps the front slot with
+the middle one, each with one atomic exchange. See my_triple_buffer.h.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "my_triple_buffer.h"
+
+/*
+tbInit
+Allocates the slots, zeroed.
+returns 1 on success, 0 on failure
+*/
+int tbInit(struct tb_buffer_struct * tb, int slot_size)
+{
+	int i;
+
+	memset(tb, 0, sizeof(struct tb_buffer_struct));
+	for(i = 0; i < TB_NUM_SLOTS; i++)
+	{
+		tb->slots[i] = (char*)calloc(1, slot_size);
+		if(tb->slots[i] == 0)
+		{
+			printf("tbInit: calloc failed for %d bytes\n", slot_size);
+			tbFree(tb);
+			return 0;
+		}
+	}
+	tb->slot_size = slot_size;
+	tb->back = 0;
+	tb->middle = 1;
+	tb->front = 2;
+	return 1;
+}
+
+void tbFree(struct tb_buffer_struct * tb)
+{
+	int i;
+
+	for(i = 0; i < TB_NUM_SLOTS; i++)
+	{
+		free(tb->slots[i]);
+		tb->slots[i] = 0;
+	}
+}
+
+/*
+tbGetBack
+returns the slot for the writer to fill. It holds whatever was written
+to it two publishes ago, or zeroes. Writer thread only.
+*/
+void * tbGetBack(struct tb_buffer_struct * tb)
+{
+	return tb->slots[tb->back];
+}
+
+/*
+tbPublish
+Hands the back slot to the reader, replacing the one it would have got
+if it hasn't picked that one up yet, and takes the old middle slot as
+the new back slot. Writer thread only.
+*/
+void tbPublish(struct tb_buffer_struct * tb)
+{
+	int prev;
+
+	prev = __atomic_exchange_n(&(tb->middle), (tb->back | TB_FRESH), __ATOMIC_ACQ_REL);
+	tb->back = prev & TB_SLOT_MASK;
+	__atomic_add_fetch(&(tb->num_published), 1, __ATOMIC_RELEASE);
+}
+
+/*
+tbGetLatest
+Picks up the newest published slot if there is one the reader hasn't
+seen. The slot stays the reader's, unchanged, until the next call.
+Reader thread only.
+returns the slot, or 0 if nothing has been published yet
+*/
+void * tbGetLatest(struct tb_buffer_struct * tb)
+{
+	int prev;
+
+	//check the count first: once it is non-zero the first publish is visible in middle
+	if(__atomic_load_n(&(tb->num_published), __ATOMIC_ACQUIRE) == 0)
+		return 0;
+	if(__atomic_load_n(&(tb->middle), __ATOMIC_ACQUIRE) & TB_FRESH)
+	{
+		prev = __atomic_exchange_n(&(tb->middle), tb->front, __ATOMIC_ACQ_REL);
+		tb->front = prev & TB_SLOT_MASK;
+		tb->num_picked += 1;
+	}
+	return tb->slots[tb->front];
+}
@@ -0,0 +1,33 @@
+/*
+This file holds a lock-free triple buffer for handing a block of state
+from one writer thread to one reader thread. The writer fills the back
+slot and publishes it, the reader picks up the newest published slot
+when it starts using one. Neither side ever waits: the writer always has
+a free slot and the reader keeps the slot it has until it asks for a
+newer one, so a slow reader only skips states, it never sees a torn one.
+*/
+#ifndef MY_TRIPLE_BUFFER_H
+#define MY_TRIPLE_BUFFER_H
+
+#define TB_NUM_SLOTS 3
+#define TB_SLOT_MASK 3	//bits of middle that hold the slot index
+#define TB_FRESH 4		//bit of middle set when the middle slot was published and not picked up
+
+struct tb_buffer_struct
+{
+	char * slots[TB_NUM_SLOTS];
+	int slot_size;		//bytes per slot
+	int back;			//slot the writer fills, writer thread only
+	int front;			//slot the reader uses, reader thread only
+	int middle;			//last published slot and TB_FRESH, swapped atomically
+	int num_published;	//# of tbPublish() calls, reader can tell when none have happened yet
+	int num_picked;		//# of times the reader picked up a newer slot, reader thread only
+};
+
+int tbInit(struct tb_buffer_struct * tb, int slot_size);
+void tbFree(struct tb_buffer_struct * tb);
+void * tbGetBack(struct tb_buffer_struct * tb);
+void tbPublish(struct tb_buffer_struct * tb);
+void * tbGetLatest(struct tb_buffer_struct * tb);
+
+#endif
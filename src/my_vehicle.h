@@ -98,6 +98,7 @@ struct wheel_struct2
 	float k_spring;			//spring constant
 	float k_damp;
 	float mass;
+	int groundQuad[3];		//terrain tile, quad row, quad col the wheel's ray was over last tick (tile -1 if none)
 };
 
 struct vehicle_physics_struct2
@@ -24,10 +24,13 @@ See log.txt
 #include <string.h>
 #include <unistd.h>
 #include <math.h>
+#include <float.h>
 #include <time.h>
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
+#define GL_GLEXT_PROTOTYPES
 #include <GL/gl.h>
+#include <GL/glext.h>
 #include <GL/glx.h>
 #include <errno.h>
 
@@ -41,6 +44,99 @@ gravity constant calculated by: g / fps
 */
 #define G_K_GRAVITY 0.1666666f
 
+/*
+vert step of the coarse height grid that paged terrain tiles keep while
+they aren't resident. 99 quads per tile side / 9 = 11 coarse quads. The
+last coarse vert is always on the tile edge.
+*/
+#define TERRAIN_COARSE_STEP 9
+
+/*
+Raycasts skip terrain in blocks of TERRAIN_RAY_BLOCK x TERRAIN_RAY_BLOCK
+quads whose highest vert is below the ray (see RaycastTileSurf).
+*/
+#define TERRAIN_RAY_BLOCK 8
+#define TERRAIN_RAY_MAX_CELLS 128 //max # of blocks or quads a ray crosses in one tile or block
+
+/*
+Terrain map geometry used when neither the command line nor the DEM
+header says otherwise. Tiles are at most 256 verts on a side so every
+vert of a tile can be addressed by the 16-bit element array.
+*/
+#define TERRAIN_DEFAULT_TILE_VERTS 100
+#define TERRAIN_DEFAULT_VERT_SPACING 10.0f
+#define TERRAIN_MIN_TILE_VERTS 2
+#define TERRAIN_MAX_TILE_VERTS 256
+
+/*
+Default for how far (in pixels) a terrain tile's LOD level may move the
+surface on screen before a finer level is drawn.
+*/
+#define TERRAIN_DEFAULT_LOD_PIXEL_ERROR 2.0f
+
+/*
+# of random cameras --count-frustum-tiles checks the culled tiles from,
+on top of the poses in its file
+*/
+#define FRUSTUM_CHECK_RANDOM_POSES 2000
+
+/*
+The water is an opaque plane at y = WATER_LEVEL that covers x,z from
+-WATER_PLANE_HALF_LEN to WATER_PLANE_HALF_LEN. Terrain under it can't
+be seen from above the water.
+*/
+#define WATER_LEVEL 0.0f
+#define WATER_PLANE_HALF_LEN 10000.0f
+
+/*
+Flags of a detailed plant model part (see InitPlantDetailParts)
+*/
+#define PLANT_PART_TWO_SIDED 1	//drawn with back-face culling off, the model only has one side of each leaf
+#define PLANT_PART_TRUNK 2		//drawn with the trunk sampler, which repeats the bark texture
+
+/*
+Moveables that never move are merged into one mesh per moveable_type for
+each square of MOVEABLE_BATCH_REGION_TILES x MOVEABLE_BATCH_REGION_TILES
+moveables grid tiles (see RebuildMoveableBatches)
+*/
+#define MOVEABLE_BATCH_REGION_TILES 8
+
+/*
+Jobs that prepare a frame on g_frame_jobs (see PrepareFrame). The jobs
+of a group run at the same time, and the groups run one after another.
+*/
+#define FRAME_JOB_TERRAIN 0		//group 1: visible terrain tiles, their LOD and terrain occlusion
+#define FRAME_JOB_SKINNING 1	//group 1: pose the characters' verts
+#define FRAME_JOB_PLANTS 2		//group 2: cull plants and build their billboard and instance lists
+#define FRAME_JOB_MOVEABLES 3	//group 2: cull moveables and static batches, build instance matrices
+#define FRAME_JOB_ITEMS 4		//group 2: cull ground items and build their matrices
+#define FRAME_JOB_NUM 5
+#define FRAME_JOB_GROUP2 2		//first job of group 2
+
+/*
+Simulation thread (see SimulationThread). Steps are due every
+SIM_STEP_NS counted from the first one, so a late step is made up by
+running the next ones back to back. Past SIM_MAX_LATE_STEPS behind the
+missed steps are dropped instead.
+*/
+#define SIM_STEP_NS 16000000LL	//~60Hz
+#define SIM_MAX_LATE_STEPS 5
+#define RENDER_SNAPSHOT_MAX_CHARACTERS 32	//same as g_soldier_list.max_soldiers
+
+/*
+Main loop pacing (see main). Frames are due every FRAME_PERIOD_NS but
+only drawn when something changed. The keyboard is looked at when a key
+goes down or up and then every INPUT_PERIOD_NS while any are held.
+*/
+#define FRAME_PERIOD_NS 15000000LL
+#define INPUT_PERIOD_NS 16000000LL
+#define FRAME_HITCH_NS 100000000LL	//frames that start this late are printed
+
+/*
+Render queue passes (see DrawScene), drawn in this order
+*/
+#define RENDER_PASS_OPAQUE 0	//terrain, moveables, plants, items and the vehicle
+
 /*my_mat_math: contains functions for matrices & vectors*/
 #include "my_mat_math_6.h"
 
@@ -65,6 +161,37 @@ gravity constant calculated by: g / fps
 #include "my_mouse_2.h"
 #include "my_gui.h"
 
+/*my_dem.h: contains functions for reading .asc DEM files*/
+#include "my_dem.h"
+
+/*my_heightfield.h: contains functions that work on a whole-map height grid (e.g. normals)*/
+#include "my_heightfield.h"
+
+/*my_terrain_cache.h: contains functions for the binary terrain cache built from the DEM file*/
+#include "my_terrain_cache.h"
+
+/*my_tile_pager.h: contains a worker-thread tile loader with LRU eviction, used to page terrain tiles*/
+#include "my_tile_pager.h"
+
+/*my_terrain_lod.h: contains the geomipmap index lists and LOD level picking for terrain tiles*/
+#include "my_terrain_lod.h"
+
+/*my_tile_quadtree.h: contains a static quadtree over the terrain tile grid, used to cull whole groups of tiles*/
+#include "my_tile_quadtree.h"
+
+/*my_object_cull.h: contains SIMD bounding-sphere culling of plants, moveables and items*/
+#include "my_object_cull.h"
+/*my_horizon.h: contains the horizon that hides things behind nearer terrain*/
+#include "my_horizon.h"
+/*my_render_queue.h: contains the render queue that sorts draws by GL state*/
+#include "my_render_queue.h"
+/*my_job_pool.h: contains the worker threads that prepare each frame*/
+#include "my_job_pool.h"
+/*my_triple_buffer.h: contains the lock-free hand-off of render snapshots from the simulation thread*/
+#include "my_triple_buffer.h"
+/*my_frame_pacer.h: contains the main loop's frame deadlines and the wait for input between them*/
+#include "my_frame_pacer.h"
+
 
 /*OpenGL Definitions*/
 #define GLX_CONTEXT_MAJOR_VERSION_ARB 0x2091
@@ -101,6 +228,7 @@ struct simple_billboard
 	float   size[12]; //height and halfwidth of billboard, vec2 array of 6 elements (width,height) 
 	int     num_verts;
 	GLuint  texture_ids[6]; //this is an array of texture ids, one for each plant
+	GLuint  instance_vbo; //vec3 world position per instance, attribute 2 of vao
 };
 
 /*
@@ -115,6 +243,10 @@ struct simple_model_struct
 	int num_indices;
 	int num_verts;
 	float offset_groundToCg;	//vector from cg to ground
+	float cull_center_y;	//bounding sphere for culling, on the model's y axis
+	float cull_radius;
+	float * p_vertex_data;	//copy of the vbo, 8 floats per vert, kept for static batching. 0 if not kept
+	int * p_elements;		//copy of the ebo
 };
 
 /*
@@ -180,16 +312,60 @@ struct moveable_items_tile_struct
 This structure holds the moveable items grid. It
 consists of a grid of tiles.
 */
+/*
+Static moveables of one moveable_type in one region of the moveables
+grid, merged into a single mesh that is already in world space
+*/
+struct moveable_batch_struct
+{
+	GLuint vbo;
+	GLuint ebo;
+	GLuint vao;
+	int num_indices;
+	int moveable_type;	//the batch is drawn with this type's texture
+	int num_moveables;
+	float box_min[3];	//bounds of the batch's verts
+	float box_max[3];
+};
+
+/*
+A moveable to batch, with the key it sorts by: region*OC_MAX_TYPES + moveable_type
+*/
+struct moveable_batch_item_struct
+{
+	int key;
+	struct moveable_object_struct * pmoveable;
+};
+
 struct moveables_grid_struct
 {
 	int num_tiles;
-	int num_cols;	//1207
-	int num_rows;	//1207
+	int num_cols;	//e.g. 1207, enough to cover the terrain map
+	int num_rows;	//e.g. 1207
 	float tileSize;	//width of tile (tiles are square)
 	struct moveable_items_tile_struct * p_tiles;
 	int local_grid[2116];	//46x46 grid of working moveables, -1 indicates no entry
 	int localGridSize[2]; //0=row, 1=col, 46x46
 	int numLocalTiles; //total # of local grid tiles, 2116
+	struct oc_spheres_struct cull_spheres;	//moveables in the local grid, rebuilt every frame
+	struct oc_visible_struct visible;	//ids into cull_moveables, by moveable_type
+	struct moveable_object_struct ** cull_moveables; //moveable of each sphere in cull_spheres
+	int max_cull_moveables;
+	int num_occlusion_tests; //# of local grid tiles tested against the terrain horizon in the last UpdateVisibleMoveables()
+	int num_occluded_tiles;
+	GLuint instance_vbo;	//model matrices of the visible moveables, see InitMoveableInstancing
+	float * instance_mats;	//the visible moveables' model matrices by moveable_type, 16 floats each
+	int instance_first[OC_MAX_TYPES]; //first matrix of each moveable_type in instance_mats
+	int instance_num[OC_MAX_TYPES];
+	int max_instances;	//# of matrices instance_mats has room for
+	int num_instance_draws;	//# of instanced draws the last frame
+	struct moveable_batch_struct * batches;	//see RebuildMoveableBatches
+	int num_batches;
+	int num_batched_moveables;
+	int batches_dirty;	//1 when moveables were added or removed since the last rebuild
+	struct oc_spheres_struct batch_spheres;	//a sphere around each batch
+	struct oc_visible_struct batch_visible;	//batches that passed the last UpdateVisibleMoveableBatches()
+	int num_batches_occluded;	//# of batches behind nearer terrain in the last UpdateVisibleMoveableBatches()
 };
 
 /*
@@ -226,6 +402,11 @@ struct plant_tile
 	int num_plants;
 	int num_items;
 	float urcorner[2];	//origin corner of tile
+	struct oc_spheres_struct cull_spheres; //one per plant, same order as plants
+	struct oc_visible_struct visible; //indexes into plants that passed the last UpdateVisiblePlants(), by plant type
+	GLuint billboard_vbo; //static billboard instances, the plant positions grouped by type. 0 until the tile is first drawn
+	int billboard_first[6]; //per plant type, first instance in billboard_vbo. there are cull_spheres.type_count[type]
+	int billboard_dirty; //1 if the plants changed since billboard_vbo was filled
 };
 
 /*
@@ -239,8 +420,40 @@ struct plant_grid
 	struct plant_tile * p_tiles;
 	int draw_grid[9]; //this holds tiles around the camera in a 3x3 fashion (This is row major form)
 	float detail_boundaries[4]; //-x,+x,-z,+z boundaries for drawing detailed plants. 
+	float detail_dist; //plants closer than this in x and z are drawn detailed
 	float nodraw_dist[6]; //dist
 	float nodraw_boundaries[24]; //-x,+x,-z,+z boundaries for not-drawing plants. 6 plants * 4 floats
+	float cull_center_y[6]; //per plant type, bounding sphere that holds both the detailed model and the billboard
+	float cull_radius[6];
+	float cull_max_radius; //largest cull_radius, how far past its tile a plant can reach in x,z
+	float cull_max_top; //highest top of any type's sphere above the plant's pos
+	int * cull_tiles; //tiles culled by the last UpdateVisiblePlants(), the draw_grid tiles first
+	int num_cull_tiles;
+	int num_near_cull_tiles; //# of draw_grid tiles at the start of cull_tiles
+	int num_cull_tests; //# of plants tested in the last UpdateVisiblePlants()
+	int num_cull_visible;
+	int num_occlusion_tests; //# of plant tiles tested against the terrain horizon in the last UpdateVisiblePlants()
+	int num_occluded_tiles;
+	struct oc_spheres_struct item_spheres; //items on the draw_grid tiles, rebuilt every frame
+	struct oc_visible_struct visible_items; //ids into cull_items, by item type
+	struct item_struct ** cull_items; //item of each sphere in item_spheres
+	int max_cull_items;
+	float * item_mats; //model to camera matrix of each item in visible_items, in the same order
+	int max_item_mats;
+	float * billboard_pos; //positions of the plants to draw as billboards this frame from tiles that can't use their static buffer, grouped by type (see UpdatePlantDrawLists)
+	int billboard_first[6]; //per plant type, first plant in billboard_pos
+	int billboard_num[6];
+	int num_near_billboards; //# of them on the draw_grid tiles
+	int max_billboards; //allocated length of billboard_pos, in plants
+	int * static_billboards; //tile, plant type pairs drawn whole from the tile's billboard_vbo this frame, in type order
+	int num_static_billboards; //# of pairs
+	struct plant_billboard * detail_parts[6][2]; //per plant type, the meshes of its detailed model (e.g. trunk and branches), 0 if it has one
+	int detail_part_flags[6][2]; //PLANT_PART_* of each mesh
+	float * detail_mats; //model matrices of the plants in the detail box this frame, grouped by type (see UpdatePlantDrawLists)
+	int detail_first[6]; //per plant type, first matrix in detail_mats
+	int detail_num[6];
+	int max_detail_plants; //allocated length of detail_mats, in matrices
+	GLuint detail_vbo; //detail_mats is uploaded here for the instanced draws
 };
 
 /*
@@ -250,11 +463,26 @@ struct lvl_1_tile
 {
 	GLuint vbo;
 	GLuint vao;
-	float * pPos;
+	float * pHeights; //vert heights, row-major: vert (i,j) is pHeights[(i*num_x)+j]. x,z come from the vert's grid position. 0 if the tile is quantized
+	unsigned short * pQHeights; //quantized vert heights, same layout as pHeights: h = height_bias + (q*height_scale). 0 if the tile uses pHeights
+	float height_scale;
+	float height_bias;
+	short * pNormals; //packed vert normals, 2 per vert (see PackTerrainNormal)
+	float * pCoarseHeights; //only when paging: heights of every TERRAIN_COARSE_STEP'th vert, used while the tile isn't resident
+	int vbo_loaded; //1 if vbo holds the tile's vertex data
 	float urcorner[2]; //origin corner position of the tile
-	int num_verts;	//10,000 verts
-	int num_z; //number of verts in the z direction, 100 verts
-	int num_x; //number of verts in the x direction, 100 verts
+	int num_verts;	//num_x*num_z, e.g. 10,000 verts
+	int num_z; //number of verts in the z direction, e.g. 100 verts
+	int num_x; //number of verts in the x direction, e.g. 100 verts
+	float min_height; //lowest vert height in the tile
+	float max_height; //highest vert height in the tile
+	float mean_height; //average vert height in the tile
+	float lod_error[TL_NUM_LEVELS]; //how far (in height) each LOD level is off from the full res heights
+	int lod_level; //LOD level picked for this frame
+	int lod_mask; //TL_EDGE_* sides that border a coarser tile this frame
+	float * pBlockMaxHeights; //highest vert of each TERRAIN_RAY_BLOCK quad block, row-major. kept while paged out, 0 if not calculated
+	float * pBlockMinHeights; //lowest vert of each block, same layout. the occluders for UpdateTerrainOcclusion()
+	int occluded; //1 if UpdateTerrainOcclusion() found the tile hidden behind nearer terrain this frame
 };
 
 /*
@@ -262,41 +490,227 @@ This structure holds lvl_1_tile's
 */
 struct lvl_1_terrain_struct
 {
-	int num_tiles;		//1521
-	int num_cols;		//39
-	int num_rows;		//39
-	int tile_num_quads[2]; //length of tile in quads, 0=x axis(col), 1=z axis(rows). 99,99. (need this because there is +1 more vertex than quads and num_z, num_x hold # of vertices but sometimes I need # of quads)
-	float tile_len[2]; //length of a tile (0 = len in x, 1 = len in z). (990.0, 990.0)
+	int num_tiles;		//num_rows*num_cols, e.g. 1521
+	int num_cols;		//e.g. 39
+	int num_rows;		//e.g. 39
+	int tile_num_quads[2]; //length of tile in quads, 0=x axis(col), 1=z axis(rows). e.g. 99,99. (need this because there is +1 more vertex than quads and num_z, num_x hold # of vertices but sometimes I need # of quads)
+	float tile_len[2]; //length of a tile (0 = len in x, 1 = len in z). e.g. (990.0, 990.0)
+	float vert_spacing; //distance between neighbouring verts in x and z (1.0 => 1 meter), e.g. 10.0
 	struct lvl_1_tile * pTiles; //tiles in row-major
-	int num_floats_per_vert;
-	GLshort * pElements; //element array
+	int num_floats_per_vert; //# of floats per vert in the tile VBOs {pos[3]; normal[3]; texcoord[2]}
+	struct tl_elements_struct lod; //element arrays of every LOD level and edge mask, all in ebo
 	GLuint ebo; //element buffer object
-	int num_indices;
+	char * lod_levels; //per tile LOD level, scratch space for UpdateTerrainLod()
+	float lod_pixel_error; //max screen-space error of a tile's LOD level in pixels
 	int colorTexUnit;
 	GLuint colorTextureUnif;
 	GLuint textureId;
 	GLuint sampler;	
 	float nodraw_boundaries[4]; //boundaries within a tile is draw, -x,+x,-z,+z boundaries
 	float nodrawDist;
+	float height_max_error; //if > 0 tile heights are stored as 16-bit values when they fit within this error (1.0 => 1 meter)
 };
 
-struct DEM_info_struct
+/*
+Terrain map geometry asked for on the command line. 0 means take the
+value from the DEM header (map size, vert spacing) or the default.
+*/
+struct terrain_config_struct
 {
-	FILE * pFile;
-	int num_col;
-	int num_row;
-	int num_total;
-	float x_llcenter;
-	float y_llcenter;
-	float cellsize;
-	float nodata_value;
-	long data_start_pos; //file position indicator of where the data starts
+	int tile_verts;		//verts along a tile side
+	int num_cols;		//tiles in x
+	int num_rows;		//tiles in z
+	float vert_spacing;	//distance between verts (1.0 => 1 meter)
+};
+
+/*
+per-tile height statistics gathered while filling the tiles. Each
+parser thread has its own array so no locking is needed.
+*/
+struct terrain_tile_stats_struct
+{
+	float min;
+	float max;
+	double sum;
+	int count;
+};
+
+/*
+state shared by the InitTerrainDEMRowFunc() callback
+*/
+struct terrain_dem_fill_struct
+{
+	int * row_len;		//# of columns filled from the DEM for each map vertex row
+	struct terrain_tile_stats_struct * tile_stats[DEM_MAX_THREADS]; //num_tiles per thread
+	float dem_min[DEM_MAX_THREADS];	//min/max over every value in the DEM file, per thread
+	float dem_max[DEM_MAX_THREADS];
+	int num_threads;
+};
+
+/*
+Data of one terrain tile loaded by the tile pager's worker thread. It is
+moved into the lvl_1_tile on the main thread.
+*/
+struct terrain_page_struct
+{
+	float * pHeights;
+	unsigned short * pQHeights;
+	float height_scale;
+	float height_bias;
+	short * pNormals;
+};
+
+/*
+State of the terrain tile pager (--page-terrain). Only tiles within
+radius of the camera are sure to keep their heights and normals; other
+tiles stay resident until the byte budget runs out. Tiles that aren't
+resident answer height queries from their coarse grid.
+*/
+struct terrain_pager_struct
+{
+	int active;			//1 if tiles are paged
+	int streaming;		//0 during startup: a query on a non-resident tile loads it right away. 1 from before the simulation thread starts: the coarse grid is used instead
+	float radius;		//0 = paging off
+	long long budget_bytes;
+	struct tile_pager_struct pager;
+	struct tcache_struct cache;	//tiles are paged in from the terrain cache
+	char * keep;		//per tile, 1 if it must stay resident (in radius or edited)
+	char * dirty;		//per tile, 1 if edited. Edited tiles can't be reloaded from the cache so they are never evicted
+	int * order;		//scratch, tiles to request sorted by distance
+	float * dist;		//scratch, distance to the camera per tile
+	int busy;			//1 while tiles in radius are still loading or waiting for their VBO, see UpdateTerrainPager()
+};
+
+/*
+What the simulation thread publishes after each step for the main
+thread to draw (see PublishRenderSnapshot). Everything the simulation
+moves that drawing needs is copied in, so drawing never reads the live
+characters, vehicle or camera.
+*/
+struct render_snapshot_struct
+{
+	unsigned int step;			//g_simulation_step when it was taken
+	unsigned int input_serial;	//g_view_input.serial when it was taken
+	float camera_pos[3];		//this is really the negative camera position, like g_camera_pos
+	float ws_camera_pos[3];
+	float mRotateCameraMatrix[16];
+	float player_pos[3];		//g_a_man, for the map
+	float mVehicleMatrix[16];	//g_b_vehicle local to world
+	float mWheelMatrices[4][16];	//each wheel's local to world
+	int num_characters;
+	struct character_struct characters[RENDER_SNAPSHOT_MAX_CHARACTERS];	//copies of the soldiers to draw
+};
+
+/*
+The camera rotation as input on the main thread last left it. A snapshot
+only gets the rotation when the simulation thread next publishes, so
+DrawScene() turns the camera with this copy until a snapshot has caught
+up with the input, and mouse-look shows on the next frame.
+*/
+struct view_input_struct
+{
+	unsigned int serial;	//bumped after each input, under g_world_lock
+	float rotX;				//g_camera_rotX and g_camera_rotY after the input
+	float rotY;
+	int vehicle_camera;		//1 if the camera is the vehicle camera, which only the simulation can turn
+};
+
+struct sim_thread_struct
+{
+	pthread_t thread;
+	int started;
+	int quit;			//set under g_world_lock to stop the thread
+	int wake;			//set under g_world_lock to have a paused thread publish, see WakeSimulationThread()
+	pthread_cond_t wake_cond;	//a paused thread waits on this with g_world_lock
+	int num_steps;		//# of times the thread stepped (or was woken to publish while paused)
+	int num_unchanged;	//# of times it was paused and had nothing new to publish
+	int num_dropped;	//steps dropped after falling more than SIM_MAX_LATE_STEPS behind
+	long long last_ns;	//when the last step started
+	double min_period_ms;	//shortest and longest time between steps since the 'o' key last printed them
+	double max_period_ms;
+	struct render_snapshot_struct last;	//the last snapshot published
+};
+
+/*
+GL calls the render queue would have made, recorded instead of made
+while g_gl_record is set (see SubmitRenderQueue). Headless checks like
+--count-billboard-draws use it, since they have no GL context.
+*/
+struct gl_record_draw_struct
+{
+	unsigned int program;
+	unsigned int texture;
+	unsigned int vao;
+	int count;			//# of verts or indices
+	int num_instances;	//0 if the draw isn't instanced
+};
+
+struct gl_record_struct
+{
+	struct gl_record_draw_struct * draws;	//the draw calls, in the order they were made
+	int num_draws;
+	int max_draws;			//length of draws, the draws past it are only counted
+	int num_state_changes;	//program, texture, sampler, vao and face culling changes
+	int num_uploads;		//buffer uploads skipped on the way
+};
+
+/*
+What the frame jobs need and how long they took (see PrepareFrame)
+*/
+struct frame_prep_struct
+{
+	int local_tile;		//terrain tile the camera is over
+	float mCameraMatrix[16];
+	float ws_camera_pos[3];
+	struct render_snapshot_struct * snapshot;	//being drawn
+	struct jp_job_struct jobs[FRAME_JOB_NUM];
+	double group_ms[2];	//wall time of each group of jobs
+	double total_ms;	//wall time of all of PrepareFrame
+};
+
+/*
+Terrain occlusion for this frame (see UpdateTerrainOcclusion). The
+horizon is built from the nearer terrain tiles, and tiles, plant tiles
+and moveables that are wholly under it aren't drawn.
+*/
+struct terrain_occlusion_struct
+{
+	struct horizon_struct horizon;
+	int enabled;			//0 when the camera is under the terrain, then nothing is occluded
+	int num_occluder_tiles;	//# of tiles that added blocks to the horizon
+	int num_tested;			//# of terrain tiles tested
+	int num_occluded;		//# of terrain tiles hidden
+};
+
+/*
+per-thread error totals for ValidateTerrainHeights()
+*/
+struct terrain_height_check_struct
+{
+	float max_err[DEM_MAX_THREADS];
+	int max_err_row[DEM_MAX_THREADS];	//map vertex row/col of max_err
+	int max_err_col[DEM_MAX_THREADS];
+	double sum_err[DEM_MAX_THREADS];
+	long long count[DEM_MAX_THREADS];
+};
+
+/*
+One ray for RaycastTileSurfBatch(). The caller fills pos, ray and
+quad_hint, the batch fills the rest.
+*/
+struct terrain_ray_struct
+{
+	float pos[3];		//start of the ray
+	float ray[3];		//ray goes from pos to pos+ray
+	int * quad_hint;	//tile, quad row, quad col the ray was in last time (tile -1 if none). kept by the caller between calls, or 0
+	float surf_pos[3];	//[out] first intersection with the terrain
+	float surf_norm[3];	//[out] terrain normal there
+	int result;			//[out] what RaycastTileSurf() would return
 };
 
 struct camera_frustum_struct
 {
-	float left_normal[3];
-	float right_normal[3];
+	float planes[6][4];	//left, right, bottom, top, near, far. (a,b,c,d): a*x + b*y + c*z + d >= 0 is inside, (a,b,c) is unit length
 	float camera[3];	//position of camera
 	float fzNear;
 	float fzFar;
@@ -340,6 +754,22 @@ struct debug_stats_struct
 GLenum e;
 void (*g_DrawFunc)(void);
 struct lvl_1_terrain_struct g_big_terrain;
+struct terrain_pager_struct g_terrain_pager;
+struct terrain_config_struct g_terrain_config;
+struct tile_quadtree_struct g_terrain_quadtree; //quadtree over g_big_terrain's tiles, visible holds the tiles to draw this frame
+struct terrain_occlusion_struct g_terrain_occlusion;
+struct rq_queue_struct g_render_queue; //draws of the current frame, see DrawScene
+struct gl_record_struct * g_gl_record; //when set, the render queue and plant instance uploads record their GL calls in it instead of making them
+struct jp_pool_struct g_frame_jobs; //worker threads for PrepareFrame
+struct frame_prep_struct g_frame_prep;
+pthread_mutex_t g_world_lock = PTHREAD_MUTEX_INITIALIZER; //held by the simulation thread for a step, and by the main thread to handle input or swap paged terrain tiles
+struct sim_thread_struct g_sim_thread;
+struct tb_buffer_struct g_render_snapshots; //simulation thread to main thread
+struct render_snapshot_struct * g_draw_snapshot; //main thread only, the snapshot g_DrawFunc draws
+struct view_input_struct g_view_input; //written by the main thread with g_world_lock held
+struct fp_pacer_struct g_frame_pacer; //main thread only
+int g_keys_down; //1 if any key was down the last time HandleKeyboardInput() looked
+int g_redraw; //main thread only, 1 to draw the next frame that is due even if there is no new snapshot
 struct camera_frustum_struct g_camera_frustum;
 struct plant_billboard g_bush_billboard;
 struct simple_billboard g_bush_smallbillboard;
@@ -363,6 +793,7 @@ struct bush_group g_bush_group;
 struct plant_grid g_bush_grid;
 struct moveables_grid_struct g_moveables_grid;
 struct bush_shader_struct g_bush_shader;
+struct bush_shader_struct g_bush_instanced_shader; //g_bush_shader with a model matrix per instance, for the detailed plants
 struct simple_billboard_shader_struct g_billboard_shader;
 struct simple_wave_shader_struct g_simple_wave_shader;
 struct simple_wave_vbo_struct g_simple_wave;
@@ -423,9 +854,12 @@ GLuint g_bush_trunktex_sampler;		//sampler for bush trunk billboard textures
 unsigned int g_screen_width;
 unsigned int g_screen_height;
 unsigned int g_simulation_step;
-unsigned int g_debug_num_simple_billboard_draws; //count of draw calls for wholely simple tiles
-unsigned int g_debug_num_detail_billboard_draws; //count of billboard drawcalls in detail tiles
+unsigned int g_debug_num_billboard_draws; //count of instanced draw calls for plant billboards
+unsigned int g_debug_num_billboard_plants; //count of plants drawn as billboards
 unsigned int g_debug_num_himodel_plant_draws; //count of draw calls for detailed plant models
+unsigned int g_debug_num_terrain_triangles; //terrain triangles drawn this frame
+unsigned int g_debug_num_terrain_full_triangles; //terrain triangles the same tiles would have at full res
+unsigned int g_debug_num_ray_quad_tests; //count of terrain quads tested by raycasts
 int g_render_mode; //0=draw scene, 1=draw inventory
 int g_debug_freeze_culling;
 int g_debug_keyframe;
@@ -439,23 +873,111 @@ static void SetOrthoMat(float * ortho_mat, unsigned int width, unsigned int heig
 void SetMapOrthoMat(float * orthoMat, float fsize);
 int InitCamera(struct camera_info_struct * p_camera);
 void DrawScene(void);
-int DEMLoadInfo(struct DEM_info_struct * pDemInfo);
-int DEMGetMinMaxElevation(struct DEM_info_struct * pDemInfo, float * pMin, float * pMax);
-int InitTerrain(void);
-int MakeTerrainElementArray(GLshort ** ppElements, int * num_indices, int num_x, int num_z);
+void PrepareFrame(int local_tile, float * mCameraMatrix, struct render_snapshot_struct * snap);
+int PublishRenderSnapshot(int only_if_changed);
+void CopyViewInput(void);
+void WakeSimulationThread(void);
+void * SimulationThread(void * arg);
+int StartSimulationThread(void);
+void StopSimulationThread(void);
+void FrameJobTerrain(void * user);
+void FrameJobSkinning(void * user);
+void FrameJobPlants(void * user);
+void FrameJobMoveables(void * user);
+void FrameJobItems(void * user);
+int UpdateItemDrawList(struct plant_grid * p_grid, float * mCameraMatrix);
+void QueueTerrainTiles(struct rq_queue_struct * queue, float * mCameraMatrix);
+void QueueMoveables(struct rq_queue_struct * queue, float * mCameraMatrix);
+void QueueMoveableBatches(struct rq_queue_struct * queue, float * mCameraMatrix);
+void QueuePlants(struct rq_queue_struct * queue, float * mCameraMatrix);
+void QueuePlantBillboard(struct rq_packet_struct * packet, int iplant_type, float * mCameraMatrix);
+void QueueItems(struct rq_queue_struct * queue, float * mCameraMatrix);
+void QueueVehicle(struct rq_queue_struct * queue, float * mCameraMatrix, struct render_snapshot_struct * snap);
+void SubmitRenderQueue(struct rq_queue_struct * queue);
+void RecordRenderQueue(struct rq_queue_struct * queue, struct gl_record_struct * record);
+float GetCameraDist(float * pos);
+int InitTerrain(char * dem_filename);
+int InitTerrainGeometry(char * filename);
+int InitTerrainLoadDEM(char * filename, float * pMin, float * pMax);
+void InitTerrainDEMRowFunc(void * user, int thread_i, int row, float * values, int num_values);
+void InitTerrainSetVertRow(int map_row, int first_col, int last_col, float * values, float pad_height, struct terrain_tile_stats_struct * stats);
+void InitTerrainAddTileStat(struct terrain_tile_stats_struct * stat, float h);
+void CalcTileHeightStats(struct lvl_1_tile * ptile);
+int InitTerrainCalcNormals(void);
+void InitTerrainNormalRowFunc(void * user, int row, float * nx, float * ny, float * nz, int num_x);
+int GetMapVertTiles(int map_i, int num_quads, int num_tiles, int * tiles, int * verts);
+int InitTerrainAllocTileData(void);
+int InitTerrainCheckCache(struct tcache_struct * cache);
+int InitTerrainLoadCache(struct tcache_struct * cache);
+int InitTerrainSaveCache(char * cache_filename, unsigned long long dem_checksum, long long dem_size, float min, float max);
+void CalcTileLodErrors(struct lvl_1_tile * ptile);
+void CalcTileBlockHeights(struct lvl_1_tile * ptile);
+float GetTileCameraDist(struct lvl_1_tile * ptile, float * camera_pos);
+void UpdateTerrainLod(float * camera_pos, int * tiles, int num_tiles);
+int CheckTerrainLod(char * dem_filename);
+int BenchRaycastTerrain(int num_rays, char * dem_filename);
+int BenchWheelRays(int num_vehicles, char * dem_filename);
 void MakeTerrainCalcNormal(float * normal, float * origin_pos, float * u, float * v);
+float GetTileVertHeight(struct lvl_1_tile * ptile, int vert_i);
+void SetTileVertHeight(struct lvl_1_tile * ptile, int vert_i, float h);
+void GetTileVertPos(struct lvl_1_tile * ptile, int vert_i, float * pos);
+void GetTileVertNormal(struct lvl_1_tile * ptile, int vert_i, float * normal);
+void GetTileQuadCorners(struct lvl_1_tile * ptile, int quad_row, int quad_col, float * quad_origin, float * quad_pos_x, float * quad_pos_z, float * quad_opposite);
+int QuantizeTileHeights(struct lvl_1_tile * ptile);
+int DequantizeTileHeights(struct lvl_1_tile * ptile);
+int InitTerrainQuantizeHeights(void);
+int ValidateTerrainHeights(char * dem_filename, float max_error);
+void ValidateTerrainHeightsRowFunc(void * user, int thread_i, int row, float * values, int num_values);
+int IsTileResident(struct lvl_1_tile * ptile);
+long long GetTileDataBytes(struct lvl_1_tile * ptile);
+int GetTileCoarseSize(struct lvl_1_tile * ptile);
+float GetTileCoarseHeight(struct lvl_1_tile * ptile, int vert_i);
+int InitTerrainPager(struct tcache_struct * cache);
+void InitTerrainPagerCoarseGrid(struct lvl_1_tile * ptile, int coarse_n);
+void TerrainPagerShutdown(void);
+void * TerrainPagerLoadFunc(void * user, int tile_i, long long * pbytes);
+void TerrainPagerFreeFunc(void * user, void * data);
+void TerrainPagerInstallTile(int tile_i, struct terrain_page_struct * page);
+int TerrainPagerLoadTileNow(int tile_i);
+int TerrainPagerFaultTile(struct lvl_1_tile * ptile);
+void TerrainPagerEvictTile(int tile_i);
+void TerrainPagerEvictOverBudget(int except_tile);
+void TerrainPagerUpdateKeep(float * camera_pos);
+static int TerrainPagerCompareDist(const void * a, const void * b);
+void UpdateTerrainPager(float * camera_pos);
+void PackTerrainNormal(float nx, float nz, short * packed);
+void UnpackTerrainNormal(short * packed, float * normal);
+void BuildTileVertexData(struct lvl_1_tile * ptile, float * out);
+static inline void BuildTileVertexDataSized(struct lvl_1_tile * ptile, float * out, const int num_x, const int num_z);
+int UpdateTileVBO(struct lvl_1_tile * ptile);
 int GetLvl1Tile(float * pos);
 int GetLvl1Tileij(float * pos, int * i, int * j);
 int GetTileRowColFromIndex(struct lvl_1_tile * ptile, int * pi, int * pj);
 int GetTileSurfPoint(float * pos, float * surf_pos, float * surf_norm);
+int GetTileSurfPointBatch(const float * xz, int n, float * y_out, float * n_out);
+int RaycastTileSurfBatch(struct terrain_ray_struct * rays, int num_rays);
 int RaycastTileSurf(float * pos, float * ray, float * surf_pos, float * surf_norm);
 static int RaycastQuadTileSurf(float * pos, float * ray, struct lvl_1_tile * ptile, int quad_row, int quad_col, float * surf_pos, float * surf_norm);
 static struct lvl_1_tile* GetNewTileQuad(float * pos, float * ray, struct lvl_1_tile * ptile, int * pi, int * pj);
-void ClipTilesSetupFrustum(void);
+static int RaycastTileSurfByQuad(float * pos, float * ray, float * surf_pos, float * surf_norm);
+void ClipTilesSetupFrustum(float * mCamera, float * ws_camera_pos);
+static int CountTilesInLeftRightFrustum(int local_tile);
+static void SetupPoseCamera(float * pose, float * mCamera);
+static int CullTilesFromPose(float * pose, char * in_view, float * mCamera);
+int CountBillboardDraws(char * pose_filename, char * dem_filename);
+int CountFrustumTiles(char * pose_filename, char * dem_filename);
+int CountOccludedTiles(char * pose_filename, char * dem_filename);
+int BenchObjectCull(int num_objects, char * dem_filename);
 int IsTileInCameraFrustum(struct lvl_1_terrain_struct * pTerrain, struct lvl_1_tile * pTile);
+int ClassifyBoxInCameraFrustum(float * box_min, float * box_max);
+int ClassifyTerrainQuadtreeNode(void * user, struct qt_node_struct * node);
+void UpdateVisibleTerrainTiles(int local_tile);
+void UpdateTerrainOcclusion(float * camera_pos, int need_vbo);
+void AddTileOccluders(struct horizon_struct * hz, struct lvl_1_tile * ptile);
+int IsTerrainBoxOccluded(float * box_min, float * box_max);
 void UpdateTerrainDrawBox(float * camera_pos);
 int IsTileInTerrainDrawBox(struct lvl_1_tile * tile);
-int IsTileInPlantViewBox(struct lvl_1_tile * p_tile);
+int IsTileInPlantViewBox(struct lvl_1_tile * p_tile, float * camera_pos);
 void GetElapsedTime(struct timespec * start, struct timespec * end, struct timespec * result);
 void SimulationStep(void);
 void DebugUpdateDrawCallStats(struct timespec * diff, struct timespec * drawStart, struct timespec * drawEnd);
@@ -470,6 +992,9 @@ void UpdateCameraForThirdPerson(struct character_struct * p_character, float * i
 void UpdateCharacterCameraForVehicle(struct character_struct * p_character, float * matCamera4);
 void UpdateCharacterAnimation(struct character_struct * p_character);
 void UpdateCharacterBoneModel(struct character_struct * guy);
+void SkinCharacterVerts(struct character_struct * guy, float * out_verts);
+int SkinCharacterModel(struct character_struct * guy);
+int InitCharacterSkin(struct character_struct * guy);
 int CharacterStartAnim(struct character_animation_struct * characterAnim, int animToStart, int timeToNextKeyframe);
 int CharacterDetermineStandAnim(struct character_struct * p_character, struct character_anim_flags_struct newAnimStateFlags);
 int CharacterDetermineUprightMoveAnim(struct character_struct * p_character, struct character_anim_flags_struct newAnimStateFlags);
@@ -523,8 +1048,9 @@ void VehicleConvertDisplacementMat3To4(float * mat3, float * mat4);
 void FillInMat4withMat3(float * mat3, float * mat4);
 /*new vehicle functions*/
 int InitSomeVehicle2(struct vehicle_physics_struct2 * p_vehicle);
-void UpdateVehicleSimulation2(struct vehicle_physics_struct2 * p_vehicle);
-void CalculateWheelSpringForce2(struct wheel_struct2 * pwheel, struct vehicle_physics_struct2 * pvehicle, float * forceOut, float * torqueOut);
+int UpdateVehicleWheelRays2(struct vehicle_physics_struct2 * vehicles, int num_vehicles, struct terrain_ray_struct * wheelRays);
+void UpdateVehicleSimulation2(struct vehicle_physics_struct2 * p_vehicle, struct terrain_ray_struct * wheelRays);
+void CalculateWheelSpringForce2(struct wheel_struct2 * pwheel, struct vehicle_physics_struct2 * pvehicle, struct terrain_ray_struct * wheelRay, float * forceOut, float * torqueOut);
 static void UpdateVehicleFromKeyboard2(char * keys_return, float * camera_rotX, float * camera_rotY, float * camera_ipos, struct vehicle_physics_struct2 * p_vehicle);
 void CalculateSteeringForce(struct vehicle_physics_struct2 * pvehicle, float * torqueOut, float * forceOut);
 void UpdateCameraPosAtVehicle2(float follow_dist, struct vehicle_physics_struct2 * p_vehicle, float * camera_pos, float * icamera_pos, float * camera_rotY);
@@ -537,15 +1063,22 @@ int InitBushGroup(struct bush_group * p_group);
 int LoadBushVBO(struct plant_billboard * p_billboard, char * mesh_filename, char * mesh_name, char * tex_filename, float fscale_factor, char flags);
 int LoadSimpleBillboardVBO(struct simple_billboard * p_billboard);
 int LoadSimpleBillboardTextures(struct simple_billboard * billboard);
+void InitSimpleBillboardSizes(struct simple_billboard * billboard);
 int MakeDetailedBushTile(struct plant_billboard * p_tile, struct plant_billboard * single_bush, float * v3_origin, int dot_tga_file_index);
 int MakeSimpleBushTile(struct simple_billboard * p_tile, struct simple_billboard * single_bush, float * v3_origin, int dot_tga_file_index);
-int InitBushShaders(struct bush_shader_struct * p_shader);
+int InitBushShaders(struct bush_shader_struct * p_shader, char * vert_filename);
 int InitBillboardShaders(struct simple_billboard_shader_struct * p_shader);
 int InitDotsTga(struct dots_struct * p_dots_info);
 //int InitPlantGrid(struct plant_grid * p_grid, struct dots_struct * p_dots_info, int dots_index, float plant_cluster_scale);
 int InitPlantGrid2(struct plant_grid * p_grid);
 int WritePlantGridToFile(struct plant_grid * p_grid, char * filename);
 void UpdatePlantDrawGrid(struct plant_grid * p_grid, int cam_tile, float * camera_pos);
+void InitPlantDetailParts(struct plant_grid * p_grid);
+void InitPlantCullBounds(struct plant_grid * p_grid);
+int UpdatePlantTileCullSpheres(struct plant_grid * p_grid, struct plant_tile * p_tile);
+void UpdateVisiblePlants(struct plant_grid * p_grid, float * camera_pos);
+int UpdatePlantDrawLists(struct plant_grid * p_grid);
+int UpdatePlantTileBillboardVbo(struct plant_tile * p_tile);
 int GenRandomPlantType(float * pos, char * plant_type);
 
 /*Base functions*/
@@ -562,9 +1095,21 @@ int CreateWarehouse(float * pos);
 int InitItemCommon(struct item_common_struct * p_common, char * obj_filename, char * objname, char * texture_filename);
 struct item_struct * CreateItem(float * initialPos, unsigned char newType);
 float GetItemGroundOffset(unsigned char itemType);
+struct item_common_struct * GetItemCommon(unsigned char itemType);
+void UpdateVisibleItems(struct plant_grid * p_grid, float * camera_pos);
 int InitRifleCommon(struct item_common_struct * p_item);
 int InitMoveablesGrid(struct moveables_grid_struct * p_grid);
+void InitMoveableInstancing(struct moveables_grid_struct * p_grid);
+int UpdateMoveableInstances(struct moveables_grid_struct * p_grid);
+int IsMoveableStatic(struct moveable_object_struct * pmoveable);
+int RebuildMoveableBatches(struct moveables_grid_struct * p_grid);
+static int MoveableBatchCompareKeys(const void * a, const void * b);
+int BuildMoveableBatch(struct moveable_batch_struct * p_batch, struct moveable_batch_item_struct * items, int num_items);
+void FreeMoveableBatches(struct moveables_grid_struct * p_grid);
+void UpdateVisibleMoveableBatches(struct moveables_grid_struct * p_grid, float * camera_pos);
 void UpdateMoveablesLocalGrid(struct moveables_grid_struct * p_grid, float * pos);
+struct simple_model_struct * GetMoveableModelCommon(int moveable_type);
+void UpdateVisibleMoveables(struct moveables_grid_struct * p_grid, float * camera_pos);
 int GetMoveablesTileIndex(float * pos);
 struct moveable_object_struct * AddMoveableToTile(float * moveablePos);
 int InitCrateCommon(struct crate_common_physics_struct * p_common);
@@ -642,6 +1187,7 @@ int main(int argc, char ** argv)
 	int glx_minor;
 	int fbcount;
 	int running=1;
+	int i;
 	unsigned int width = 1024;
 	unsigned int height = 768;
 	GLXFBConfig * fbc;
@@ -656,13 +1202,19 @@ int main(int argc, char ** argv)
 	GLXContext ctx = 0;
 	int context_attribs[] = {GLX_CONTEXT_MAJOR_VERSION_ARB, 3, GLX_CONTEXT_MINOR_VERSION_ARB, 3, None};
 	struct timespec last_drawcall;
-	struct timespec last_simulatecall;
 	struct timespec curr_time;
 	struct timespec tdrawSceneStart;
 	struct timespec tdrawSceneEnd;
-	const struct timespec diff_simulate = {0, 16000000}; //~60Hz, 16,000,000
-	const struct timespec diff_drawcall = {0, 15000000};
 	struct timespec diff;
+	long long now_ns;
+	long long next_input_ns;
+	long long late_ns;
+	int poll_input;
+	int key_event;
+	int mouse_bit;
+	int x_bit;
+	int ready;
+	int num_picked;
 
 	//initialize global variables
 	g_DrawFunc = DrawScene;
@@ -700,8 +1252,92 @@ int main(int argc, char ** argv)
 	g_anim_interp = 0.0f;
 	g_keyboard_state.state = KEYBOARD_MODE_CAMERA;
 	g_pause_simulation_step = 1;	//start the simulation paused
+	g_big_terrain.lod_pixel_error = TERRAIN_DEFAULT_LOD_PIXEL_ERROR;
 	
 	srand(0x53F8E6A2);
+	
+	//command line options (see README.md). The tools run here, before any window is opened.
+	for(i = 1; i < argc; i++)
+	{
+		if(strcmp(argv[i], "--quantize-heights") == 0 && (i+1) < argc)
+		{
+			g_big_terrain.height_max_error = strtof(argv[i+1], 0);
+			i += 1;
+		}
+		else if(strcmp(argv[i], "--tile-verts") == 0 && (i+1) < argc)
+		{
+			g_terrain_config.tile_verts = atoi(argv[i+1]);
+			i += 1;
+		}
+		else if(strcmp(argv[i], "--map-tiles") == 0 && (i+2) < argc)
+		{
+			g_terrain_config.num_cols = atoi(argv[i+1]);
+			g_terrain_config.num_rows = atoi(argv[i+2]);
+			i += 2;
+		}
+		else if(strcmp(argv[i], "--vert-spacing") == 0 && (i+1) < argc)
+		{
+			g_terrain_config.vert_spacing = strtof(argv[i+1], 0);
+			i += 1;
+		}
+		else if(strcmp(argv[i], "--page-terrain") == 0 && (i+2) < argc)
+		{
+			g_terrain_pager.radius = strtof(argv[i+1], 0);
+			g_terrain_pager.budget_bytes = strtoll(argv[i+2], 0, 10)*1024*1024;
+			i += 2;
+		}
+		else if(strcmp(argv[i], "--lod-pixel-error") == 0 && (i+1) < argc)
+		{
+			g_big_terrain.lod_pixel_error = strtof(argv[i+1], 0);
+			i += 1;
+		}
+		else if(strcmp(argv[i], "--validate-heights") == 0 && (i+1) < argc)
+		{
+			r = ValidateTerrainHeights((((i+2) < argc) ? argv[i+2] : 0), strtof(argv[i+1], 0));
+			return (r == 1) ? 0 : 1;
+		}
+		else if(strcmp(argv[i], "--check-terrain-lod") == 0)
+		{
+			r = CheckTerrainLod((((i+1) < argc) ? argv[i+1] : 0));
+			return (r == 1) ? 0 : 1;
+		}
+		else if(strcmp(argv[i], "--bench-raycast") == 0 && (i+1) < argc)
+		{
+			r = BenchRaycastTerrain(atoi(argv[i+1]), (((i+2) < argc) ? argv[i+2] : 0));
+			return (r == 1) ? 0 : 1;
+		}
+		else if(strcmp(argv[i], "--bench-wheel-rays") == 0 && (i+1) < argc)
+		{
+			r = BenchWheelRays(atoi(argv[i+1]), (((i+2) < argc) ? argv[i+2] : 0));
+			return (r == 1) ? 0 : 1;
+		}
+		else if(strcmp(argv[i], "--count-frustum-tiles") == 0 && (i+1) < argc)
+		{
+			r = CountFrustumTiles(argv[i+1], (((i+2) < argc) ? argv[i+2] : 0));
+			return (r == 1) ? 0 : 1;
+		}
+		else if(strcmp(argv[i], "--bench-object-cull") == 0 && (i+1) < argc)
+		{
+			r = BenchObjectCull(atoi(argv[i+1]), (((i+2) < argc) ? argv[i+2] : 0));
+			return (r == 1) ? 0 : 1;
+		}
+		else if(strcmp(argv[i], "--count-occluded-tiles") == 0 && (i+1) < argc)
+		{
+			r = CountOccludedTiles(argv[i+1], (((i+2) < argc) ? argv[i+2] : 0));
+			return (r == 1) ? 0 : 1;
+		}
+		else if(strcmp(argv[i], "--count-billboard-draws") == 0 && (i+1) < argc)
+		{
+			r = CountBillboardDraws(argv[i+1], (((i+2) < argc) ? argv[i+2] : 0));
+			return (r == 1) ? 0 : 1;
+		}
+		else
+		{
+			printf("main: unknown option %s\n", argv[i]);
+			printf("usage: %s [--tile-verts n] [--map-tiles cols rows] [--vert-spacing dist] [--quantize-heights max_error] [--page-terrain radius budget_mb] [--lod-pixel-error pixels] [--validate-heights max_error [dem_file]] [--check-terrain-lod [dem_file]] [--bench-raycast num_rays [dem_file]] [--bench-wheel-rays num_vehicles [dem_file]] [--count-frustum-tiles pose_file [dem_file]] [--bench-object-cull num_objects [dem_file]] [--count-occluded-tiles pose_file [dem_file]] [--count-billboard-draws pose_file [dem_file]]\n", argv[0]);
+			return 1;
+		}
+	}
 		
 	//setup the mouse handling
 	r = in_InitMouseInput();
@@ -765,7 +1401,7 @@ int main(int argc, char ** argv)
 	swa.background_pixmap = 0;
 	swa.border_pixel = 0;
 	//swa.event_mask = ExposureMask | KeyPressMask | StructureNotifyMask;
-	swa.event_mask = ExposureMask | StructureNotifyMask;
+	swa.event_mask = ExposureMask | KeyPressMask | KeyReleaseMask | StructureNotifyMask; //key events only wake the main loop, see HandleKeyboardInput()
 	
 	//Create the window
 	win = XCreateWindow(display,
@@ -814,7 +1450,7 @@ int main(int argc, char ** argv)
 	printf("GL_SHADING_LANGUAGE_VERSION: %s\n", glGetString(GL_SHADING_LANGUAGE_VERSION));
 	
 	//Load elevation data and build terrain map
-	r = InitTerrain();
+	r = InitTerrain(0);
 	if(r == 0)
 	{
 		printf("main: InitTerrain() failed.\n");
@@ -822,6 +1458,15 @@ int main(int argc, char ** argv)
 		return 0;
 	}
 	
+	//smaller maps may not reach the default camera start, so start over the middle of the map
+	if(GetLvl1Tile(g_ws_camera_pos) == -1)
+	{
+		g_ws_camera_pos[0] = g_big_terrain.num_cols*g_big_terrain.tile_len[0]*0.5f;
+		g_ws_camera_pos[2] = g_big_terrain.num_rows*g_big_terrain.tile_len[1]*0.5f;
+		g_camera_pos[0] = -1.0f*g_ws_camera_pos[0];
+		g_camera_pos[2] = -1.0f*g_ws_camera_pos[2];
+	}
+	
 	//initialize the structure that holds bush position data
 	r = InitBushGroup(&g_bush_group);
 	if(r == -1)
@@ -833,25 +1478,58 @@ int main(int argc, char ** argv)
 	
 	//Initialize OpenGL objects and shaders
 	running = InitGL(width, height);
+	jpInit(&g_frame_jobs, jpGetNumThreads());
 	e = glGetError();
 	if(e != GL_NO_ERROR)
 	{
 		printf("main: glGetError() returned 0x%X\n", e);
 	}
 	
+	//the simulation runs on its own thread from here on, and the main thread
+	//draws the snapshots it publishes. Publish one first so there is always one to draw.
+	r = tbInit(&g_render_snapshots, sizeof(struct render_snapshot_struct));
+	if(r == 0)
+	{
+		printf("main: tbInit() failed for the render snapshots.\n");
+		running = 0;
+	}
+	if(running == 1)
+	{
+		PublishRenderSnapshot(0);
+		g_draw_snapshot = (struct render_snapshot_struct*)tbGetLatest(&g_render_snapshots);
+		
+		//startup is over: queries on paged out tiles use the coarse grid from now on,
+		//so the simulation thread never loads a tile (which can evict others, and that needs GL)
+		g_terrain_pager.streaming = 1;
+		r = StartSimulationThread();
+		if(r == 0)
+			running = 0;
+	}
+
+	//between frames the loop sleeps in fpWait() until the next frame is due, the
+	//keyboard needs another look or there is input from X or the mouse
+	r = fpInit(&g_frame_pacer, FRAME_PERIOD_NS);
+	if(r == 0)
+		running = 0;
+	x_bit = fpAddFd(&g_frame_pacer, ConnectionNumber(display));
+	mouse_bit = fpAddFd(&g_frame_pacer, in_GetMouseFd());
+	ready = mouse_bit | x_bit;
+	key_event = 1; //look at the keyboard once to start
+	g_redraw = 1;
+
 	printf("setup complete. entering message loop.\n");
 	XMapRaised(display, win);
 	
 	//getting a starting time point to use when looping
 	clock_gettime(CLOCK_MONOTONIC, &last_drawcall);
-	clock_gettime(CLOCK_MONOTONIC, &last_simulatecall);
-	clock_gettime(CLOCK_MONOTONIC, &curr_time);
+	next_input_ns = fpGetTime();
 	
 	//message loop
 	while(running)
 	{
-		//handle any pending X messages
-		while(XPending(display) > 0)
+		//handle any pending X messages: the connection woke fpWait(), or XPending() already
+		//read events into Xlib's queue. Nothing to do on a timer wake.
+		while(((ready & x_bit) || XQLength(display) > 0) && XPending(display) > 0)
 		{
 			XNextEvent(display, &event);
 			if(event.type == Expose)
@@ -859,9 +1537,14 @@ int main(int argc, char ** argv)
 				//printf("main: expose event\n");
 
 				//Draw stuff & swap the buffer
+				g_draw_snapshot = (struct render_snapshot_struct*)tbGetLatest(&g_render_snapshots);
 				g_DrawFunc();
 				glXSwapBuffers(display, win);
 			}
+			if(event.type == KeyPress || event.type == KeyRelease)
+			{
+				key_event = 1;
+			}
 			if(event.type == ClientMessage)
 			{
 				running = 0;
@@ -869,6 +1552,7 @@ int main(int argc, char ** argv)
 			}
 			if(event.type == ConfigureNotify)
 			{
+				g_redraw = 1;
 				//glUseProgram(g_theProgram);
 				//glViewport(0, 0, (GLsizei)event.xconfigure.width, (GLsizei)event.xconfigure.height);
 				//TODO: This is messed up, CalculatePerspectiveMatrix updates one of the shader programs but not all of them
@@ -877,53 +1561,98 @@ int main(int argc, char ** argv)
 				//glUseProgram(0);
 			}
 		}
-		r = UpdateFromMouseInput(&g_camera_rotX, &g_camera_rotY);
-		if(r == 0)
+
+		//input changes the same camera and characters the simulation does, so it
+		//waits for any step in progress
+		if(ready & mouse_bit)
 		{
-			running = 0;
-			break;
+			pthread_mutex_lock(&g_world_lock);
+			r = UpdateFromMouseInput(&g_camera_rotX, &g_camera_rotY);
+			CopyViewInput();
+			WakeSimulationThread();
+			pthread_mutex_unlock(&g_world_lock);
+			if(r == 0)
+			{
+				running = 0;
+				break;
+			}
+			g_redraw = 1;
 		}
 
-		//get the current time and check to see if the enough time has passed
-		//to call update again
-		clock_gettime(CLOCK_MONOTONIC, &curr_time);
-		GetElapsedTime(&last_simulatecall, &curr_time, &diff);
-		if(diff.tv_sec > diff_simulate.tv_sec || (diff.tv_sec == diff_simulate.tv_sec && diff.tv_nsec >= diff_simulate.tv_nsec))
+		//the keyboard is looked at right away when a key goes down or up, then every
+		//INPUT_PERIOD_NS while any are held (or a GUI screen is up). SimulationThread()
+		//steps the simulation.
+		now_ns = fpGetTime();
+		poll_input = key_event;
+		if((ready & mouse_bit) && g_render_mode != 0) //mouse clicks in the GUI
+			poll_input = 1;
+		if((g_keys_down == 1 || g_render_mode != 0) && now_ns >= next_input_ns)
+			poll_input = 1;
+		if(poll_input == 1)
 		{
-			last_simulatecall.tv_sec = curr_time.tv_sec;
-			last_simulatecall.tv_nsec = curr_time.tv_nsec;
+			key_event = 0;
+			next_input_ns = now_ns + INPUT_PERIOD_NS;
+			pthread_mutex_lock(&g_world_lock);
 			r = HandleKeyboardInput(display, &g_camera_rotX, &g_camera_rotY, g_camera_pos, &g_a_man, &g_a_vehicle);
+			if(r != 0 && g_render_mode == 1) //Inventory Screen
+			{
+				UpdateGUI();
+			}
+			CopyViewInput();
+			WakeSimulationThread();
+			pthread_mutex_unlock(&g_world_lock);
 			if(r == 0) //error
 			{
 				running = 0;
 				break;
 			}
-			if(g_pause_simulation_step == 0)
+			g_redraw = 1;
+		}
+
+		//draw when a frame is due, unless nothing changed since the last one
+		now_ns = fpGetTime();
+		if(fpIsFrameDue(&g_frame_pacer, now_ns) == 1)
+		{
+			num_picked = g_render_snapshots.num_picked;
+			g_draw_snapshot = (struct render_snapshot_struct*)tbGetLatest(&g_render_snapshots);
+			if(g_render_snapshots.num_picked != num_picked || g_terrain_pager.busy == 1)
+				g_redraw = 1;
+			if(g_redraw == 0)
 			{
-				SimulationStep(); 
-				//printf("***simulation step end***\n");
+				fpSkipFrame(&g_frame_pacer, now_ns);
 			}
-			if(g_render_mode == 1) //Inventory Screen
+			else
 			{
-				UpdateGUI();
+				g_redraw = 0;
+				late_ns = fpBeginFrame(&g_frame_pacer, now_ns);
+				if(late_ns >= FRAME_HITCH_NS)
+					printf("main: frame %d started %.1f ms late\n", g_frame_pacer.num_frames, (late_ns/1000000.0));
+				clock_gettime(CLOCK_MONOTONIC, &curr_time);
+				GetElapsedTime(&last_drawcall, &curr_time, &diff);
+				clock_gettime(CLOCK_MONOTONIC, &tdrawSceneStart);
+				g_DrawFunc();
+				clock_gettime(CLOCK_MONOTONIC, &tdrawSceneEnd);
+				glXSwapBuffers(display, win);
+				last_drawcall.tv_sec = curr_time.tv_sec;
+				last_drawcall.tv_nsec = curr_time.tv_nsec;
+				DebugUpdateDrawCallStats(&diff, &tdrawSceneStart, &tdrawSceneEnd);	//keep track of the latest time since last draw
 			}
 		}
 
-		//get the current time and check to see if enough time has elapsed to call DrawScene()
-		clock_gettime(CLOCK_MONOTONIC, &curr_time);
-		GetElapsedTime(&last_drawcall, &curr_time, &diff);
-		if(diff.tv_sec > diff_drawcall.tv_sec || (diff.tv_sec == diff_drawcall.tv_sec && diff.tv_nsec >= diff_drawcall.tv_nsec))
-		{
-			clock_gettime(CLOCK_MONOTONIC, &tdrawSceneStart);
-			g_DrawFunc();
-			clock_gettime(CLOCK_MONOTONIC, &tdrawSceneEnd);
-			glXSwapBuffers(display, win);
-			last_drawcall.tv_sec = curr_time.tv_sec;
-			last_drawcall.tv_nsec = curr_time.tv_nsec;
-			DebugUpdateDrawCallStats(&diff, &tdrawSceneStart, &tdrawSceneEnd);	//keep track of the latest time since last draw
-		}
+		//sleep until the next frame or keyboard look, or until there is input. XPending()
+		//also sends anything Xlib has buffered before going to sleep.
+		ready = 0;
+		if(running == 1 && XPending(display) == 0)
+			ready = fpWait(&g_frame_pacer, ((g_keys_down == 1 || g_render_mode != 0) ? next_input_ns : -1));
 	}
 	
+	StopSimulationThread();
+	if(g_terrain_pager.active == 1)
+		TerrainPagerShutdown();
+	rqFree(&g_render_queue);
+	jpShutdown(&g_frame_jobs);
+	tbFree(&g_render_snapshots);
+	fpFree(&g_frame_pacer);
 	in_CloseMouseInput();
 	//release glx context
 	glXMakeCurrent(display, None, 0);
@@ -942,6 +1671,7 @@ int InitGL(unsigned int width, unsigned int height)
 	GLint status;
 	GLint infoLogLength;
 	GLchar * strInfoLog;
+	float * pTerrainVerts;
 	int i;
 	int r;
 	float origin[3] = {0.0f, 0.0f, 0.0f};
@@ -957,7 +1687,7 @@ int InitGL(unsigned int width, unsigned int height)
 		return 0;
 	g_shaderlist[0] = glCreateShader(GL_VERTEX_SHADER);
 	printf("created shader %d\n", g_shaderlist[0]);
-	glShaderSource(g_shaderlist[0], 1, &vertexShaderString, 0);
+	glShaderSource(g_shaderlist[0], 1, (const GLchar**)&vertexShaderString, 0);
 	glCompileShader(g_shaderlist[0]);
 	glGetShaderiv(g_shaderlist[0], GL_COMPILE_STATUS, &status);
 	free(vertexShaderString);
@@ -983,7 +1713,7 @@ int InitGL(unsigned int width, unsigned int height)
 		return 0;
 	g_shaderlist[1] = glCreateShader(GL_FRAGMENT_SHADER);
 	printf("created shader %d\n", g_shaderlist[1]);
-	glShaderSource(g_shaderlist[1], 1, &fragmentShaderString, 0);
+	glShaderSource(g_shaderlist[1], 1, (const GLchar**)&fragmentShaderString, 0);
 	glCompileShader(g_shaderlist[1]);
 	glGetShaderiv(g_shaderlist[1], GL_COMPILE_STATUS, &status);
 	free(fragmentShaderString);
@@ -1061,7 +1791,10 @@ int InitGL(unsigned int width, unsigned int height)
 	glUseProgram(0);
 	
 	//Setup the shaders for the detailed bush
-	r = InitBushShaders(&g_bush_shader);
+	r = InitBushShaders(&g_bush_shader, "shaders/bush.vert");
+	if(r == 0)
+		return 0;
+	r = InitBushShaders(&g_bush_instanced_shader, "shaders/bush_instanced.vert");
 	if(r == 0)
 		return 0;
 	
@@ -1083,15 +1816,29 @@ int InitGL(unsigned int width, unsigned int height)
 	//setup the VAO and buffers for the terrain map
 	glGenBuffers(1, &(g_big_terrain.ebo));
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g_big_terrain.ebo);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, g_big_terrain.num_indices*sizeof(GLshort), g_big_terrain.pElements, GL_STATIC_DRAW);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, g_big_terrain.lod.num_elements*sizeof(GLushort), g_big_terrain.lod.elements, GL_STATIC_DRAW);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 	
+	//the interleaved vertex data is only built here, one tile at a time, for the upload
+	pTerrainVerts = (float*)malloc(g_big_terrain.pTiles[0].num_verts*g_big_terrain.num_floats_per_vert*sizeof(float));
+	if(pTerrainVerts == 0)
+	{
+		printf("InitGL: malloc failed for terrain vertex data\n");
+		return 0;
+	}
 	for(i = 0; i < g_big_terrain.num_tiles; i++)
 	{
 		glGenBuffers(1, &(g_big_terrain.pTiles[i].vbo));
-		glBindBuffer(GL_ARRAY_BUFFER, g_big_terrain.pTiles[i].vbo);
-		glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)(g_big_terrain.pTiles[i].num_verts*8*sizeof(float)), g_big_terrain.pTiles[i].pPos, GL_STATIC_DRAW);
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		
+		//paged out tiles get their buffer storage from UpdateTerrainPager() once they are loaded
+		if(IsTileResident(&(g_big_terrain.pTiles[i])) == 1)
+		{
+			BuildTileVertexData(&(g_big_terrain.pTiles[i]), pTerrainVerts);
+			glBindBuffer(GL_ARRAY_BUFFER, g_big_terrain.pTiles[i].vbo);
+			glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)(g_big_terrain.pTiles[i].num_verts*8*sizeof(float)), pTerrainVerts, GL_STATIC_DRAW);
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+			g_big_terrain.pTiles[i].vbo_loaded = 1;
+		}
 
 		glGenVertexArrays(1, &(g_big_terrain.pTiles[i].vao));
 		glBindVertexArray(g_big_terrain.pTiles[i].vao);
@@ -1120,6 +1867,7 @@ int InitGL(unsigned int width, unsigned int height)
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g_big_terrain.ebo);
 		glBindVertexArray(0);
 	}
+	free(pTerrainVerts);
 	
 	//load the terrain map's sand texture
 	LoadTexture();
@@ -1300,6 +2048,9 @@ int InitGL(unsigned int width, unsigned int height)
 	//	printf("InitGL: error InitPlantGrid() failed.\n");
 	//	return 0;
 	//}
+	//plant models and billboard sizes are loaded, so the plant culling spheres can be sized
+	InitPlantDetailParts(&g_bush_grid);
+	InitPlantCullBounds(&g_bush_grid);
 	r = InitPlantGrid2(&g_bush_grid);
 	if(r == -1)
 		return 0;
@@ -1414,6 +2165,9 @@ int InitGL(unsigned int width, unsigned int height)
 	r = InitMoveableModelCommon(&g_warehouse_model_common, "Cylinder", "./resources/models/warehouse00.obj", "./resources/textures/corrugated02.tga");
 	if(r == 0)
 		return 0;
+	
+	//moveable models are loaded, so their vaos can take per-instance matrices
+	InitMoveableInstancing(&g_moveables_grid);
 
 	//Initialize Base stuff
 	tempVec[0] = 12464.0f;
@@ -1549,7 +2303,14 @@ int InitGL(unsigned int width, unsigned int height)
 	return 1;
 }
 
-int InitBushShaders(struct bush_shader_struct * p_shader)
+/*
+InitBushShaders
+Builds the shader program for plant and object models from vert_filename
+and shaders/bush.frag. The vertex shader must have the perspectiveMatrix,
+modelToCameraMatrix and lightDir uniforms.
+returns 1 on success, 0 on failure
+*/
+int InitBushShaders(struct bush_shader_struct * p_shader, char * vert_filename)
 {
 	char * vertexShaderString;
 	char * fragmentShaderString;
@@ -1558,11 +2319,11 @@ int InitBushShaders(struct bush_shader_struct * p_shader)
 	GLchar * strInfoLog;
 
 	//compile the bush vertex shader
-	vertexShaderString = LoadShaderSource("shaders/bush.vert");
+	vertexShaderString = LoadShaderSource(vert_filename);
 	if(vertexShaderString == 0)
 		return 0;
 	p_shader->shaderList[0] = glCreateShader(GL_VERTEX_SHADER);
-	glShaderSource(p_shader->shaderList[0], 1, &vertexShaderString, 0);
+	glShaderSource(p_shader->shaderList[0], 1, (const GLchar**)&vertexShaderString, 0);
 	glCompileShader(p_shader->shaderList[0]);
 	glGetShaderiv(p_shader->shaderList[0], GL_COMPILE_STATUS, &status);
 	free(vertexShaderString);
@@ -1587,7 +2348,7 @@ int InitBushShaders(struct bush_shader_struct * p_shader)
 	if(fragmentShaderString == 0)
 		return 0;
 	p_shader->shaderList[1] = glCreateShader(GL_FRAGMENT_SHADER);
-	glShaderSource(p_shader->shaderList[1], 1, &fragmentShaderString, 0);
+	glShaderSource(p_shader->shaderList[1], 1, (const GLchar**)&fragmentShaderString, 0);
 	glCompileShader(p_shader->shaderList[1]);
 	glGetShaderiv(p_shader->shaderList[1], GL_COMPILE_STATUS, &status);
 	free(fragmentShaderString);
@@ -1683,7 +2444,7 @@ int InitBillboardShaders(struct simple_billboard_shader_struct * p_shader)
 	if(vertexShaderString == 0)
 		return 0;
 	p_shader->shaderList[0] = glCreateShader(GL_VERTEX_SHADER);
-	glShaderSource(p_shader->shaderList[0], 1, &vertexShaderString, 0);
+	glShaderSource(p_shader->shaderList[0], 1, (const GLchar**)&vertexShaderString, 0);
 	glCompileShader(p_shader->shaderList[0]);
 	glGetShaderiv(p_shader->shaderList[0], GL_COMPILE_STATUS, &status);
 	free(vertexShaderString);
@@ -1708,7 +2469,7 @@ int InitBillboardShaders(struct simple_billboard_shader_struct * p_shader)
 	if(fragmentShaderString == 0)
 		return 0;
 	p_shader->shaderList[1] = glCreateShader(GL_FRAGMENT_SHADER);
-	glShaderSource(p_shader->shaderList[1], 1, &fragmentShaderString, 0);
+	glShaderSource(p_shader->shaderList[1], 1, (const GLchar**)&fragmentShaderString, 0);
 	glCompileShader(p_shader->shaderList[1]);
 	glGetShaderiv(p_shader->shaderList[1], GL_COMPILE_STATUS, &status);
 	free(fragmentShaderString);
@@ -1797,7 +2558,7 @@ int InitSimpleWavePlaneShader(struct simple_wave_shader_struct * p_shader)
 	if(vertexShaderString == 0)
 		return 0;
 	p_shader->shaderList[0] = glCreateShader(GL_VERTEX_SHADER);
-	glShaderSource(p_shader->shaderList[0], 1, &vertexShaderString, 0);
+	glShaderSource(p_shader->shaderList[0], 1, (const GLchar**)&vertexShaderString, 0);
 	glCompileShader(p_shader->shaderList[0]);
 	glGetShaderiv(p_shader->shaderList[0], GL_COMPILE_STATUS, &status);
 	free(vertexShaderString);
@@ -1822,7 +2583,7 @@ int InitSimpleWavePlaneShader(struct simple_wave_shader_struct * p_shader)
 	if(fragmentShaderString == 0)
 		return 0;
 	p_shader->shaderList[1] = glCreateShader(GL_FRAGMENT_SHADER);
-	glShaderSource(p_shader->shaderList[1], 1, &fragmentShaderString, 0);
+	glShaderSource(p_shader->shaderList[1], 1, (const GLchar**)&fragmentShaderString, 0);
 	glCompileShader(p_shader->shaderList[1]);
 	glGetShaderiv(p_shader->shaderList[1], GL_COMPILE_STATUS, &status);
 	free(fragmentShaderString);
@@ -1920,7 +2681,7 @@ int InitCharacterShaders(struct character_shader_struct * p_shader)
 	if(vertexShaderString == 0)
 		return 0;
 	p_shader->shaderList[0] = glCreateShader(GL_VERTEX_SHADER);
-	glShaderSource(p_shader->shaderList[0], 1, &vertexShaderString, 0);
+	glShaderSource(p_shader->shaderList[0], 1, (const GLchar**)&vertexShaderString, 0);
 	glCompileShader(p_shader->shaderList[0]);
 	glGetShaderiv(p_shader->shaderList[0], GL_COMPILE_STATUS, &status);
 	free(vertexShaderString);
@@ -1945,7 +2706,7 @@ int InitCharacterShaders(struct character_shader_struct * p_shader)
 	if(fragmentShaderString == 0)
 		return 0;
 	p_shader->shaderList[1] = glCreateShader(GL_FRAGMENT_SHADER);
-	glShaderSource(p_shader->shaderList[1], 1, &fragmentShaderString, 0);
+	glShaderSource(p_shader->shaderList[1], 1, (const GLchar**)&fragmentShaderString, 0);
 	glCompileShader(p_shader->shaderList[1]);
 	glGetShaderiv(p_shader->shaderList[1], GL_COMPILE_STATUS, &status);
 	free(fragmentShaderString);
@@ -2038,8 +2799,7 @@ int InitCharacterShaders(struct character_shader_struct * p_shader)
 
 void DrawScene(void)
 {
-	struct moveable_object_struct * pmoveable=0;
-	struct item_struct * pitem=0;
+	struct render_snapshot_struct * snap = g_draw_snapshot;
 	struct character_struct * psoldier=0;
 	float mCameraMatrix[16];
 	float mTranslateCameraMatrix[16];
@@ -2047,45 +2807,69 @@ void DrawScene(void)
 	float mRotateCameraMat_X[16];
 	float mRotateCameraMat_Y[16];
 	float mModelToCameraMatrix[16];
-	float mBaseModelMatrix[16];
 	float mChildModelMatrix[16];
 	float mModelMatrix[16];
 	float mTranslateModelMatrix[16];
 	float mRotateModelMatrix_Y[16];
-	float mRotateModelMatrix[16];
-	float iModelMatrix[16];
 	float mag;
-	float vCameraPos[4];
 	float lightDir[] = {0.0f, 1.0f, 0.0f};
 	float shininess = 40.0f;
-	float * v3;
 	int i;
 	int j;
-	int k;
-	int r;
 	int local_tile;
-	int is_detail_bush_tile;
-	int iplant_type;
-	int ilastplant_type = -1; //set to an invalid plant type.
 
-	g_debug_num_simple_billboard_draws = 0;
-	g_debug_num_detail_billboard_draws = 0;
+	g_debug_num_billboard_draws = 0;
+	g_debug_num_billboard_plants = 0;
 	g_debug_num_himodel_plant_draws = 0;
+	g_debug_num_terrain_triangles = 0;
+	g_debug_num_terrain_full_triangles = 0;
+
+	//the camera is drawn from the snapshot, its rotation was worked out by PublishRenderSnapshot().
+	//Input the snapshot hasn't seen yet turns it right away.
+	if(snap->input_serial != g_view_input.serial && g_view_input.vehicle_camera == 0)
+	{
+		mmRotateAboutY(mRotateCameraMat_Y, g_view_input.rotY);
+		mmRotateAboutX(mRotateCameraMat_X, g_view_input.rotX);
+		mmMultiplyMatrix4x4(mRotateCameraMat_X, mRotateCameraMat_Y, mRotateCameraMatrix);
+	}
+	else
+	{
+		memcpy(mRotateCameraMatrix, snap->mRotateCameraMatrix, sizeof(float)*16);
+	}
+	mmMakeIdentityMatrix(mCameraMatrix);
+	mmTranslateMatrix(mTranslateCameraMatrix, snap->camera_pos[0], snap->camera_pos[1], snap->camera_pos[2]);
+	
+	//We want to translate and then rotate the world by the opposite of the camera's position
+	//and rotation. So we want to translate and then rotate the world. Thus we
+	//need to multiply the matrices in the opposite sequence: rotate then translate.
+	mmMultiplyMatrix4x4(mRotateCameraMatrix, mTranslateCameraMatrix, mCameraMatrix);
+	mmMakeIdentityMatrix(mModelMatrix);
+	mmMultiplyMatrix4x4(mCameraMatrix, mModelMatrix, mModelToCameraMatrix);
 
 	//prepare for doing frustum clipping tests
 	if(g_debug_freeze_culling == 0) //if debug freeze culling is set then skip.
 	{
-		ClipTilesSetupFrustum();
+		ClipTilesSetupFrustum(mCameraMatrix, snap->ws_camera_pos);
 		local_tile = GetLvl1Tile(g_camera_frustum.camera);
 	}
 
 	//update a grid that holds tiles that are around the camera, and a bounding box
 	//around the camera that is later used to render bushes.
-	UpdatePlantDrawGrid(&g_bush_grid, local_tile, g_ws_camera_pos);
+	UpdatePlantDrawGrid(&g_bush_grid, local_tile, snap->ws_camera_pos);
 
-	UpdateTerrainDrawBox(g_ws_camera_pos);
+	UpdateTerrainDrawBox(snap->ws_camera_pos);
+	
+	//installing and evicting tiles takes g_world_lock itself, only to swap a tile's heights
+	UpdateTerrainPager(snap->ws_camera_pos);
+
+	UpdateMoveablesLocalGrid(&g_moveables_grid, snap->ws_camera_pos);
+	
+	//merge moveables that never move again if any were added or removed
+	if(g_moveables_grid.batches_dirty == 1)
+		RebuildMoveableBatches(&g_moveables_grid);
 
-	UpdateMoveablesLocalGrid(&g_moveables_grid, g_ws_camera_pos);
+	//cull and build the draw lists on the worker threads, the rest of DrawScene only reads them
+	PrepareFrame(local_tile, mCameraMatrix, snap);
 	
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 	
@@ -2095,29 +2879,6 @@ void DrawScene(void)
 	lightDir[1] = lightDir[1] / mag;
 	lightDir[2] = lightDir[2] / mag;
 	
-	mmMakeIdentityMatrix(mCameraMatrix);
-	mmTranslateMatrix(mTranslateCameraMatrix, g_camera_pos[0], g_camera_pos[1], g_camera_pos[2]);
-
-	//update the camera rotation for vehicle if needed:
-	//update the camera for vehicle if needed
-	if(g_keyboard_state.state == KEYBOARD_MODE_TRUCK && g_camera_state.playerCameraMode == PLAYERCAMERA_VEHICLE)
-	{
-		UpdateCharacterCameraForVehicle(&g_a_man, mRotateCameraMatrix);
-	}
-	else
-	{
-		mmRotateAboutY(mRotateCameraMat_Y, g_camera_rotY);
-		mmRotateAboutX(mRotateCameraMat_X, g_camera_rotX);
-		mmMultiplyMatrix4x4(mRotateCameraMat_X, mRotateCameraMat_Y, mRotateCameraMatrix);
-	}
-	
-	//We want to translate and then rotate the world by the opposite of the camera's position
-	//and rotation. So we want to translate and then rotate the world. Thus we
-	//need to multiply the matrices in the opposite sequence: rotate then translate.
-	mmMultiplyMatrix4x4(mRotateCameraMatrix, mTranslateCameraMatrix, mCameraMatrix);
-	mmMakeIdentityMatrix(mModelMatrix);
-	mmMultiplyMatrix4x4(mCameraMatrix, mModelMatrix, mModelToCameraMatrix);
-	
 	//draw the wave plane
 	glUseProgram(g_simple_wave_shader.program);
 		glUniform3fv(g_simple_wave_shader.lightDirUnif, 1, lightDir);
@@ -2125,481 +2886,49 @@ void DrawScene(void)
 		glUniformMatrix4fv(g_simple_wave_shader.modelToCameraMatrixUnif, 1, GL_FALSE, mModelToCameraMatrix);
 		
 		//This will only work as long as the model transform matrix is the identity matrix
-		glUniform3fv(g_simple_wave_shader.modelSpaceCameraPosUnif, 1, g_ws_camera_pos);
+		glUniform3fv(g_simple_wave_shader.modelSpaceCameraPosUnif, 1, snap->ws_camera_pos);
 		
 		glBindVertexArray(g_simple_wave.vao);
 		glDrawArrays(GL_TRIANGLES, 0, g_simple_wave.num_verts);
 	
 	//setup textures
 	glActiveTexture(GL_TEXTURE0 + g_big_terrain.colorTexUnit); //this active texture unit is used for all subequent draw calls
-	glBindTexture(GL_TEXTURE_2D, g_big_terrain.textureId);
-	glBindSampler(g_big_terrain.colorTexUnit, g_big_terrain.sampler);
-	
-	//Need to put in camera pos
-	//vCameraPos[0] = -1.0f*g_camera_pos[0];
-	//vCameraPos[1] = -1.0f*g_camera_pos[1];
-	//vCameraPos[2] = -1.0f*g_camera_pos[2];
-	//vCameraPos[3] = 1.0f;
-	//memcpy(iModelMatrix, mModelMatrix, (sizeof(float)*16));
-	//mmInverse4x4(iModelMatrix);
-	//mmTransformVec(iModelMatrix, vCameraPos);
-	//glUniform3fv(g_modelSpaceCameraPosUnif, 1, vCameraPos);
-			
-	//and draw the terrain
+	
+	//uniforms that are the same for every draw this frame
 	glUseProgram(g_theProgram);
 		glUniform3fv(g_lightDirUnif, 1, lightDir);
-		glUniformMatrix4fv(g_modelToCameraMatrixUnif, 1, GL_FALSE, mModelToCameraMatrix);
-		for(i = 0; i < 	g_big_terrain.num_tiles; i++)
-		{
-			//check if tile is too far away to draw
-			r = IsTileInTerrainDrawBox(&(g_big_terrain.pTiles[i]));
-			if(r == 0)
-				continue;
-
-			//check to see that tile is in camera frustum
-			r = IsTileInCameraFrustum(&g_big_terrain, &(g_big_terrain.pTiles[i]));
-			if(i == local_tile) //override if this is the local tile.
-				r = 1;
-			if(r == 0)
-				continue;
-			
-			//are we in a tile around the camera?
-			
-			//draw the terrain tile	
-			glBindVertexArray(g_big_terrain.pTiles[i].vao);
-			glDrawElements(GL_TRIANGLES, 			//mode
-					g_big_terrain.num_indices,	//count
-					GL_UNSIGNED_SHORT, 		//type
-					0);				//0 since VAO has IBO stored
-		}
-
-	//Loop only through local moveables grid tiles since there are too many grid tiles
-	//on the map to go through
-	//mmMakeIdentityMatrix(mModelMatrix);
-	glBindSampler(0, g_bush_branchtex_sampler); //use branch sampler because it clamps to edge
-	glUseProgram(g_bush_shader.program);
-	for(i = 0; i < g_moveables_grid.numLocalTiles; i++)
-	{
-		//if entry is marked invalid skip it
-		if(g_moveables_grid.local_grid[i] == -1)
-			continue;
-
-		k = g_moveables_grid.local_grid[i];
-
-		//if there are no things to draw in the tiles skip it
-		if(g_moveables_grid.p_tiles[k].num_moveables == 0)
-			continue;
-
-		//pmoveable is a linked list
-		pmoveable = g_moveables_grid.p_tiles[k].moveables_list;
-		for(j = 0; j < g_moveables_grid.p_tiles[k].num_moveables; j++) //pmoveable is a linked list
-		{
-			mmRotateAboutY(mModelMatrix, pmoveable->yrot); 
-			mModelMatrix[12] = pmoveable->pos[0];
-			mModelMatrix[13] = pmoveable->pos[1];
-			mModelMatrix[14] = pmoveable->pos[2];
-			mmMultiplyMatrix4x4(mCameraMatrix, mModelMatrix, mModelToCameraMatrix);
-			glUniformMatrix4fv(g_bush_shader.modelToCameraMatrixUnif, 1, GL_FALSE, mModelToCameraMatrix);
-
-			switch(pmoveable->moveable_type)
-			{
-			case MOVEABLE_TYPE_CRATE:	//crate
-				glBindTexture(GL_TEXTURE_2D, g_crate_model_common.texture_id);
-				glBindVertexArray(g_crate_model_common.vao);
-				glDrawElements(GL_TRIANGLES,
-						g_crate_model_common.num_indices,
-						GL_UNSIGNED_INT,
-						0);
-				break;
-			case MOVEABLE_TYPE_BARREL: //barrel
-				glBindTexture(GL_TEXTURE_2D, g_barrel_model_common.texture_id);
-				glBindVertexArray(g_barrel_model_common.vao);
-				glDrawElements(GL_TRIANGLES,
-						g_barrel_model_common.num_indices,
-						GL_UNSIGNED_INT,
-						0);
-				break;
-			case MOVEABLE_TYPE_DOCK:
-				glBindTexture(GL_TEXTURE_2D, g_dock_common.texture_id);
-				glBindVertexArray(g_dock_common.vao);
-				glDrawElements(GL_TRIANGLES,
-						g_dock_common.num_indices,
-						GL_UNSIGNED_INT,
-						0);
-				break;
-			case MOVEABLE_TYPE_BUNKER:
-				glBindTexture(GL_TEXTURE_2D, g_bunker_model_common.texture_id);
-				glBindVertexArray(g_bunker_model_common.vao);
-				glDrawElements(GL_TRIANGLES,
-						g_bunker_model_common.num_indices,
-						GL_UNSIGNED_INT,
-						0);
-				break;
-			case MOVEABLE_TYPE_WAREHOUSE:
-				glBindSampler(0, g_bush_trunktex_sampler); //bind the trunk sampler because we need repeat for the siding texture
-				glBindTexture(GL_TEXTURE_2D, g_warehouse_model_common.texture_id);
-				glBindVertexArray(g_warehouse_model_common.vao);
-				glDrawElements(GL_TRIANGLES,
-						g_warehouse_model_common.num_indices,
-						GL_UNSIGNED_INT,
-						0);
-				glBindSampler(0, g_bush_branchtex_sampler); //restore the sampler that the other objects use.
-				break;
-			default:
-				printf("%s: error. %d is unknown moveable_type.\n", __func__, pmoveable->moveable_type);
-			}
-
-			pmoveable = pmoveable->pNext; //advance the LINKED LIST
-		}
-	}
-		
-	//draw simple bush billboards, skip tiles that may need to have detailed bushes drawn
-	mmMakeIdentityMatrix(mModelMatrix);
-	glUseProgram(g_billboard_shader.program);
-		glBindSampler(g_billboard_shader.colorTexUnit, g_bush_branchtex_sampler);
-		glBindVertexArray(g_bush_smallbillboard.vao);
-		for(i = 0; i < g_bush_grid.num_tiles; i++)
-		{
-			if(g_bush_grid.p_tiles[i].num_plants == 0)
-				continue;
-			
-			//check to see if the tile is in the camera frustum (use the terrain tile to do this)
-			r = IsTileInCameraFrustum(&g_big_terrain, &(g_big_terrain.pTiles[i]));
-			if(i == local_tile)
-				r = 1;
-			if(r == 0)
-				continue;
-
-			//check to see if the tile is too far away and outside of a large box
-			r = IsTileInPlantViewBox(&(g_big_terrain.pTiles[i]));
-			if(r == 0)
-				continue;
-			
-			//check to see if the tile is in the list of tiles that need to be detailed.
-			//if so skip drawing that tile
-			is_detail_bush_tile = 0;
-			for(k = 0; k < 9; k++)
-			{
-				if(i == g_bush_grid.draw_grid[k])
-				{
-					is_detail_bush_tile = 1;
-				}
-			}
-			
-			//only draw bushes that are not in the bush grid's draw grid
-			if(is_detail_bush_tile == 0)
-			{
-					//draw all bushes in the tile as billboards
-					for(j = 0; j < g_bush_grid.p_tiles[i].num_plants; j++)
-					{
-						mModelMatrix[12] = g_bush_grid.p_tiles[i].plants[j].pos[0]; //xpos
-						mModelMatrix[13] = g_bush_grid.p_tiles[i].plants[j].pos[1]; //ypos
-						mModelMatrix[14] = g_bush_grid.p_tiles[i].plants[j].pos[2]; //zpos
-						//mmMultiplyMatrix4x4(mCameraMatrix, (g_bush_grid.p_tiles[i].m16_model_mat + (j*16)), mModelToCameraMatrix);
-						mmMultiplyMatrix4x4(mCameraMatrix, mModelMatrix, mModelToCameraMatrix);
-						glUniformMatrix4fv(g_billboard_shader.modelToCameraMatrixUnif, 1, GL_FALSE, mModelToCameraMatrix);
-						
-						//check plant type, use it to select billboard size uniforms and texture id.
-						iplant_type = (int)g_bush_grid.p_tiles[i].plants[j].plant_type;
-						if(iplant_type > 5)
-						{
-							printf("DrawScene: error. unknown plant_type=%d for simplebillboard tile=%d plant index=%d\n", g_bush_grid.p_tiles[i].plants[j].plant_type, i, j);
-							continue;
-						}
-
-						//only change if this plant type is different than the last one
-						if(ilastplant_type != iplant_type)
-						{
-							glUniform2fv(g_billboard_shader.billboardSizeUnif, 1, (g_bush_smallbillboard.size+(iplant_type*2)));
-							glBindTexture(GL_TEXTURE_2D, g_bush_smallbillboard.texture_ids[iplant_type]);
-						}
-					
-						glDrawArrays(GL_TRIANGLES,				//mode
-							0,									//starting index. start at 0.
-							g_bush_smallbillboard.num_verts);	//count of vertices to draw
-						ilastplant_type = iplant_type;
-						g_debug_num_simple_billboard_draws += 1;
-					}
-			}
-			
-		}
-	
-	//setup the more detailed shader
-	glUseProgram(g_bush_shader.program);
-	glUniform3fv(g_lightDirUnif, 1, lightDir);
-	glUseProgram(0);
-	
-	//Now handle the detailed bush tiles
-	for(k = 0; k < 9; k++)
-	{
-		if(g_bush_grid.draw_grid[k] == -1)
-			continue;
-		
-		for(j = 0; j < g_bush_grid.p_tiles[(g_bush_grid.draw_grid[k])].num_plants; j++)
-		{
-			//get the plant's world-space coordinate out of its transform matrix
-			//v3 = g_bush_grid.p_tiles[(g_bush_grid.draw_grid[k])].m16_model_mat + (j*16) + 12;
-			//v3 = (g_bush_grid.p_tiles[(g_bush_grid.draw_grid[k])].plant_pos_yrot_list+(j*4));
-			v3 = g_bush_grid.p_tiles[(g_bush_grid.draw_grid[k])].plants[j].pos;
-
-			iplant_type = (int)g_bush_grid.p_tiles[(g_bush_grid.draw_grid[k])].plants[j].plant_type;
-			
-			//calculate the model-to-camera matrix for the bush. This doesn't matter if it's detailed
-			//or not
-			//mmMultiplyMatrix4x4(mCameraMatrix, (g_bush_grid.p_tiles[(g_bush_grid.draw_grid[k])].m16_model_mat + (j*16)), mModelToCameraMatrix);
-			mmRotateAboutY(mModelMatrix, g_bush_grid.p_tiles[(g_bush_grid.draw_grid[k])].plants[j].yrot);
-			mModelMatrix[12] = v3[0];
-			mModelMatrix[13] = v3[1];
-			mModelMatrix[14] = v3[2];
-			mmMultiplyMatrix4x4(mCameraMatrix, mModelMatrix, mModelToCameraMatrix);
-
-			//determine if this bush is close to a box around the camera
-			if(v3[0] > g_bush_grid.detail_boundaries[0]
-				&& v3[0] < g_bush_grid.detail_boundaries[1]
-				&& v3[2] > g_bush_grid.detail_boundaries[2]
-				&& v3[2] < g_bush_grid.detail_boundaries[3])
-			{
-				//draw it detailed quad billboard
-				glUseProgram(g_bush_shader.program);
-				glUniformMatrix4fv(g_bush_shader.modelToCameraMatrixUnif, 1, GL_FALSE, mModelToCameraMatrix);
-				switch(iplant_type)
-				{
-				case 0: //1st bush
-					glBindTexture(GL_TEXTURE_2D, g_bush_billboard.texture_id);
-					glBindSampler(g_bush_shader.colorTexUnit, g_bush_branchtex_sampler);
-					glBindVertexArray(g_bush_billboard.vao);
-					glDrawElements(GL_TRIANGLES,		//mode
-						g_bush_billboard.num_indices,	//number of indices to be rendered
-						GL_UNSIGNED_INT,		//type of value in indices.
-						0);				//pointer to location where indices are. (VAO state has EBO)
-					break;
-				case 1: //palm_2
-					glBindTexture(GL_TEXTURE_2D, g_palm_trunk.texture_id);
-					glBindSampler(0, g_bush_trunktex_sampler);
-					glBindVertexArray(g_palm_trunk.vao);
-					glDrawElements(GL_TRIANGLES,		//mode
-						g_palm_trunk.num_indices,	//number of indices to render.
-						GL_UNSIGNED_INT,			//type of indices.
-						0);							//pointer to location where indices are (VAO state has EBO)
-					glDisable(GL_CULL_FACE);			//draw both face sides, blender will only export one triangle.
-					glBindTexture(GL_TEXTURE_2D, g_palm_fronds.texture_id);
-					glBindSampler(0, g_bush_branchtex_sampler);
-					glBindVertexArray(g_palm_fronds.vao);
-					glDrawElements(GL_TRIANGLES,		//mode
-						g_palm_fronds.num_indices,	//number of indices to render.
-						GL_UNSIGNED_INT,			//type of indices.
-						0);							//pointer to location where indices are (VAO state has EBO)
-					glEnable(GL_CULL_FACE);
-					break;
-				case 2: //scaevola
-					glDisable(GL_CULL_FACE);
-					glBindTexture(GL_TEXTURE_2D, g_scaevola_shrub.texture_id);
-					glBindSampler(0, g_bush_branchtex_sampler);
-					glBindVertexArray(g_scaevola_shrub.vao);
-					glDrawElements(GL_TRIANGLES,			//mode
-						g_scaevola_shrub.num_indices,	//number of indices to render
-						GL_UNSIGNED_INT,				//type of indices
-						0);								//pointer to location where indices are (VAO state has EBO)
-					glEnable(GL_CULL_FACE);
-					break;
-				case 3: //fake pemphis
-					glDisable(GL_CULL_FACE);
-					glBindTexture(GL_TEXTURE_2D, g_pemphis_shrub.texture_id);
-					glBindSampler(0, g_bush_branchtex_sampler);
-					glBindVertexArray(g_pemphis_shrub.vao);
-					glDrawElements(GL_TRIANGLES,			//mode
-						g_pemphis_shrub.num_indices,	//number of indices to render
-						GL_UNSIGNED_INT,				//type of indices
-						0);								//pointer to location where indices are (VAO state has EBO)
-					glEnable(GL_CULL_FACE);
-					break;
-				case 4: //tourne fortia
-					glBindTexture(GL_TEXTURE_2D, g_tournefortia_trunk.texture_id);
-					glBindSampler(0, g_bush_trunktex_sampler);
-					glBindVertexArray(g_tournefortia_trunk.vao);
-					glDrawElements(GL_TRIANGLES,				//mode
-						g_tournefortia_trunk.num_indices,	//number of indices to render
-						GL_UNSIGNED_INT,					//type of indices
-						0);									//pointer to location where indices are (VAO state has EBO)
-					glDisable(GL_CULL_FACE);
-					glBindTexture(GL_TEXTURE_2D, g_tournefortia_shrub.texture_id);
-					glBindSampler(0, g_bush_branchtex_sampler);
-					glBindVertexArray(g_tournefortia_shrub.vao);
-					glDrawElements(GL_TRIANGLES,				//mode
-						g_tournefortia_shrub.num_indices,	//number of indices to render
-						GL_UNSIGNED_INT,					//type of indices
-						0);									//pointer to location where indices are (VAO state has EBO)
-					glEnable(GL_CULL_FACE);
-					break;
-				case 5: //ironwood
-					glBindTexture(GL_TEXTURE_2D, g_ironwood_trunk.texture_id);
-					glBindSampler(0, g_bush_trunktex_sampler);
-					glBindVertexArray(g_ironwood_trunk.vao);
-					glDrawElements(GL_TRIANGLES,				//mode
-						g_ironwood_trunk.num_indices,		//number of indices to render
-						GL_UNSIGNED_INT,					//type of indices
-						0);									//pointer to location where indices are (VAO state has EBO)
-					glDisable(GL_CULL_FACE);
-					glBindTexture(GL_TEXTURE_2D, g_ironwood_branches.texture_id);
-					glBindSampler(0, g_bush_branchtex_sampler);
-					glBindVertexArray(g_ironwood_branches.vao);
-					glDrawElements(GL_TRIANGLES,				//mode
-						g_ironwood_branches.num_indices,	//number of indices to render
-						GL_UNSIGNED_INT,					//type of indices
-						0);									//pointer to location where indices are (VAO state has EBO)
-					glEnable(GL_CULL_FACE);
-					break;
-				default:
-					printf("DrawScene: unknown plant type %d. tile index=%d plant index=%d\n", (int)g_bush_grid.p_tiles[(g_bush_grid.draw_grid[k])].plants[j].plant_type, g_bush_grid.draw_grid[k], j);
-					break;
-				}
-				g_debug_num_himodel_plant_draws += 1;
-			}
-			else if(v3[0] > g_bush_grid.nodraw_boundaries[(iplant_type*4)]
-				&& v3[0] < g_bush_grid.nodraw_boundaries[(iplant_type*4)+1]
-				&& v3[2] > g_bush_grid.nodraw_boundaries[(iplant_type*4)+2]
-				&& v3[2] < g_bush_grid.nodraw_boundaries[(iplant_type*4)+3])
-			{
-				//draw it as a camera-facing billboard
-				glUseProgram(g_billboard_shader.program);
-					
-					//check plant type. change billboard size uniforms and texture id based on this plant type.
-					if(iplant_type > 5)
-					{
-						printf("DrawScene: error. unknown plant type=%d for close-in simplebillboard tile=%d planti=%d\n", iplant_type, g_bush_grid.draw_grid[k], j);
-					}	
-					glUniform2fv(g_billboard_shader.billboardSizeUnif, 1, (g_bush_smallbillboard.size+(iplant_type*2)));
-					glBindTexture(GL_TEXTURE_2D, g_bush_smallbillboard.texture_ids[iplant_type]);
-					glBindSampler(g_billboard_shader.colorTexUnit, g_bush_branchtex_sampler);
-					
-					glUniformMatrix4fv(g_billboard_shader.modelToCameraMatrixUnif, 1, GL_FALSE, mModelToCameraMatrix);
-					glBindVertexArray(g_bush_smallbillboard.vao);
-					glDrawArrays(GL_TRIANGLES,			//mode
-						0,					//starting index. start at 0.
-						g_bush_smallbillboard.num_verts);	//count of vertices to draw
-				g_debug_num_detail_billboard_draws += 1;
-			}
-			//and if it is not in the boundary don't draw it
-		}	
-	}
-
-	//Loop through the tiles marked for detail and draw any items on the ground.
-	glBindSampler(0, g_bush_branchtex_sampler);
 	glUseProgram(g_bush_shader.program);
-	for(k = 0; k < 9; k++)
-	{
-		if(g_bush_grid.draw_grid[k] == -1)
-			continue;
-
-		//get the head of the linked list. This may be 0 if there are no items on the tile.
-		pitem = g_bush_grid.p_tiles[g_bush_grid.draw_grid[k]].items_list;
-
-		while(pitem != 0)
-		{
-			mmTranslateMatrix(mTranslateModelMatrix, pitem->pos[0], pitem->pos[1], pitem->pos[2]);
-			mmMultiplyMatrix4x4(mCameraMatrix, mTranslateModelMatrix, mModelToCameraMatrix);
-			glUniformMatrix4fv(g_bush_shader.modelToCameraMatrixUnif, 1, GL_FALSE, mModelToCameraMatrix);
-			switch(pitem->type)
-			{
-			case ITEM_TYPE_BEANS:
-				glBindTexture(GL_TEXTURE_2D, g_beans_common.texture_id);
-				glBindVertexArray(g_beans_common.vao);
-				glDrawElements(GL_TRIANGLES,
-						g_beans_common.num_indices,
-						GL_UNSIGNED_INT,
-						0);
-				break;
-			case ITEM_TYPE_CANTEEN:
-				glBindTexture(GL_TEXTURE_2D, g_canteen_common.texture_id);
-				glBindVertexArray(g_canteen_common.vao);
-				glDrawElements(GL_TRIANGLES,
-						g_canteen_common.num_indices,
-						GL_UNSIGNED_INT,
-						0);
-				break;
-			case ITEM_TYPE_RIFLE:
-				glBindTexture(GL_TEXTURE_2D, g_rifle_common.texture_id);
-				glBindVertexArray(g_rifle_common.vao);
-				glDrawElements(GL_TRIANGLES,
-						g_rifle_common.num_indices,
-						GL_UNSIGNED_INT,
-						0);
-				break;
-			case ITEM_TYPE_PISTOL:
-				glBindTexture(GL_TEXTURE_2D, g_pistol_common.texture_id);
-				glBindVertexArray(g_pistol_common.vao);
-				glDrawElements(GL_TRIANGLES,
-						g_pistol_common.num_indices,
-						GL_UNSIGNED_INT,
-						0);
-				break;
-			default:
-				printf("%s: error. '%d' unknown item type.\n", __func__, (int)pitem->type);
-			}
-
-			pitem = pitem->pNext;
-		}
-	}
-	
-	//Draw vehicle b:
-	VehicleConvertDisplacementMat3To4(g_b_vehicle.orientation, mRotateModelMatrix);
-	mmTranslateMatrix(mTranslateModelMatrix, g_b_vehicle.cg[0], g_b_vehicle.cg[1], g_b_vehicle.cg[2]);
-	mmMultiplyMatrix4x4(mTranslateModelMatrix, mRotateModelMatrix, mBaseModelMatrix);
-	mmMultiplyMatrix4x4(mCameraMatrix, mBaseModelMatrix, mModelToCameraMatrix);
-	glBindTexture(GL_TEXTURE_2D, g_wheel_common.texture_id); //wheel texture is just a flat blue square, use it here for car as well.
-	glBindSampler(g_big_terrain.colorTexUnit, g_big_terrain.sampler); //use the terrain's sampler for the car.
-	glUseProgram(g_theProgram);
-	glUniformMatrix4fv(g_modelToCameraMatrixUnif, 1, GL_FALSE, mModelToCameraMatrix);
-	glBindVertexArray(g_vehicle_common.vao);
-	glDrawElements(GL_TRIANGLES,
-				g_vehicle_common.num_indices,
-				GL_UNSIGNED_INT,
-				0);
-	//draw wheels
-	for(i = 0; i < 4; i++) //Assume mBaseModelMatrix contains vehicle local-to-world transform
-	{
-		mmRotateAboutXRad(mRotateModelMatrix, g_b_vehicle.wheelOrientation_X); //TODO: fix the name 'mRotateModelMatrix_Y' since the name should end with _X based on the rotation
-		mmTranslateMatrix(mTranslateModelMatrix, g_b_vehicle.wheels[i].connectPos[0], (g_b_vehicle.wheels[i].connectPos[1]-g_b_vehicle.wheels[i].x+0.5f), g_b_vehicle.wheels[i].connectPos[2]); //adjust y pos pased on wheel displacement x
-
-		//add yaw for front wheels
-		if(i == 0 || i == 1) //front wheels
-		{
-			mmRotateAboutYRad(mRotateModelMatrix_Y, g_b_vehicle.steeringAngle);
-			mmMultiplyMatrix4x4(mRotateModelMatrix_Y, mRotateModelMatrix, mRotateModelMatrix);
-		}
-
-		//start on the right-side: R = (Car_Mat) * (wheel_pos_mat) * (wheel_rot_mat)
-		mmMultiplyMatrix4x4(mTranslateModelMatrix, mRotateModelMatrix, mModelMatrix);
-		mmMultiplyMatrix4x4(mBaseModelMatrix, mModelMatrix, mModelMatrix);
-
-		mmMultiplyMatrix4x4(mCameraMatrix, mModelMatrix, mModelToCameraMatrix);
-		//glUseProgram(g_theProgram) //use the car shader
-		glUniformMatrix4fv(g_modelToCameraMatrixUnif, 1, GL_FALSE, mModelToCameraMatrix);
-		glBindVertexArray(g_wheel_common.vao);
-		glDrawElements(GL_TRIANGLES,
-				g_wheel_common.num_indices,
-				GL_UNSIGNED_INT,
-				0);
-	}
-	
-	//Draw the triangle men:
-	for(i = 0; i < g_soldier_list.num_soldiers; i++)
-	{
-		//don't draw the local player when in the player keyboard state
-		if(g_soldier_list.ptrsToCharacters[i] == &g_a_man 
-				&& g_keyboard_state.state == KEYBOARD_MODE_PLAYER 
-				&& g_camera_state.playerCameraMode == PLAYERCAMERA_FP)
+		glUniform3fv(g_bush_shader.lightDirUnif, 1, lightDir);
+	glUseProgram(g_bush_instanced_shader.program);
+		glUniform3fv(g_bush_instanced_shader.lightDirUnif, 1, lightDir);
+	
+	//the terrain, moveables, plants, items and vehicle go through the render queue, which
+	//sorts them by GL state before they are drawn
+	rqClear(&g_render_queue);
+	QueueTerrainTiles(&g_render_queue, mCameraMatrix);
+	QueueMoveables(&g_render_queue, mCameraMatrix);
+	QueueMoveableBatches(&g_render_queue, mCameraMatrix);
+	QueuePlants(&g_render_queue, mCameraMatrix);
+	QueueItems(&g_render_queue, mCameraMatrix);
+	QueueVehicle(&g_render_queue, mCameraMatrix, snap);
+	rqSort(&g_render_queue);
+	SubmitRenderQueue(&g_render_queue);
+	
+	//Draw the triangle men (the snapshot leaves out the local player in first person):
+	for(i = 0; i < snap->num_characters; i++)
+	{
+		psoldier = &(snap->characters[i]);
+		if(psoldier->skinned_verts == 0) //InitCharacterSkin() failed
 			continue;
-	
-		//draw everybody else	
-		psoldier = g_soldier_list.ptrsToCharacters[i];
-		UpdateCharacterBoneModel(psoldier); //updates the vbo
+		glBindBuffer(GL_ARRAY_BUFFER, psoldier->p_common->vbo);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, (psoldier->p_common->num_verts*8*sizeof(float)), psoldier->skinned_verts);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
 		mmTranslateMatrix(mChildModelMatrix, psoldier->pos[0], (psoldier->pos[1]+psoldier->biasY), psoldier->pos[2]);
 		
 		//check if character is in a car, if so adjust transform so that they are attached to car
 		if(psoldier->flags & CHARACTER_FLAGS_IN_VEHICLE)
 		{
-			mmMultiplyMatrix4x4(mBaseModelMatrix, mChildModelMatrix, mModelMatrix); //TODO: Fix this. This assumes whatever was last vehicle to set mBaseModelMatrix is the car the man is in.
+			mmMultiplyMatrix4x4(snap->mVehicleMatrix, mChildModelMatrix, mModelMatrix); //TODO: Fix this. This assumes the man is in g_b_vehicle.
 		}
 		else
 		{
@@ -2610,7 +2939,7 @@ void DrawScene(void)
 		mmMultiplyMatrix4x4(mCameraMatrix, mModelMatrix, mModelToCameraMatrix);
 		
 		glUseProgram(g_character_shader.program);
-			glUniform3fv(g_character_shader.modelSpaceCameraPosUnif, 1, g_ws_camera_pos);
+			glUniform3fv(g_character_shader.modelSpaceCameraPosUnif, 1, snap->ws_camera_pos);
 			glUniformMatrix4fv(g_character_shader.modelToCameraMatrixUnif, 1, GL_FALSE, mModelToCameraMatrix);
 			glBindSampler(g_character_shader.colorTexUnit, g_triangle_man.sampler);
 			
@@ -2668,755 +2997,4421 @@ void DrawScene(void)
 	glUseProgram(0);
 }
 
-void CalculatePerspectiveMatrix(unsigned int width, unsigned int height)
+/*
+PrepareFrame
+Runs the frame's culling and draw list jobs on g_frame_jobs and times
+them. When it returns, g_terrain_quadtree.visible (with LOD and occluded
+flags), the plant, moveable and item visible lists, their instance and
+item matrices, and the skinned_verts of each character in the snapshot are ready for the draw
+passes, which only read them. No GL calls are made.
+-call after UpdateTerrainPager() and RebuildMoveableBatches()
+*/
+void PrepareFrame(int local_tile, float * mCameraMatrix, struct render_snapshot_struct * snap)
 {
-	float y_scale;
-	float x_scale;
-	float fzNear;
-	float fzFar;
-	
-	//fzNear = 1.0f;
-	fzNear = g_near_distance;
-	fzFar = 10000.0f;
+	struct frame_prep_struct * prep = &g_frame_prep;
+	struct timespec start;
+	struct timespec mid;
+	struct timespec end;
+	struct timespec diff;
 
-	//save the near and far planes for later
-	g_camera_frustum.fzNear = fzNear;
-	g_camera_frustum.fzFar = fzFar;
+	prep->local_tile = local_tile;
+	memcpy(prep->mCameraMatrix, mCameraMatrix, sizeof(float)*16);
+	memcpy(prep->ws_camera_pos, snap->ws_camera_pos, sizeof(float)*3);
+	prep->snapshot = snap;
+	prep->jobs[FRAME_JOB_TERRAIN].func = FrameJobTerrain;
+	prep->jobs[FRAME_JOB_SKINNING].func = FrameJobSkinning;
+	prep->jobs[FRAME_JOB_PLANTS].func = FrameJobPlants;
+	prep->jobs[FRAME_JOB_MOVEABLES].func = FrameJobMoveables;
+	prep->jobs[FRAME_JOB_ITEMS].func = FrameJobItems;
+	prep->jobs[FRAME_JOB_TERRAIN].user = prep;
+	prep->jobs[FRAME_JOB_SKINNING].user = prep;
+	prep->jobs[FRAME_JOB_PLANTS].user = prep;
+	prep->jobs[FRAME_JOB_MOVEABLES].user = prep;
+	prep->jobs[FRAME_JOB_ITEMS].user = prep;
+
+	//everything in group 2 is tested against the terrain horizon from group 1
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	jpRun(&g_frame_jobs, prep->jobs, FRAME_JOB_GROUP2);
+	clock_gettime(CLOCK_MONOTONIC, &mid);
+	jpRun(&g_frame_jobs, (prep->jobs + FRAME_JOB_GROUP2), (FRAME_JOB_NUM - FRAME_JOB_GROUP2));
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	GetElapsedTime(&start, &mid, &diff);
+	prep->group_ms[0] = (diff.tv_sec*1000.0) + (diff.tv_nsec/1000000.0);
+	GetElapsedTime(&mid, &end, &diff);
+	prep->group_ms[1] = (diff.tv_sec*1000.0) + (diff.tv_nsec/1000000.0);
+	prep->total_ms = prep->group_ms[0] + prep->group_ms[1];
+}
 
-	//calculate the projection matrix
-	memset(g_perspectiveMatrix, 0, sizeof(float)*16);
-	y_scale = 1.0f/(tanf((PI/180.0f)*(45.0f/2.0f)));
-	x_scale = y_scale / ((float)width/(float)height);
-	g_perspectiveMatrix[0] = x_scale;
-	g_perspectiveMatrix[5] = y_scale;
-	g_perspectiveMatrix[10] = (fzFar + fzNear) / (fzNear - fzFar);
-	g_perspectiveMatrix[14] = (2 * fzFar * fzNear) / (fzNear - fzFar);
-	g_perspectiveMatrix[11] = -1.0f;
-	//printf("x_scale:%f y_scale:%f\n", x_scale, y_scale);
+/*
+FrameJobTerrain
+Walks the terrain quadtree for the tiles the terrain and vegetation
+passes look at, picks their LOD levels, then finds what is hidden behind
+nearer terrain (the occluders depend on the LOD levels).
+*/
+void FrameJobTerrain(void * user)
+{
+	struct frame_prep_struct * prep = (struct frame_prep_struct*)user;
+
+	UpdateVisibleTerrainTiles(prep->local_tile);
+	UpdateTerrainLod(prep->ws_camera_pos, g_terrain_quadtree.visible, g_terrain_quadtree.num_visible);
+	UpdateTerrainOcclusion(g_camera_frustum.camera, 1);
 }
 
-int InitTerrain(void)
+/*
+FrameJobSkinning
+Poses the verts of each character in the snapshot into its skinned_verts.
+The characters share the bone scratch arrays of their common model, so
+they are done one after another in this one job.
+*/
+void FrameJobSkinning(void * user)
 {
-	struct DEM_info_struct demInfo;
-	FILE * pFile;
-	//char filename[255] = "./resources/maps/wake_island_1_3sec.asc";
-	//char filename[255] = "./resources/maps/dem5.asc";
-	//char filename[255] = "./resources/maps/dem6.asc"; //last good map
-	char filename[255] = "./resources/maps/dem7.asc"; //test map with noise
-	float min, max;
-	float f;
-	float v1[3]; //for normal calculation
-	float v2[3]; //for normal calculation
-	float sum[3]; //for normal calculation
-	float temp_normal[3]; //for normal calculation
-	int f_count;
-	int f_col_count;
-	int i,j;
-	int k,l;
-	int r;
-	int tile_i;
-	int vert_i;
-	int lastrow_i;
-	int lastcol_i;
-	int t; //overall iterator for verts
-	int found_eof=0;
-	int num_floats_per_vert; //make this a local variable so we don't have to keep referencing it all over the place.
-	
-	pFile = fopen(filename, "r");
-	if(pFile == 0)
-	{
-		printf("InitTerrain: error. could not open %s\n", filename);
-		return 0;
-	}
-	printf("opened dem file.\n");
-	demInfo.pFile = pFile;
-	DEMLoadInfo(&demInfo);
-	DEMGetMinMaxElevation(&demInfo, &min, &max);
-	
-	//allocate a map of lvl 1 tiles to cover the DEM file: 38 rows, 38 columns
-	g_big_terrain.num_tiles = 1521; //39*39
-	g_big_terrain.num_cols = 39;
-	g_big_terrain.num_rows = 39;
-	num_floats_per_vert = 8; //{pos[3]; normal[3]; texcoord[2]}
-	g_big_terrain.num_floats_per_vert = num_floats_per_vert; //pos only
-	g_big_terrain.nodrawDist = 10000.0f;
-	g_big_terrain.tile_len[0] = 990.0f; //size of a tile in x dir (TODO: Don't make this value hard-coded) (1.0 => 1 meter)
-	g_big_terrain.tile_len[1] = 990.0f; //size of a tile in z dir
-	g_big_terrain.tile_num_quads[0] = 99;
-	g_big_terrain.tile_num_quads[1] = 99;
-	g_big_terrain.pTiles = (struct lvl_1_tile*)malloc(1521*sizeof(struct lvl_1_tile)); //1521 = 39x39 tiles
-	if(g_big_terrain.pTiles == 0)
+	struct frame_prep_struct * prep = (struct frame_prep_struct*)user;
+	int i;
+
+	for(i = 0; i < prep->snapshot->num_characters; i++)
 	{
-		printf("InitTerrain: malloc failed for g_big_terrain.pTiles\n");
-		fclose(pFile);
-		return 0;
+		SkinCharacterModel(&(prep->snapshot->characters[i]));
 	}
-	
-	//allocate memory for each tile
-	k = 0; //row
-	l = 0; //column
-	for(i = 0; i < g_big_terrain.num_tiles; i++)
-	{
-		g_big_terrain.pTiles[i].num_z = 100; //number of vertices along one tile's x edge
-		g_big_terrain.pTiles[i].num_x = 100; //number of vertices along one tile's z edge
-		g_big_terrain.pTiles[i].num_verts = 10000;
-		g_big_terrain.pTiles[i].pPos = (float*)malloc(10000*g_big_terrain.num_floats_per_vert*sizeof(float));
-		if(g_big_terrain.pTiles[i].pPos == 0)
-		{
-			printf("InitTerrain: malloc failed for tile %d\n", i);
-			fclose(pFile);
-			return 0;
-		}
-		
-		/*
+}
+
+void FrameJobPlants(void * user)
+{
+	UpdateVisiblePlants(&g_bush_grid, g_camera_frustum.camera);
+	UpdatePlantDrawLists(&g_bush_grid);
+}
+
+void FrameJobMoveables(void * user)
+{
+	UpdateVisibleMoveables(&g_moveables_grid, g_camera_frustum.camera);
+	UpdateMoveableInstances(&g_moveables_grid);
+	UpdateVisibleMoveableBatches(&g_moveables_grid, g_camera_frustum.camera);
+}
+
+void FrameJobItems(void * user)
+{
+	struct frame_prep_struct * prep = (struct frame_prep_struct*)user;
+
+	UpdateVisibleItems(&g_bush_grid, g_camera_frustum.camera);
+	UpdateItemDrawList(&g_bush_grid, prep->mCameraMatrix);
+}
+
+/*
+QueueTerrainTiles
+Adds a draw for each terrain tile that is in the draw box and frustum,
+paged in and not behind nearer terrain, at the tile's LOD level.
+*/
+void QueueTerrainTiles(struct rq_queue_struct * queue, float * mCameraMatrix)
+{
+	struct rq_packet_struct * packet;
+	struct lvl_1_tile * ptile;
+	int lod_level;
+	int lod_mask;
+	int i_visible;
+
+	for(i_visible = 0; i_visible < g_terrain_quadtree.num_visible; i_visible++)
+	{
+		//tiles in the draw box and camera frustum (see UpdateVisibleTerrainTiles)
+		ptile = g_big_terrain.pTiles + g_terrain_quadtree.visible[i_visible];
+		
+		//skip tiles that are still paged out
+		if(ptile->vbo_loaded == 0)
+			continue;
+		
+		//and tiles behind nearer terrain (see UpdateTerrainOcclusion)
+		if(ptile->occluded == 1)
+			continue;
+		
+		packet = rqAdd(queue);
+		if(packet == 0)
+			return;
+		
+		//draw the terrain tile at the LOD level picked by UpdateTerrainLod(), the model matrix is the identity
+		lod_level = ptile->lod_level;
+		lod_mask = ptile->lod_mask;
+		packet->program = g_theProgram;
+		packet->texture = g_big_terrain.textureId;
+		packet->sampler = g_big_terrain.sampler;
+		packet->vao = ptile->vao;
+		packet->draw_type = RQ_DRAW_ELEMENTS;
+		packet->count = g_big_terrain.lod.count[lod_level][lod_mask];
+		packet->index_type = GL_UNSIGNED_SHORT;
+		packet->offset = (long)(g_big_terrain.lod.offset[lod_level][lod_mask]*sizeof(GLushort)); //offset into the VAO's IBO
+		packet->matrix_unif = g_modelToCameraMatrixUnif;
+		memcpy(packet->matrix, mCameraMatrix, sizeof(float)*16);
+		packet->key = rqMakeKey(RENDER_PASS_OPAQUE, packet->program, packet->texture, packet->vao, GetTileCameraDist(ptile, g_frame_prep.ws_camera_pos));
+		g_debug_num_terrain_triangles += g_big_terrain.lod.count[lod_level][lod_mask]/3;
+		g_debug_num_terrain_full_triangles += g_big_terrain.lod.count[0][0]/3;
+	}
+}
+
+/*
+QueueMoveables
+Adds one instanced draw per moveable_type for the moveables that passed
+UpdateVisibleMoveables(), and uploads their matrices (see
+UpdateMoveableInstances).
+*/
+void QueueMoveables(struct rq_queue_struct * queue, float * mCameraMatrix)
+{
+	struct rq_packet_struct * packet;
+	struct simple_model_struct * p_model;
+	int num;
+	int k;
+
+	g_moveables_grid.num_instance_draws = 0;
+	num = g_moveables_grid.instance_first[(OC_MAX_TYPES-1)] + g_moveables_grid.instance_num[(OC_MAX_TYPES-1)];
+	if(num == 0)
+		return;
+	glBindBuffer(GL_ARRAY_BUFFER, g_moveables_grid.instance_vbo);
+	glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)(num*16*sizeof(float)), g_moveables_grid.instance_mats, GL_STREAM_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	for(k = 0; k < OC_MAX_TYPES; k++)
+	{
+		if(g_moveables_grid.instance_num[k] == 0)
+			continue;
+		packet = rqAdd(queue);
+		if(packet == 0)
+			return;
+
+		//only known types are added to the cull list, so the model is never 0
+		p_model = GetMoveableModelCommon(k);
+		packet->program = g_bush_instanced_shader.program;
+		packet->texture = p_model->texture_id;
+		packet->sampler = g_bush_branchtex_sampler; //use branch sampler because it clamps to edge
+		if(k == MOVEABLE_TYPE_WAREHOUSE)
+			packet->sampler = g_bush_trunktex_sampler; //the trunk sampler repeats, which the siding texture needs
+		packet->vao = p_model->vao;
+		packet->draw_type = RQ_DRAW_ELEMENTS;
+		packet->count = p_model->num_indices;
+		packet->index_type = GL_UNSIGNED_INT;
+		packet->num_instances = g_moveables_grid.instance_num[k];
+		packet->instance_vbo = g_moveables_grid.instance_vbo;
+		packet->instance_attrib = 3;	//the matrix columns, see InitMoveableInstancing
+		packet->instance_columns = 4;
+		packet->instance_size = 4;
+		packet->instance_offset = (long)(g_moveables_grid.instance_first[k]*16*sizeof(float));
+		packet->matrix_unif = g_bush_instanced_shader.modelToCameraMatrixUnif;
+		memcpy(packet->matrix, mCameraMatrix, sizeof(float)*16);
+		packet->key = rqMakeKey(RENDER_PASS_OPAQUE, packet->program, packet->texture, packet->vao, 0.0f);
+		g_moveables_grid.num_instance_draws += 1;
+	}
+}
+
+/*
+QueueMoveableBatches
+Adds a draw for each static moveable batch that passed
+UpdateVisibleMoveableBatches(). The batches are already in world space.
+*/
+void QueueMoveableBatches(struct rq_queue_struct * queue, float * mCameraMatrix)
+{
+	struct rq_packet_struct * packet;
+	struct moveable_batch_struct * p_batch;
+	float center[3];
+	int i;
+
+	for(i = 0; i < g_moveables_grid.batch_visible.num[0]; i++)
+	{
+		packet = rqAdd(queue);
+		if(packet == 0)
+			return;
+		p_batch = g_moveables_grid.batches + g_moveables_grid.batch_visible.ids[(g_moveables_grid.batch_visible.first[0] + i)];
+		packet->program = g_bush_shader.program;
+		packet->texture = GetMoveableModelCommon(p_batch->moveable_type)->texture_id;
+		packet->sampler = g_bush_branchtex_sampler;
+		if(p_batch->moveable_type == MOVEABLE_TYPE_WAREHOUSE)
+			packet->sampler = g_bush_trunktex_sampler; //the trunk sampler repeats, which the siding texture needs
+		packet->vao = p_batch->vao;
+		packet->draw_type = RQ_DRAW_ELEMENTS;
+		packet->count = p_batch->num_indices;
+		packet->index_type = GL_UNSIGNED_INT;
+		packet->matrix_unif = g_bush_shader.modelToCameraMatrixUnif;
+		memcpy(packet->matrix, mCameraMatrix, sizeof(float)*16);
+		center[0] = (p_batch->box_min[0] + p_batch->box_max[0])*0.5f;
+		center[1] = (p_batch->box_min[1] + p_batch->box_max[1])*0.5f;
+		center[2] = (p_batch->box_min[2] + p_batch->box_max[2])*0.5f;
+		packet->key = rqMakeKey(RENDER_PASS_OPAQUE, packet->program, packet->texture, packet->vao, GetCameraDist(center));
+	}
+}
+
+/*
+QueuePlants
+Adds the plants that UpdatePlantDrawLists() picked. Billboards are one
+instanced draw per plant type for each tile that uses its static buffer,
+plus one per type for the plants gathered from the other tiles. Detailed
+plants are one instanced draw per model part. The per-frame instance
+buffers are uploaded here, before the queue is submitted.
+*/
+void QueuePlants(struct rq_queue_struct * queue, float * mCameraMatrix)
+{
+	struct rq_packet_struct * packet;
+	struct plant_tile * p_plant_tile;
+	struct plant_billboard * p_part;
+	int iplant_type;
+	int part_flags;
+	int j;
+	int k;
+
+	for(k = 0; k < g_bush_grid.num_static_billboards; k++)
+	{
+		p_plant_tile = g_bush_grid.p_tiles + g_bush_grid.static_billboards[(k*2)];
+		UpdatePlantTileBillboardVbo(p_plant_tile);
+	}
+	if(g_gl_record != 0)
+	{
+		g_gl_record->num_uploads += 2;
+	}
+	else
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, g_bush_smallbillboard.instance_vbo);
+		glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)((g_bush_grid.billboard_first[5] + g_bush_grid.billboard_num[5])*3*sizeof(float)), g_bush_grid.billboard_pos, GL_STREAM_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, g_bush_grid.detail_vbo);
+		glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)((g_bush_grid.detail_first[5] + g_bush_grid.detail_num[5])*16*sizeof(float)), g_bush_grid.detail_mats, GL_STREAM_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	//billboards
+	k = 0;
+	for(iplant_type = 0; iplant_type < 6; iplant_type++)
+	{
+		for(; k < g_bush_grid.num_static_billboards && g_bush_grid.static_billboards[(k*2)+1] == iplant_type; k++)
+		{
+			p_plant_tile = g_bush_grid.p_tiles + g_bush_grid.static_billboards[(k*2)];
+			if(p_plant_tile->billboard_dirty == 1) //the vbo update failed
+				continue;
+			packet = rqAdd(queue);
+			if(packet == 0)
+				return;
+			packet->instance_vbo = p_plant_tile->billboard_vbo;
+			packet->instance_offset = (long)(p_plant_tile->billboard_first[iplant_type]*3*sizeof(float));
+			packet->num_instances = p_plant_tile->cull_spheres.type_count[iplant_type];
+			g_debug_num_billboard_draws += 1;
+			g_debug_num_billboard_plants += packet->num_instances;
+			QueuePlantBillboard(packet, iplant_type, mCameraMatrix);
+		}
+		if(g_bush_grid.billboard_num[iplant_type] == 0)
+			continue;
+		packet = rqAdd(queue);
+		if(packet == 0)
+			return;
+		packet->instance_vbo = g_bush_smallbillboard.instance_vbo;
+		packet->instance_offset = (long)(g_bush_grid.billboard_first[iplant_type]*3*sizeof(float));
+		packet->num_instances = g_bush_grid.billboard_num[iplant_type];
+		g_debug_num_billboard_draws += 1;
+		g_debug_num_billboard_plants += packet->num_instances;
+		QueuePlantBillboard(packet, iplant_type, mCameraMatrix);
+	}
+
+	//detailed plants
+	for(iplant_type = 0; iplant_type < 6; iplant_type++)
+	{
+		if(g_bush_grid.detail_num[iplant_type] == 0)
+			continue;
+		for(j = 0; j < 2; j++)
+		{
+			p_part = g_bush_grid.detail_parts[iplant_type][j];
+			if(p_part == 0)
+				continue;
+			packet = rqAdd(queue);
+			if(packet == 0)
+				return;
+			part_flags = g_bush_grid.detail_part_flags[iplant_type][j];
+			packet->program = g_bush_instanced_shader.program;
+			packet->texture = p_part->texture_id;
+			packet->sampler = (part_flags & PLANT_PART_TRUNK) ? g_bush_trunktex_sampler : g_bush_branchtex_sampler;
+			packet->vao = p_part->vao;
+			packet->two_sided = (part_flags & PLANT_PART_TWO_SIDED) ? 1 : 0;
+			packet->draw_type = RQ_DRAW_ELEMENTS;
+			packet->count = p_part->num_indices;
+			packet->index_type = GL_UNSIGNED_INT;
+			packet->num_instances = g_bush_grid.detail_num[iplant_type];
+			packet->instance_vbo = g_bush_grid.detail_vbo;
+			packet->instance_attrib = 3;	//the matrix columns, see InitPlantDetailParts
+			packet->instance_columns = 4;
+			packet->instance_size = 4;
+			packet->instance_offset = (long)(g_bush_grid.detail_first[iplant_type]*16*sizeof(float));
+			packet->matrix_unif = g_bush_instanced_shader.modelToCameraMatrixUnif;
+			memcpy(packet->matrix, mCameraMatrix, sizeof(float)*16);
+			packet->key = rqMakeKey(RENDER_PASS_OPAQUE, packet->program, packet->texture, packet->vao, 0.0f);
+			g_debug_num_himodel_plant_draws += 1;
+		}
+	}
+}
+
+/*
+QueuePlantBillboard
+Fills in the parts of a billboard packet that only depend on the plant
+type. The caller sets the instances.
+*/
+void QueuePlantBillboard(struct rq_packet_struct * packet, int iplant_type, float * mCameraMatrix)
+{
+	packet->program = g_billboard_shader.program;
+	packet->texture = g_bush_smallbillboard.texture_ids[iplant_type];
+	packet->sampler = g_bush_branchtex_sampler;
+	packet->vao = g_bush_smallbillboard.vao;
+	packet->draw_type = RQ_DRAW_ARRAYS;
+	packet->count = g_bush_smallbillboard.num_verts;
+	packet->instance_attrib = 2;	//instancePos, see LoadSimpleBillboardVBO
+	packet->instance_columns = 1;
+	packet->instance_size = 3;
+	packet->matrix_unif = g_billboard_shader.modelToCameraMatrixUnif;
+	memcpy(packet->matrix, mCameraMatrix, sizeof(float)*16);
+	packet->vec2_unif = g_billboard_shader.billboardSizeUnif;
+	packet->vec2[0] = g_bush_smallbillboard.size[(iplant_type*2)];
+	packet->vec2[1] = g_bush_smallbillboard.size[(iplant_type*2)+1];
+	packet->key = rqMakeKey(RENDER_PASS_OPAQUE, packet->program, packet->texture, packet->vao, 0.0f);
+}
+
+/*
+QueueItems
+Adds a draw for each item on the ground that passed UpdateVisibleItems(),
+with the matrices from UpdateItemDrawList().
+*/
+void QueueItems(struct rq_queue_struct * queue, float * mCameraMatrix)
+{
+	struct rq_packet_struct * packet;
+	struct item_struct * pitem;
+	struct item_common_struct * p_item_common;
+	int * p_ids;
+	int j;
+	int k;
+
+	for(k = 0; k < OC_MAX_TYPES; k++)
+	{
+		if(g_bush_grid.visible_items.num[k] == 0)
+			continue;
+
+		//only item types with a model are added to the cull list
+		p_item_common = GetItemCommon((unsigned char)k);
+		p_ids = g_bush_grid.visible_items.ids + g_bush_grid.visible_items.first[k];
+		for(j = 0; j < g_bush_grid.visible_items.num[k]; j++)
+		{
+			packet = rqAdd(queue);
+			if(packet == 0)
+				return;
+			pitem = g_bush_grid.cull_items[p_ids[j]];
+			packet->program = g_bush_shader.program;
+			packet->texture = p_item_common->texture_id;
+			packet->sampler = g_bush_branchtex_sampler;
+			packet->vao = p_item_common->vao;
+			packet->draw_type = RQ_DRAW_ELEMENTS;
+			packet->count = p_item_common->num_indices;
+			packet->index_type = GL_UNSIGNED_INT;
+			packet->matrix_unif = g_bush_shader.modelToCameraMatrixUnif;
+			memcpy(packet->matrix, (g_bush_grid.item_mats + ((g_bush_grid.visible_items.first[k] + j)*16)), sizeof(float)*16); //see UpdateItemDrawList
+			packet->key = rqMakeKey(RENDER_PASS_OPAQUE, packet->program, packet->texture, packet->vao, GetCameraDist(pitem->pos));
+		}
+	}
+}
+
+/*
+QueueVehicle
+Adds the draws for vehicle b and its wheels, with the transforms from
+the snapshot.
+*/
+void QueueVehicle(struct rq_queue_struct * queue, float * mCameraMatrix, struct render_snapshot_struct * snap)
+{
+	struct rq_packet_struct * packet;
+	float dist;
+	int i;
+
+	dist = GetCameraDist(snap->mVehicleMatrix + 12); //translation column is the cg
+	
+	packet = rqAdd(queue);
+	if(packet == 0)
+		return;
+	packet->program = g_theProgram;
+	packet->texture = g_wheel_common.texture_id; //wheel texture is just a flat blue square, use it here for car as well.
+	packet->sampler = g_big_terrain.sampler; //use the terrain's sampler for the car.
+	packet->vao = g_vehicle_common.vao;
+	packet->draw_type = RQ_DRAW_ELEMENTS;
+	packet->count = g_vehicle_common.num_indices;
+	packet->index_type = GL_UNSIGNED_INT;
+	packet->matrix_unif = g_modelToCameraMatrixUnif;
+	mmMultiplyMatrix4x4(mCameraMatrix, snap->mVehicleMatrix, packet->matrix);
+	packet->key = rqMakeKey(RENDER_PASS_OPAQUE, packet->program, packet->texture, packet->vao, dist);
+	
+	//wheels
+	for(i = 0; i < 4; i++)
+	{
+		packet = rqAdd(queue);
+		if(packet == 0)
+			return;
+		packet->program = g_theProgram;
+		packet->texture = g_wheel_common.texture_id;
+		packet->sampler = g_big_terrain.sampler;
+		packet->vao = g_wheel_common.vao;
+		packet->draw_type = RQ_DRAW_ELEMENTS;
+		packet->count = g_wheel_common.num_indices;
+		packet->index_type = GL_UNSIGNED_INT;
+		packet->matrix_unif = g_modelToCameraMatrixUnif;
+		mmMultiplyMatrix4x4(mCameraMatrix, snap->mWheelMatrices[i], packet->matrix);
+		packet->key = rqMakeKey(RENDER_PASS_OPAQUE, packet->program, packet->texture, packet->vao, dist);
+	}
+}
+
+/*
+SubmitRenderQueue
+Draws the packets of a queue in the order rqSort() left them in. The
+program, texture, sampler, vao and face culling are only changed when the
+next packet needs something else. Texture unit 0 must be active.
+While g_gl_record is set the calls are recorded instead of made.
+*/
+void SubmitRenderQueue(struct rq_queue_struct * queue)
+{
+	struct rq_packet_struct * packet;
+	struct rq_packet_struct * prev=0;
+	int i;
+	int c;
+
+	if(g_gl_record != 0)
+	{
+		RecordRenderQueue(queue, g_gl_record);
+		return;
+	}
+	for(i = 0; i < queue->num; i++)
+	{
+		packet = queue->packets + queue->order[i].packet;
+		if(prev == 0 || packet->program != prev->program)
+			glUseProgram(packet->program);
+		if(prev == 0 || packet->texture != prev->texture)
+			glBindTexture(GL_TEXTURE_2D, packet->texture);
+		if(prev == 0 || packet->sampler != prev->sampler)
+			glBindSampler(0, packet->sampler);
+		if(prev == 0 || packet->vao != prev->vao)
+			glBindVertexArray(packet->vao);
+		if((prev == 0 && packet->two_sided == 1) || (prev != 0 && packet->two_sided != prev->two_sided))
+		{
+			if(packet->two_sided == 1)
+				glDisable(GL_CULL_FACE);	//draw both face sides, blender will only export one triangle.
+			else
+				glEnable(GL_CULL_FACE);
+		}
+		prev = packet;
+
+		if(packet->matrix_unif != -1)
+			glUniformMatrix4fv(packet->matrix_unif, 1, GL_FALSE, packet->matrix);
+		if(packet->vec2_unif != -1)
+			glUniform2fv(packet->vec2_unif, 1, packet->vec2);
+
+		if(packet->num_instances == 0)
+		{
+			if(packet->draw_type == RQ_DRAW_ELEMENTS)
+				glDrawElements(GL_TRIANGLES, packet->count, packet->index_type, (GLvoid*)packet->offset);
+			else
+				glDrawArrays(GL_TRIANGLES, 0, packet->count);
+			continue;
+		}
+
+		//point the vao's per-instance attributes at the packet's first instance
+		glBindBuffer(GL_ARRAY_BUFFER, packet->instance_vbo);
+		for(c = 0; c < packet->instance_columns; c++)
+		{
+			glVertexAttribPointer((packet->instance_attrib + c), packet->instance_size, GL_FLOAT, GL_FALSE, 
+					(packet->instance_columns*packet->instance_size*sizeof(float)), 
+					(GLvoid*)(packet->instance_offset + (c*packet->instance_size*sizeof(float))));
+		}
+		if(packet->draw_type == RQ_DRAW_ELEMENTS)
+			glDrawElementsInstanced(GL_TRIANGLES, packet->count, packet->index_type, (GLvoid*)packet->offset, packet->num_instances);
+		else
+			glDrawArraysInstanced(GL_TRIANGLES, 0, packet->count, packet->num_instances);
+	}
+	if(prev != 0 && prev->two_sided == 1)
+		glEnable(GL_CULL_FACE);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+/*
+RecordRenderQueue
+Adds the draw calls SubmitRenderQueue() would make for a queue to record,
+and counts the state changes between them, without calling GL.
+*/
+void RecordRenderQueue(struct rq_queue_struct * queue, struct gl_record_struct * record)
+{
+	struct rq_packet_struct * packet;
+	struct rq_packet_struct * prev=0;
+	struct gl_record_draw_struct * draw;
+	int i;
+
+	for(i = 0; i < queue->num; i++)
+	{
+		packet = queue->packets + queue->order[i].packet;
+		record->num_state_changes += rqCountStateChanges(prev, packet);
+		prev = packet;
+		if(record->num_draws < record->max_draws)
+		{
+			draw = record->draws + record->num_draws;
+			draw->program = packet->program;
+			draw->texture = packet->texture;
+			draw->vao = packet->vao;
+			draw->count = packet->count;
+			draw->num_instances = packet->num_instances;
+		}
+		record->num_draws += 1;
+	}
+}
+
+/*
+GetCameraDist
+returns the distance from the camera to pos
+*/
+float GetCameraDist(float * pos)
+{
+	float v[3];
+
+	vSubtract(v, pos, g_frame_prep.ws_camera_pos);
+	return vMagnitude(v);
+}
+
+void CalculatePerspectiveMatrix(unsigned int width, unsigned int height)
+{
+	float y_scale;
+	float x_scale;
+	float fzNear;
+	float fzFar;
+	
+	//fzNear = 1.0f;
+	fzNear = g_near_distance;
+	fzFar = 10000.0f;
+
+	//save the near and far planes for later
+	g_camera_frustum.fzNear = fzNear;
+	g_camera_frustum.fzFar = fzFar;
+
+	//calculate the projection matrix
+	memset(g_perspectiveMatrix, 0, sizeof(float)*16);
+	y_scale = 1.0f/(tanf((PI/180.0f)*(45.0f/2.0f)));
+	x_scale = y_scale / ((float)width/(float)height);
+	g_perspectiveMatrix[0] = x_scale;
+	g_perspectiveMatrix[5] = y_scale;
+	g_perspectiveMatrix[10] = (fzFar + fzNear) / (fzNear - fzFar);
+	g_perspectiveMatrix[14] = (2 * fzFar * fzNear) / (fzNear - fzFar);
+	g_perspectiveMatrix[11] = -1.0f;
+	//printf("x_scale:%f y_scale:%f\n", x_scale, y_scale);
+}
+
+/*
+InitTerrain
+Loads the terrain tiles from dem_filename, or from the default map if
+dem_filename is 0.
+returns 1 on success, 0 on failure
+*/
+int InitTerrain(char * dem_filename)
+{
+	//char filename[255] = "./resources/maps/wake_island_1_3sec.asc";
+	//char filename[255] = "./resources/maps/dem5.asc";
+	//char filename[255] = "./resources/maps/dem6.asc"; //last good map
+	char filename[255] = "./resources/maps/dem7.asc"; //test map with noise
+	char cache_filename[255+8]; //filename + ".tcache"
+	struct tcache_struct cache;
+	unsigned long long dem_checksum;
+	long long dem_size;
+	float min, max;
+	int i;
+	int k,l;
+	int r;
+	int num_floats_per_vert; //make this a local variable so we don't have to keep referencing it all over the place.
+	
+	if(dem_filename != 0)
+		snprintf(filename, 255, "%s", dem_filename);
+	
+	//allocate a map of lvl 1 tiles to cover the DEM file
+	r = InitTerrainGeometry(filename);
+	if(r == 0)
+	{
+		return 0;
+	}
+	num_floats_per_vert = 8; //{pos[3]; normal[3]; texcoord[2]}
+	g_big_terrain.num_floats_per_vert = num_floats_per_vert; //pos only
+	g_big_terrain.nodrawDist = 10000.0f;
+	g_big_terrain.pTiles = (struct lvl_1_tile*)malloc(g_big_terrain.num_tiles*sizeof(struct lvl_1_tile));
+	if(g_big_terrain.pTiles == 0)
+	{
+		printf("InitTerrain: malloc failed for g_big_terrain.pTiles\n");
+		return 0;
+	}
+	
+	//allocate memory for each tile
+	k = 0; //row
+	l = 0; //column
+	for(i = 0; i < g_big_terrain.num_tiles; i++)
+	{
+		g_big_terrain.pTiles[i].num_z = g_big_terrain.tile_num_quads[1] + 1; //number of vertices along one tile's x edge
+		g_big_terrain.pTiles[i].num_x = g_big_terrain.tile_num_quads[0] + 1; //number of vertices along one tile's z edge
+		g_big_terrain.pTiles[i].num_verts = g_big_terrain.pTiles[i].num_x*g_big_terrain.pTiles[i].num_z;
+		g_big_terrain.pTiles[i].pHeights = 0; //allocated once we know whether tiles are paged
+		g_big_terrain.pTiles[i].pNormals = 0;
+		g_big_terrain.pTiles[i].pQHeights = 0;
+		g_big_terrain.pTiles[i].pCoarseHeights = 0;
+		g_big_terrain.pTiles[i].height_scale = 0.0f;
+		g_big_terrain.pTiles[i].height_bias = 0.0f;
+		g_big_terrain.pTiles[i].vbo = 0;
+		g_big_terrain.pTiles[i].vao = 0;
+		g_big_terrain.pTiles[i].vbo_loaded = 0;
+		memset(g_big_terrain.pTiles[i].lod_error, 0, sizeof(g_big_terrain.pTiles[i].lod_error));
+		g_big_terrain.pTiles[i].lod_level = 0;
+		g_big_terrain.pTiles[i].pBlockMaxHeights = 0;
+		g_big_terrain.pTiles[i].pBlockMinHeights = 0;
+		g_big_terrain.pTiles[i].occluded = 0;
+		g_big_terrain.pTiles[i].lod_mask = 0;
+		
+		/*
 		On a side, for level 1 tiles n, the number of verts, is 100, so
 		the length of the side is n-1, so 990.0f if the distance between
 		each vertex is 10.0f.
-		distance between each vertex is 10.0f so each side is 990.0f
 		*/
-		g_big_terrain.pTiles[i].urcorner[0] = l*990.0f; //x
-		g_big_terrain.pTiles[i].urcorner[1] = k*990.0f; //z
+		g_big_terrain.pTiles[i].urcorner[0] = l*g_big_terrain.tile_len[0]; //x
+		g_big_terrain.pTiles[i].urcorner[1] = k*g_big_terrain.tile_len[1]; //z
 		l += 1;
 		if(l == g_big_terrain.num_cols)
 		{
-			k += 1; //increment the row
-			l = 0; //reset the column index
+			k += 1; //increment the row
+			l = 0; //reset the column index
+		}
+	}
+	printf("initialized %d tiles. k=%d l=%d\n", i, k, l);
+	
+	/*
+	Check for a binary cache of this DEM file. The checksum covers the
+	whole .asc file so editing the map invalidates the cache.
+	*/
+	r = tcChecksumFile(filename, &dem_checksum, &dem_size);
+	if(r == 0)
+	{
+		printf("InitTerrain: error. could not read %s\n", filename);
+		return 0;
+	}
+	snprintf(cache_filename, sizeof(cache_filename), "%s.tcache", filename);
+	r = tcOpenCache(&cache, cache_filename, dem_checksum, dem_size);
+	if(r == 1)
+		r = InitTerrainCheckCache(&cache);
+	if(r == 1 && g_terrain_pager.radius > 0.0f)
+	{
+		//tiles are paged in from the cache as the camera moves
+		r = InitTerrainPager(&cache);
+		if(r == 0)
+			return 0;
+		printf("paging terrain from %s\n", cache_filename);
+	}
+	else if(r == 1)
+	{
+		r = InitTerrainAllocTileData();
+		if(r == 0)
+		{
+			tcCloseCache(&cache);
+			return 0;
+		}
+		r = InitTerrainLoadCache(&cache);
+		tcCloseCache(&cache);
+		if(r == 1)
+			printf("loaded terrain from %s\n", cache_filename);
+	}
+	else
+	{
+		tcCloseCache(&cache);
+		
+		//no usable cache, so parse the DEM file and save the result for next time
+		r = InitTerrainAllocTileData();
+		if(r == 0)
+		{
+			return 0;
+		}
+		r = InitTerrainLoadDEM(filename, &min, &max);
+		if(r == 0)
+		{
+			return 0;
+		}
+		r = InitTerrainCalcNormals();
+		if(r == 0)
+		{
+			return 0;
+		}
+		for(i = 0; i < g_big_terrain.num_tiles; i++)
+		{
+			CalcTileLodErrors(&(g_big_terrain.pTiles[i]));
+			CalcTileBlockHeights(&(g_big_terrain.pTiles[i]));
+		}
+		r = InitTerrainSaveCache(cache_filename, dem_checksum, dem_size, min, max);
+		
+		//paging needs the cache, so reopen what was just written. Every tile is resident until it is evicted
+		if(r == 1 && g_terrain_pager.radius > 0.0f)
+		{
+			r = tcOpenCache(&cache, cache_filename, dem_checksum, dem_size);
+			if(r == 1)
+				r = InitTerrainPager(&cache);
+			if(r == 0)
+				printf("InitTerrain: could not page terrain, keeping every tile resident.\n");
+		}
+	}
+	
+	//the cache always holds float heights, so quantize after it is written
+	if(g_big_terrain.height_max_error > 0.0f)
+	{
+		r = InitTerrainQuantizeHeights();
+		if(r == 0)
+		{
+			return 0;
+		}
+	}
+	
+	//setup indices for the enumeration buffer, every LOD level of a tile
+	r = tlMakeElements(&(g_big_terrain.lod), g_big_terrain.pTiles[0].num_x, g_big_terrain.pTiles[0].num_z);
+	if(r == 0)
+	{
+		return 0;
+	}
+	g_big_terrain.lod_levels = (char*)malloc(g_big_terrain.num_tiles*sizeof(char));
+	if(g_big_terrain.lod_levels == 0)
+	{
+		printf("InitTerrain: malloc failed for lod_levels\n");
+		return 0;
+	}
+	
+	//quadtree for culling groups of tiles
+	r = qtInit(&g_terrain_quadtree, g_big_terrain.num_cols, g_big_terrain.num_rows, g_big_terrain.tile_len[0], g_big_terrain.tile_len[1]);
+	if(r == 0)
+	{
+		return 0;
+	}
+	for(i = 0; i < g_big_terrain.num_tiles; i++)
+	{
+		qtSetTileHeights(&g_terrain_quadtree, i, g_big_terrain.pTiles[i].min_height, g_big_terrain.pTiles[i].max_height);
+	}
+	
+	return 1;
+}
+
+/*
+InitTerrainGeometry
+Sets the map size, tile size and vert spacing of g_big_terrain. Values
+given on the command line (g_terrain_config) win. Otherwise the map gets
+enough tiles to cover the DEM, and the vert spacing is the DEM cellsize.
+A cellsize under 1cm is taken to be in degrees (geographic DEM) and the
+default spacing is used instead.
+returns 1 on success, 0 on failure
+*/
+int InitTerrainGeometry(char * filename)
+{
+	struct DEM_info_struct demInfo;
+	int tile_verts;
+	int r;
+	
+	r = DEMOpen(&demInfo, filename);
+	if(r == 0)
+	{
+		printf("InitTerrainGeometry: error. could not open %s\n", filename);
+		return 0;
+	}
+	DEMClose(&demInfo);
+	
+	tile_verts = TERRAIN_DEFAULT_TILE_VERTS;
+	if(g_terrain_config.tile_verts != 0)
+		tile_verts = g_terrain_config.tile_verts;
+	if(tile_verts < TERRAIN_MIN_TILE_VERTS || tile_verts > TERRAIN_MAX_TILE_VERTS)
+	{
+		printf("InitTerrainGeometry: error. tile verts %d not in [%d,%d]\n", tile_verts, TERRAIN_MIN_TILE_VERTS, TERRAIN_MAX_TILE_VERTS);
+		return 0;
+	}
+	g_big_terrain.tile_num_quads[0] = tile_verts-1;
+	g_big_terrain.tile_num_quads[1] = tile_verts-1;
+	
+	//tiles share their edge verts, so n tiles hold (n*quads)+1 verts
+	g_big_terrain.num_cols = (demInfo.num_col - 1 + (tile_verts-2))/(tile_verts-1);
+	g_big_terrain.num_rows = (demInfo.num_row - 1 + (tile_verts-2))/(tile_verts-1);
+	if(g_terrain_config.num_cols > 0)
+		g_big_terrain.num_cols = g_terrain_config.num_cols;
+	if(g_terrain_config.num_rows > 0)
+		g_big_terrain.num_rows = g_terrain_config.num_rows;
+	if(g_big_terrain.num_cols < 1)
+		g_big_terrain.num_cols = 1;
+	if(g_big_terrain.num_rows < 1)
+		g_big_terrain.num_rows = 1;
+	g_big_terrain.num_tiles = g_big_terrain.num_cols*g_big_terrain.num_rows;
+	
+	g_big_terrain.vert_spacing = demInfo.cellsize;
+	if(g_big_terrain.vert_spacing < 0.01f)
+		g_big_terrain.vert_spacing = TERRAIN_DEFAULT_VERT_SPACING;
+	if(g_terrain_config.vert_spacing > 0.0f)
+		g_big_terrain.vert_spacing = g_terrain_config.vert_spacing;
+	g_big_terrain.tile_len[0] = g_big_terrain.tile_num_quads[0]*g_big_terrain.vert_spacing;
+	g_big_terrain.tile_len[1] = g_big_terrain.tile_num_quads[1]*g_big_terrain.vert_spacing;
+	
+	printf("terrain map: %d x %d tiles of %d x %d verts, %f between verts (DEM is %d x %d)\n",
+		g_big_terrain.num_cols,
+		g_big_terrain.num_rows,
+		tile_verts,
+		tile_verts,
+		g_big_terrain.vert_spacing,
+		demInfo.num_col,
+		demInfo.num_row);
+	return 1;
+}
+
+/*
+InitTerrainLoadDEM
+Reads the elevation data from the .asc file into the tiles of g_big_terrain
+in a single parse. The min elevation of the DEM is only known at the end,
+so verts not covered by the DEM are left alone during the parse and
+patched afterwards. Per-tile min/max/mean heights are gathered on the way.
+Tiles must already be allocated.
+returns 1 on success, 0 on failure
+*/
+int InitTerrainLoadDEM(char * filename, float * pMin, float * pMax)
+{
+	struct DEM_info_struct demInfo;
+	struct terrain_dem_fill_struct fill;
+	struct terrain_tile_stats_struct * stats;
+	struct terrain_tile_stats_struct * thread_stats;
+	struct lvl_1_tile * ptile;
+	int map_num_x;
+	int map_num_z;
+	int found = 0;
+	int r = 1;
+	int i;
+	int t;
+	
+	r = DEMOpen(&demInfo, filename);
+	if(r == 0)
+	{
+		printf("InitTerrainLoadDEM: error. could not open %s\n", filename);
+		return 0;
+	}
+	printf("opened dem file.\n");
+	
+	//number of vertex rows and columns in the whole map (tiles share their edge verts)
+	map_num_x = (g_big_terrain.num_cols*g_big_terrain.tile_num_quads[0]) + 1;
+	map_num_z = (g_big_terrain.num_rows*g_big_terrain.tile_num_quads[1]) + 1;
+	
+	memset(&fill, 0, sizeof(struct terrain_dem_fill_struct));
+	fill.num_threads = DEMGetNumThreads();
+	fill.row_len = (int*)calloc(map_num_z, sizeof(int));
+	for(t = 0; t < fill.num_threads; t++)
+	{
+		fill.tile_stats[t] = (struct terrain_tile_stats_struct*)malloc(g_big_terrain.num_tiles*sizeof(struct terrain_tile_stats_struct));
+		if(fill.tile_stats[t] == 0)
+			break;
+		for(i = 0; i < g_big_terrain.num_tiles; i++)
+		{
+			fill.tile_stats[t][i].min = FLT_MAX;
+			fill.tile_stats[t][i].max = -FLT_MAX;
+			fill.tile_stats[t][i].sum = 0.0;
+			fill.tile_stats[t][i].count = 0;
+		}
+		fill.dem_min[t] = FLT_MAX;
+		fill.dem_max[t] = -FLT_MAX;
+	}
+	if(fill.row_len == 0 || t < fill.num_threads)
+	{
+		printf("InitTerrainLoadDEM: malloc failed for fill state\n");
+		r = 0;
+	}
+	
+	if(r == 1)
+	{
+		printf("parsing dem file on %d threads.\n", fill.num_threads);
+		r = DEMParseRows(&demInfo, fill.num_threads, InitTerrainDEMRowFunc, &fill);
+	}
+	DEMClose(&demInfo);
+	printf("closed dem file.\n");
+	
+	if(r == 1)
+	{
+		//combine the per-thread results into thread 0's
+		stats = fill.tile_stats[0];
+		for(t = 0; t < fill.num_threads; t++)
+		{
+			if(fill.dem_min[t] > fill.dem_max[t]) //thread didn't see any data
+				continue;
+			if(found == 0 || fill.dem_min[t] < *pMin)
+				*pMin = fill.dem_min[t];
+			if(found == 0 || fill.dem_max[t] > *pMax)
+				*pMax = fill.dem_max[t];
+			found = 1;
+			
+			if(t == 0)
+				continue;
+			thread_stats = fill.tile_stats[t];
+			for(i = 0; i < g_big_terrain.num_tiles; i++)
+			{
+				if(thread_stats[i].min < stats[i].min)
+					stats[i].min = thread_stats[i].min;
+				if(thread_stats[i].max > stats[i].max)
+					stats[i].max = thread_stats[i].max;
+				stats[i].sum += thread_stats[i].sum;
+				stats[i].count += thread_stats[i].count;
+			}
+		}
+		if(found == 0)
+		{
+			printf("InitTerrainLoadDEM: error. no elevation data found\n");
+			r = 0;
+		}
+	}
+	
+	if(r == 1)
+	{
+		printf("found min %f\nfound max %f\n", *pMin, *pMax);
+		
+		//verts past the end of a DEM row, or past the last DEM row, get the minimum elevation of the DEM file as default.
+		for(i = 0; i < map_num_z; i++)
+		{
+			if(fill.row_len[i] < map_num_x)
+				InitTerrainSetVertRow(i, fill.row_len[i], map_num_x, 0, *pMin, stats);
+		}
+		
+		for(i = 0; i < g_big_terrain.num_tiles; i++)
+		{
+			ptile = &(g_big_terrain.pTiles[i]);
+			ptile->min_height = stats[i].min;
+			ptile->max_height = stats[i].max;
+			ptile->mean_height = (float)(stats[i].sum/stats[i].count);
+		}
+	}
+	
+	for(t = 0; t < fill.num_threads; t++)
+	{
+		if(fill.tile_stats[t] != 0)
+			free(fill.tile_stats[t]);
+	}
+	if(fill.row_len != 0)
+		free(fill.row_len);
+	
+	return r;
+}
+
+/*
+InitTerrainDEMRowFunc
+Called from the DEM parser threads with one row of elevations. DEM row r
+is vertex row r of the whole map. Each row only touches its own vertex
+slots so rows can be filled concurrently.
+*/
+void InitTerrainDEMRowFunc(void * user, int thread_i, int row, float * values, int num_values)
+{
+	struct terrain_dem_fill_struct * fill = (struct terrain_dem_fill_struct*)user;
+	float min, max;
+	int map_num_x;
+	int map_num_z;
+	int i;
+	
+	//the pad height is the min of the whole DEM, including any part that's off the map
+	min = fill->dem_min[thread_i];
+	max = fill->dem_max[thread_i];
+	for(i = 0; i < num_values; i++)
+	{
+		if(values[i] < min)
+			min = values[i];
+		if(values[i] > max)
+			max = values[i];
+	}
+	fill->dem_min[thread_i] = min;
+	fill->dem_max[thread_i] = max;
+	
+	map_num_z = (g_big_terrain.num_rows*g_big_terrain.tile_num_quads[1]) + 1;
+	if(row >= map_num_z) //DEM is bigger than the tile map
+		return;
+	
+	map_num_x = (g_big_terrain.num_cols*g_big_terrain.tile_num_quads[0]) + 1;
+	if(num_values > map_num_x)
+		num_values = map_num_x;
+	InitTerrainSetVertRow(row, 0, num_values, values, 0.0f, fill->tile_stats[thread_i]);
+	fill->row_len[row] = num_values;
+}
+
+/*
+InitTerrainSetVertRow
+Fills columns [first_col, last_col) of one vertex row of the whole map
+(row 0 is at z=0). Tiles share their edge verts, so a vert on a tile
+boundary is written to every tile that holds it. The height comes from
+values[col], or is pad_height if values is 0. Each written vert is
+added to the tile's entry in stats.
+*/
+void InitTerrainSetVertRow(int map_row, int first_col, int last_col, float * values, float pad_height, struct terrain_tile_stats_struct * stats)
+{
+	int tile_rows[2];
+	int vert_rows[2];
+	int tile_cols[2];
+	int vert_cols[2];
+	int num_tile_rows;
+	int num_tile_cols;
+	int map_col;
+	int m,n;
+	int tile_i;
+	float h;
+	
+	num_tile_rows = GetMapVertTiles(map_row, g_big_terrain.tile_num_quads[1], g_big_terrain.num_rows, tile_rows, vert_rows);
+	for(map_col = first_col; map_col < last_col; map_col++)
+	{
+		h = (values != 0) ? values[map_col] : pad_height;
+		num_tile_cols = GetMapVertTiles(map_col, g_big_terrain.tile_num_quads[0], g_big_terrain.num_cols, tile_cols, vert_cols);
+		for(m = 0; m < num_tile_rows; m++)
+		{
+			for(n = 0; n < num_tile_cols; n++)
+			{
+				tile_i = (tile_rows[m]*g_big_terrain.num_cols) + tile_cols[n];
+				SetTileVertHeight(&(g_big_terrain.pTiles[tile_i]), ((vert_rows[m]*g_big_terrain.pTiles[tile_i].num_x) + vert_cols[n]), h);
+				InitTerrainAddTileStat(&(stats[tile_i]), h);
+			}
+		}
+	}
+}
+
+void InitTerrainAddTileStat(struct terrain_tile_stats_struct * stat, float h)
+{
+	if(h < stat->min)
+		stat->min = h;
+	if(h > stat->max)
+		stat->max = h;
+	stat->sum += h;
+	stat->count += 1;
+}
+
+/*
+CalcTileHeightStats
+Recalculates the min/max/mean height of a tile from its verts. Call this
+after editing tile heights (e.g. FlattenTerrain).
+*/
+void CalcTileHeightStats(struct lvl_1_tile * ptile)
+{
+	struct terrain_tile_stats_struct stat;
+	int i;
+	
+	stat.min = FLT_MAX;
+	stat.max = -FLT_MAX;
+	stat.sum = 0.0;
+	stat.count = 0;
+	for(i = 0; i < ptile->num_verts; i++)
+	{
+		InitTerrainAddTileStat(&stat, GetTileVertHeight(ptile, i));
+	}
+	ptile->min_height = stat.min;
+	ptile->max_height = stat.max;
+	ptile->mean_height = (float)(stat.sum/stat.count);
+}
+
+/*
+InitTerrainCalcNormals
+Calculates the per-vertex normals of every tile. The tile heights are
+copied into one whole-map height grid first so verts on tile edges see
+their neighbours in the next tile, and every copy of a shared edge vert
+gets the exact same normal.
+returns 1 on success, 0 on failure
+*/
+int InitTerrainCalcNormals(void)
+{
+	struct lvl_1_tile * ptile;
+	float * heights;
+	int map_num_x;
+	int map_num_z;
+	int quads_x = g_big_terrain.tile_num_quads[0];
+	int quads_z = g_big_terrain.tile_num_quads[1];
+	int num_threads;
+	int i,j;
+	int k,l;
+	int r;
+	
+	map_num_x = (g_big_terrain.num_cols*quads_x) + 1;
+	map_num_z = (g_big_terrain.num_rows*quads_z) + 1;
+	heights = (float*)malloc((size_t)map_num_x*map_num_z*sizeof(float));
+	if(heights == 0)
+	{
+		printf("InitTerrainCalcNormals: malloc failed for height grid\n");
+		return 0;
+	}
+	
+	//gather the whole-map height grid. shared edge verts are written twice with the same value.
+	for(k = 0; k < g_big_terrain.num_rows; k++)
+	{
+		for(l = 0; l < g_big_terrain.num_cols; l++)
+		{
+			ptile = &(g_big_terrain.pTiles[(k*g_big_terrain.num_cols) + l]);
+			for(i = 0; i < ptile->num_z; i++)
+			{
+				for(j = 0; j < ptile->num_x; j++)
+				{
+					heights[((size_t)((k*quads_z) + i)*map_num_x) + (l*quads_x) + j] = GetTileVertHeight(ptile, ((i*ptile->num_x) + j));
+				}
+			}
+		}
+	}
+	
+	num_threads = hfGetNumThreads();
+	printf("calclating normals on %d threads.\n", num_threads);
+	r = hfCalcNormals(heights, map_num_x, map_num_z, g_big_terrain.vert_spacing, g_big_terrain.vert_spacing, num_threads, InitTerrainNormalRowFunc, 0);
+	free(heights);
+	printf("finished calculating normals.\n");
+	
+	return r;
+}
+
+/*
+InitTerrainNormalRowFunc
+Called from the normal worker threads with the normals of one map vertex
+row. Writes them to every tile that holds a copy of the vert.
+*/
+void InitTerrainNormalRowFunc(void * user, int row, float * nx, float * ny, float * nz, int num_x)
+{
+	struct lvl_1_tile * ptile;
+	int tile_rows[2];
+	int vert_rows[2];
+	int tile_cols[2];
+	int vert_cols[2];
+	int num_tile_rows;
+	int num_tile_cols;
+	int map_col;
+	int m,n;
+	int vert_i;
+	
+	num_tile_rows = GetMapVertTiles(row, g_big_terrain.tile_num_quads[1], g_big_terrain.num_rows, tile_rows, vert_rows);
+	for(map_col = 0; map_col < num_x; map_col++)
+	{
+		num_tile_cols = GetMapVertTiles(map_col, g_big_terrain.tile_num_quads[0], g_big_terrain.num_cols, tile_cols, vert_cols);
+		for(m = 0; m < num_tile_rows; m++)
+		{
+			for(n = 0; n < num_tile_cols; n++)
+			{
+				ptile = &(g_big_terrain.pTiles[(tile_rows[m]*g_big_terrain.num_cols) + tile_cols[n]]);
+				vert_i = (vert_rows[m]*ptile->num_x) + vert_cols[n];
+				PackTerrainNormal(nx[map_col], nz[map_col], (ptile->pNormals+(vert_i*2)));
+			}
+		}
+	}
+}
+
+/*
+GetMapVertTiles
+Converts a vertex row (or column) index of the whole map into tile
+row (or column) and vertex index within the tile. A vert on a tile
+boundary belongs to two tiles: vert 0 of tile k and the last vert of
+tile k-1.
+	map_i		;[in] vertex row or column in the whole map
+	num_quads	;[in] # of quads along the tile in that direction
+	num_tiles	;[in] # of tiles in the map in that direction
+	tiles		;[out] up to 2 tile rows/columns
+	verts		;[out] vertex row/column in each of tiles
+returns the # of entries filled in (0, 1 or 2)
+*/
+int GetMapVertTiles(int map_i, int num_quads, int num_tiles, int * tiles, int * verts)
+{
+	int n = 0;
+	int k;
+	int i;
+	
+	k = map_i/num_quads;
+	i = map_i%num_quads;
+	if(k < num_tiles)
+	{
+		tiles[n] = k;
+		verts[n] = i;
+		n += 1;
+	}
+	if(i == 0 && k > 0 && k <= num_tiles)
+	{
+		tiles[n] = k-1;
+		verts[n] = num_quads;
+		n += 1;
+	}
+	return n;
+}
+
+/*
+InitTerrainAllocTileData
+Allocates the heights and normals of every tile (when not paging).
+returns 1 on success, 0 on failure
+*/
+int InitTerrainAllocTileData(void)
+{
+	struct lvl_1_tile * ptile;
+	int tile_i;
+	
+	for(tile_i = 0; tile_i < g_big_terrain.num_tiles; tile_i++)
+	{
+		ptile = &(g_big_terrain.pTiles[tile_i]);
+		ptile->pHeights = (float*)malloc(ptile->num_verts*sizeof(float));
+		ptile->pNormals = (short*)malloc(ptile->num_verts*2*sizeof(short));
+		if(ptile->pHeights == 0 || ptile->pNormals == 0)
+		{
+			printf("InitTerrainAllocTileData: malloc failed for tile %d\n", tile_i);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/*
+InitTerrainCheckCache
+returns 1 if a mapped terrain cache has the same tile layout as
+g_big_terrain, 0 if not.
+*/
+int InitTerrainCheckCache(struct tcache_struct * cache)
+{
+	if(cache->header->num_rows != g_big_terrain.num_rows
+		|| cache->header->num_cols != g_big_terrain.num_cols
+		|| cache->header->tile_num_x != g_big_terrain.pTiles[0].num_x
+		|| cache->header->tile_num_z != g_big_terrain.pTiles[0].num_z
+		|| cache->header->tile_len[0] != g_big_terrain.tile_len[0]
+		|| cache->header->tile_len[1] != g_big_terrain.tile_len[1])
+	{
+		printf("InitTerrainCheckCache: cache tile layout doesn't match, ignoring.\n");
+		return 0;
+	}
+	return 1;
+}
+
+/*
+InitTerrainLoadCache
+Fills the tiles of g_big_terrain from a mapped terrain cache. Tiles must
+already be allocated and the cache checked with InitTerrainCheckCache().
+returns 1 on success
+*/
+int InitTerrainLoadCache(struct tcache_struct * cache)
+{
+	struct lvl_1_tile * ptile;
+	int tile_i;
+	
+	for(tile_i = 0; tile_i < g_big_terrain.num_tiles; tile_i++)
+	{
+		ptile = &(g_big_terrain.pTiles[tile_i]);
+		memcpy(ptile->pHeights, tcGetTileHeights(cache, tile_i), ptile->num_verts*sizeof(float));
+		memcpy(ptile->pNormals, tcGetTileNormals(cache, tile_i), ptile->num_verts*2*sizeof(short));
+		CalcTileHeightStats(ptile);
+		CalcTileLodErrors(ptile);
+		CalcTileBlockHeights(ptile);
+	}
+	return 1;
+}
+
+/*
+InitTerrainSaveCache
+Writes the heights and normals of every tile to a terrain cache file.
+A failure here isn't fatal, the DEM just gets parsed again next start.
+returns 1 on success, 0 on failure
+*/
+int InitTerrainSaveCache(char * cache_filename, unsigned long long dem_checksum, long long dem_size, float min, float max)
+{
+	struct tcache_header_struct header;
+	FILE * pFile;
+	int tile_i;
+	int r = 1;
+	
+	memset(&header, 0, sizeof(struct tcache_header_struct));
+	header.dem_checksum = dem_checksum;
+	header.dem_size = dem_size;
+	header.num_rows = g_big_terrain.num_rows;
+	header.num_cols = g_big_terrain.num_cols;
+	header.tile_num_x = g_big_terrain.pTiles[0].num_x;
+	header.tile_num_z = g_big_terrain.pTiles[0].num_z;
+	header.tile_len[0] = g_big_terrain.tile_len[0];
+	header.tile_len[1] = g_big_terrain.tile_len[1];
+	header.min_elevation = min;
+	header.max_elevation = max;
+	
+	pFile = tcCreateCache(cache_filename, &header);
+	if(pFile == 0)
+		return 0;
+	
+	for(tile_i = 0; tile_i < g_big_terrain.num_tiles && r == 1; tile_i++)
+	{
+		r = tcWriteTile(pFile, &header, g_big_terrain.pTiles[tile_i].pHeights, g_big_terrain.pTiles[tile_i].pNormals);
+	}
+	
+	if(r == 0)
+	{
+		printf("InitTerrainSaveCache: write failed at tile %d\n", tile_i);
+		fclose(pFile);
+		return 0;
+	}
+	r = tcFinishCache(pFile, cache_filename);
+	if(r == 1)
+		printf("saved terrain cache %s\n", cache_filename);
+	return r;
+}
+
+/*
+Terrain vertex accessors. Tiles only keep a row-major height array and
+packed normals. The x,z of a vert come from its grid position in the
+tile, and the texture coordinate is (j*2, i*2).
+vert_i is the index of the vert in the tile: (row*num_x)+column
+*/
+float GetTileVertHeight(struct lvl_1_tile * ptile, int vert_i)
+{
+	if(ptile->pHeights == 0 && ptile->pQHeights == 0 && TerrainPagerFaultTile(ptile) == 0) //paged out
+		return GetTileCoarseHeight(ptile, vert_i);
+	if(ptile->pQHeights != 0)
+		return ptile->height_bias + (ptile->pQHeights[vert_i]*ptile->height_scale);
+	return ptile->pHeights[vert_i];
+}
+
+/*
+A quantized tile is switched back to float heights first. Call
+QuantizeTileHeights() once the edits to the tile are done.
+A paged out tile is loaded first, and an edited tile stays resident
+since the cache only has the original heights.
+*/
+void SetTileVertHeight(struct lvl_1_tile * ptile, int vert_i, float h)
+{
+	int tile_i;
+	int r;
+	
+	if(g_terrain_pager.active == 1)
+	{
+		tile_i = (int)(ptile - g_big_terrain.pTiles);
+		r = TerrainPagerLoadTileNow(tile_i);
+		if(r == 0)
+		{
+			printf("SetTileVertHeight: error. could not load tile %d.\n", tile_i);
+			return;
+		}
+		g_terrain_pager.dirty[tile_i] = 1;
+		g_terrain_pager.keep[tile_i] = 1;
+	}
+	if(ptile->pQHeights != 0)
+	{
+		r = DequantizeTileHeights(ptile);
+		if(r == 0)
+		{
+			printf("SetTileVertHeight: error. could not dequantize tile.\n");
+			return;
+		}
+	}
+	ptile->pHeights[vert_i] = h;
+}
+
+/*
+fills pos (vec3) with the world space position of a tile vert
+*/
+void GetTileVertPos(struct lvl_1_tile * ptile, int vert_i, float * pos)
+{
+	pos[0] = ((vert_i%ptile->num_x)*g_big_terrain.vert_spacing) + ptile->urcorner[0];
+	pos[1] = GetTileVertHeight(ptile, vert_i);
+	pos[2] = ((vert_i/ptile->num_x)*g_big_terrain.vert_spacing) + ptile->urcorner[1];
+}
+
+/*
+fills normal (vec3) with the unpacked normal of a tile vert
+*/
+void GetTileVertNormal(struct lvl_1_tile * ptile, int vert_i, float * normal)
+{
+	if(ptile->pNormals == 0 && TerrainPagerFaultTile(ptile) == 0) //paged out
+	{
+		normal[0] = 0.0f;
+		normal[1] = 1.0f;
+		normal[2] = 0.0f;
+		return;
+	}
+	UnpackTerrainNormal((ptile->pNormals+(vert_i*2)), normal);
+}
+
+/*
+Gets the 4 corners (vec3's) of quad (quad_row, quad_col) in a tile.
+*/
+void GetTileQuadCorners(struct lvl_1_tile * ptile, int quad_row, int quad_col, float * quad_origin, float * quad_pos_x, float * quad_pos_z, float * quad_opposite)
+{
+	int quad_i;
+	
+	quad_i = (quad_row*ptile->num_x)+quad_col;
+	GetTileVertPos(ptile, quad_i, quad_origin);
+	GetTileVertPos(ptile, (quad_i+1), quad_pos_x);
+	GetTileVertPos(ptile, (quad_i+ptile->num_x), quad_pos_z);
+	GetTileVertPos(ptile, (quad_i+1+ptile->num_x), quad_opposite);
+}
+
+/*
+QuantizeTileHeights
+Replaces a tile's float heights with 16-bit heights if they fit within
+g_big_terrain.height_max_error. Tiles with too big a height range for
+that error keep their float heights. Does nothing if quantizing is off.
+returns 1 on success, 0 on failure
+*/
+int QuantizeTileHeights(struct lvl_1_tile * ptile)
+{
+	unsigned short * q;
+	float scale, bias, err;
+	int r;
+	
+	if(g_big_terrain.height_max_error <= 0.0f || ptile->pHeights == 0) //off, already quantized or not resident
+		return 1;
+	
+	q = (unsigned short*)malloc(ptile->num_verts*sizeof(unsigned short));
+	if(q == 0)
+	{
+		printf("QuantizeTileHeights: malloc failed for quantized heights\n");
+		return 0;
+	}
+	r = hfQuantizeHeights(ptile->pHeights, ptile->num_verts, g_big_terrain.height_max_error, q, &scale, &bias, &err);
+	if(r == 0) //range too big for the max error, keep the float heights
+	{
+		free(q);
+		return 1;
+	}
+	free(ptile->pHeights);
+	ptile->pHeights = 0;
+	ptile->pQHeights = q;
+	ptile->height_scale = scale;
+	ptile->height_bias = bias;
+	if(g_terrain_pager.active == 1)
+		tpSetResident(&(g_terrain_pager.pager), (int)(ptile - g_big_terrain.pTiles), GetTileDataBytes(ptile));
+	return 1;
+}
+
+/*
+DequantizeTileHeights
+Switches a quantized tile back to float heights.
+returns 1 on success, 0 on failure
+*/
+int DequantizeTileHeights(struct lvl_1_tile * ptile)
+{
+	float * heights;
+	int i;
+	
+	if(ptile->pQHeights == 0)
+		return 1;
+	
+	heights = (float*)malloc(ptile->num_verts*sizeof(float));
+	if(heights == 0)
+	{
+		printf("DequantizeTileHeights: malloc failed for heights\n");
+		return 0;
+	}
+	for(i = 0; i < ptile->num_verts; i++)
+	{
+		heights[i] = GetTileVertHeight(ptile, i);
+	}
+	free(ptile->pQHeights);
+	ptile->pQHeights = 0;
+	ptile->pHeights = heights;
+	if(g_terrain_pager.active == 1)
+		tpSetResident(&(g_terrain_pager.pager), (int)(ptile - g_big_terrain.pTiles), GetTileDataBytes(ptile));
+	return 1;
+}
+
+/*
+InitTerrainQuantizeHeights
+Quantizes the heights of every tile (see QuantizeTileHeights).
+returns 1 on success, 0 on failure
+*/
+int InitTerrainQuantizeHeights(void)
+{
+	int num_quantized = 0;
+	int i;
+	int r;
+	
+	for(i = 0; i < g_big_terrain.num_tiles; i++)
+	{
+		r = QuantizeTileHeights(&(g_big_terrain.pTiles[i]));
+		if(r == 0)
+			return 0;
+		if(g_big_terrain.pTiles[i].pQHeights != 0)
+			num_quantized += 1;
+	}
+	printf("quantized heights of %d of %d tiles (max error %f)\n", num_quantized, g_big_terrain.num_tiles, g_big_terrain.height_max_error);
+	return 1;
+}
+
+/*
+ValidateTerrainHeights
+Command line tool (--validate-heights). Loads the terrain from
+dem_filename (or the default map if 0) with heights quantized to
+max_error, then parses the DEM file again and compares every tile vert
+against the float elevation in the file. Prints the worst-case and
+mean error and how much height memory the tiles use.
+returns 1 if every vert is within max_error, 0 if not or on failure.
+*/
+int ValidateTerrainHeights(char * dem_filename, float max_error)
+{
+	char filename[255] = "./resources/maps/dem7.asc";
+	struct DEM_info_struct demInfo;
+	struct terrain_height_check_struct check;
+	long long count = 0;
+	long long height_bytes = 0;
+	double sum_err = 0.0;
+	float max_err = 0.0f;
+	int max_row = 0;
+	int max_col = 0;
+	int num_quantized = 0;
+	int num_resident = 0;
+	int num_threads;
+	int t;
+	int r;
+	
+	if(dem_filename != 0)
+		snprintf(filename, 255, "%s", dem_filename);
+	
+	g_big_terrain.height_max_error = max_error;
+	r = InitTerrain(filename);
+	if(r == 0)
+	{
+		printf("ValidateTerrainHeights: error. InitTerrain() failed.\n");
+		return 0;
+	}
+	
+	r = DEMOpen(&demInfo, filename);
+	if(r == 0)
+	{
+		printf("ValidateTerrainHeights: error. could not open %s\n", filename);
+		return 0;
+	}
+	memset(&check, 0, sizeof(struct terrain_height_check_struct));
+	num_threads = DEMGetNumThreads();
+	r = DEMParseRows(&demInfo, num_threads, ValidateTerrainHeightsRowFunc, &check);
+	DEMClose(&demInfo);
+	if(r == 0)
+	{
+		printf("ValidateTerrainHeights: error. failed to parse %s\n", filename);
+		return 0;
+	}
+	
+	for(t = 0; t < num_threads; t++)
+	{
+		if(check.max_err[t] > max_err)
+		{
+			max_err = check.max_err[t];
+			max_row = check.max_err_row[t];
+			max_col = check.max_err_col[t];
+		}
+		sum_err += check.sum_err[t];
+		count += check.count[t];
+	}
+	for(t = 0; t < g_big_terrain.num_tiles; t++)
+	{
+		if(g_big_terrain.pTiles[t].pQHeights != 0)
+		{
+			num_quantized += 1;
+			num_resident += 1;
+			height_bytes += g_big_terrain.pTiles[t].num_verts*sizeof(unsigned short);
+		}
+		else if(g_big_terrain.pTiles[t].pHeights != 0)
+		{
+			num_resident += 1;
+			height_bytes += g_big_terrain.pTiles[t].num_verts*sizeof(float);
+		}
+	}
+	
+	printf("%s:\n", filename);
+	printf("\tmax error allowed: %f\n", max_error);
+	printf("\ttiles quantized: %d of %d\n", num_quantized, g_big_terrain.num_tiles);
+	if(g_terrain_pager.active == 1)
+		printf("\ttiles resident: %d of %d (paged, the rest were checked in the cache)\n", num_resident, g_big_terrain.num_tiles);
+	printf("\theight memory: %lld bytes (%lld as floats)\n", height_bytes, (long long)g_big_terrain.num_tiles*g_big_terrain.pTiles[0].num_verts*sizeof(float));
+	printf("\tverts checked: %lld\n", count);
+	printf("\tworst-case error: %f at map vert row %d col %d\n", max_err, max_row, max_col);
+	printf("\tmean error: %f\n", (count > 0) ? (sum_err/count) : 0.0);
+	if(max_err > max_error)
+	{
+		printf("\tFAIL: worst-case error is over the limit\n");
+		return 0;
+	}
+	printf("\tOK\n");
+	return 1;
+}
+
+/*
+ValidateTerrainHeightsRowFunc
+DEM parser callback for ValidateTerrainHeights(). Compares one row of
+DEM elevations against every tile vert that holds them.
+*/
+void ValidateTerrainHeightsRowFunc(void * user, int thread_i, int row, float * values, int num_values)
+{
+	struct terrain_height_check_struct * check = (struct terrain_height_check_struct*)user;
+	struct lvl_1_tile * ptile;
+	int tile_rows[2];
+	int vert_rows[2];
+	int tile_cols[2];
+	int vert_cols[2];
+	int num_tile_rows;
+	int num_tile_cols;
+	int map_num_x;
+	int vert_i;
+	int col;
+	int m,n;
+	float h;
+	float e;
+	
+	num_tile_rows = GetMapVertTiles(row, g_big_terrain.tile_num_quads[1], g_big_terrain.num_rows, tile_rows, vert_rows);
+	map_num_x = (g_big_terrain.num_cols*g_big_terrain.tile_num_quads[0]) + 1;
+	if(num_values > map_num_x)
+		num_values = map_num_x;
+	for(col = 0; col < num_values; col++)
+	{
+		num_tile_cols = GetMapVertTiles(col, g_big_terrain.tile_num_quads[0], g_big_terrain.num_cols, tile_cols, vert_cols);
+		for(m = 0; m < num_tile_rows; m++)
+		{
+			for(n = 0; n < num_tile_cols; n++)
+			{
+				ptile = g_big_terrain.pTiles + (tile_rows[m]*g_big_terrain.num_cols) + tile_cols[n];
+				vert_i = (vert_rows[m]*ptile->num_x) + vert_cols[n];
+				if(IsTileResident(ptile) == 1)
+					h = GetTileVertHeight(ptile, vert_i);
+				else //paged out, and this runs on the parser threads so read the cache instead of faulting the tile in
+					h = tcGetTileHeights(&(g_terrain_pager.cache), (int)(ptile - g_big_terrain.pTiles))[vert_i];
+				e = fabsf(h - values[col]);
+				if(e > check->max_err[thread_i])
+				{
+					check->max_err[thread_i] = e;
+					check->max_err_row[thread_i] = row;
+					check->max_err_col[thread_i] = col;
+				}
+				check->sum_err[thread_i] += e;
+				check->count[thread_i] += 1;
+			}
+		}
+	}
+}
+
+/*
+IsTileResident
+returns 1 if the tile's heights and normals are in memory, 0 if only its
+coarse grid is (paging).
+*/
+int IsTileResident(struct lvl_1_tile * ptile)
+{
+	return (ptile->pHeights != 0 || ptile->pQHeights != 0);
+}
+
+/*
+returns the # of bytes of height and normal data a resident tile holds
+*/
+long long GetTileDataBytes(struct lvl_1_tile * ptile)
+{
+	long long bytes;
+	
+	bytes = (long long)ptile->num_verts*2*sizeof(short); //normals
+	if(ptile->pQHeights != 0)
+		bytes += (long long)ptile->num_verts*sizeof(unsigned short);
+	else
+		bytes += (long long)ptile->num_verts*sizeof(float);
+	return bytes;
+}
+
+/*
+returns the # of coarse verts along a tile side
+*/
+int GetTileCoarseSize(struct lvl_1_tile * ptile)
+{
+	return ((ptile->num_x - 1 + (TERRAIN_COARSE_STEP-1))/TERRAIN_COARSE_STEP) + 1;
+}
+
+/*
+GetTileCoarseHeight
+Height of a tile vert from the tile's coarse grid (bilinear between the
+coarse verts). Used for tiles that aren't resident.
+*/
+float GetTileCoarseHeight(struct lvl_1_tile * ptile, int vert_i)
+{
+	float * c;
+	float fi, fj;
+	float h0, h1;
+	int coarse_n;
+	int row, col;
+	int ci, cj;
+	int row1, col1; //vert row/col of the next coarse vert
+	
+	coarse_n = GetTileCoarseSize(ptile);
+	row = vert_i/ptile->num_x;
+	col = vert_i%ptile->num_x;
+	ci = row/TERRAIN_COARSE_STEP;
+	cj = col/TERRAIN_COARSE_STEP;
+	if(ci > (coarse_n-2))
+		ci = coarse_n-2;
+	if(cj > (coarse_n-2))
+		cj = coarse_n-2;
+	row1 = ((ci+1)*TERRAIN_COARSE_STEP < (ptile->num_z-1)) ? ((ci+1)*TERRAIN_COARSE_STEP) : (ptile->num_z-1);
+	col1 = ((cj+1)*TERRAIN_COARSE_STEP < (ptile->num_x-1)) ? ((cj+1)*TERRAIN_COARSE_STEP) : (ptile->num_x-1);
+	fi = (float)(row - (ci*TERRAIN_COARSE_STEP))/(row1 - (ci*TERRAIN_COARSE_STEP));
+	fj = (float)(col - (cj*TERRAIN_COARSE_STEP))/(col1 - (cj*TERRAIN_COARSE_STEP));
+	c = ptile->pCoarseHeights + (ci*coarse_n) + cj;
+	h0 = c[0] + ((c[1] - c[0])*fj);
+	h1 = c[coarse_n] + ((c[coarse_n+1] - c[coarse_n])*fj);
+	return h0 + ((h1 - h0)*fi);
+}
+
+/*
+InitTerrainPager
+Starts paging terrain tiles from the terrain cache (--page-terrain).
+Builds every tile's coarse grid and height stats, starts the pager's
+worker thread, loads the tiles around the camera and evicts any tile
+over the byte budget. Tiles that are already resident (the DEM was just
+parsed) are kept as long as the budget allows.
+The pager owns the cache from here on, and closes it on failure.
+returns 1 on success, 0 on failure
+*/
+int InitTerrainPager(struct tcache_struct * cache)
+{
+	struct terrain_pager_struct * tp = &g_terrain_pager;
+	struct lvl_1_tile * ptile;
+	int num_resident = 0;
+	int coarse_n;
+	int tile_i;
+	int r;
+	
+	tp->cache = *cache;
+	tp->keep = (char*)calloc(g_big_terrain.num_tiles, sizeof(char));
+	tp->dirty = (char*)calloc(g_big_terrain.num_tiles, sizeof(char));
+	tp->order = (int*)malloc(g_big_terrain.num_tiles*sizeof(int));
+	tp->dist = (float*)malloc(g_big_terrain.num_tiles*sizeof(float));
+	if(tp->keep == 0 || tp->dirty == 0 || tp->order == 0 || tp->dist == 0)
+	{
+		printf("InitTerrainPager: malloc failed for pager state\n");
+		TerrainPagerShutdown();
+		return 0;
+	}
+	
+	coarse_n = GetTileCoarseSize(&(g_big_terrain.pTiles[0]));
+	for(tile_i = 0; tile_i < g_big_terrain.num_tiles; tile_i++)
+	{
+		ptile = &(g_big_terrain.pTiles[tile_i]);
+		ptile->pCoarseHeights = (float*)malloc(coarse_n*coarse_n*sizeof(float));
+		if(ptile->pCoarseHeights == 0)
+		{
+			printf("InitTerrainPager: malloc failed for coarse grid of tile %d\n", tile_i);
+			TerrainPagerShutdown();
+			return 0;
+		}
+		if(IsTileResident(ptile) == 1)
+		{
+			InitTerrainPagerCoarseGrid(ptile, coarse_n);
+			continue;
+		}
+		
+		//read the stats and coarse grid straight from the mapped cache, then let the pages go
+		ptile->pHeights = tcGetTileHeights(&(tp->cache), tile_i);
+		CalcTileHeightStats(ptile);
+		CalcTileLodErrors(ptile);
+		CalcTileBlockHeights(ptile);
+		InitTerrainPagerCoarseGrid(ptile, coarse_n);
+		ptile->pHeights = 0;
+		tcReleaseTile(&(tp->cache), tile_i);
+	}
+	
+	r = tpInit(&(tp->pager), g_big_terrain.num_tiles, tp->budget_bytes, TerrainPagerLoadFunc, TerrainPagerFreeFunc, 0);
+	if(r == 0)
+	{
+		TerrainPagerShutdown();
+		return 0;
+	}
+	for(tile_i = 0; tile_i < g_big_terrain.num_tiles; tile_i++)
+	{
+		if(IsTileResident(&(g_big_terrain.pTiles[tile_i])) == 1)
+			tpSetResident(&(tp->pager), tile_i, GetTileDataBytes(&(g_big_terrain.pTiles[tile_i])));
+	}
+	tp->active = 1;
+	tp->streaming = 0;
+	
+	//start out with the tiles around the camera resident
+	TerrainPagerUpdateKeep(g_ws_camera_pos);
+	for(tile_i = 0; tile_i < g_big_terrain.num_tiles; tile_i++)
+	{
+		if(tp->keep[tile_i] == 0)
+			continue;
+		r = TerrainPagerLoadTileNow(tile_i);
+		if(r == 0)
+		{
+			TerrainPagerShutdown();
+			return 0;
+		}
+		num_resident += 1;
+	}
+	TerrainPagerEvictOverBudget(-1);
+	
+	printf("paging terrain tiles: radius %f, budget %lld bytes, %d tiles around the camera, %lld bytes resident\n",
+		tp->radius,
+		tp->budget_bytes,
+		num_resident,
+		tp->pager.resident_bytes);
+	return 1;
+}
+
+/*
+InitTerrainPagerCoarseGrid
+Samples every TERRAIN_COARSE_STEP'th vert of a tile into its coarse grid.
+*/
+void InitTerrainPagerCoarseGrid(struct lvl_1_tile * ptile, int coarse_n)
+{
+	int row, col;
+	int ci, cj;
+	
+	for(ci = 0; ci < coarse_n; ci++)
+	{
+		row = ci*TERRAIN_COARSE_STEP;
+		if(row > (ptile->num_z-1))
+			row = ptile->num_z-1;
+		for(cj = 0; cj < coarse_n; cj++)
+		{
+			col = cj*TERRAIN_COARSE_STEP;
+			if(col > (ptile->num_x-1))
+				col = ptile->num_x-1;
+			ptile->pCoarseHeights[(ci*coarse_n)+cj] = GetTileVertHeight(ptile, ((row*ptile->num_x)+col));
+		}
+	}
+}
+
+/*
+TerrainPagerShutdown
+Stops the pager's worker thread and closes the terrain cache. Tiles keep
+whatever data they have.
+*/
+void TerrainPagerShutdown(void)
+{
+	struct terrain_pager_struct * tp = &g_terrain_pager;
+	
+	if(tp->pager.state != 0)
+		tpShutdown(&(tp->pager));
+	tcCloseCache(&(tp->cache));
+	free(tp->keep);
+	free(tp->dirty);
+	free(tp->order);
+	free(tp->dist);
+	tp->keep = 0;
+	tp->dirty = 0;
+	tp->order = 0;
+	tp->dist = 0;
+	tp->active = 0;
+}
+
+/*
+TerrainPagerLoadFunc
+Runs on the pager's worker thread. Copies a tile's heights and normals
+out of the mapped terrain cache, quantizing the heights if that is on.
+Only reads g_big_terrain fields that don't change after startup.
+returns a terrain_page_struct, or 0 on failure
+*/
+void * TerrainPagerLoadFunc(void * user, int tile_i, long long * pbytes)
+{
+	struct terrain_page_struct * page;
+	float err;
+	int num_verts;
+	int r;
+	
+	num_verts = g_big_terrain.pTiles[tile_i].num_verts;
+	page = (struct terrain_page_struct*)calloc(1, sizeof(struct terrain_page_struct));
+	if(page == 0)
+	{
+		printf("TerrainPagerLoadFunc: malloc failed for tile %d\n", tile_i);
+		return 0;
+	}
+	page->pHeights = (float*)malloc(num_verts*sizeof(float));
+	page->pNormals = (short*)malloc(num_verts*2*sizeof(short));
+	if(page->pHeights == 0 || page->pNormals == 0)
+	{
+		printf("TerrainPagerLoadFunc: malloc failed for tile %d\n", tile_i);
+		TerrainPagerFreeFunc(user, page);
+		return 0;
+	}
+	memcpy(page->pHeights, tcGetTileHeights(&(g_terrain_pager.cache), tile_i), num_verts*sizeof(float));
+	memcpy(page->pNormals, tcGetTileNormals(&(g_terrain_pager.cache), tile_i), num_verts*2*sizeof(short));
+	tcReleaseTile(&(g_terrain_pager.cache), tile_i);
+	
+	if(g_big_terrain.height_max_error > 0.0f)
+	{
+		page->pQHeights = (unsigned short*)malloc(num_verts*sizeof(unsigned short));
+		if(page->pQHeights != 0)
+		{
+			r = hfQuantizeHeights(page->pHeights, num_verts, g_big_terrain.height_max_error, page->pQHeights, &(page->height_scale), &(page->height_bias), &err);
+			if(r == 1)
+			{
+				free(page->pHeights);
+				page->pHeights = 0;
+			}
+			else //too big a range for the max error, keep the float heights
+			{
+				free(page->pQHeights);
+				page->pQHeights = 0;
+			}
+		}
+	}
+	
+	*pbytes = (long long)num_verts*2*sizeof(short);
+	if(page->pQHeights != 0)
+		*pbytes += (long long)num_verts*sizeof(unsigned short);
+	else
+		*pbytes += (long long)num_verts*sizeof(float);
+	return page;
+}
+
+void TerrainPagerFreeFunc(void * user, void * data)
+{
+	struct terrain_page_struct * page = (struct terrain_page_struct*)data;
+	
+	free(page->pHeights);
+	free(page->pQHeights);
+	free(page->pNormals);
+	free(page);
+}
+
+/*
+TerrainPagerInstallTile
+Moves loaded tile data into its tile. Main thread only. Takes
+g_world_lock just for the swap, so a simulation step never sees half
+of a tile's data.
+*/
+void TerrainPagerInstallTile(int tile_i, struct terrain_page_struct * page)
+{
+	struct lvl_1_tile * ptile;
+	
+	ptile = &(g_big_terrain.pTiles[tile_i]);
+	pthread_mutex_lock(&g_world_lock);
+	ptile->pHeights = page->pHeights;
+	ptile->pQHeights = page->pQHeights;
+	ptile->height_scale = page->height_scale;
+	ptile->height_bias = page->height_bias;
+	ptile->pNormals = page->pNormals;
+	pthread_mutex_unlock(&g_world_lock);
+	free(page);
+}
+
+/*
+TerrainPagerLoadTileNow
+Makes a tile resident right away on the calling (main) thread.
+returns 1 on success, 0 on failure
+*/
+int TerrainPagerLoadTileNow(int tile_i)
+{
+	struct terrain_page_struct * page;
+	long long bytes;
+	
+	if(IsTileResident(&(g_big_terrain.pTiles[tile_i])) == 1)
+		return 1;
+	
+	page = (struct terrain_page_struct*)TerrainPagerLoadFunc(0, tile_i, &bytes);
+	if(page == 0)
+		return 0;
+	TerrainPagerInstallTile(tile_i, page);
+	tpSetResident(&(g_terrain_pager.pager), tile_i, bytes); //also drops any pending async load of the tile
+	TerrainPagerEvictOverBudget(tile_i);
+	return 1;
+}
+
+/*
+TerrainPagerFaultTile
+Called when a query hits a tile that isn't resident. During startup the
+tile is loaded right away, so everything built at init (plants, map)
+sees the real heights. main() ends startup (sets streaming) before it
+starts the simulation thread, since loading a tile can evict others and
+that makes GL calls. From then on the query uses the coarse grid instead
+of stalling a frame or a step.
+returns 1 if the tile is now resident, 0 if the caller should use the coarse grid
+*/
+int TerrainPagerFaultTile(struct lvl_1_tile * ptile)
+{
+	int r;
+	
+	if(g_terrain_pager.active == 0 || g_terrain_pager.streaming == 1)
+		return 0;
+	r = TerrainPagerLoadTileNow((int)(ptile - g_big_terrain.pTiles));
+	if(r == 0)
+		return 0;
+	return 1;
+}
+
+/*
+TerrainPagerEvictTile
+Frees a tile's heights, normals and VBO storage. Main thread only. The
+pointers are cleared under g_world_lock and the arrays freed after it
+is dropped: a simulation step only reads heights with the lock held, so
+none can still be using them.
+*/
+void TerrainPagerEvictTile(int tile_i)
+{
+	struct lvl_1_tile * ptile;
+	float * pHeights;
+	unsigned short * pQHeights;
+	short * pNormals;
+	
+	ptile = &(g_big_terrain.pTiles[tile_i]);
+	pthread_mutex_lock(&g_world_lock);
+	pHeights = ptile->pHeights;
+	pQHeights = ptile->pQHeights;
+	pNormals = ptile->pNormals;
+	ptile->pHeights = 0;
+	ptile->pQHeights = 0;
+	ptile->pNormals = 0;
+	pthread_mutex_unlock(&g_world_lock);
+	free(pHeights);
+	free(pQHeights);
+	free(pNormals);
+	if(ptile->vbo_loaded == 1)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, ptile->vbo);
+		glBufferData(GL_ARRAY_BUFFER, 0, 0, GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		ptile->vbo_loaded = 0;
+	}
+	tpSetEvicted(&(g_terrain_pager.pager), tile_i);
+}
+
+/*
+TerrainPagerEvictOverBudget
+Evicts least recently used tiles until the resident bytes fit in the
+budget. Tiles in the camera radius, edited tiles and except_tile (-1 for
+none) are never evicted, so the budget can be exceeded if it is too
+small for the radius.
+*/
+void TerrainPagerEvictOverBudget(int except_tile)
+{
+	char old_keep = 0;
+	int tile_i;
+	
+	if(except_tile != -1)
+	{
+		old_keep = g_terrain_pager.keep[except_tile];
+		g_terrain_pager.keep[except_tile] = 1;
+	}
+	while((tile_i = tpFindEvictTile(&(g_terrain_pager.pager), g_terrain_pager.keep)) != -1)
+	{
+		TerrainPagerEvictTile(tile_i);
+	}
+	if(except_tile != -1)
+		g_terrain_pager.keep[except_tile] = old_keep;
+}
+
+/*
+TerrainPagerUpdateKeep
+Marks the tiles that must stay resident: tiles with any part within the
+pager radius of camera_pos (x,z only), and edited tiles. Also fills in
+each tile's distance to the camera.
+*/
+void TerrainPagerUpdateKeep(float * camera_pos)
+{
+	struct terrain_pager_struct * tp = &g_terrain_pager;
+	struct lvl_1_tile * ptile;
+	float dx, dz;
+	int tile_i;
+	
+	for(tile_i = 0; tile_i < g_big_terrain.num_tiles; tile_i++)
+	{
+		ptile = &(g_big_terrain.pTiles[tile_i]);
+		
+		//distance to the closest point of the tile
+		dx = 0.0f;
+		if(camera_pos[0] < ptile->urcorner[0])
+			dx = ptile->urcorner[0] - camera_pos[0];
+		else if(camera_pos[0] > (ptile->urcorner[0] + g_big_terrain.tile_len[0]))
+			dx = camera_pos[0] - (ptile->urcorner[0] + g_big_terrain.tile_len[0]);
+		dz = 0.0f;
+		if(camera_pos[2] < ptile->urcorner[1])
+			dz = ptile->urcorner[1] - camera_pos[2];
+		else if(camera_pos[2] > (ptile->urcorner[1] + g_big_terrain.tile_len[1]))
+			dz = camera_pos[2] - (ptile->urcorner[1] + g_big_terrain.tile_len[1]);
+		tp->dist[tile_i] = sqrtf((dx*dx) + (dz*dz));
+		tp->keep[tile_i] = (tp->dist[tile_i] <= tp->radius) || (tp->dirty[tile_i] == 1);
+	}
+}
+
+static int TerrainPagerCompareDist(const void * a, const void * b)
+{
+	float da = g_terrain_pager.dist[*(const int*)a];
+	float db = g_terrain_pager.dist[*(const int*)b];
+	
+	if(da < db)
+		return -1;
+	if(da > db)
+		return 1;
+	return 0;
+}
+
+/*
+UpdateTerrainPager
+Called once a frame from DrawScene(). Picks up tiles the worker thread
+finished loading, uploads the VBOs of tiles near the camera (a few per
+frame), queues the tiles in radius that aren't resident (closest first)
+and evicts the least recently used tiles while over the byte budget.
+Called without g_world_lock: only the swaps in TerrainPagerInstallTile()
+and TerrainPagerEvictTile() take it, so the VBO uploads and request
+sorting don't hold up the simulation.
+*/
+void UpdateTerrainPager(float * camera_pos)
+{
+	struct terrain_pager_struct * tp = &g_terrain_pager;
+	struct lvl_1_tile * ptile;
+	struct terrain_page_struct * page;
+	long long bytes;
+	int num_requests = 0;
+	int num_uploads = 0;
+	int tile_i;
+	int i;
+	
+	if(tp->active == 0)
+		return;
+	tpNextFrame(&(tp->pager));
+	
+	while(tpGetLoaded(&(tp->pager), &tile_i, (void**)&page, &bytes) == 1)
+	{
+		TerrainPagerInstallTile(tile_i, page);
+	}
+	
+	TerrainPagerUpdateKeep(camera_pos);
+	for(tile_i = 0; tile_i < g_big_terrain.num_tiles; tile_i++)
+	{
+		if(tp->keep[tile_i] == 0)
+			continue;
+		ptile = &(g_big_terrain.pTiles[tile_i]);
+		if(IsTileResident(ptile) == 1)
+		{
+			tpTouch(&(tp->pager), tile_i);
+			if(ptile->vbo_loaded == 0 && num_uploads < 4) //spread the uploads over frames
+			{
+				UpdateTileVBO(ptile);
+				num_uploads += 1;
+			}
+		}
+		else
+		{
+			tp->order[num_requests] = tile_i;
+			num_requests += 1;
+		}
+	}
+	
+	//re-queue the wanted tiles closest first, dropping requests for tiles that moved out of radius
+	tpClearRequests(&(tp->pager));
+	qsort(tp->order, num_requests, sizeof(int), TerrainPagerCompareDist);
+	for(i = 0; i < num_requests; i++)
+	{
+		tpRequest(&(tp->pager), tp->order[i]);
+	}
+	
+	TerrainPagerEvictOverBudget(-1);
+	tp->busy = (num_requests > 0 || num_uploads > 0);
+}
+
+/*
+CalcTileLodErrors
+Recalculates how far (in height) each LOD level of a tile is off from
+its verts (see tlCalcLevelErrors). Call this after editing tile heights.
+Tiles that are paged out keep the errors they have.
+*/
+void CalcTileLodErrors(struct lvl_1_tile * ptile)
+{
+	float * heights;
+	int i;
+	
+	if(ptile->pHeights != 0)
+	{
+		tlCalcLevelErrors(ptile->pHeights, ptile->num_x, ptile->num_z, ptile->lod_error);
+		return;
+	}
+	if(ptile->pQHeights == 0) //paged out
+		return;
+	
+	heights = (float*)malloc(ptile->num_verts*sizeof(float));
+	if(heights == 0)
+	{
+		printf("CalcTileLodErrors: malloc failed for heights\n");
+		return;
+	}
+	for(i = 0; i < ptile->num_verts; i++)
+	{
+		heights[i] = GetTileVertHeight(ptile, i);
+	}
+	tlCalcLevelErrors(heights, ptile->num_x, ptile->num_z, ptile->lod_error);
+	free(heights);
+}
+
+/*
+CalcTileBlockHeights
+Recalculates the highest and lowest vert of each TERRAIN_RAY_BLOCK x
+TERRAIN_RAY_BLOCK block of quads in a tile. RaycastTileSurf uses the
+highest to skip blocks the ray passes over, UpdateTerrainOcclusion uses
+the lowest as solid ground. A block includes the verts on its far edges. Call this
+after editing tile heights. Tiles that are paged out keep the heights
+they have.
+returns nothing, the block heights stay 0 if they can't be allocated
+*/
+void CalcTileBlockHeights(struct lvl_1_tile * ptile)
+{
+	float h;
+	int num_blocks_x;
+	int num_blocks_z;
+	int bi, bj;
+	int row, col;
+	int i;
+	
+	if(ptile->pHeights == 0 && ptile->pQHeights == 0) //paged out
+		return;
+	
+	num_blocks_x = (ptile->num_x - 1 + (TERRAIN_RAY_BLOCK-1))/TERRAIN_RAY_BLOCK;
+	num_blocks_z = (ptile->num_z - 1 + (TERRAIN_RAY_BLOCK-1))/TERRAIN_RAY_BLOCK;
+	if(ptile->pBlockMaxHeights == 0)
+	{
+		ptile->pBlockMaxHeights = (float*)malloc(num_blocks_x*num_blocks_z*sizeof(float));
+		ptile->pBlockMinHeights = (float*)malloc(num_blocks_x*num_blocks_z*sizeof(float));
+		if(ptile->pBlockMaxHeights == 0 || ptile->pBlockMinHeights == 0)
+		{
+			printf("CalcTileBlockHeights: malloc failed for %d blocks\n", num_blocks_x*num_blocks_z);
+			free(ptile->pBlockMaxHeights);
+			free(ptile->pBlockMinHeights);
+			ptile->pBlockMaxHeights = 0;
+			ptile->pBlockMinHeights = 0;
+			return;
+		}
+	}
+	
+	for(i = 0; i < num_blocks_x*num_blocks_z; i++)
+	{
+		ptile->pBlockMaxHeights[i] = -FLT_MAX;
+		ptile->pBlockMinHeights[i] = FLT_MAX;
+	}
+	for(row = 0; row < ptile->num_z; row++)
+	{
+		for(col = 0; col < ptile->num_x; col++)
+		{
+			h = GetTileVertHeight(ptile, ((row*ptile->num_x) + col));
+			
+			//a vert on a block edge belongs to the blocks on both sides of it
+			for(bi = (row-1)/TERRAIN_RAY_BLOCK; bi <= row/TERRAIN_RAY_BLOCK; bi++)
+			{
+				if(bi < 0 || bi >= num_blocks_z)
+					continue;
+				for(bj = (col-1)/TERRAIN_RAY_BLOCK; bj <= col/TERRAIN_RAY_BLOCK; bj++)
+				{
+					if(bj < 0 || bj >= num_blocks_x)
+						continue;
+					i = (bi*num_blocks_x) + bj;
+					if(h > ptile->pBlockMaxHeights[i])
+						ptile->pBlockMaxHeights[i] = h;
+					if(h < ptile->pBlockMinHeights[i])
+						ptile->pBlockMinHeights[i] = h;
+				}
+			}
+		}
+	}
+}
+
+/*
+GetTileCameraDist
+returns the distance from camera_pos to the closest point of the tile's
+bounding box, 0 if the camera is inside it.
+*/
+float GetTileCameraDist(struct lvl_1_tile * ptile, float * camera_pos)
+{
+	float box_min[3];
+	float box_max[3];
+	float d[3];
+	int i;
+	
+	box_min[0] = ptile->urcorner[0];
+	box_min[1] = ptile->min_height;
+	box_min[2] = ptile->urcorner[1];
+	box_max[0] = ptile->urcorner[0] + g_big_terrain.tile_len[0];
+	box_max[1] = ptile->max_height;
+	box_max[2] = ptile->urcorner[1] + g_big_terrain.tile_len[1];
+	for(i = 0; i < 3; i++)
+	{
+		d[i] = 0.0f;
+		if(camera_pos[i] < box_min[i])
+			d[i] = box_min[i] - camera_pos[i];
+		else if(camera_pos[i] > box_max[i])
+			d[i] = camera_pos[i] - box_max[i];
+	}
+	return sqrtf((d[0]*d[0]) + (d[1]*d[1]) + (d[2]*d[2]));
+}
+
+/*
+UpdateTerrainLod
+Called once a frame from DrawScene(). Every tile in tiles (or every tile
+of the map if tiles is 0) gets the coarsest LOD level whose height error
+is at most lod_pixel_error pixels on screen at the tile's distance from
+the camera. Tiles that aren't drawn get the coarsest level so they don't
+hold their neighbours back. Levels are then lowered until neighbouring
+tiles are at most one level apart, and each tile gets the edge mask of
+the sides it has to stitch to a coarser neighbour.
+*/
+void UpdateTerrainLod(float * camera_pos, int * tiles, int num_tiles)
+{
+	struct lvl_1_tile * ptile;
+	float pixels_per_unit;
+	int tile_i;
+	int i;
+	
+	//pixels covered by 1 unit at distance 1: half the screen height over tan(fov/2)
+	pixels_per_unit = (g_screen_height*0.5f)*g_perspectiveMatrix[5];
+	if(tiles == 0)
+		num_tiles = g_big_terrain.num_tiles;
+	else
+		memset(g_big_terrain.lod_levels, (TL_NUM_LEVELS-1), g_big_terrain.num_tiles*sizeof(char));
+	for(i = 0; i < num_tiles; i++)
+	{
+		tile_i = (tiles != 0) ? tiles[i] : i;
+		ptile = &(g_big_terrain.pTiles[tile_i]);
+		g_big_terrain.lod_levels[tile_i] = (char)tlPickLevel(ptile->lod_error, GetTileCameraDist(ptile, camera_pos), pixels_per_unit, g_big_terrain.lod_pixel_error);
+	}
+	tlConstrainLevels(g_big_terrain.lod_levels, g_big_terrain.num_cols, g_big_terrain.num_rows);
+	for(tile_i = 0; tile_i < g_big_terrain.num_tiles; tile_i++)
+	{
+		ptile = &(g_big_terrain.pTiles[tile_i]);
+		ptile->lod_level = g_big_terrain.lod_levels[tile_i];
+		ptile->lod_mask = tlGetEdgeMask(g_big_terrain.lod_levels, g_big_terrain.num_cols, g_big_terrain.num_rows, tile_i);
+	}
+}
+
+/*
+CheckTerrainLod
+Command line tool (--check-terrain-lod). Loads the terrain from
+dem_filename (or the default map if 0) and checks the triangles of every
+LOD level and edge mask of the tile element array (see tlCheckElements).
+Then picks LOD levels from a few camera positions over the map, checks
+that neighbouring tiles are at most one level apart and that only the
+finer tile of a pair stitches the shared side, and prints the triangle
+counts against full res.
+returns 1 if every check passes, 0 if not or on failure.
+*/
+int CheckTerrainLod(char * dem_filename)
+{
+	char filename[255] = "./resources/maps/dem7.asc";
+	static const char * camera_names[5] = {"map center, low", "map center, 500 up", "map center, 3000 up", "map corner, low", "far map corner, low"};
+	struct lvl_1_tile * ptile;
+	struct lvl_1_tile * pnext;
+	float camera_pos[3];
+	float center[3];
+	long long num_tris;
+	long long num_full_tris;
+	int num_per_level[TL_NUM_LEVELS];
+	int num_bad = 0;
+	int col, row;
+	int tile_i;
+	int cam_i;
+	int i;
+	int r;
+	
+	if(dem_filename != 0)
+		snprintf(filename, 255, "%s", dem_filename);
+	
+	r = InitTerrain(filename);
+	if(r == 0)
+	{
+		printf("CheckTerrainLod: error. InitTerrain() failed.\n");
+		return 0;
+	}
+	CalculatePerspectiveMatrix(g_screen_width, g_screen_height);
+	
+	printf("%s:\n", filename);
+	printf("\ttile verts: %dx%d, %d LOD levels, %d index lists, %d indices\n",
+		g_big_terrain.lod.num_x,
+		g_big_terrain.lod.num_z,
+		TL_NUM_LEVELS,
+		(TL_NUM_LEVELS*TL_NUM_MASKS),
+		g_big_terrain.lod.num_elements);
+	r = tlCheckElements(&(g_big_terrain.lod));
+	if(r == 0)
+		num_bad += 1;
+	printf("\tindex lists: %s\n", (r == 1) ? "OK" : "FAIL");
+	printf("\tmax pixel error: %f\n", g_big_terrain.lod_pixel_error);
+	
+	center[0] = (g_big_terrain.num_cols*g_big_terrain.tile_len[0])*0.5f;
+	center[2] = (g_big_terrain.num_rows*g_big_terrain.tile_len[1])*0.5f;
+	center[1] = 0.0f;
+	tile_i = GetLvl1Tile(center);
+	if(tile_i != -1)
+		center[1] = g_big_terrain.pTiles[tile_i].max_height;
+	for(cam_i = 0; cam_i < 5; cam_i++)
+	{
+		camera_pos[0] = center[0];
+		camera_pos[1] = center[1] + 2.0f;
+		camera_pos[2] = center[2];
+		if(cam_i == 1)
+			camera_pos[1] = center[1] + 500.0f;
+		else if(cam_i == 2)
+			camera_pos[1] = center[1] + 3000.0f;
+		else if(cam_i == 3)
+		{
+			camera_pos[0] = 1.0f;
+			camera_pos[2] = 1.0f;
+			camera_pos[1] = g_big_terrain.pTiles[0].max_height + 2.0f;
+		}
+		else if(cam_i == 4)
+		{
+			camera_pos[0] = (g_big_terrain.num_cols*g_big_terrain.tile_len[0]) - 1.0f;
+			camera_pos[2] = (g_big_terrain.num_rows*g_big_terrain.tile_len[1]) - 1.0f;
+			camera_pos[1] = g_big_terrain.pTiles[(g_big_terrain.num_tiles-1)].max_height + 2.0f;
+		}
+		UpdateTerrainLod(camera_pos, 0, 0);
+		
+		num_tris = 0;
+		num_full_tris = 0;
+		memset(num_per_level, 0, sizeof(num_per_level));
+		for(tile_i = 0; tile_i < g_big_terrain.num_tiles; tile_i++)
+		{
+			ptile = &(g_big_terrain.pTiles[tile_i]);
+			num_tris += g_big_terrain.lod.count[ptile->lod_level][ptile->lod_mask]/3;
+			num_full_tris += g_big_terrain.lod.count[0][0]/3;
+			num_per_level[ptile->lod_level] += 1;
+			
+			//the tile in +x and the tile in +z must agree on the shared side
+			row = tile_i/g_big_terrain.num_cols;
+			col = tile_i%g_big_terrain.num_cols;
+			for(i = 0; i < 2; i++)
+			{
+				if(i == 0 && col == (g_big_terrain.num_cols-1))
+					continue;
+				if(i == 1 && row == (g_big_terrain.num_rows-1))
+					continue;
+				pnext = (i == 0) ? (ptile+1) : (ptile+g_big_terrain.num_cols);
+				if(abs(ptile->lod_level - pnext->lod_level) > 1)
+				{
+					printf("\tFAIL: tiles %d and %d are levels %d and %d\n", tile_i, (int)(pnext-g_big_terrain.pTiles), ptile->lod_level, pnext->lod_level);
+					num_bad += 1;
+					continue;
+				}
+				if(((ptile->lod_mask & ((i == 0) ? TL_EDGE_POS_X : TL_EDGE_POS_Z)) != 0) != (pnext->lod_level > ptile->lod_level)
+					|| ((pnext->lod_mask & ((i == 0) ? TL_EDGE_NEG_X : TL_EDGE_NEG_Z)) != 0) != (ptile->lod_level > pnext->lod_level))
+				{
+					printf("\tFAIL: tiles %d and %d don't stitch their shared side\n", tile_i, (int)(pnext-g_big_terrain.pTiles));
+					num_bad += 1;
+				}
+			}
+		}
+		printf("\tcamera %d (%s) at (%f, %f, %f):\n", cam_i, camera_names[cam_i], camera_pos[0], camera_pos[1], camera_pos[2]);
+		printf("\t\ttiles per level:");
+		for(i = 0; i < TL_NUM_LEVELS; i++)
+			printf(" %d", num_per_level[i]);
+		printf("\n");
+		printf("\t\ttriangles: %lld of %lld at full res (%.1f%%)\n", num_tris, num_full_tris, (num_full_tris > 0) ? ((100.0*num_tris)/num_full_tris) : 0.0);
+	}
+	
+	if(num_bad > 0)
+	{
+		printf("\tFAIL: %d checks failed\n", num_bad);
+		return 0;
+	}
+	printf("\tOK\n");
+	return 1;
+}
+
+/*
+BenchRaycastTerrain
+Command line tool (--bench-raycast). Loads the terrain from dem_filename
+(or the default map if 0) and casts num_rays random rays at it, from
+2 to 300 above the ground and up to 3000 long, both with
+RaycastTileSurf() and with RaycastTileSurfByQuad(), which tests every
+quad under the ray. Prints rays per second and quads tested per ray for
+each and checks that they find the same intersections, apart from rays
+the quad stepping loses.
+returns 1 if the results match, 0 if not or on failure.
+*/
+int BenchRaycastTerrain(int num_rays, char * dem_filename)
+{
+	char filename[255] = "./resources/maps/dem7.asc";
+	struct timespec start_time;
+	struct timespec end_time;
+	float map_len[2];
+	float surf_pos[3];
+	float surf_norm[3];
+	float * rays;		//start pos and ray of each ray, 6 floats per ray
+	float * hits;		//intersection of each ray with RaycastTileSurf()
+	int * results;		//RaycastTileSurf() return value of each ray
+	float * pos;
+	float * ray;
+	float d[3];
+	float angle;
+	float len;
+	float max_t;
+	float t;
+	double secs[2];
+	unsigned int num_quad_tests[2];
+	int num_hits = 0;
+	int num_lost = 0;
+	int num_bad = 0;
+	int pass;
+	int i, k;
+	int r;
+	
+	if(num_rays < 1)
+	{
+		printf("BenchRaycastTerrain: error. num_rays must be at least 1 (%d)\n", num_rays);
+		return 0;
+	}
+	if(dem_filename != 0)
+		snprintf(filename, 255, "%s", dem_filename);
+	
+	r = InitTerrain(filename);
+	if(r == 0)
+	{
+		printf("BenchRaycastTerrain: error. InitTerrain() failed.\n");
+		return 0;
+	}
+	
+	rays = (float*)malloc(num_rays*6*sizeof(float));
+	hits = (float*)malloc(num_rays*3*sizeof(float));
+	results = (int*)malloc(num_rays*sizeof(int));
+	if(rays == 0 || hits == 0 || results == 0)
+	{
+		printf("BenchRaycastTerrain: malloc failed for %d rays\n", num_rays);
+		free(rays);
+		free(hits);
+		free(results);
+		return 0;
+	}
+	
+	//make the rays first so the ground lookups aren't timed
+	map_len[0] = g_big_terrain.num_cols*g_big_terrain.tile_len[0];
+	map_len[1] = g_big_terrain.num_rows*g_big_terrain.tile_len[1];
+	for(i = 0; i < num_rays; i++)
+	{
+		pos = rays + (i*6);
+		ray = pos + 3;
+		pos[0] = 1.0f + (((float)rand()/(float)RAND_MAX)*(map_len[0] - 2.0f));
+		pos[2] = 1.0f + (((float)rand()/(float)RAND_MAX)*(map_len[1] - 2.0f));
+		pos[1] = 0.0f;
+		r = GetTileSurfPoint(pos, surf_pos, surf_norm);
+		if(r == 1)
+			pos[1] = surf_pos[1];
+		pos[1] += 2.0f + (((float)rand()/(float)RAND_MAX)*298.0f);
+		
+		angle = ((float)rand()/(float)RAND_MAX)*2.0f*(float)PI;
+		len = 10.0f + (((float)rand()/(float)RAND_MAX)*2990.0f);
+		ray[0] = cosf(angle)*len;
+		ray[2] = sinf(angle)*len;
+		ray[1] = 50.0f - (((float)rand()/(float)RAND_MAX)*600.0f);
+		
+		//shorten the ray so it ends on the map
+		max_t = 1.0f;
+		for(k = 0; k < 2; k++)
+		{
+			t = max_t;
+			if(ray[(k*2)] > 0.0f)
+				t = (map_len[k] - 1.0f - pos[(k*2)])/ray[(k*2)];
+			else if(ray[(k*2)] < 0.0f)
+				t = (1.0f - pos[(k*2)])/ray[(k*2)];
+			if(t < max_t)
+				max_t = t;
+		}
+		ray[0] *= max_t;
+		ray[1] *= max_t;
+		ray[2] *= max_t;
+	}
+	
+	for(pass = 0; pass < 2; pass++)
+	{
+		g_debug_num_ray_quad_tests = 0;
+		clock_gettime(CLOCK_MONOTONIC, &start_time);
+		for(i = 0; i < num_rays; i++)
+		{
+			pos = rays + (i*6);
+			ray = pos + 3;
+			if(pass == 0)
+			{
+				results[i] = RaycastTileSurf(pos, ray, (hits+(i*3)), surf_norm);
+				continue;
+			}
+			r = RaycastTileSurfByQuad(pos, ray, surf_pos, surf_norm);
+			vSubtract(d, surf_pos, (hits+(i*3)));
+			if(r == 0 && results[i] == 1)
+			{
+				//stepping from quad to quad can lose the ray where it crosses a quad corner. The
+				//intersection still has to be on the terrain.
+				GetTileSurfPoint((hits+(i*3)), surf_pos, surf_norm);
+				if(fabsf(surf_pos[1] - hits[(i*3)+1]) < 0.01f)
+				{
+					num_lost += 1;
+					continue;
+				}
+			}
+			if(r != results[i] || (r == 1 && vMagnitude(d) > 0.01f))
+			{
+				if(num_bad < 10)
+					printf("\tFAIL: ray %d from (%f, %f, %f) along (%f, %f, %f) returned %d, by quad %d\n", i, pos[0], pos[1], pos[2], ray[0], ray[1], ray[2], results[i], r);
+				num_bad += 1;
+			}
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end_time);
+		secs[pass] = (end_time.tv_sec - start_time.tv_sec) + ((end_time.tv_nsec - start_time.tv_nsec)*1e-9);
+		num_quad_tests[pass] = g_debug_num_ray_quad_tests;
+	}
+	for(i = 0; i < num_rays; i++)
+	{
+		if(results[i] == 1)
+			num_hits += 1;
+	}
+	
+	printf("%s:\n", filename);
+	printf("\t%d rays, %d hit the terrain\n", num_rays, num_hits);
+	printf("\tRaycastTileSurf: %.0f rays/s, %.1f quads tested per ray\n", num_rays/((secs[0] > 0.0) ? secs[0] : 1e-9), (float)num_quad_tests[0]/num_rays);
+	printf("\tby quad: %.0f rays/s, %.1f quads tested per ray\n", num_rays/((secs[1] > 0.0) ? secs[1] : 1e-9), (float)num_quad_tests[1]/num_rays);
+	if(num_lost > 0)
+		printf("\tby quad lost %d rays that hit the terrain\n", num_lost);
+	free(rays);
+	free(hits);
+	free(results);
+	
+	if(num_bad > 0)
+	{
+		printf("\tFAIL: %d rays don't match\n", num_bad);
+		return 0;
+	}
+	printf("\tOK\n");
+	return 1;
+}
+
+/*
+BenchWheelRays
+Command line tool (--bench-wheel-rays). Loads the terrain from
+dem_filename (or the default map if 0), puts num_vehicles vehicles on
+the map at random places, headings and tilts (up to 10 degrees), and
+drives them straight ahead for 600 ticks, keeping them on the ground.
+Each tick the 4 wheel rays of every vehicle are cast in one batch
+(UpdateVehicleWheelRays2) and one by one with RaycastTileSurf(). Prints
+the time per tick for each and checks they hit the same points.
+returns 1 if the results match, 0 if not or on failure.
+*/
+int BenchWheelRays(int num_vehicles, char * dem_filename)
+{
+	char filename[255] = "./resources/maps/dem7.asc";
+	const int num_ticks = 600;
+	struct vehicle_physics_struct2 * vehicles;
+	struct vehicle_physics_struct2 * pvehicle;
+	struct terrain_ray_struct * wheelRays;
+	struct terrain_ray_struct * pray;
+	struct timespec start_time;
+	struct timespec end_time;
+	float * speeds;		//distance each vehicle moves per tick
+	float * xz;			//x,z of every vehicle, for the ground heights
+	float * ground;
+	float map_len[2];
+	float axis[3];
+	float qyaw[4];
+	float qtilt[4];
+	float fwd[3];
+	float surf_pos[3];
+	float surf_norm[3];
+	double secs[2] = {0.0, 0.0};
+	long long num_walked = 0;
+	long long num_hits = 0;
+	int num_bad = 0;
+	int tick;
+	int i, j;
+	int r;
+	
+	if(num_vehicles < 1)
+	{
+		printf("BenchWheelRays: error. num_vehicles must be at least 1 (%d)\n", num_vehicles);
+		return 0;
+	}
+	if(dem_filename != 0)
+		snprintf(filename, 255, "%s", dem_filename);
+	
+	r = InitTerrain(filename);
+	if(r == 0)
+	{
+		printf("BenchWheelRays: error. InitTerrain() failed.\n");
+		return 0;
+	}
+	
+	vehicles = (struct vehicle_physics_struct2*)malloc(num_vehicles*sizeof(struct vehicle_physics_struct2));
+	wheelRays = (struct terrain_ray_struct*)malloc(num_vehicles*4*sizeof(struct terrain_ray_struct));
+	speeds = (float*)malloc(num_vehicles*sizeof(float));
+	xz = (float*)malloc(num_vehicles*2*sizeof(float));
+	ground = (float*)malloc(num_vehicles*sizeof(float));
+	if(vehicles == 0 || wheelRays == 0 || speeds == 0 || xz == 0 || ground == 0)
+	{
+		printf("BenchWheelRays: malloc failed for %d vehicles\n", num_vehicles);
+		free(vehicles);
+		free(wheelRays);
+		free(speeds);
+		free(xz);
+		free(ground);
+		return 0;
+	}
+	
+	map_len[0] = g_big_terrain.num_cols*g_big_terrain.tile_len[0];
+	map_len[1] = g_big_terrain.num_rows*g_big_terrain.tile_len[1];
+	for(i = 0; i < num_vehicles; i++)
+	{
+		pvehicle = vehicles + i;
+		InitSomeVehicle2(pvehicle);
+		pvehicle->cg[0] = 50.0f + (RandomFloat()*(map_len[0] - 100.0f));
+		pvehicle->cg[2] = 50.0f + (RandomFloat()*(map_len[1] - 100.0f));
+		axis[0] = 0.0f;
+		axis[1] = 1.0f;
+		axis[2] = 0.0f;
+		qCreate(qyaw, axis, (360.0f*RandomFloat()));
+		axis[0] = RandomFloat() - 0.5f;
+		axis[1] = 0.0f;
+		axis[2] = RandomFloat() - 0.5f;
+		vNormalize(axis);
+		qCreate(qtilt, axis, (10.0f*RandomFloat()));
+		qMultiply(pvehicle->orientationQ, qtilt, qyaw);
+		qConvertToMat3(pvehicle->orientationQ, pvehicle->orientation);
+		speeds[i] = 0.5f*RandomFloat(); //up to 30 per second at 60 ticks per second
+	}
+	
+	for(tick = 0; tick < num_ticks; tick++)
+	{
+		//drive forward and sit the vehicles on the ground, turning back at the edge of the map
+		for(i = 0; i < num_vehicles; i++)
+		{
+			pvehicle = vehicles + i;
+			fwd[0] = 0.0f;
+			fwd[1] = 0.0f;
+			fwd[2] = speeds[i];
+			mmTransformVec3(pvehicle->orientation, fwd);
+			if((pvehicle->cg[0] + fwd[0]) < 10.0f || (pvehicle->cg[0] + fwd[0]) > (map_len[0] - 10.0f)
+				|| (pvehicle->cg[2] + fwd[2]) < 10.0f || (pvehicle->cg[2] + fwd[2]) > (map_len[1] - 10.0f))
+				speeds[i] = -speeds[i];
+			else
+			{
+				pvehicle->cg[0] += fwd[0];
+				pvehicle->cg[2] += fwd[2];
+			}
+			xz[(i*2)] = pvehicle->cg[0];
+			xz[(i*2)+1] = pvehicle->cg[2];
+		}
+		GetTileSurfPointBatch(xz, num_vehicles, ground, 0);
+		for(i = 0; i < num_vehicles; i++)
+		{
+			vehicles[i].cg[1] = ground[i] + 1.4f; //wheel springs start 0.9 under the cg and are 1 long
+		}
+		
+		clock_gettime(CLOCK_MONOTONIC, &start_time);
+		num_walked += UpdateVehicleWheelRays2(vehicles, num_vehicles, wheelRays);
+		clock_gettime(CLOCK_MONOTONIC, &end_time);
+		secs[0] += (end_time.tv_sec - start_time.tv_sec) + ((end_time.tv_nsec - start_time.tv_nsec)*1e-9);
+		
+		clock_gettime(CLOCK_MONOTONIC, &start_time);
+		for(j = 0; j < (num_vehicles*4); j++)
+		{
+			pray = wheelRays + j;
+			r = RaycastTileSurf(pray->pos, pray->ray, surf_pos, surf_norm);
+			if(r == 1)
+				num_hits += 1;
+			if(r != pray->result || (r == 1 && fabsf(surf_pos[1] - pray->surf_pos[1]) > 0.001f))
+			{
+				if(num_bad < 10)
+					printf("\tFAIL: tick %d wheel ray %d from (%f, %f, %f) returned %d, RaycastTileSurf() %d\n", tick, j, pray->pos[0], pray->pos[1], pray->pos[2], pray->result, r);
+				num_bad += 1;
+			}
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end_time);
+		secs[1] += (end_time.tv_sec - start_time.tv_sec) + ((end_time.tv_nsec - start_time.tv_nsec)*1e-9);
+	}
+	
+	printf("%s:\n", filename);
+	printf("\t%d vehicles, %d ticks, %lld wheel rays, %lld hit the terrain\n", num_vehicles, num_ticks, ((long long)num_vehicles*4*num_ticks), num_hits);
+	printf("\tbatch: %.3f ms per tick, %.1f%% of rays needed RaycastTileSurf()\n", (secs[0]*1000.0)/num_ticks, (100.0*num_walked)/((double)num_vehicles*4*num_ticks));
+	printf("\tRaycastTileSurf: %.3f ms per tick\n", (secs[1]*1000.0)/num_ticks);
+	free(vehicles);
+	free(wheelRays);
+	free(speeds);
+	free(xz);
+	free(ground);
+	
+	if(num_bad > 0)
+	{
+		printf("\tFAIL: %d rays don't match\n", num_bad);
+		return 0;
+	}
+	printf("\tOK\n");
+	return 1;
+}
+
+/*
+SetupPoseCamera
+Sets up the camera for a pose (world-space x,y,z, rotY, rotX) the same
+way DrawScene() does, including the frustum planes and terrain draw box.
+-mCamera: out, the camera matrix
+*/
+static void SetupPoseCamera(float * pose, float * mCamera)
+{
+	float mRotateX[16];
+	float mRotateY[16];
+	float mRotate[16];
+	float mTranslate[16];
+	
+	g_ws_camera_pos[0] = pose[0];
+	g_ws_camera_pos[1] = pose[1];
+	g_ws_camera_pos[2] = pose[2];
+	g_camera_pos[0] = -1.0f*pose[0];
+	g_camera_pos[1] = -1.0f*pose[1];
+	g_camera_pos[2] = -1.0f*pose[2];
+	g_camera_rotY = pose[3];
+	g_camera_rotX = pose[4];
+	mmTranslateMatrix(mTranslate, g_camera_pos[0], g_camera_pos[1], g_camera_pos[2]);
+	mmRotateAboutY(mRotateY, g_camera_rotY);
+	mmRotateAboutX(mRotateX, g_camera_rotX);
+	mmMultiplyMatrix4x4(mRotateX, mRotateY, mRotate);
+	mmMultiplyMatrix4x4(mRotate, mTranslate, mCamera);
+	ClipTilesSetupFrustum(mCamera, g_ws_camera_pos);
+	UpdateTerrainDrawBox(g_ws_camera_pos);
+}
+
+/*
+CullTilesFromPose
+Sets up the camera for a pose (see SetupPoseCamera) and culls the
+terrain tiles with the quadtree. Then
+checks g_terrain_quadtree.visible against testing every tile one by one,
+the way DrawScene() did before the quadtree: each tile in the terrain
+draw box and the frustum (or the tile the camera is in) must be listed
+once, and no other tile may be.
+-in_view: out, 1 for each listed tile
+-mCamera: out, the camera matrix
+returns the # of tiles that don't match
+*/
+static int CullTilesFromPose(float * pose, char * in_view, float * mCamera)
+{
+	struct lvl_1_tile * ptile;
+	int num_bad = 0;
+	int local_tile;
+	int tile_i;
+	int r;
+	int i;
+	
+	SetupPoseCamera(pose, mCamera);
+	local_tile = GetLvl1Tile(g_camera_frustum.camera);
+	UpdateVisibleTerrainTiles(local_tile);
+	
+	memset(in_view, 0, g_big_terrain.num_tiles*sizeof(char));
+	for(i = 0; i < g_terrain_quadtree.num_visible; i++)
+	{
+		tile_i = g_terrain_quadtree.visible[i];
+		if(in_view[tile_i] == 1)
+		{
+			printf("\t\tFAIL: tile %d is listed twice\n", tile_i);
+			num_bad += 1;
+		}
+		in_view[tile_i] = 1;
+	}
+	for(tile_i = 0; tile_i < g_big_terrain.num_tiles; tile_i++)
+	{
+		ptile = &(g_big_terrain.pTiles[tile_i]);
+		r = IsTileInTerrainDrawBox(ptile);
+		if(r == 1 && tile_i != local_tile)
+			r = IsTileInCameraFrustum(&g_big_terrain, ptile);
+		if(r != in_view[tile_i])
+		{
+			printf("\t\tFAIL: camera (%f, %f, %f) rotY:%f rotX:%f: tile %d is %s but testing it alone says %d\n",
+				pose[0], pose[1], pose[2], pose[3], pose[4], tile_i, ((in_view[tile_i] == 1) ? "listed" : "not listed"), r);
+			num_bad += 1;
+		}
+	}
+	return num_bad;
+}
+
+/*
+CountFrustumTiles
+Command line tool (--count-frustum-tiles). Loads the terrain from
+dem_filename (or the default map if 0) and, for each camera pose in
+pose_filename, counts the tiles the terrain pass would draw with the
+6-plane frustum and with the old left/right planes. Then checks every
+tile the frustum rejected: none of its verts may be on screen (verts
+under the water don't count while the camera is above it). For these
+poses and for FRUSTUM_CHECK_RANDOM_POSES random ones over the map, the
+tiles the quadtree lists must be the ones testing every tile one by one
+gives (see CullTilesFromPose).
+pose_filename has one pose per line, either "x y z rotY rotX" or a line
+printed by the 'p' key ("icamera: (x,y,z) rotY:... rotX:..."). Lines
+starting with '#' are skipped.
+returns 1 if every check passes, 0 if not or on failure.
+*/
+int CountFrustumTiles(char * pose_filename, char * dem_filename)
+{
+	char filename[255] = "./resources/maps/dem7.asc";
+	char line[512];
+	struct lvl_1_tile * ptile;
+	FILE * pose_file;
+	char * in_view;
+	float pose[5];		//world-space camera x,y,z, rotY, rotX
+	float mCamera[16];
+	float mClip[16];
+	float vert[4];
+	float map_len[2];
+	long long total_old = 0;
+	long long total_new = 0;
+	long long total_random = 0;
+	long long total_random_tests = 0;
+	int num_poses = 0;
+	int num_bad = 0;
+	int num_old;
+	int tile_i;
+	int i;
+	int r;
+	
+	if(dem_filename != 0)
+		snprintf(filename, 255, "%s", dem_filename);
+	
+	pose_file = fopen(pose_filename, "r");
+	if(pose_file == 0)
+	{
+		printf("CountFrustumTiles: error. failed to open %s\n", pose_filename);
+		return 0;
+	}
+	r = InitTerrain(filename);
+	if(r == 0)
+	{
+		printf("CountFrustumTiles: error. InitTerrain() failed.\n");
+		fclose(pose_file);
+		return 0;
+	}
+	CalculatePerspectiveMatrix(g_screen_width, g_screen_height);
+	in_view = (char*)malloc(g_big_terrain.num_tiles*sizeof(char));
+	if(in_view == 0)
+	{
+		printf("CountFrustumTiles: malloc failed for %d tiles\n", g_big_terrain.num_tiles);
+		fclose(pose_file);
+		return 0;
+	}
+	
+	printf("%s, %s:\n", filename, pose_filename);
+	while(fgets(line, sizeof(line), pose_file) != 0)
+	{
+		if(line[0] == '#')
+			continue;
+		r = sscanf(line, "icamera: (%f,%f,%f) rotY:%f rotX:%f", &pose[0], &pose[1], &pose[2], &pose[3], &pose[4]);
+		if(r != 5)
+			r = sscanf(line, "%f %f %f %f %f", &pose[0], &pose[1], &pose[2], &pose[3], &pose[4]);
+		if(r != 5)
+			continue;
+		
+		num_bad += CullTilesFromPose(pose, in_view, mCamera);
+		num_old = CountTilesInLeftRightFrustum(GetLvl1Tile(g_camera_frustum.camera));
+		total_old += num_old;
+		total_new += g_terrain_quadtree.num_visible;
+		printf("\tpose %d at (%f, %f, %f) rotY:%f rotX:%f: %d tiles, %d with left/right planes (%d node tests)\n",
+			num_poses, pose[0], pose[1], pose[2], pose[3], pose[4], g_terrain_quadtree.num_visible, num_old, g_terrain_quadtree.num_tests);
+		num_poses += 1;
+		
+		mmMultiplyMatrix4x4(g_perspectiveMatrix, mCamera, mClip);
+		for(tile_i = 0; tile_i < g_big_terrain.num_tiles; tile_i++)
+		{
+			ptile = &(g_big_terrain.pTiles[tile_i]);
+			if(in_view[tile_i] == 1 || IsTileInTerrainDrawBox(ptile) == 0)
+				continue;
+			for(i = 0; i < ptile->num_verts; i++)
+			{
+				GetTileVertPos(ptile, i, vert);
+				if(pose[1] > WATER_LEVEL && vert[1] < WATER_LEVEL
+					&& fabsf(vert[0]) <= WATER_PLANE_HALF_LEN && fabsf(vert[2]) <= WATER_PLANE_HALF_LEN)
+					continue;
+				vert[3] = 1.0f;
+				mmTransformVec(mClip, vert);
+				if(fabsf(vert[0]) <= vert[3] && fabsf(vert[1]) <= vert[3] && fabsf(vert[2]) <= vert[3])
+					break;
+			}
+			if(i < ptile->num_verts)
+			{
+				printf("\t\tFAIL: tile %d was culled but vert %d is on screen\n", tile_i, i);
+				num_bad += 1;
+			}
 		}
 	}
-	printf("initialized %d tiles. k=%d l=%d\n", i, k, l);
+	fclose(pose_file);
 	
-	//set the file stream to the start of the elevation data
-	r = fseek(demInfo.pFile, demInfo.data_start_pos, SEEK_SET);
-	if(r == -1)
+	if(num_poses == 0)
 	{
-		printf("InitTerrain: fseek() failed.\n");
-		fclose(pFile);
+		printf("CountFrustumTiles: error. no camera poses in %s\n", pose_filename);
+		free(in_view);
 		return 0;
 	}
+	printf("\t%d poses: %lld tiles, %lld with left/right planes (%.1f%%)\n", num_poses, total_new, total_old, (total_old > 0) ? ((100.0*total_new)/total_old) : 0.0);
 	
-	/*
-	the idea here is to loop overall all verts in the entire
-	tile map, but keep smaller iterators that actually are used
-	to index the tile arrays.
-	*/
-	i = 0; //row of vert
-	j = 0; //column of vert
-	k = 0; //row of tile
-	l = 0; //column of tile
-	f_count = 0;
-	f_col_count = 0;
-	for(t = 0; t < (g_big_terrain.num_tiles*g_big_terrain.pTiles[0].num_x*g_big_terrain.pTiles[0].num_z); t++) //iterate for 1521 tiles * 10,000 verts per tile.
-	{
-		tile_i = (k*g_big_terrain.num_cols) + l;
-		vert_i = ((i*g_big_terrain.pTiles[tile_i].num_x) + j)*(g_big_terrain.num_floats_per_vert); 
+	//random cameras over the map and a little past its edges, looking every way
+	map_len[0] = g_big_terrain.num_cols*g_big_terrain.tile_len[0];
+	map_len[1] = g_big_terrain.num_rows*g_big_terrain.tile_len[1];
+	srand(1);
+	for(i = 0; i < FRUSTUM_CHECK_RANDOM_POSES; i++)
+	{
+		pose[0] = ((1.4f*RandomFloat()) - 0.2f)*map_len[0];
+		pose[1] = (3000.0f*RandomFloat()) - 100.0f;
+		pose[2] = ((1.4f*RandomFloat()) - 0.2f)*map_len[1];
+		pose[3] = 360.0f*RandomFloat();
+		pose[4] = (178.0f*RandomFloat()) - 89.0f;
+		num_bad += CullTilesFromPose(pose, in_view, mCamera);
+		total_random += g_terrain_quadtree.num_visible;
+		total_random_tests += g_terrain_quadtree.num_tests;
+	}
+	free(in_view);
+	printf("\t%d random poses: %.1f tiles and %.1f node tests per pose, against %d tile tests one by one\n", FRUSTUM_CHECK_RANDOM_POSES,
+		((double)total_random/FRUSTUM_CHECK_RANDOM_POSES), ((double)total_random_tests/FRUSTUM_CHECK_RANDOM_POSES), g_big_terrain.num_tiles);
+	
+	if(num_bad > 0)
+	{
+		printf("\tFAIL: %d checks failed\n", num_bad);
+		return 0;
+	}
+	printf("\tOK\n");
+	return 1;
+}
+
+/*
+CountOccludedTiles
+Command line tool (--count-occluded-tiles). Loads the terrain from
+dem_filename (or the default map if 0) and, for each camera pose in
+pose_filename (same format as --count-frustum-tiles), culls the tiles to
+the frustum, picks LOD levels and runs UpdateTerrainOcclusion(). Prints
+how many frustum tiles the horizon hides and how long it took. Then
+checks every hidden tile: a ray from the camera to any of its verts must
+hit the terrain before it gets there.
+returns 1 if every check passes, 0 if not or on failure.
+*/
+int CountOccludedTiles(char * pose_filename, char * dem_filename)
+{
+	char filename[255] = "./resources/maps/dem7.asc";
+	char line[512];
+	struct lvl_1_tile * ptile;
+	struct timespec t_start, t_end, t_elapsed;
+	FILE * pose_file;
+	float pose[5];		//world-space camera x,y,z, rotY, rotX
+	float mRotateX[16];
+	float mRotateY[16];
+	float mRotate[16];
+	float mTranslate[16];
+	float mCamera[16];
+	float vert[3];
+	float ray[3];
+	float surf_pos[3];
+	float surf_norm[3];
+	float len;
+	double secs = 0.0;
+	long long total_visible = 0;
+	long long total_occluded = 0;
+	long long num_rays = 0;
+	int num_poses = 0;
+	int num_bad = 0;
+	int local_tile;
+	int i_visible;
+	int row, col;
+	int vert_row, vert_col;
+	int r;
+	
+	if(dem_filename != 0)
+		snprintf(filename, 255, "%s", dem_filename);
+	
+	pose_file = fopen(pose_filename, "r");
+	if(pose_file == 0)
+	{
+		printf("CountOccludedTiles: error. failed to open %s\n", pose_filename);
+		return 0;
+	}
+	r = InitTerrain(filename);
+	if(r == 0)
+	{
+		printf("CountOccludedTiles: error. InitTerrain() failed.\n");
+		fclose(pose_file);
+		return 0;
+	}
+	CalculatePerspectiveMatrix(g_screen_width, g_screen_height);
+	
+	printf("%s, %s:\n", filename, pose_filename);
+	while(fgets(line, sizeof(line), pose_file) != 0)
+	{
+		if(line[0] == '#')
+			continue;
+		r = sscanf(line, "icamera: (%f,%f,%f) rotY:%f rotX:%f", &pose[0], &pose[1], &pose[2], &pose[3], &pose[4]);
+		if(r != 5)
+			r = sscanf(line, "%f %f %f %f %f", &pose[0], &pose[1], &pose[2], &pose[3], &pose[4]);
+		if(r != 5)
+			continue;
+		
+		//set up the camera the same way DrawScene() does
+		g_ws_camera_pos[0] = pose[0];
+		g_ws_camera_pos[1] = pose[1];
+		g_ws_camera_pos[2] = pose[2];
+		g_camera_pos[0] = -1.0f*pose[0];
+		g_camera_pos[1] = -1.0f*pose[1];
+		g_camera_pos[2] = -1.0f*pose[2];
+		g_camera_rotY = pose[3];
+		g_camera_rotX = pose[4];
+		mmTranslateMatrix(mTranslate, g_camera_pos[0], g_camera_pos[1], g_camera_pos[2]);
+		mmRotateAboutY(mRotateY, g_camera_rotY);
+		mmRotateAboutX(mRotateX, g_camera_rotX);
+		mmMultiplyMatrix4x4(mRotateX, mRotateY, mRotate);
+		mmMultiplyMatrix4x4(mRotate, mTranslate, mCamera);
+		ClipTilesSetupFrustum(mCamera, g_ws_camera_pos);
+		local_tile = GetLvl1Tile(g_camera_frustum.camera);
+		UpdateTerrainDrawBox(g_ws_camera_pos);
+		UpdateVisibleTerrainTiles(local_tile);
+		UpdateTerrainLod(g_ws_camera_pos, g_terrain_quadtree.visible, g_terrain_quadtree.num_visible);
+		
+		clock_gettime(CLOCK_MONOTONIC, &t_start);
+		UpdateTerrainOcclusion(g_camera_frustum.camera, 0);
+		clock_gettime(CLOCK_MONOTONIC, &t_end);
+		GetElapsedTime(&t_start, &t_end, &t_elapsed);
+		secs += t_elapsed.tv_sec + (t_elapsed.tv_nsec/1000000000.0);
+		total_visible += g_terrain_quadtree.num_visible;
+		total_occluded += g_terrain_occlusion.num_occluded;
+		printf("\tpose %d at (%f, %f, %f) rotY:%f rotX:%f: %d of %d frustum tiles occluded, %d occluder tiles, %d blocks, %.3f ms%s\n",
+			num_poses, pose[0], pose[1], pose[2], pose[3], pose[4], g_terrain_occlusion.num_occluded, g_terrain_quadtree.num_visible,
+			g_terrain_occlusion.num_occluder_tiles, g_terrain_occlusion.horizon.num_occluders, (t_elapsed.tv_sec*1000.0) + (t_elapsed.tv_nsec/1000000.0),
+			(g_terrain_occlusion.enabled == 0) ? " (camera under the terrain)" : "");
+		num_poses += 1;
 		
-		//special case: first vert in the whole map...just fetch a data point
-		if(k == 0 && l == 0 && i == 0 && j == 0)
+		//every 4th vert and the far edges of each hidden tile
+		for(i_visible = 0; i_visible < g_terrain_quadtree.num_visible; i_visible++)
 		{
-			r = feof(demInfo.pFile);
-			if(r != 0) //we hit the end of the file
+			ptile = &(g_big_terrain.pTiles[g_terrain_quadtree.visible[i_visible]]);
+			if(ptile->occluded == 0)
+				continue;
+			r = 1;
+			for(row = 0; row < (ptile->num_z + 3) && r == 1; row += 4)
 			{
-				printf("InitTerrain: found end of file at t=%d k=%d l=%d i=%d j=%d\n", t, k, l, i, j);
-				fclose(demInfo.pFile);
-				return 0;
+				vert_row = (row < ptile->num_z) ? row : (ptile->num_z-1);
+				for(col = 0; col < (ptile->num_x + 3) && r == 1; col += 4)
+				{
+					vert_col = (col < ptile->num_x) ? col : (ptile->num_x-1);
+					GetTileVertPos(ptile, ((vert_row*ptile->num_x) + vert_col), vert);
+					ray[0] = vert[0] - pose[0];
+					ray[1] = vert[1] - pose[1];
+					ray[2] = vert[2] - pose[2];
+					
+					//stop half a unit short so the vert's own triangles don't count as a hit
+					len = vMagnitude(ray);
+					if(len <= 0.5f)
+						continue;
+					ray[0] *= (len - 0.5f)/len;
+					ray[1] *= (len - 0.5f)/len;
+					ray[2] *= (len - 0.5f)/len;
+					num_rays += 1;
+					r = RaycastTileSurf(pose, ray, surf_pos, surf_norm);
+				}
+			}
+			if(r != 1)
+			{
+				printf("\t\tFAIL: tile %d was occluded but vert (%d,%d) can be seen\n", g_terrain_quadtree.visible[i_visible], vert_row, vert_col);
+				num_bad += 1;
 			}
-			
-			fscanf(demInfo.pFile, "%f", &f);
-			f_count += 1;
-			f_col_count += 1;
-			g_big_terrain.pTiles[0].pPos[1] = f;
 		}
-		else if(k != 0 && //not a tile in the first row
-			i == 0) //vertex is in the first row
+	}
+	fclose(pose_file);
+	
+	if(num_poses == 0)
+	{
+		printf("CountOccludedTiles: error. no camera poses in %s\n", pose_filename);
+		return 0;
+	}
+	printf("\t%d poses: %lld of %lld frustum tiles occluded (%.1f%%), %.3f ms per pose, %lld verts checked\n", num_poses, total_occluded, total_visible,
+		(total_visible > 0) ? ((100.0*total_occluded)/total_visible) : 0.0, (secs*1000.0)/num_poses, num_rays);
+	if(num_bad > 0)
+	{
+		printf("\tFAIL: %d checks failed\n", num_bad);
+		return 0;
+	}
+	printf("\tOK\n");
+	return 1;
+}
+
+/*
+CountBillboardDraws
+Command line tool (--count-billboard-draws). Loads the terrain from
+dem_filename (or the default map if 0) and plants it, then for each
+camera pose in pose_filename (same format as --count-frustum-tiles)
+culls the plants, queues them with QueuePlants() and records the GL calls
+the render queue would make (see g_gl_record). There is no GL context, so
+the plant textures and billboard program get made up names and there are
+no detailed plant models. Checks that every billboard is drawn instanced:
+one draw per plant type for the plants gathered from the tiles, plus one
+per type for each tile drawn from its static buffer, covering every
+billboard plant once.
+returns 1 if every check passes, 0 if not or on failure.
+*/
+int CountBillboardDraws(char * pose_filename, char * dem_filename)
+{
+	char filename[255] = "./resources/maps/dem7.asc";
+	char line[512];
+	struct gl_record_struct record;
+	struct gl_record_draw_struct * new_draws;
+	struct rq_queue_struct queue;
+	struct plant_tile * p_plant_tile;
+	FILE * pose_file;
+	float pose[5];		//world-space camera x,y,z, rotY, rotX
+	float mCamera[16];
+	long long total_plants = 0;
+	long long total_draws = 0;
+	int want_draws[6];	//per plant type, from the draw lists
+	int want_plants[6];
+	int num_draws[6];	//per plant type, from the recorded calls
+	int num_plants[6];
+	int num_poses = 0;
+	int num_bad = 0;
+	int pose_plants;
+	int pose_draws;
+	int local_tile;
+	int ret_val = 0;
+	int i, k, t;
+	int r;
+	
+	if(dem_filename != 0)
+		snprintf(filename, 255, "%s", dem_filename);
+	
+	memset(&record, 0, sizeof(struct gl_record_struct));
+	memset(&queue, 0, sizeof(struct rq_queue_struct));
+	pose_file = fopen(pose_filename, "r");
+	if(pose_file == 0)
+	{
+		printf("CountBillboardDraws: error. failed to open %s\n", pose_filename);
+		return 0;
+	}
+	r = InitTerrain(filename);
+	if(r == 0)
+	{
+		printf("CountBillboardDraws: error. InitTerrain() failed.\n");
+		goto cleanup;
+	}
+	CalculatePerspectiveMatrix(g_screen_width, g_screen_height);
+	
+	//made up GL names, the render queue only compares them
+	InitSimpleBillboardSizes(&g_bush_smallbillboard);
+	for(t = 0; t < 6; t++)
+		g_bush_smallbillboard.texture_ids[t] = t + 1;
+	g_bush_smallbillboard.vao = 1;
+	g_bush_smallbillboard.instance_vbo = 1;
+	g_billboard_shader.program = 1;
+	InitPlantCullBounds(&g_bush_grid);
+	r = InitPlantGrid2(&g_bush_grid);
+	if(r == -1)
+	{
+		printf("CountBillboardDraws: error. InitPlantGrid2() failed.\n");
+		goto cleanup;
+	}
+	
+	g_gl_record = &record;
+	printf("%s, %s:\n", filename, pose_filename);
+	while(fgets(line, sizeof(line), pose_file) != 0)
+	{
+		if(line[0] == '#')
+			continue;
+		r = sscanf(line, "icamera: (%f,%f,%f) rotY:%f rotX:%f", &pose[0], &pose[1], &pose[2], &pose[3], &pose[4]);
+		if(r != 5)
+			r = sscanf(line, "%f %f %f %f %f", &pose[0], &pose[1], &pose[2], &pose[3], &pose[4]);
+		if(r != 5)
+			continue;
+		
+		//the culling DrawScene() and the frame jobs do
+		SetupPoseCamera(pose, mCamera);
+		local_tile = GetLvl1Tile(g_camera_frustum.camera);
+		UpdatePlantDrawGrid(&g_bush_grid, local_tile, g_ws_camera_pos);
+		UpdateVisibleTerrainTiles(local_tile);
+		UpdateTerrainLod(g_ws_camera_pos, g_terrain_quadtree.visible, g_terrain_quadtree.num_visible);
+		UpdateTerrainOcclusion(g_camera_frustum.camera, 0);
+		UpdateVisiblePlants(&g_bush_grid, g_camera_frustum.camera);
+		r = UpdatePlantDrawLists(&g_bush_grid);
+		if(r == 0)
+			goto cleanup;
+		
+		rqClear(&queue);
+		QueuePlants(&queue, mCamera);
+		rqSort(&queue);
+		if(record.max_draws < queue.num)
 		{
-			//get the elevation from the tile in the row above
-			lastrow_i = ((99*100) + j)*(g_big_terrain.num_floats_per_vert);
-			g_big_terrain.pTiles[tile_i].pPos[(vert_i+1)] = g_big_terrain.pTiles[(tile_i-g_big_terrain.num_cols)].pPos[(lastrow_i+1)];
+			new_draws = (struct gl_record_draw_struct*)realloc(record.draws, queue.num*sizeof(struct gl_record_draw_struct));
+			if(new_draws == 0)
+			{
+				printf("CountBillboardDraws: realloc failed for %d draws\n", queue.num);
+				goto cleanup;
+			}
+			record.draws = new_draws;
+			record.max_draws = queue.num;
 		}
-		else if(l != 0 && //not a tile in the first column
-			j == 0) //vertex is in the first column
+		record.num_draws = 0;
+		record.num_state_changes = 0;
+		SubmitRenderQueue(&queue);
+		
+		memset(want_draws, 0, sizeof(want_draws));
+		memset(want_plants, 0, sizeof(want_plants));
+		for(k = 0; k < g_bush_grid.num_static_billboards; k++)
 		{
-			//get the elevation from the previous tile in the row
-			lastcol_i = ((i*100) + 99)*g_big_terrain.num_floats_per_vert;
-			g_big_terrain.pTiles[tile_i].pPos[(vert_i+1)] = g_big_terrain.pTiles[(tile_i-1)].pPos[(lastcol_i+1)];
+			p_plant_tile = g_bush_grid.p_tiles + g_bush_grid.static_billboards[(k*2)];
+			t = g_bush_grid.static_billboards[(k*2)+1];
+			want_draws[t] += 1;
+			want_plants[t] += p_plant_tile->cull_spheres.type_count[t];
 		}
-		else if(f_count > demInfo.num_total) //we are past the point of where the DEM file has data.
+		memset(num_draws, 0, sizeof(num_draws));
+		memset(num_plants, 0, sizeof(num_plants));
+		for(i = 0; i < record.num_draws; i++)
 		{
-			g_big_terrain.pTiles[tile_i].pPos[(vert_i+1)] = min; //use the minimum elevation of the DEM file as default.
+			if(record.draws[i].program != g_billboard_shader.program)
+				continue;
+			t = (int)record.draws[i].texture - 1;
+			if(record.draws[i].num_instances == 0)
+			{
+				printf("\t\tFAIL: pose %d: a plant type %d billboard was drawn without instancing\n", num_poses, t);
+				num_bad += 1;
+			}
+			num_draws[t] += 1;
+			num_plants[t] += record.draws[i].num_instances;
 		}
-		else if(f_col_count > demInfo.num_col) //we are past the end of a row of the DEM file.
+		pose_plants = 0;
+		pose_draws = 0;
+		for(t = 0; t < 6; t++)
 		{
-			g_big_terrain.pTiles[tile_i].pPos[(vert_i+1)] = min; //use the minimum elevation of the DEM file as default.
+			if(g_bush_grid.billboard_num[t] > 0)
+				want_draws[t] += 1;
+			want_plants[t] += g_bush_grid.billboard_num[t];
+			if(num_draws[t] != want_draws[t] || num_plants[t] != want_plants[t])
+			{
+				printf("\t\tFAIL: pose %d plant type %d: %d draws for %d billboards, want %d draws for %d\n", num_poses, t, num_draws[t], num_plants[t], want_draws[t], want_plants[t]);
+				num_bad += 1;
+			}
+			pose_plants += num_plants[t];
+			pose_draws += num_draws[t];
 		}
-		else
+		printf("\tpose %d at (%f, %f, %f) rotY:%f rotX:%f: %d billboards in %d instanced draws (%d from tile buffers), %d state changes\n",
+			num_poses, pose[0], pose[1], pose[2], pose[3], pose[4], pose_plants, pose_draws, g_bush_grid.num_static_billboards, record.num_state_changes);
+		total_plants += pose_plants;
+		total_draws += pose_draws;
+		num_poses += 1;
+	}
+	
+	if(num_poses == 0)
+	{
+		printf("CountBillboardDraws: error. no camera poses in %s\n", pose_filename);
+		goto cleanup;
+	}
+	printf("\t%d poses: %lld billboards in %lld draws, one draw per billboard before\n", num_poses, total_plants, total_draws);
+	if(num_bad > 0)
+	{
+		printf("\tFAIL: %d checks failed\n", num_bad);
+	}
+	else
+	{
+		printf("\tOK\n");
+		ret_val = 1;
+	}
+	
+cleanup:
+	g_gl_record = 0;
+	fclose(pose_file);
+	rqFree(&queue);
+	free(record.draws);
+	return ret_val;
+}
+
+/*
+BenchObjectCull
+Command line tool (--bench-object-cull). Loads the terrain from
+dem_filename (or the default map if 0), scatters num_objects plants of
+random types over it and culls them from 12 camera headings at the map
+center: one plant at a time from the plants array, and with
+ocCullSpheresSimd() on each path the cpu has (AVX, SSE, scalar). Prints
+the time per cull for each and checks that every path picks the same
+plants in the same order as one at a time.
+returns 1 if the results match, 0 if not or on failure.
+*/
+int BenchObjectCull(int num_objects, char * dem_filename)
+{
+	char filename[255] = "./resources/maps/dem7.asc";
+	const int num_headings = 12;
+	const int num_repeats = 20;
+	const float radius[6] = {2.0f, 9.0f, 1.5f, 2.0f, 6.0f, 9.0f};
+	const float max_dist[6] = {200.0f, 2000.0f, 200.0f, 200.0f, 200.0f, 2000.0f};
+	struct oc_spheres_struct spheres;
+	struct oc_visible_struct visible;
+	struct plant_info_struct * plants;
+	struct timespec start_time;
+	struct timespec end_time;
+	float * xz;
+	float * y;
+	float center[3];
+	float mRotateY[16];
+	float mTranslate[16];
+	float mCamera[16];
+	float d;
+	double secs[OC_SIMD_AVX+2];	//per OC_SIMD_* path, then one at a time
+	long long num_visible = 0;
+	int best_simd;
+	int simd;
+	int ret_val = 0;
+	int * ref_ids;
+	int ref_num[6];
+	int num_bad = 0;
+	int heading;
+	int repeat;
+	int i, j, t;
+	int r;
+
+	if(num_objects < 1)
+	{
+		printf("BenchObjectCull: error. num_objects must be at least 1 (%d)\n", num_objects);
+		return 0;
+	}
+	if(dem_filename != 0)
+		snprintf(filename, 255, "%s", dem_filename);
+
+	r = InitTerrain(filename);
+	if(r == 0)
+	{
+		printf("BenchObjectCull: error. InitTerrain() failed.\n");
+		return 0;
+	}
+	CalculatePerspectiveMatrix(g_screen_width, g_screen_height);
+
+	memset(secs, 0, sizeof(secs));
+	best_simd = ocGetSimd();
+	memset(&spheres, 0, sizeof(struct oc_spheres_struct));
+	memset(&visible, 0, sizeof(struct oc_visible_struct));
+	plants = (struct plant_info_struct*)malloc(num_objects*sizeof(struct plant_info_struct));
+	ref_ids = (int*)malloc(num_objects*sizeof(int));
+	xz = (float*)malloc(num_objects*2*sizeof(float));
+	y = (float*)malloc(num_objects*sizeof(float));
+	if(plants == 0 || ref_ids == 0 || xz == 0 || y == 0)
+	{
+		printf("BenchObjectCull: malloc failed for %d objects\n", num_objects);
+		goto cleanup;
+	}
+
+	//scatter the plants over the map, sorted by type like InitPlantGrid2() does
+	srand(1);
+	for(i = 0; i < num_objects; i++)
+	{
+		xz[(i*2)] = RandomFloat()*(g_big_terrain.num_cols*g_big_terrain.tile_len[0]);
+		xz[(i*2)+1] = RandomFloat()*(g_big_terrain.num_rows*g_big_terrain.tile_len[1]);
+	}
+	GetTileSurfPointBatch(xz, num_objects, y, 0);
+	for(i = 0; i < num_objects; i++)
+	{
+		t = (i*6)/num_objects;
+		plants[i].pos[0] = xz[(i*2)];
+		plants[i].pos[1] = (y[i] == -FLT_MAX) ? 0.0f : y[i];
+		plants[i].pos[2] = xz[(i*2)+1];
+		plants[i].plant_type = (char)t;
+		center[0] = plants[i].pos[0];
+		center[1] = plants[i].pos[1] + radius[t];
+		center[2] = plants[i].pos[2];
+		r = ocSpheresAdd(&spheres, center, radius[t], max_dist[t], t);
+		if(r == 0)
+			goto cleanup;
+	}
+
+	//camera a little above the middle of the map
+	g_ws_camera_pos[0] = 0.5f*(g_big_terrain.num_cols*g_big_terrain.tile_len[0]);
+	g_ws_camera_pos[2] = 0.5f*(g_big_terrain.num_rows*g_big_terrain.tile_len[1]);
+	xz[0] = g_ws_camera_pos[0];
+	xz[1] = g_ws_camera_pos[2];
+	GetTileSurfPointBatch(xz, 1, y, 0);
+	g_ws_camera_pos[1] = ((y[0] == -FLT_MAX) ? 0.0f : y[0]) + 10.0f;
+	g_camera_pos[0] = -1.0f*g_ws_camera_pos[0];
+	g_camera_pos[1] = -1.0f*g_ws_camera_pos[1];
+	g_camera_pos[2] = -1.0f*g_ws_camera_pos[2];
+	for(heading = 0; heading < num_headings; heading++)
+	{
+		mmTranslateMatrix(mTranslate, g_camera_pos[0], g_camera_pos[1], g_camera_pos[2]);
+		mmRotateAboutY(mRotateY, (360.0f*heading)/num_headings);
+		mmMultiplyMatrix4x4(mRotateY, mTranslate, mCamera);
+		ClipTilesSetupFrustum(mCamera, g_ws_camera_pos);
+
+		//one plant at a time, the way the draw pass used to walk a tile. ocCullSpheresSimd()
+		//puts each type's plants at visible.first[], which only depends on the type counts
+		ocCullSpheresSimd(g_camera_frustum.planes, g_camera_frustum.camera, &spheres, &visible, OC_SIMD_SCALAR);
+		clock_gettime(CLOCK_MONOTONIC, &start_time);
+		for(repeat = 0; repeat < num_repeats; repeat++)
 		{
-			r = feof(demInfo.pFile);
-			if(r != 0)
+			memset(ref_num, 0, sizeof(ref_num));
+			for(i = 0; i < num_objects; i++)
 			{
-				if(found_eof == 0)
+				t = (int)plants[i].plant_type;
+				if(!(fabsf(plants[i].pos[0] - g_camera_frustum.camera[0]) < max_dist[t]))
+					continue;
+				if(!(fabsf(plants[i].pos[2] - g_camera_frustum.camera[2]) < max_dist[t]))
+					continue;
+				center[1] = plants[i].pos[1] + radius[t];
+				for(j = 0; j < 6; j++)
 				{
-					printf("InitTerrain: found end of file at t=%d k=%d l=%d i=%d j=%d\n", t, k, l, i, j);
-					found_eof = 1;
+					d = (((g_camera_frustum.planes[j][0]*plants[i].pos[0]) + (g_camera_frustum.planes[j][1]*center[1])) + (g_camera_frustum.planes[j][2]*plants[i].pos[2])) + g_camera_frustum.planes[j][3];
+					if(d < -radius[t])
+						break;
 				}
-				f = min;	
-			}
-			else
-			{
-				fscanf(demInfo.pFile, "%f", &f);
+				if(j < 6)
+					continue;
+				ref_ids[(visible.first[t] + ref_num[t])] = i;
+				ref_num[t] += 1;
 			}
-			f_count += 1;
-			f_col_count += 1;
-			
-			g_big_terrain.pTiles[tile_i].pPos[(vert_i+1)] = f;
 		}
-		
-		//set the x & z coordinates of the vertex
-		g_big_terrain.pTiles[tile_i].pPos[vert_i] = j*10.0f; //10.0f is the distance between vertices in the tile.
-		g_big_terrain.pTiles[tile_i].pPos[(vert_i+2)] = i*10.0f;
-		g_big_terrain.pTiles[tile_i].pPos[vert_i] += g_big_terrain.pTiles[tile_i].urcorner[0];
-		g_big_terrain.pTiles[tile_i].pPos[(vert_i+2)] += g_big_terrain.pTiles[tile_i].urcorner[1];
-		
-		//set the texture coordinate of the vertex
-		g_big_terrain.pTiles[tile_i].pPos[(vert_i+6)] = j*2.0f;
-		g_big_terrain.pTiles[tile_i].pPos[(vert_i+7)] = i*2.0f;
-		
-		/*
-		update the indices. Need to make sure to move through the tile map in the same way that
-		data is presented in the data file. This means filling in a row for all tiles in a tile row before
-		going onto to the next vertex row.
-		*/
-		j += 1; //increment vertex column
-		if(j == g_big_terrain.pTiles[tile_i].num_x)
+		clock_gettime(CLOCK_MONOTONIC, &end_time);
+		secs[OC_SIMD_AVX+1] += (end_time.tv_sec - start_time.tv_sec) + ((end_time.tv_nsec - start_time.tv_nsec)*1e-9);
+
+		for(simd = best_simd; simd >= OC_SIMD_SCALAR; simd--)
 		{
-			l += 1; //move to the next tile
-			j = 0; //reset vertex column index since we are in a new tile
-			
-			if(l == g_big_terrain.num_cols)
+			clock_gettime(CLOCK_MONOTONIC, &start_time);
+			for(repeat = 0; repeat < num_repeats; repeat++)
+				ocCullSpheresSimd(g_camera_frustum.planes, g_camera_frustum.camera, &spheres, &visible, simd);
+			clock_gettime(CLOCK_MONOTONIC, &end_time);
+			secs[simd] += (end_time.tv_sec - start_time.tv_sec) + ((end_time.tv_nsec - start_time.tv_nsec)*1e-9);
+
+			if(simd == best_simd)
+				num_visible += visible.num_visible;
+			for(t = 0; t < 6; t++)
 			{
-				i += 1; //go to the next vertex row
-				j = 0;  //reset the vertex column
-				l = 0; //put l back at the first tile.
-				f_col_count = 0;
-				
-				//check to see if we completed filling data for a row of tiles
-				if(i == g_big_terrain.pTiles[tile_i].num_z)
+				if(ref_num[t] != visible.num[t]
+					|| memcmp(ref_ids+visible.first[t], visible.ids+visible.first[t], ref_num[t]*sizeof(int)) != 0)
 				{
-					k += 1; //goto the next tile row
-					l = 0; //reset the tile column index
-					i = 0; //reset the vertex indices
-					j = 0;
-					
-					if(k == g_big_terrain.num_rows)
-					{
-						printf("InitTerrain: k and l == num_rows and num_cols. completed loading data. why did we get here. i=%d j=%d k=%d l=%d t=%d f_count=%d\n", i, j, k, l, t, f_count);
-					}
+					printf("\tFAIL: heading %d plant type %d: %d visible with %s, %d one at a time\n", heading, t, visible.num[t], ocSimdName(simd), ref_num[t]);
+					num_bad += 1;
 				}
 			}
 		}
 	}
+
+	printf("%s:\n", filename);
+	printf("\t%d plants, camera at (%f, %f, %f), %d headings, %.1f visible per cull\n", num_objects, g_ws_camera_pos[0], g_ws_camera_pos[1], g_ws_camera_pos[2], num_headings, ((double)num_visible)/num_headings);
+	for(simd = best_simd; simd >= OC_SIMD_SCALAR; simd--)
+		printf("\tocCullSpheres (%s): %.3f ms per cull\n", ocSimdName(simd), (secs[simd]*1000.0)/(num_headings*num_repeats));
+	printf("\tone at a time: %.3f ms per cull\n", (secs[OC_SIMD_AVX+1]*1000.0)/(num_headings*num_repeats));
+	if(num_bad > 0)
+	{
+		printf("\tFAIL: %d checks failed\n", num_bad);
+	}
+	else
+	{
+		printf("\tOK\n");
+		ret_val = 1;
+	}
+
+cleanup:
+	ocSpheresFree(&spheres);
+	ocVisibleFree(&visible);
+	free(plants);
+	free(ref_ids);
+	free(xz);
+	free(y);
+	return ret_val;
+}
+
+/*
+Terrain normals always point up (y > 0) so only x and z are stored, as
+signed 16-bit fixed point. y is rebuilt from x and z when unpacking.
+*/
+void PackTerrainNormal(float nx, float nz, short * packed)
+{
+	packed[0] = (short)lrintf(nx*32767.0f);
+	packed[1] = (short)lrintf(nz*32767.0f);
+}
+
+void UnpackTerrainNormal(short * packed, float * normal)
+{
+	float y2;
 	
-	fclose(pFile);
-	printf("closed dem file.\n");
+	normal[0] = packed[0]*(1.0f/32767.0f);
+	normal[2] = packed[1]*(1.0f/32767.0f);
+	y2 = 1.0f - (normal[0]*normal[0]) - (normal[2]*normal[2]);
+	normal[1] = (y2 > 0.0f) ? sqrtf(y2) : 0.0f;
+}
+
+/*
+Builds the interleaved {pos[3]; normal[3]; texcoord[2]} vertex data for
+a tile's VBO into out, which must hold num_verts*num_floats_per_vert floats.
+This is the only place the interleaved layout exists on the CPU.
+Resident tiles of the common sizes go through BuildTileVertexDataSized()
+with constant dimensions so the inner loop can be unrolled.
+*/
+void BuildTileVertexData(struct lvl_1_tile * ptile, float * out)
+{
+	int i,j;
+	int vert_i;
 	
-	//first-pass at calculating vertex normals
-	//loop through all tiles calculte vertex normals (ignore handling additional issues with vertices on tile edges)
-	printf("calclating normals.\n");
-	for(k = 0; k < g_big_terrain.num_rows; k++)
-	{
-		for(l = 0; l < g_big_terrain.num_cols; l++)
-		{
-			tile_i = (k*g_big_terrain.num_cols) + l;
-			for(i = 0; i < g_big_terrain.pTiles[tile_i].num_z; i++)
-			{
-				for(j = 0; j < g_big_terrain.pTiles[tile_i].num_x; j++)
-				{
-					vert_i = ((i*g_big_terrain.pTiles[tile_i].num_x) + j)*num_floats_per_vert;
-					
-					//zero sum from last iteration
-					sum[0] = 0.0f;
-					sum[1] = 0.0f;
-					sum[2] = 0.0f;
-					
-					//top-left vertex
-					if(i == 0 && j == 0)
-					{
-						MakeTerrainCalcNormal(sum,
-							&(g_big_terrain.pTiles[tile_i].pPos[vert_i]), //origin vertex
-							&(g_big_terrain.pTiles[tile_i].pPos[(vert_i+(100*num_floats_per_vert))]), //vertex below
-							&(g_big_terrain.pTiles[tile_i].pPos[(vert_i+num_floats_per_vert)]) );
-							
-					}
-					//top-right vertex
-					else if(i == 0 && j == 99)
-					{
-						MakeTerrainCalcNormal(sum,
-							&(g_big_terrain.pTiles[tile_i].pPos[vert_i]),
-							&(g_big_terrain.pTiles[tile_i].pPos[(vert_i-num_floats_per_vert)]),
-							&(g_big_terrain.pTiles[tile_i].pPos[(vert_i+(100*num_floats_per_vert))]) );
-					}
-					//bottom-left vertex
-					else if(i == 99 && j == 0)
-					{
-						MakeTerrainCalcNormal(sum,
-							&(g_big_terrain.pTiles[tile_i].pPos[vert_i]),
-							&(g_big_terrain.pTiles[tile_i].pPos[(vert_i+num_floats_per_vert)]), //vertex to the right
-							&(g_big_terrain.pTiles[tile_i].pPos[(vert_i-(100*num_floats_per_vert))]) );//vertex above
-					}
-					//bottom-right vertex
-					else if(i == 99 && j == 99)
-					{
-						MakeTerrainCalcNormal(sum,
-							&(g_big_terrain.pTiles[tile_i].pPos[vert_i]),
-							&(g_big_terrain.pTiles[tile_i].pPos[(vert_i-(100*num_floats_per_vert))]),
-							&(g_big_terrain.pTiles[tile_i].pPos[(vert_i-num_floats_per_vert)]) );
-					}
-					//left-edge vertices
-					else if(j == 0)
-					{
-						MakeTerrainCalcNormal(temp_normal,
-							&(g_big_terrain.pTiles[tile_i].pPos[vert_i]),
-							&(g_big_terrain.pTiles[tile_i].pPos[(vert_i+num_floats_per_vert)]),
-							&(g_big_terrain.pTiles[tile_i].pPos[(vert_i-(100*num_floats_per_vert))]) );
-						sum[0] += temp_normal[0];
-						sum[1] += temp_normal[1];
-						sum[2] += temp_normal[2];
-						
-						MakeTerrainCalcNormal(temp_normal,
-							&(g_big_terrain.pTiles[tile_i].pPos[vert_i]),
-							&(g_big_terrain.pTiles[tile_i].pPos[(vert_i+(100*num_floats_per_vert))]),
-							&(g_big_terrain.pTiles[tile_i].pPos[(vert_i+num_floats_per_vert)]) );
-						sum[0] += temp_normal[0];
-						sum[1] += temp_normal[1];
-						sum[2] += temp_normal[2];
-						
-						//re-normalize since its no longer normal
-						vNormalize(sum);
-					}
-					//bottom-edge vertices
-					else if(i == 99)
-					{
-						MakeTerrainCalcNormal(temp_normal,
-							&(g_big_terrain.pTiles[tile_i].pPos[vert_i]),
-							&(g_big_terrain.pTiles[tile_i].pPos[(vert_i-(100*num_floats_per_vert))]),
-							&(g_big_terrain.pTiles[tile_i].pPos[(vert_i-num_floats_per_vert)]) );
-						sum[0] += temp_normal[0];
-						sum[1] += temp_normal[1];
-						sum[2] += temp_normal[2];
-						
-						MakeTerrainCalcNormal(temp_normal,
-							&(g_big_terrain.pTiles[tile_i].pPos[vert_i]),
-							&(g_big_terrain.pTiles[tile_i].pPos[(vert_i+num_floats_per_vert)]),
-							&(g_big_terrain.pTiles[tile_i].pPos[(vert_i-(100*num_floats_per_vert))]) );
-						sum[0] += temp_normal[0];
-						sum[1] += temp_normal[1];
-						sum[2] += temp_normal[2];
-						
-						vNormalize(sum);
-					}
-					//right-edge vertices
-					else if(j == 99)
-					{
-						MakeTerrainCalcNormal(temp_normal,
-							&(g_big_terrain.pTiles[tile_i].pPos[vert_i]),
-							&(g_big_terrain.pTiles[tile_i].pPos[(vert_i-(100*num_floats_per_vert))]),
-							&(g_big_terrain.pTiles[tile_i].pPos[(vert_i-num_floats_per_vert)]) );
-						sum[0] += temp_normal[0];
-						sum[1] += temp_normal[1];
-						sum[2] += temp_normal[2];
-						
-						MakeTerrainCalcNormal(temp_normal,
-							&(g_big_terrain.pTiles[tile_i].pPos[vert_i]),
-							&(g_big_terrain.pTiles[tile_i].pPos[(vert_i-num_floats_per_vert)]),
-							&(g_big_terrain.pTiles[tile_i].pPos[(vert_i+(100*num_floats_per_vert))]) );
-						sum[0] += temp_normal[0];
-						sum[1] += temp_normal[1];
-						sum[2] += temp_normal[2];
-						
-						vNormalize(sum);
-					}
-					//top edges
-					else if(i == 0)
-					{
-						MakeTerrainCalcNormal(temp_normal,
-							&(g_big_terrain.pTiles[tile_i].pPos[vert_i]),
-							&(g_big_terrain.pTiles[tile_i].pPos[(vert_i-num_floats_per_vert)]),
-							&(g_big_terrain.pTiles[tile_i].pPos[(vert_i+(100*num_floats_per_vert))]) );
-						sum[0] += temp_normal[0];
-						sum[1] += temp_normal[1];
-						sum[2] += temp_normal[2];
-						
-						MakeTerrainCalcNormal(temp_normal,
-							&(g_big_terrain.pTiles[tile_i].pPos[vert_i]),
-							&(g_big_terrain.pTiles[tile_i].pPos[(vert_i+(100*num_floats_per_vert))]),
-							&(g_big_terrain.pTiles[tile_i].pPos[(vert_i+num_floats_per_vert)]) );
-						sum[0] += temp_normal[0];
-						sum[1] += temp_normal[1];
-						sum[2] += temp_normal[2];
-						
-						vNormalize(sum);
-					}
-					//all other interior vertices
-					else
-					{
-						MakeTerrainCalcNormal(temp_normal,
-							&(g_big_terrain.pTiles[tile_i].pPos[vert_i]),
-							&(g_big_terrain.pTiles[tile_i].pPos[(vert_i-(100*num_floats_per_vert))]),
-							&(g_big_terrain.pTiles[tile_i].pPos[(vert_i-num_floats_per_vert)]) );
-						sum[0] += temp_normal[0];
-						sum[1] += temp_normal[1];
-						sum[2] += temp_normal[2];
-						
-						MakeTerrainCalcNormal(temp_normal,
-							&(g_big_terrain.pTiles[tile_i].pPos[vert_i]),
-							&(g_big_terrain.pTiles[tile_i].pPos[(vert_i-num_floats_per_vert)]),
-							&(g_big_terrain.pTiles[tile_i].pPos[(vert_i+(100*num_floats_per_vert))]) );
-						sum[0] += temp_normal[0];
-						sum[1] += temp_normal[1];
-						sum[2] += temp_normal[2];
-						
-						MakeTerrainCalcNormal(temp_normal,
-							&(g_big_terrain.pTiles[tile_i].pPos[vert_i]),
-							&(g_big_terrain.pTiles[tile_i].pPos[(vert_i+(100*num_floats_per_vert))]),
-							&(g_big_terrain.pTiles[tile_i].pPos[(vert_i-num_floats_per_vert)]) );
-						sum[0] += temp_normal[0];
-						sum[1] += temp_normal[1];
-						sum[2] += temp_normal[2];
-						
-						MakeTerrainCalcNormal(temp_normal,
-							&(g_big_terrain.pTiles[tile_i].pPos[vert_i]),
-							&(g_big_terrain.pTiles[tile_i].pPos[(vert_i+num_floats_per_vert)]),
-							&(g_big_terrain.pTiles[tile_i].pPos[(vert_i-(100*num_floats_per_vert))]) );
-						sum[0] += temp_normal[0];
-						sum[1] += temp_normal[1];
-						sum[2] += temp_normal[2];
-						
-						vNormalize(sum);
-					}
-					
-					//fill in the final normal here
-					g_big_terrain.pTiles[tile_i].pPos[(vert_i+3)] = sum[0];
-					g_big_terrain.pTiles[tile_i].pPos[(vert_i+4)] = sum[1];
-					g_big_terrain.pTiles[tile_i].pPos[(vert_i+5)] = sum[2];	
-				}
-			}
+	if(IsTileResident(ptile) == 1 && ptile->num_x == ptile->num_z)
+	{
+		switch(ptile->num_x)
+		{
+		case 65:
+			BuildTileVertexDataSized(ptile, out, 65, 65);
+			return;
+		case 100:
+			BuildTileVertexDataSized(ptile, out, 100, 100);
+			return;
+		case 129:
+			BuildTileVertexDataSized(ptile, out, 129, 129);
+			return;
 		}
 	}
-	printf("finished calculating normals.\n");
-	
-	//TODO: Handle Normal vectors that are on tile boundaries (currently you can easily see the tile boundary because of this)
 	
-	//setup indices for the enumeration buffer
-	r = MakeTerrainElementArray(&(g_big_terrain.pElements), &(g_big_terrain.num_indices),100, 100);
-	if(r == 0)
+	for(i = 0; i < ptile->num_z; i++)
 	{
-		return 0;
+		for(j = 0; j < ptile->num_x; j++)
+		{
+			vert_i = (i*ptile->num_x) + j;
+			GetTileVertPos(ptile, vert_i, out);
+			GetTileVertNormal(ptile, vert_i, (out+3));
+			out[6] = j*2.0f;
+			out[7] = i*2.0f;
+			out += g_big_terrain.num_floats_per_vert;
+		}
 	}
+}
+
+/*
+BuildTileVertexDataSized
+BuildTileVertexData() for a resident tile. Called with constant num_x and
+num_z for the common tile sizes: once inlined the compiler knows the trip
+counts. Gives the same floats as the accessor path.
+*/
+static inline void BuildTileVertexDataSized(struct lvl_1_tile * ptile, float * out, const int num_x, const int num_z)
+{
+	const float spacing = g_big_terrain.vert_spacing;
+	const int stride = g_big_terrain.num_floats_per_vert;
+	const short * pNormals = ptile->pNormals;
+	int i,j;
+	int vert_i;
+	float y2;
 	
-	return 1;
+	for(i = 0; i < num_z; i++)
+	{
+		for(j = 0; j < num_x; j++)
+		{
+			vert_i = (i*num_x) + j;
+			out[0] = (j*spacing) + ptile->urcorner[0];
+			if(ptile->pQHeights != 0)
+				out[1] = ptile->height_bias + (ptile->pQHeights[vert_i]*ptile->height_scale);
+			else
+				out[1] = ptile->pHeights[vert_i];
+			out[2] = (i*spacing) + ptile->urcorner[1];
+			
+			//same as UnpackTerrainNormal()
+			out[3] = pNormals[(vert_i*2)]*(1.0f/32767.0f);
+			out[5] = pNormals[(vert_i*2)+1]*(1.0f/32767.0f);
+			y2 = 1.0f - (out[3]*out[3]) - (out[5]*out[5]);
+			out[4] = (y2 > 0.0f) ? sqrtf(y2) : 0.0f;
+			
+			out[6] = j*2.0f;
+			out[7] = i*2.0f;
+			out += stride;
+		}
+	}
 }
 
-int DEMLoadInfo(struct DEM_info_struct * pDemInfo)
+/*
+Rebuilds the vertex data of a tile and uploads it to the tile's VBO.
+Used after the tile's heights change, and when a paged tile is loaded.
+returns 1 on success, 0 on failure
+*/
+int UpdateTileVBO(struct lvl_1_tile * ptile)
 {
-	char s[255];
-	FILE * pFile;
+	float * pVerts;
 	
-	if(pDemInfo->pFile == 0)
+	pVerts = (float*)malloc(ptile->num_verts*g_big_terrain.num_floats_per_vert*sizeof(float));
+	if(pVerts == 0)
 	{
-		printf("DEMLoadInfo: error. pFile is 0.\n");
+		printf("UpdateTileVBO: malloc failed for vertex data\n");
 		return 0;
 	}
-	else
+	BuildTileVertexData(ptile, pVerts);
+	glBindBuffer(GL_ARRAY_BUFFER, ptile->vbo);
+	if(ptile->vbo_loaded == 0) //storage was dropped when the tile was paged out
 	{
-		pFile = pDemInfo->pFile;
+		glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)(ptile->num_verts*g_big_terrain.num_floats_per_vert*sizeof(float)), pVerts, GL_STATIC_DRAW);
+		ptile->vbo_loaded = 1;
 	}
-	
-	//get ncols
-	fscanf(pFile, "%s",s);
-	if(strcmp(s, "ncols") != 0)
+	else
 	{
-		printf("DEMLoadInfo: format error. 'ncols' missing.\n");
-		return 0;
+		glBufferSubData(GL_ARRAY_BUFFER,
+				0,	//offset
+				(ptile->num_verts*g_big_terrain.num_floats_per_vert*sizeof(float)),
+				pVerts);
 	}
-	fscanf(pFile, "%d", &(pDemInfo->num_col));
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	free(pVerts);
+	return 1;
+}
+
+/*
+Given a world space position, returns a tile index
+-returns -1 if position is not in tile map.
+*/
+int GetLvl1Tile(float * pos)
+{
+	int i, j;
 	
-	//get nrows
-	fscanf(pFile, "%s", s);
-	if(strcmp(s, "nrows") != 0)
+	//check to see if the position is outside of the tilemap:
+	if(pos[0] < 0.0f 
+		|| pos[2] < 0.0f 
+		|| pos[0] > (g_big_terrain.num_cols*g_big_terrain.tile_len[0])
+		|| pos[2] > (g_big_terrain.num_rows*g_big_terrain.tile_len[1]) )
 	{
-		printf("DEMLoadInfo: format error. 'nrows' missing.\n");
-		return 0;
+		return -1;
 	}
-	fscanf(pFile, "%d", &(pDemInfo->num_row));
 	
-	pDemInfo->num_total = pDemInfo->num_col*pDemInfo->num_row;
+	j = (int)(pos[0]/g_big_terrain.tile_len[0]);
+	i = (int)(pos[2]/g_big_terrain.tile_len[1]);
 	
-	//get xllcenter
-	fscanf(pFile, "%s", s);
-	if(strcmp(s, "xllcenter") != 0)
-	{
-		printf("DEMLoadInfo: format error. 'xllcenter' missing.\n");
-		return 0;
-	}
-	fscanf(pFile, "%f", &(pDemInfo->x_llcenter));
+	//a pos on the far edge of the map belongs to the last tile
+	if(j > (g_big_terrain.num_cols-1))
+		j = g_big_terrain.num_cols-1;
+	if(i > (g_big_terrain.num_rows-1))
+		i = g_big_terrain.num_rows-1;
 	
-	//get yllcenter
-	fscanf(pFile, "%s", s);
-	if(strcmp(s, "yllcenter") != 0)
+	return (i*g_big_terrain.num_cols)+j;
+}
+
+/*
+This func given a vec3 pos returns the i,j indices in the g_big_terrain's pTiles array
+*/
+int GetLvl1Tileij(float * pos, int * i, int * j)
+{
+	//check for position out of tilemap
+	if(pos[0] < 0.0f 
+		|| pos[2] < 0.0f 
+		|| pos[0] > (g_big_terrain.num_cols*g_big_terrain.tile_len[0])
+		|| pos[2] > (g_big_terrain.num_rows*g_big_terrain.tile_len[1]) )
 	{
-		printf("DEMLoadInfo: format error. 'yllcenter' missing.\n");
-		return 0;
+		return -1;
 	}
-	fscanf(pFile, "%f", &(pDemInfo->y_llcenter));
+
+	*j = (int)(pos[0]/g_big_terrain.tile_len[0]);
+	*i = (int)(pos[2]/g_big_terrain.tile_len[1]);
 	
-	//read cellsize data
-	fscanf(pFile, "%s", s);
-	if(strcmp(s, "cellsize") != 0)
-	{
-		printf("DEMLoadInfo: format error. 'cellsize' missing.\n");
-		return 0;
-	}
-	fscanf(pFile, "%f", &(pDemInfo->cellsize));
+	return ((*i)*g_big_terrain.num_cols)+(*j);
+}
+
+
+/*
+This function given a tile address, will return the tile's row and col in 
+the lvl_1_terrain_struct's pTiles array.
+*/
+int GetTileRowColFromIndex(struct lvl_1_tile * ptile, int * pi, int * pj)
+{
+	int overall_index;
+
+	overall_index = ptile - g_big_terrain.pTiles;
+
+	*pi = overall_index/g_big_terrain.num_cols;
+	*pj = overall_index % g_big_terrain.num_cols;
+
+	return 1;
+}
+
+/*
+This function takes a pos and returns a point in the plane along with the surface normal of terrain
+of the surface of the tile.
+	-float * pos expects a vec3
+	-surface point is returned in the address passed by surf_pos
+	-the surface normal is returned in the vec3 passed in surf_norm
+*/
+int GetTileSurfPoint(float * pos, float * surf_pos, float * surf_norm)
+{
+	int tile_i;
+	float quad_origin[3]; //this and the three following arrays make up the four points of a quad
+	float quad_pos_z[3];
+	float quad_pos_x[3];
+	float quad_opposite[3];
+	float local_pos[3];
+	int vert_i;
+	int i,j;
+	struct lvl_1_tile * ptile;
+	float check_vec[3];
+	float r_dot; //dot-product result
+	float d; //constant in the plane equation
+	float n[3]; //normal vector of the triangle
 	
-	//read nodata_value
-	fscanf(pFile, "%s", s);
-	if(strcmp(s, "nodata_value") != 0)
-	{
-		printf("DEMLoadInfo: format error. 'nodata_value' missing.\n");
-		return 0;
-	}
-	fscanf(pFile, "%f", &(pDemInfo->nodata_value));
+	//setup the check vector (it points in the -1,1 direction and really is a vec2)
+	check_vec[0] = 0.707106781f;
+	check_vec[1] = 0.0f;
+	check_vec[2] = 0.707106781f;
+	
+	//first see if we can get a tile
+	tile_i = GetLvl1Tile(pos);
+	if(tile_i == -1) 
+		return -1; //the point isn't in the tilemap, so return
+	ptile = (g_big_terrain.pTiles+tile_i);
+	
+	//figure out the origin vertex of the quad in the tile
+	local_pos[0] = pos[0] - ptile->urcorner[0];
+	local_pos[2] = pos[2] - ptile->urcorner[1]; //note: urcorner is only a vec2 but local_pos and pos are vec3
+	j = (int)(local_pos[0]/g_big_terrain.vert_spacing); //column
+	i = (int)(local_pos[2]/g_big_terrain.vert_spacing); //row
+	
+	//a pos on the far edge of the tile (or map) belongs to the last quad
+	if(j > (g_big_terrain.tile_num_quads[0]-1))
+		j = g_big_terrain.tile_num_quads[0]-1;
+	if(i > (g_big_terrain.tile_num_quads[1]-1))
+		i = g_big_terrain.tile_num_quads[1]-1;
 	
-	//save the file position location where the data starts
-	pDemInfo->data_start_pos = ftell(pFile);
+	//get all four points of the tile
+	GetTileQuadCorners(ptile, i, j, quad_origin, quad_pos_x, quad_pos_z, quad_opposite);
+	
+	//debug
+	//printf("\tquad_origin: (%f,%f,%f)\n",quad_origin[0], quad_origin[1], quad_origin[2]);
+	//printf("\tquad_pos_x: (%f,%f,%f)\n",quad_pos_x[0], quad_pos_x[1], quad_pos_x[2]);
+	//printf("\tquad_pos_z: (%f,%f,%f)\n",quad_pos_z[0], quad_pos_z[1], quad_pos_z[2]);
+	//printf("\tquad_opposite: (%f,%f,%f)\n",quad_opposite[0], quad_opposite[1], quad_opposite[2]);
+
+	//calculate a relative point that will be used to determine which triangle in
+	//the quad will be used
+	local_pos[0] = pos[0] - quad_pos_z[0]; //recalculate local_pos using an origin from the +z corner of the quad
+	local_pos[1] = 0.0f;
+	local_pos[2] = pos[2] - quad_pos_z[2];
 	
-	printf("ncols: %d\nnrows: %d\n", pDemInfo->num_col, pDemInfo->num_row);
-	printf("xllcenter: %f\nyllcenter: %f\n", pDemInfo->x_llcenter, pDemInfo->y_llcenter);
+	//calculate the dot product and determine which triangle to use
+	r_dot = vDotProduct(local_pos, check_vec);
 	
+	//calculate the normal for the triangle
+	if(r_dot >= 0.0f) //point is in triangle adjacent to origin
+	{
+		vGetPlaneNormal(quad_pos_z, quad_opposite, quad_pos_x, n);
+	}
+	else //point is in the opposite triangle
+	{
+		vGetPlaneNormal(quad_pos_z, quad_pos_x, quad_origin, n);
+	}
+	d = 0.0f - (quad_pos_z[0]*n[0]) - (quad_pos_z[1]*n[1]) - (quad_pos_z[2]*n[2]);
+
+	//calculate the y-coordinate and point on the surface
+	surf_pos[0] = pos[0];
+	surf_pos[1] = (0.0f - d - (pos[0]*n[0]) - (pos[2]*n[2]))/n[1];
+	surf_pos[2] = pos[2];
+	//printf("\tsurf_pos: (%f,%f,%f)\n", surf_pos[0], surf_pos[1], surf_pos[2]);
+	surf_norm[0] = n[0];
+	surf_norm[1] = n[1];
+	surf_norm[2] = n[2];
 	return 1;
 }
 
-int DEMGetMinMaxElevation(struct DEM_info_struct * pDemInfo, float * pMin, float * pMax)
+/*
+GetTileSurfPointBatch
+Finds the terrain height under n points. xz holds an x,z pair per point.
+The height of each point goes in y_out and, if n_out isn't 0, the terrain
+normal in n_out (3 floats per point). Points off the map get a height of
+-FLT_MAX and a normal of (0,1,0).
+The points are sorted by tile so each tile is set up once, then heights
+and normals are worked out HF_SAMPLE_CHUNK points at a time (see
+hfSampleQuads). A single point skips the sort.
+Paged out tiles go through GetTileVertHeight(): before the pager streams
+they are loaded on the spot, which can evict other tiles (frees heights,
+GL calls), so until then it is main thread only. Once the pager streams,
+paged out tiles use the coarse grid and the function only reads the
+terrain, so several threads can call it at once, as long as no tile is
+installed or evicted and no terrain edit runs meanwhile. Tiles are only
+swapped on the main thread in UpdateTerrainPager(), so the frame jobs
+DrawScene() runs after it (e.g. UpdateTerrainOcclusion) need no lock.
+The simulation thread runs at any time and calls it with g_world_lock
+held, which the pager takes for each swap.
+returns the # of points on the map, -1 on failure
+*/
+int GetTileSurfPointBatch(const float * xz, int n, float * y_out, float * n_out)
 {
-	FILE * pFile;
-	float f, min, max;
-	int i_min, i_max; //index of the min and max in the data
-	int i;
-	int r;
+	struct lvl_1_tile * ptile;
+	int * tiles;	//tile of each point, -1 if off the map
+	int * order;	//points on the map sorted by tile
+	int * starts;	//per tile, first entry of the tile's points in order. 0 for a single point
+	int one_tile;
+	int one_order;
+	float h00[HF_SAMPLE_CHUNK];
+	float h10[HF_SAMPLE_CHUNK];
+	float h01[HF_SAMPLE_CHUNK];
+	float h11[HF_SAMPLE_CHUNK];
+	float u[HF_SAMPLE_CHUNK];
+	float v[HF_SAMPLE_CHUNK];
+	float y[HF_SAMPLE_CHUNK];
+	float nx[HF_SAMPLE_CHUNK];
+	float ny[HF_SAMPLE_CHUNK];
+	float nz[HF_SAMPLE_CHUNK];
+	int points[HF_SAMPLE_CHUNK];
+	float pos[3];
+	float * heights;
+	int num_on_map = 0;
+	int num_chunk = 0;
+	int tile_i;
+	int point_i;
+	int vert_i;
+	int i, j;
+	int k, c;
 	
-	if(pDemInfo->pFile == 0)
-	{
-		printf("DEMGetMinMaxElevation: error. pFile is 0\n");
+	if(n <= 0)
 		return 0;
+	if(n == 1) //nothing to sort
+	{
+		tiles = &one_tile;
+		order = &one_order;
+		starts = 0;
 	}
-	pFile = pDemInfo->pFile;
-	
-	//go to the start of the data
-	r = fseek(pFile, pDemInfo->data_start_pos, SEEK_SET);
-	if(r == -1)
+	else
 	{
-		printf("DEMGetMinMaxElevation: fseek failed.\n");
-		return 0;
+		tiles = (int*)malloc(n*sizeof(int));
+		order = (int*)malloc(n*sizeof(int));
+		starts = (int*)calloc((g_big_terrain.num_tiles+1), sizeof(int));
+		if(tiles == 0 || order == 0 || starts == 0)
+		{
+			printf("GetTileSurfPointBatch: malloc failed for %d points\n", n);
+			free(tiles);
+			free(order);
+			free(starts);
+			return -1;
+		}
 	}
 	
-	//get one elevation from the file to setup min max
-	fscanf(pFile, "%f", &f);
-	min = f;
-	i_min = 0;
-	max = f;
-	i_max = 0;
-	i = 1;
+	//counting sort of the points by tile
+	for(k = 0; k < n; k++)
+	{
+		pos[0] = xz[(k*2)];
+		pos[1] = 0.0f;
+		pos[2] = xz[(k*2)+1];
+		tiles[k] = GetLvl1Tile(pos);
+		if(tiles[k] == -1)
+		{
+			y_out[k] = -FLT_MAX;
+			if(n_out != 0)
+			{
+				n_out[(k*3)] = 0.0f;
+				n_out[(k*3)+1] = 1.0f;
+				n_out[(k*3)+2] = 0.0f;
+			}
+			continue;
+		}
+		if(starts != 0)
+			starts[(tiles[k]+1)] += 1;
+		num_on_map += 1;
+	}
+	if(starts == 0)
+	{
+		order[0] = 0;
+	}
+	else
+	{
+		for(tile_i = 0; tile_i < g_big_terrain.num_tiles; tile_i++)
+		{
+			starts[(tile_i+1)] += starts[tile_i];
+		}
+		for(k = 0; k < n; k++)
+		{
+			if(tiles[k] == -1)
+				continue;
+			order[starts[tiles[k]]] = k;
+			starts[tiles[k]] += 1;
+		}
+	}
 	
-	//now read the remaining data and find the min and max values
-	while(feof(pFile) == 0)
+	for(k = 0; k < num_on_map; k++)
+	{
+		point_i = order[k];
+		tile_i = tiles[point_i];
+		ptile = g_big_terrain.pTiles+tile_i;
+		
+		//same quad as GetTileSurfPoint()
+		j = (int)((xz[(point_i*2)] - ptile->urcorner[0])/g_big_terrain.vert_spacing);
+		i = (int)((xz[(point_i*2)+1] - ptile->urcorner[1])/g_big_terrain.vert_spacing);
+		if(j > (g_big_terrain.tile_num_quads[0]-1))
+			j = g_big_terrain.tile_num_quads[0]-1;
+		if(i > (g_big_terrain.tile_num_quads[1]-1))
+			i = g_big_terrain.tile_num_quads[1]-1;
+		u[num_chunk] = (xz[(point_i*2)] - (ptile->urcorner[0] + (j*g_big_terrain.vert_spacing)))/g_big_terrain.vert_spacing;
+		v[num_chunk] = (xz[(point_i*2)+1] - (ptile->urcorner[1] + (i*g_big_terrain.vert_spacing)))/g_big_terrain.vert_spacing;
+		vert_i = (i*ptile->num_x) + j;
+		heights = ptile->pHeights;
+		if(heights != 0)
+		{
+			h00[num_chunk] = heights[vert_i];
+			h10[num_chunk] = heights[(vert_i+1)];
+			h01[num_chunk] = heights[(vert_i+ptile->num_x)];
+			h11[num_chunk] = heights[(vert_i+ptile->num_x+1)];
+		}
+		else
+		{
+			h00[num_chunk] = GetTileVertHeight(ptile, vert_i);
+			h10[num_chunk] = GetTileVertHeight(ptile, (vert_i+1));
+			h01[num_chunk] = GetTileVertHeight(ptile, (vert_i+ptile->num_x));
+			h11[num_chunk] = GetTileVertHeight(ptile, (vert_i+ptile->num_x+1));
+		}
+		points[num_chunk] = point_i;
+		num_chunk += 1;
+		if(num_chunk < HF_SAMPLE_CHUNK && k < (num_on_map-1))
+			continue;
+		
+		hfSampleQuads(h00, h10, h01, h11, u, v, num_chunk, g_big_terrain.vert_spacing, y, ((n_out != 0) ? nx : 0), ny, nz);
+		for(c = 0; c < num_chunk; c++)
+		{
+			y_out[points[c]] = y[c];
+			if(n_out != 0)
+			{
+				n_out[(points[c]*3)] = nx[c];
+				n_out[(points[c]*3)+1] = ny[c];
+				n_out[(points[c]*3)+2] = nz[c];
+			}
+		}
+		num_chunk = 0;
+	}
+	if(starts != 0)
 	{
-		fscanf(pFile, "%f", &f);
-		if(f < min)
+		free(tiles);
+		free(order);
+		free(starts);
+	}
+	return num_on_map;
+}
+
+/*
+ClipRaySlab
+Clips the ray parameter range [*pt0,*pt1] to the part of the ray where
+the coordinate p + t*d is between lo and hi.
+returns 1 if some of the range is left, 0 if none is
+*/
+static int ClipRaySlab(float p, float d, float lo, float hi, float * pt0, float * pt1)
+{
+	float ta;
+	float tb;
+	float tmp;
+	
+	if(fabsf(d) < 1e-12f) //ray runs along the slab
+		return (p >= lo && p <= hi);
+	ta = (lo - p)/d;
+	tb = (hi - p)/d;
+	if(ta > tb)
+	{
+		tmp = ta;
+		ta = tb;
+		tb = tmp;
+	}
+	if(ta > *pt0)
+		*pt0 = ta;
+	if(tb < *pt1)
+		*pt1 = tb;
+	return (*pt0 <= *pt1);
+}
+
+/*
+GetRayGridCells
+Lists the cells of a num_cols x num_rows grid (square cells cell_len on a
+side, cell (0,0) at origin_x,origin_z) that the ray passes over between
+ray parameters t0 and t1, in the order the ray reaches them. Cells are
+grown by a little so a ray along a cell edge picks up both sides.
+cells gets the index (row*num_cols)+col of each cell and cell_t the ray
+parameters where the ray enters and leaves it.
+returns the # of cells, at most TERRAIN_RAY_MAX_CELLS
+*/
+static int GetRayGridCells(float * pos, float * ray, float t0, float t1, float origin_x, float origin_z, float cell_len, int num_cols, int num_rows, int * cells, float * cell_t)
+{
+	float eps;
+	float a, b;
+	float row_t[2];
+	float ta, tb;
+	int row, row_first, row_last, row_step;
+	int col, col_first, col_last, col_step;
+	int num_cells = 0;
+	
+	eps = cell_len*0.001f;
+	
+	//rows are visited in the z direction of the ray, and within a row the
+	//cells in its x direction, which is the order along the ray
+	a = pos[2] + (t0*ray[2]) - origin_z;
+	b = pos[2] + (t1*ray[2]) - origin_z;
+	if(a > b)
+	{
+		ta = a;
+		a = b;
+		b = ta;
+	}
+	row_first = (int)floorf((a-eps)/cell_len);
+	row_last = (int)floorf((b+eps)/cell_len);
+	if(row_first < 0)
+		row_first = 0;
+	if(row_last >= num_rows)
+		row_last = num_rows - 1;
+	row_step = 1;
+	if(ray[2] < 0.0f)
+	{
+		row = row_first;
+		row_first = row_last;
+		row_last = row;
+		row_step = -1;
+	}
+	
+	for(row = row_first; (row - row_last)*row_step <= 0; row += row_step)
+	{
+		row_t[0] = t0;
+		row_t[1] = t1;
+		if(ClipRaySlab(pos[2], ray[2], (origin_z + (row*cell_len) - eps), (origin_z + ((row+1)*cell_len) + eps), &row_t[0], &row_t[1]) == 0)
+			continue;
+		
+		a = pos[0] + (row_t[0]*ray[0]) - origin_x;
+		b = pos[0] + (row_t[1]*ray[0]) - origin_x;
+		if(a > b)
+		{
+			ta = a;
+			a = b;
+			b = ta;
+		}
+		col_first = (int)floorf((a-eps)/cell_len);
+		col_last = (int)floorf((b+eps)/cell_len);
+		if(col_first < 0)
+			col_first = 0;
+		if(col_last >= num_cols)
+			col_last = num_cols - 1;
+		col_step = 1;
+		if(ray[0] < 0.0f)
+		{
+			col = col_first;
+			col_first = col_last;
+			col_last = col;
+			col_step = -1;
+		}
+		
+		for(col = col_first; (col - col_last)*col_step <= 0; col += col_step)
 		{
-			i_min = i;
-			min = f;
+			ta = row_t[0];
+			tb = row_t[1];
+			if(ClipRaySlab(pos[0], ray[0], (origin_x + (col*cell_len) - eps), (origin_x + ((col+1)*cell_len) + eps), &ta, &tb) == 0)
+				continue;
+			if(num_cells == TERRAIN_RAY_MAX_CELLS)
+				return num_cells;
+			cells[num_cells] = (row*num_cols) + col;
+			cell_t[(num_cells*2)] = ta;
+			cell_t[(num_cells*2)+1] = tb;
+			num_cells += 1;
 		}
-		if(f > max)
+	}
+	return num_cells;
+}
+
+/*
+GetRayMinHeight
+returns the lowest height of the ray between ray parameters t0 and t1
+*/
+static float GetRayMinHeight(float * pos, float * ray, float t0, float t1)
+{
+	float y0;
+	float y1;
+	
+	y0 = pos[1] + (t0*ray[1]);
+	y1 = pos[1] + (t1*ray[1]);
+	return (y0 < y1) ? y0 : y1;
+}
+
+/*
+RaycastTerrainTile
+Looks for the first ray intersection within one tile, between ray
+parameters t0 and t1. Blocks of quads that are below the ray are skipped
+and the quads of the other blocks are tested in ray order.
+returns 1 if there is an intersection, 0 if not
+*/
+static int RaycastTerrainTile(float * pos, float * ray, struct lvl_1_tile * ptile, float t0, float t1, float * surf_pos, float * surf_norm)
+{
+	int blocks[TERRAIN_RAY_MAX_CELLS];
+	float block_t[TERRAIN_RAY_MAX_CELLS*2];
+	int quads[TERRAIN_RAY_MAX_CELLS];
+	float quad_t[TERRAIN_RAY_MAX_CELLS*2];
+	float block_len;
+	int num_blocks_x;
+	int num_blocks_z;
+	int num_ray_blocks;
+	int num_ray_quads;
+	int block_cols;
+	int block_rows;
+	int bi, bj;
+	int i, j;
+	int r;
+	
+	block_len = TERRAIN_RAY_BLOCK*g_big_terrain.vert_spacing;
+	num_blocks_x = (ptile->num_x - 1 + (TERRAIN_RAY_BLOCK-1))/TERRAIN_RAY_BLOCK;
+	num_blocks_z = (ptile->num_z - 1 + (TERRAIN_RAY_BLOCK-1))/TERRAIN_RAY_BLOCK;
+	num_ray_blocks = GetRayGridCells(pos, ray, t0, t1, ptile->urcorner[0], ptile->urcorner[1], block_len, num_blocks_x, num_blocks_z, blocks, block_t);
+	for(i = 0; i < num_ray_blocks; i++)
+	{
+		//quantized heights can come out a little above the heights the block was measured with
+		if(ptile->pBlockMaxHeights != 0
+			&& GetRayMinHeight(pos, ray, block_t[(i*2)], block_t[(i*2)+1]) > (ptile->pBlockMaxHeights[blocks[i]] + g_big_terrain.height_max_error))
+			continue;
+		
+		bi = blocks[i]/num_blocks_x;
+		bj = blocks[i] - (bi*num_blocks_x);
+		block_cols = ptile->num_x - 1 - (bj*TERRAIN_RAY_BLOCK);
+		if(block_cols > TERRAIN_RAY_BLOCK)
+			block_cols = TERRAIN_RAY_BLOCK;
+		block_rows = ptile->num_z - 1 - (bi*TERRAIN_RAY_BLOCK);
+		if(block_rows > TERRAIN_RAY_BLOCK)
+			block_rows = TERRAIN_RAY_BLOCK;
+		num_ray_quads = GetRayGridCells(pos,
+				ray,
+				block_t[(i*2)],
+				block_t[(i*2)+1],
+				(ptile->urcorner[0] + (bj*block_len)),
+				(ptile->urcorner[1] + (bi*block_len)),
+				g_big_terrain.vert_spacing,
+				block_cols,
+				block_rows,
+				quads,
+				quad_t);
+		for(j = 0; j < num_ray_quads; j++)
 		{
-			i_max = i;
-			max = f;
+			r = RaycastQuadTileSurf(pos,
+					ray,
+					ptile,
+					((bi*TERRAIN_RAY_BLOCK) + (quads[j]/block_cols)),	//row of the quad in the tile
+					((bj*TERRAIN_RAY_BLOCK) + (quads[j]%block_cols)),	//column of the quad in the tile
+					surf_pos,
+					surf_norm);
+			if(r == 1)
+				return 1;
 		}
-		
-		i += 1;
 	}
-	
-	printf("found min %f at i=%d\nfound max %f at i=%d out of %d heights\n", min, i_min, max, i_max, i);
-	
-	*pMin = min;
-	*pMax = max;
-	return 1;
+	return 0;
 }
 
 /*
-Given a world space position, returns a tile index
--returns -1 if position is not in tile map.
+RaycastTerrainNode
+Looks for the first ray intersection under a node of g_terrain_quadtree,
+between ray parameters t0 and t1. Nodes whose box is below the ray are
+skipped, and the children of the others are searched in the order the
+ray reaches them.
+returns 1 if there is an intersection, 0 if not
 */
-int GetLvl1Tile(float * pos)
+static int RaycastTerrainNode(float * pos, float * ray, int node_i, float t0, float t1, float * surf_pos, float * surf_norm)
 {
+	struct qt_node_struct * node;
+	float child_t[4][2];
+	int children[4];
+	float eps;
+	float tmp_t[2];
+	int tmp;
+	int num_children = 0;
 	int i, j;
 	
-	//check to see if the position is outside of the tilemap:
-	if(pos[0] < 0.0f 
-		|| pos[2] < 0.0f 
-		|| pos[0] > (g_big_terrain.num_cols*g_big_terrain.tile_len[0])
-		|| pos[2] > (g_big_terrain.num_rows*g_big_terrain.tile_len[1]) )
-	{
-		return -1;
-	}
+	node = &(g_terrain_quadtree.nodes[node_i]);
+	eps = g_big_terrain.vert_spacing*0.001f;
+	if(ClipRaySlab(pos[0], ray[0], (node->box_min[0]-eps), (node->box_max[0]+eps), &t0, &t1) == 0)
+		return 0;
+	if(ClipRaySlab(pos[2], ray[2], (node->box_min[2]-eps), (node->box_max[2]+eps), &t0, &t1) == 0)
+		return 0;
+	if(GetRayMinHeight(pos, ray, t0, t1) > (node->box_max[1] + g_big_terrain.height_max_error))
+		return 0;
 	
-	j = (int)(pos[0]/g_big_terrain.tile_len[0]);
-	i = (int)(pos[2]/g_big_terrain.tile_len[1]);
+	if(node->num_children == 0)
+		return RaycastTerrainTile(pos, ray, (g_big_terrain.pTiles + (node->first_row*g_big_terrain.num_cols) + node->first_col), t0, t1, surf_pos, surf_norm);
 	
-	return (i*g_big_terrain.num_cols)+j;
+	//children don't overlap, so the order the ray enters them is the order it crosses them
+	for(i = 0; i < node->num_children; i++)
+	{
+		children[num_children] = node->children[i];
+		child_t[num_children][0] = t0;
+		child_t[num_children][1] = t1;
+		node = &(g_terrain_quadtree.nodes[node->children[i]]);
+		if(ClipRaySlab(pos[0], ray[0], (node->box_min[0]-eps), (node->box_max[0]+eps), &child_t[num_children][0], &child_t[num_children][1]) == 1
+			&& ClipRaySlab(pos[2], ray[2], (node->box_min[2]-eps), (node->box_max[2]+eps), &child_t[num_children][0], &child_t[num_children][1]) == 1)
+		{
+			for(j = num_children; j > 0 && child_t[j][0] < child_t[(j-1)][0]; j--)
+			{
+				tmp = children[j];
+				children[j] = children[(j-1)];
+				children[(j-1)] = tmp;
+				tmp_t[0] = child_t[j][0];
+				tmp_t[1] = child_t[j][1];
+				child_t[j][0] = child_t[(j-1)][0];
+				child_t[j][1] = child_t[(j-1)][1];
+				child_t[(j-1)][0] = tmp_t[0];
+				child_t[(j-1)][1] = tmp_t[1];
+			}
+			num_children += 1;
+		}
+		node = &(g_terrain_quadtree.nodes[node_i]);
+	}
+	for(i = 0; i < num_children; i++)
+	{
+		if(RaycastTerrainNode(pos, ray, children[i], child_t[i][0], child_t[i][1], surf_pos, surf_norm) == 1)
+			return 1;
+	}
+	return 0;
 }
 
 /*
-This func given a vec3 pos returns the i,j indices in the g_big_terrain's pTiles array
+This function looks for ray intersection over the whole terrain map,
+from pos to pos+ray. It walks down g_terrain_quadtree (whose boxes give
+the highest vert of each group of tiles) and then each tile's blocks
+(pBlockMaxHeights), so only quads under parts of the ray that come below
+the highest vert get tested.
+Returns:
+	-1	;the start or end of the ray is off the map
+	0	;no intersection found
+	1	;intersection found. the first point the ray hits is returned in surf_pos and the terrain normal there in surf_norm
 */
-int GetLvl1Tileij(float * pos, int * i, int * j)
+int RaycastTileSurf(float * pos, float * ray, float * surf_pos, float * surf_norm)
 {
-	//check for position out of tilemap
-	if(pos[0] < 0.0f 
-		|| pos[2] < 0.0f 
-		|| pos[0] > (g_big_terrain.num_cols*g_big_terrain.tile_len[0])
-		|| pos[2] > (g_big_terrain.num_rows*g_big_terrain.tile_len[1]) )
-	{
+	float end_pos[3];
+	
+	if(GetLvl1Tile(pos) == -1)
+		return -1;
+	vAdd(end_pos, pos, ray);
+	if(GetLvl1Tile(end_pos) == -1)
 		return -1;
-	}
-
-	*j = (int)(pos[0]/g_big_terrain.tile_len[0]);
-	*i = (int)(pos[2]/g_big_terrain.tile_len[1]);
 	
-	return ((*i)*g_big_terrain.num_cols)+(*j);
+	return RaycastTerrainNode(pos, ray, 0, 0.0f, 1.0f, surf_pos, surf_norm);
 }
 
-
 /*
-This function given a tile address, will return the tile's row and col in 
-the lvl_1_terrain_struct's pTiles array.
+IsPosInTileQuad
+returns 1 if the x,z of pos is inside (or on the edge of) a quad of a
+tile, 0 if not
 */
-int GetTileRowColFromIndex(struct lvl_1_tile * ptile, int * pi, int * pj)
+static int IsPosInTileQuad(float * pos, struct lvl_1_tile * ptile, int quad_row, int quad_col)
 {
-	int overall_index;
-
-	overall_index = ptile - g_big_terrain.pTiles;
-
-	*pi = overall_index/g_big_terrain.num_cols;
-	*pj = overall_index % g_big_terrain.num_cols;
-
-	return 1;
+	float x0;
+	float z0;
+	
+	x0 = ptile->urcorner[0] + (quad_col*g_big_terrain.vert_spacing);
+	z0 = ptile->urcorner[1] + (quad_row*g_big_terrain.vert_spacing);
+	return (pos[0] >= x0 && pos[0] <= (x0 + g_big_terrain.vert_spacing)
+		&& pos[2] >= z0 && pos[2] <= (z0 + g_big_terrain.vert_spacing));
 }
 
 /*
-This function takes a pos and returns a point in the plane along with the surface normal of terrain
-of the surface of the tile.
-	-float * pos expects a vec3
-	-surface point is returned in the address passed by surf_pos
-	-the surface normal is returned in the vec3 passed in surf_norm
+RaycastTileSurfBatch
+Casts a batch of short rays, e.g. the wheel rays of every vehicle. A ray
+that starts and ends over the same quad can only hit that quad, so it
+gets one quad test. The quad of the last call (quad_hint) is tried
+first since a wheel usually stays over the same quad from tick to tick.
+Rays that cross a quad edge, or miss their one quad, go through
+RaycastTileSurf().
+returns the # of rays that needed RaycastTileSurf()
 */
-int GetTileSurfPoint(float * pos, float * surf_pos, float * surf_norm)
+int RaycastTileSurfBatch(struct terrain_ray_struct * rays, int num_rays)
 {
-	int tile_i;
-	int quad_i;
-	float quad_origin[3]; //this and the three following arrays make up the four points of a quad
-	float quad_pos_z[3];
-	float quad_pos_x[3];
-	float quad_opposite[3];
-	float local_pos[3];
-	int vert_i;
-	int i,j;
+	struct terrain_ray_struct * pray;
 	struct lvl_1_tile * ptile;
-	float * p_pos; //vertex data array of the tile
-	float check_vec[3];
-	float r_dot; //dot-product result
-	float d; //constant in the plane equation
-	float n[3]; //normal vector of the triangle
-	
-	//setup the check vector (it points in the -1,1 direction and really is a vec2)
-	check_vec[0] = 0.707106781f;
-	check_vec[1] = 0.0f;
-	check_vec[2] = 0.707106781f;
-	
-	//first see if we can get a tile
-	tile_i = GetLvl1Tile(pos);
-	if(tile_i == -1) 
-		return -1; //the point isn't in the tilemap, so return
-	ptile = (g_big_terrain.pTiles+tile_i);
-	p_pos = ptile->pPos;
-	
-	//figure out the origin vertex of the quad in the tile
-	local_pos[0] = pos[0] - ptile->urcorner[0];
-	local_pos[2] = pos[2] - ptile->urcorner[1]; //note: urcorner is only a vec2 but local_pos and pos are vec3
-	j = (int)(local_pos[0]/10.0f); //column
-	i = (int)(local_pos[2]/10.0f); //row
-	quad_i = (i*ptile->num_x)+j;
-	
-	//check quad_i to make sure it is still in the array TODO: Remove this later
-	if(quad_i >= 10000)
-	{
-		printf("GetTileSurfPoint: error. quad_i = %d and is out of range.", quad_i);
-		return -1;
-	}
-	
-	//get all four points of the tile
-	quad_origin[0] = p_pos[(quad_i*g_big_terrain.num_floats_per_vert)];
-	quad_origin[1] = p_pos[((quad_i*g_big_terrain.num_floats_per_vert)+1)];
-	quad_origin[2] = p_pos[((quad_i*g_big_terrain.num_floats_per_vert)+2)];
-	quad_pos_x[0] = p_pos[((quad_i+1)*g_big_terrain.num_floats_per_vert)];
-	quad_pos_x[1] = p_pos[(((quad_i+1)*g_big_terrain.num_floats_per_vert)+1)];
-	quad_pos_x[2] = p_pos[(((quad_i+1)*g_big_terrain.num_floats_per_vert)+2)];
-	quad_pos_z[0] = p_pos[((quad_i+ptile->num_x)*g_big_terrain.num_floats_per_vert)];
-	quad_pos_z[1] = p_pos[(((quad_i+ptile->num_x)*g_big_terrain.num_floats_per_vert)+1)];
-	quad_pos_z[2] = p_pos[(((quad_i+ptile->num_x)*g_big_terrain.num_floats_per_vert)+2)];
-	quad_opposite[0] = p_pos[((quad_i+1+ptile->num_x)*g_big_terrain.num_floats_per_vert)];
-	quad_opposite[1] = p_pos[(((quad_i+1+ptile->num_x)*g_big_terrain.num_floats_per_vert)+1)];
-	quad_opposite[2] = p_pos[(((quad_i+1+ptile->num_x)*g_big_terrain.num_floats_per_vert)+2)];
-	
-	//debug
-	//printf("\tquad_origin: (%f,%f,%f)\n",quad_origin[0], quad_origin[1], quad_origin[2]);
-	//printf("\tquad_pos_x: (%f,%f,%f)\n",quad_pos_x[0], quad_pos_x[1], quad_pos_x[2]);
-	//printf("\tquad_pos_z: (%f,%f,%f)\n",quad_pos_z[0], quad_pos_z[1], quad_pos_z[2]);
-	//printf("\tquad_opposite: (%f,%f,%f)\n",quad_opposite[0], quad_opposite[1], quad_opposite[2]);
-
-	//calculate a relative point that will be used to determine which triangle in
-	//the quad will be used
-	local_pos[0] = pos[0] - quad_pos_z[0]; //recalculate local_pos using an origin from the +z corner of the quad
-	local_pos[1] = 0.0f;
-	local_pos[2] = pos[2] - quad_pos_z[2];
-	
-	//calculate the dot product and determine which triangle to use
-	r_dot = vDotProduct(local_pos, check_vec);
+	float end_pos[3];
+	int quad_row;
+	int quad_col;
+	int tile_i;
+	int num_walked = 0;
+	int k;
 	
-	//calculate the normal for the triangle
-	if(r_dot >= 0.0f) //point is in triangle adjacent to origin
-	{
-		vGetPlaneNormal(quad_pos_z, quad_opposite, quad_pos_x, n);
-	}
-	else //point is in the opposite triangle
+	for(k = 0; k < num_rays; k++)
 	{
-		vGetPlaneNormal(quad_pos_z, quad_pos_x, quad_origin, n);
+		pray = rays + k;
+		vAdd(end_pos, pray->pos, pray->ray);
+		
+		//try the quad from last time, then the quad under the start of the ray
+		tile_i = -1;
+		if(pray->quad_hint != 0 && pray->quad_hint[0] >= 0 && pray->quad_hint[0] < g_big_terrain.num_tiles)
+		{
+			tile_i = pray->quad_hint[0];
+			quad_row = pray->quad_hint[1];
+			quad_col = pray->quad_hint[2];
+			if(IsPosInTileQuad(pray->pos, (g_big_terrain.pTiles+tile_i), quad_row, quad_col) == 0)
+				tile_i = -1;
+		}
+		if(tile_i == -1)
+		{
+			tile_i = GetLvl1Tile(pray->pos);
+			if(tile_i == -1)
+			{
+				pray->result = -1;
+				continue;
+			}
+			ptile = g_big_terrain.pTiles + tile_i;
+			quad_col = (int)((pray->pos[0] - ptile->urcorner[0])/g_big_terrain.vert_spacing);
+			quad_row = (int)((pray->pos[2] - ptile->urcorner[1])/g_big_terrain.vert_spacing);
+			if(quad_col > (g_big_terrain.tile_num_quads[0]-1))
+				quad_col = g_big_terrain.tile_num_quads[0]-1;
+			if(quad_row > (g_big_terrain.tile_num_quads[1]-1))
+				quad_row = g_big_terrain.tile_num_quads[1]-1;
+		}
+		ptile = g_big_terrain.pTiles + tile_i;
+		if(pray->quad_hint != 0)
+		{
+			pray->quad_hint[0] = tile_i;
+			pray->quad_hint[1] = quad_row;
+			pray->quad_hint[2] = quad_col;
+		}
+		
+		//a ray running along a quad edge can slip between the quad's triangle tests, so misses get walked too
+		if(IsPosInTileQuad(end_pos, ptile, quad_row, quad_col) == 1)
+		{
+			pray->result = RaycastQuadTileSurf(pray->pos, pray->ray, ptile, quad_row, quad_col, pray->surf_pos, pray->surf_norm);
+			if(pray->result == 1)
+				continue;
+		}
+		pray->result = RaycastTileSurf(pray->pos, pray->ray, pray->surf_pos, pray->surf_norm);
+		num_walked += 1;
 	}
-	d = 0.0f - (quad_pos_z[0]*n[0]) - (quad_pos_z[1]*n[1]) - (quad_pos_z[2]*n[2]);
-
-	//calculate the y-coordinate and point on the surface
-	surf_pos[0] = pos[0];
-	surf_pos[1] = (0.0f - d - (pos[0]*n[0]) - (pos[2]*n[2]))/n[1];
-	surf_pos[2] = pos[2];
-	//printf("\tsurf_pos: (%f,%f,%f)\n", surf_pos[0], surf_pos[1], surf_pos[2]);
-	surf_norm[0] = n[0];
-	surf_norm[1] = n[1];
-	surf_norm[2] = n[2];
-	return 1;
+	return num_walked;
 }
 
 /*
-This function looks for ray intersection over the whole terrain map
+RaycastTileSurfByQuad
+Same as RaycastTileSurf() but steps through every quad under the ray.
+It is kept to check and time RaycastTileSurf() against (--bench-raycast).
 */
-int RaycastTileSurf(float * pos, float * ray, float * surf_pos, float * surf_norm)
+static int RaycastTileSurfByQuad(float * pos, float * ray, float * surf_pos, float * surf_norm)
 {
 	struct lvl_1_tile * ptile;
 	struct lvl_1_tile * pendtile;
@@ -3451,12 +7446,12 @@ int RaycastTileSurf(float * pos, float * ray, float * surf_pos, float * surf_nor
 	//determine current quad
 	xz_pos[0] = pos[0] - ptile->urcorner[0];
 	xz_pos[1] = pos[2] - ptile->urcorner[1];
-	j_quad = (int)(xz_pos[0]/10.0f);
-	i_quad = (int)(xz_pos[1]/10.0f);
+	j_quad = (int)(xz_pos[0]/g_big_terrain.vert_spacing);
+	i_quad = (int)(xz_pos[1]/g_big_terrain.vert_spacing);
 
 	//determine end quad
-	j_end_quad = (int)((cur_pos[0] - pendtile->urcorner[0])/10.0f);
-	i_end_quad = (int)((cur_pos[2] - pendtile->urcorner[1])/10.0f);
+	j_end_quad = (int)((cur_pos[0] - pendtile->urcorner[0])/g_big_terrain.vert_spacing);
+	i_end_quad = (int)((cur_pos[2] - pendtile->urcorner[1])/g_big_terrain.vert_spacing);
 
 	//Step through quads in different tiles until you get to the entile+quad of end_tile_i
 	while(1)
@@ -3497,7 +7492,7 @@ int RaycastTileSurf(float * pos, float * ray, float * surf_pos, float * surf_nor
 /*
 This function when given a starting ptile i,j that is assumed to have pos within it
 and given a ray providing direction will replace the ptile and i,j with an adjacent tile,grid
-this function is a helper function for RaycastTileSurf()
+this function is a helper function for RaycastTileSurfByQuad()
 Return values:
 	<ptr>	; ptile, pi, pj updated with adjacent quad
 	0		; could not determine new quad
@@ -3521,24 +7516,10 @@ static struct lvl_1_tile* GetNewTileQuad(float * pos, float * ray, struct lvl_1_
 	float r_dot;
 	float t_factor;
 	float dist_in_normal;
-	int quad_i;
-	int num_floats = g_big_terrain.num_floats_per_vert;
 	int i_tile;
 	int j_tile;
 
-	quad_i = ((*pi)*ptile->num_x)+(*pj);
-	quad_origin[0] = ptile->pPos[(quad_i*num_floats)];
-	quad_origin[1] = ptile->pPos[(quad_i*num_floats)+1];
-	quad_origin[2] = ptile->pPos[(quad_i*num_floats)+2];
-	quad_pos_x[0] = ptile->pPos[((quad_i+1)*num_floats)];
-	quad_pos_x[1] = ptile->pPos[((quad_i+1)*num_floats)+1];
-	quad_pos_x[2] = ptile->pPos[((quad_i+1)*num_floats)+2];
-	quad_pos_z[0] = ptile->pPos[((quad_i+ptile->num_x)*num_floats)];
-	quad_pos_z[1] = ptile->pPos[((quad_i+ptile->num_x)*num_floats)+1];
-	quad_pos_z[2] = ptile->pPos[((quad_i+ptile->num_x)*num_floats)+2];
-	quad_opposite[0] = ptile->pPos[((quad_i+1+ptile->num_x)*num_floats)];
-	quad_opposite[1] = ptile->pPos[((quad_i+1+ptile->num_x)*num_floats)+1];
-	quad_opposite[2] = ptile->pPos[((quad_i+1+ptile->num_x)*num_floats)+2];
+	GetTileQuadCorners(ptile, (*pi), (*pj), quad_origin, quad_pos_x, quad_pos_z, quad_opposite);
 	local_pos[0] = pos[0] - ptile->urcorner[0];
 	local_pos[1] = pos[2] - ptile->urcorner[1];
 	ray_2d[0] = ray[0];
@@ -3626,7 +7607,8 @@ static struct lvl_1_tile* GetNewTileQuad(float * pos, float * ray, struct lvl_1_
 			GetTileRowColFromIndex(ptile, &i_tile, &j_tile);
 			if((i_tile-1) < 0) //is this an out of range row index
 				return 0;
-			*pi = (g_big_terrain.tile_num_quads[1]); //set the quad in the new tile at the bottom row of the tile
+			i_tile -= 1;
+			*pi = (g_big_terrain.tile_num_quads[1]-1); //set the quad in the new tile at the bottom row of the tile
 			pnew_tile = g_big_terrain.pTiles+(i_tile*g_big_terrain.num_cols)+j_tile;
 			return pnew_tile;
 		}
@@ -3636,7 +7618,7 @@ static struct lvl_1_tile* GetNewTileQuad(float * pos, float * ray, struct lvl_1_
 	//check -x side
 	side_to_pos[0] = pos[0] - quad_origin[0];
 	side_to_pos[1] = pos[2] - quad_origin[2];
-	r_dot = vDotProduct(ray_2d, (side_normals+6));
+	r_dot = vDotProduct2(ray_2d, (side_normals+6));
 	dist_in_normal = vDotProduct2(side_to_pos, (side_normals+6));
 	t_factor = dist_in_normal/r_dot;
 	pos_in_side_plane[1] = (fabs(t_factor))*ray_2d[1] + pos[2];
@@ -3652,7 +7634,8 @@ static struct lvl_1_tile* GetNewTileQuad(float * pos, float * ray, struct lvl_1_
 			GetTileRowColFromIndex(ptile, &i_tile, &j_tile);
 			if((j_tile-1) < 0)
 				return 0;
-			*pj = (g_big_terrain.tile_num_quads[0]); //set the quad in the new tile to be at the last column in a row
+			j_tile -= 1;
+			*pj = (g_big_terrain.tile_num_quads[0]-1); //set the quad in the new tile to be at the last column in a row
 			pnew_tile = g_big_terrain.pTiles+(i_tile*g_big_terrain.num_cols)+j_tile;
 			return pnew_tile;
 		}
@@ -3690,26 +7673,13 @@ static int RaycastQuadTileSurf(float * pos, float * ray, struct lvl_1_tile * pti
 	float normal_ray[3];
 	float t_factor;
 	float dist_in_planenormal;
-	int quad_i;
-	int num_floats_per_vert = g_big_terrain.num_floats_per_vert;
 	int r=0;
 
+	g_debug_num_ray_quad_tests += 1;
 	vAdd(endpos, pos, ray);
 
-	//Get all four corners of the quad id'd by quad_i and quad_j
-	quad_i = (quad_row*ptile->num_x)+quad_col;
-	quad_origin[0] = ptile->pPos[(quad_i*num_floats_per_vert)];
-	quad_origin[1] = ptile->pPos[(quad_i*num_floats_per_vert)+1];
-	quad_origin[2] = ptile->pPos[(quad_i*num_floats_per_vert)+2];
-	quad_pos_x[0] = ptile->pPos[((quad_i+1)*num_floats_per_vert)];
-	quad_pos_x[1] = ptile->pPos[((quad_i+1)*num_floats_per_vert)+1];
-	quad_pos_x[2] = ptile->pPos[((quad_i+1)*num_floats_per_vert)+2];
-	quad_pos_z[0] = ptile->pPos[((quad_i+ptile->num_x)*num_floats_per_vert)];
-	quad_pos_z[1] = ptile->pPos[((quad_i+ptile->num_x)*num_floats_per_vert)+1];
-	quad_pos_z[2] = ptile->pPos[((quad_i+ptile->num_x)*num_floats_per_vert)+2];
-	quad_opposite[0] = ptile->pPos[((quad_i+1+ptile->num_x)*num_floats_per_vert)];
-	quad_opposite[1] = ptile->pPos[((quad_i+1+ptile->num_x)*num_floats_per_vert)+1];
-	quad_opposite[2] = ptile->pPos[((quad_i+1+ptile->num_x)*num_floats_per_vert)+2];
+	//Get all four corners of the quad id'd by quad_row and quad_col
+	GetTileQuadCorners(ptile, quad_row, quad_col, quad_origin, quad_pos_x, quad_pos_z, quad_opposite);
 
 	//quad consists of two triangles:
 	//1. quad_opposite, quad_pos_x, quad_pos_z
@@ -3829,65 +7799,6 @@ static int RaycastQuadTileSurf(float * pos, float * ray, struct lvl_1_tile * pti
 	return r;
 }
 
-/*
-MakeTerrainElementArray() allocates and places an array of GLshorts that
-it will fill in with element indices
-pElements: array of GLshorts
-num_x: # of vertices in the x direction
-num_z: # of vertices in the z direction
-*/
-int MakeTerrainElementArray(GLshort ** ppElements, int * num_indices, int num_x, int num_z)
-{
-	int i; //row
-	int j; //column
-	int quad_i;
-	int num_quad;
-	int num_bytes;
-	int num_triangles;
-	int num_floats;
-	GLshort * elements; 
-	
-	num_triangles = 2*(num_x-1)*(num_z-1);
-	num_floats = 3*num_triangles;
-	*num_indices = num_floats;//idk why i called this num_floats
-	num_bytes = num_floats*sizeof(GLshort); 
-	elements = (GLshort*)malloc(num_bytes);
-	if(elements == 0)
-	{
-		printf("MakeTerrainElementArray: malloc failed for elements array.\n");
-		return 0;
-	}
-	
-	num_quad = 0;
-	for(i = 0; i < (num_z-1); i++) //subtract 1 because we are dealing with the squares instead of the vertices
-	{
-		for(j = 0; j < (num_x-1); j++)
-		{
-			quad_i = ((i*(num_x-1)) + j)*6; //there are 6 elements in a quad. 3 for each triangle.
-			/*
-			This will make two triangles:
-				1st triangle: (origin, vert in +z dir, vert in +x dir)
-				2nd triangle: (vert in +z dir, vert opposite origin, vert in +x dir)
-			*/
-			elements[quad_i] = num_quad+i; //add + i 
-			elements[(quad_i+1)] = (num_quad+i) + num_x;
-			elements[(quad_i+2)] = (num_quad+i) + 1;
-			elements[(quad_i+3)] = (num_quad+i) + num_x;
-			elements[(quad_i+4)] = (num_quad+i) + num_x + 1;
-			elements[(quad_i+5)] = (num_quad+i) + 1;
-			num_quad += 1;		
-		}
-	}
-	printf("exited enumeration loop: num_quad=%d quad_i=%d i=%d j=%d\n", num_quad, quad_i, i, j);
-	//debug prints:
-	//printf("quad[0,0]: %hd %hd %hd %hd %hd %hd\n", elements[0], elements[1], elements[2], elements[3], elements[4], elements[5]);
-	//printf("quad[0,1]: %hd %hd %hd %hd %hd %hd\n", elements[6], elements[7], elements[8], elements[9], elements[10], elements[11]);
-	//printf("quad[98,0]: %hd %hd %hd %hd %hd %hd\n", elements[57624], elements[57625], elements[57626], elements[57627], elements[57628], elements[57629]);
-	//printf("quad[98,98]: %hd %hd %hd %hd %hd %hd\n", elements[58800], elements[58801], elements[58802], elements[58803], elements[58804], elements[58805]);
-	*ppElements = elements;
-	return 1;
-}
-
 /*
 all parameters are vectors.
 u _cross_ v = normal
@@ -3921,6 +7832,12 @@ static int HandleKeyboardInput(Display * dpy,
 	int r;
 
 	XQueryKeymap(dpy, keys_return);
+	g_keys_down = 0;
+	for(i = 0; i < 32; i++)
+	{
+		if(keys_return[i] != 0)
+			g_keys_down = 1;
+	}
 	switch(g_keyboard_state.state)
 	{
 		case KEYBOARD_MODE_CAMERA: //keys control camera only
@@ -4013,9 +7930,22 @@ static int HandleKeyboardInput(Display * dpy,
 		g_debug_stats.reset_flag = 1;
 
 		//print some # of drawcall info
-		printf("number of simple bush billboard drawcalls=%d\n", g_debug_num_simple_billboard_draws);
-		printf("number of detail bush billboard drawcalls=%d\n", g_debug_num_detail_billboard_draws);
-		printf("number of detailed plant drawcalls=%d\n", g_debug_num_himodel_plant_draws);
+		printf("number of bush billboard drawcalls=%d for %d plants (%d on the draw_grid tiles, %d tile static buffers)\n", g_debug_num_billboard_draws, g_debug_num_billboard_plants, g_bush_grid.num_near_billboards, g_bush_grid.num_static_billboards);
+		printf("number of terrain triangles=%u (%u at full res)\n", g_debug_num_terrain_triangles, g_debug_num_terrain_full_triangles);
+		printf("visible terrain tiles=%d of %d (%d quadtree tests)\n", g_terrain_quadtree.num_visible, g_big_terrain.num_tiles, g_terrain_quadtree.num_tests);
+		printf("number of detailed plant drawcalls=%d for %d plants\n", g_debug_num_himodel_plant_draws, (g_bush_grid.detail_first[5] + g_bush_grid.detail_num[5]));
+		printf("plants visible=%d of %d tested in %d tiles, moveables visible=%d of %d\n", g_bush_grid.num_cull_visible, g_bush_grid.num_cull_tests, g_bush_grid.num_cull_tiles, g_moveables_grid.visible.num_visible, g_moveables_grid.visible.num_tests);
+		printf("occluded by terrain: terrain tiles=%d of %d (%d occluder tiles), plant tiles=%d of %d, moveable tiles=%d of %d\n", g_terrain_occlusion.num_occluded, g_terrain_occlusion.num_tested, g_terrain_occlusion.num_occluder_tiles, g_bush_grid.num_occluded_tiles, g_bush_grid.num_occlusion_tests, g_moveables_grid.num_occluded_tiles, g_moveables_grid.num_occlusion_tests);
+		printf("moveable instances: crate=%d barrel=%d dock=%d bunker=%d warehouse=%d in %d instanced drawcalls\n", g_moveables_grid.instance_num[MOVEABLE_TYPE_CRATE], g_moveables_grid.instance_num[MOVEABLE_TYPE_BARREL], g_moveables_grid.instance_num[MOVEABLE_TYPE_DOCK], g_moveables_grid.instance_num[MOVEABLE_TYPE_BUNKER], g_moveables_grid.instance_num[MOVEABLE_TYPE_WAREHOUSE], g_moveables_grid.num_instance_draws);
+		printf("static moveable batches: %d drawn, %d occluded, %d batches hold %d moveables\n", g_moveables_grid.batch_visible.num[0], g_moveables_grid.num_batches_occluded, g_moveables_grid.num_batches, g_moveables_grid.num_batched_moveables);
+		printf("frame prep jobs: terrain=%.3f skinning=%.3f plants=%.3f moveables=%.3f items=%.3f ms\n", g_frame_prep.jobs[FRAME_JOB_TERRAIN].ms, g_frame_prep.jobs[FRAME_JOB_SKINNING].ms, g_frame_prep.jobs[FRAME_JOB_PLANTS].ms, g_frame_prep.jobs[FRAME_JOB_MOVEABLES].ms, g_frame_prep.jobs[FRAME_JOB_ITEMS].ms);
+		printf("frame prep: %.3f ms (group 1=%.3f, group 2=%.3f) on %d worker threads + the main thread, %.3f ms if run one after another\n", g_frame_prep.total_ms, g_frame_prep.group_ms[0], g_frame_prep.group_ms[1], g_frame_jobs.num_threads, (g_frame_prep.jobs[FRAME_JOB_TERRAIN].ms + g_frame_prep.jobs[FRAME_JOB_SKINNING].ms + g_frame_prep.jobs[FRAME_JOB_PLANTS].ms + g_frame_prep.jobs[FRAME_JOB_MOVEABLES].ms + g_frame_prep.jobs[FRAME_JOB_ITEMS].ms));
+		printf("simulation thread: %d steps every %.1f ms, %.3f to %.3f ms apart, %d late steps dropped, %d paused with nothing new, %d snapshots drawn\n", g_sim_thread.num_steps, (SIM_STEP_NS/1000000.0), g_sim_thread.min_period_ms, g_sim_thread.max_period_ms, g_sim_thread.num_dropped, g_sim_thread.num_unchanged, g_render_snapshots.num_picked);
+		printf("frame pacing: %d frames drawn every %.1f ms, %d skipped with nothing new, %d late (%d deadlines missed, latest started %.1f ms late), %d waits (%d woken by input)\n", g_frame_pacer.num_frames, (FRAME_PERIOD_NS/1000000.0), g_frame_pacer.num_skipped, g_frame_pacer.num_late, g_frame_pacer.num_missed, (g_frame_pacer.max_late_ns/1000000.0), g_frame_pacer.num_waits, g_frame_pacer.num_input_wakes);
+		g_frame_pacer.max_late_ns = 0;
+		g_sim_thread.min_period_ms = 0.0;
+		g_sim_thread.max_period_ms = 0.0;
+		printf("render queue: %d draws, state changes=%d sorted (%d in the order they were added)\n", g_render_queue.num, g_render_queue.num_changes_sorted, g_render_queue.num_changes_added);
 		
 		//debug advance the animation:
 		//g_debug_keyframe += 1;
@@ -4779,7 +8709,8 @@ int LoadBushVBO(struct plant_billboard * p_billboard, char * mesh_filename, char
 
 /*
 This function setups a VBO & VAO for a camera-facing billboard that is used by its
-accompanying shader.
+accompanying shader. The billboard is drawn instanced, with the plant positions
+in instance_vbo.
 */
 int LoadSimpleBillboardVBO(struct simple_billboard * p_billboard)
 {
@@ -4818,6 +8749,13 @@ int LoadSimpleBillboardVBO(struct simple_billboard * p_billboard)
 	glEnableVertexAttribArray(1);
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5*sizeof(float), 0);
 	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5*sizeof(float), (GLvoid*)(3*sizeof(float)));
+	
+	//the plant positions are filled in every frame, and each instance is one plant
+	glGenBuffers(1, &(p_billboard->instance_vbo));
+	glBindBuffer(GL_ARRAY_BUFFER, p_billboard->instance_vbo);
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 3*sizeof(float), 0);
+	glVertexAttribDivisor(2, 1);
 	glBindVertexArray(0);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	
@@ -4831,16 +8769,35 @@ int LoadSimpleBillboardVBO(struct simple_billboard * p_billboard)
 LoadSimpleBillboardTextures() initializes the struct simple_billboard.texture_id[6] array
 with textures. the array is indexed by plant type.
 */
+/*
+InitSimpleBillboardSizes
+Sets the billboard size of each plant type.
+*/
+void InitSimpleBillboardSizes(struct simple_billboard * billboard)
+{
+	memset(billboard->size, 0, 12*sizeof(float));
+	billboard->size[0] = 1.0f;	//simple bush
+	billboard->size[1] = 1.0f;
+	billboard->size[2] = 7.8159f;	//palm_2
+	billboard->size[3] = 7.8159f;
+	billboard->size[4] = 1.0f;	//scaevola
+	billboard->size[5] = 1.0f;
+	billboard->size[6] = 1.5f;	//fake pemphis
+	billboard->size[7] = 1.5f;
+	billboard->size[8] = 6.0f;	//tourne fortia
+	billboard->size[9] = 6.0f;
+	billboard->size[10] = 8.0f;	//ironwood
+	billboard->size[11] = 8.0f;
+}
+
 int LoadSimpleBillboardTextures(struct simple_billboard * billboard)
 {
 	int r;
 
-	memset(billboard->size, 0, 12*sizeof(float));
+	InitSimpleBillboardSizes(billboard);
 	memset(billboard->texture_ids, 0, 6*sizeof(GLuint));
 
 	//simple bush
-	billboard->size[0] = 1.0f;
-	billboard->size[1] = 1.0f;
 	r = LoadBushTextureManualMip(&(billboard->texture_ids[0]), "./resources/textures/m00_tourne_billboard_00.tga"); //load this one manual mip because that is what I did for simple bush.
 	if(r != 1)
 	{
@@ -4849,8 +8806,6 @@ int LoadSimpleBillboardTextures(struct simple_billboard * billboard)
 	}
 
 	//palm_2
-	billboard->size[2] = 7.8159f;
-	billboard->size[3] = 7.8159f;
 	r = LoadBushTextureGenMip(&(billboard->texture_ids[1]), "./resources/textures/palm_2_lowres_billboard.tga");
 	if(r != 1)
 	{
@@ -4859,8 +8814,6 @@ int LoadSimpleBillboardTextures(struct simple_billboard * billboard)
 	}
 
 	//scaevola
-	billboard->size[4] = 1.0f;
-	billboard->size[5] = 1.0f;
 	r = LoadBushTextureGenMip(&(billboard->texture_ids[2]), "./resources/textures/scaevola_branch.tga");
 	if(r != 1)
 	{
@@ -4869,8 +8822,6 @@ int LoadSimpleBillboardTextures(struct simple_billboard * billboard)
 	}
 
 	//fake pemphis
-	billboard->size[6] = 1.5f;
-	billboard->size[7] = 1.5f;
 	r = LoadBushTextureGenMip(&(billboard->texture_ids[3]), "./resources/textures/pemphis_simplebillboard.tga");
 	if(r != 1)
 	{
@@ -4879,8 +8830,6 @@ int LoadSimpleBillboardTextures(struct simple_billboard * billboard)
 	}
 
 	//tourne fortia
-	billboard->size[8] = 6.0f;
-	billboard->size[9] = 6.0f;
 	r = LoadBushTextureGenMip(&(billboard->texture_ids[4]), "./resources/textures/tourne_simplebillboard.tga");
 	if(r != 1)
 	{
@@ -4889,8 +8838,6 @@ int LoadSimpleBillboardTextures(struct simple_billboard * billboard)
 	}
 
 	//ironwood
-	billboard->size[10] = 8.0f;
-	billboard->size[11] = 8.0f;
 	r = LoadBushTextureGenMip(&(billboard->texture_ids[5]), "./resources/textures/ironwood_simplebillboard.tga");
 	if(r != 1)
 	{
@@ -5156,118 +9103,403 @@ void SetupBushSamplers(void)
 	glSamplerParameteri(g_bush_trunktex_sampler, GL_TEXTURE_WRAP_T, GL_REPEAT);
 }
 
-void ClipTilesSetupFrustum(void)
+/*
+ClipTilesSetupFrustum
+Pulls the 6 planes of the view frustum out of the projection matrix times
+mCamera (the world to camera matrix the scene is drawn with), so the
+culling follows the camera's pitch and whatever built mCamera (e.g. the
+vehicle camera).
+*/
+void ClipTilesSetupFrustum(float * mCamera, float * ws_camera_pos)
+{
+	float mClip[16];
+	float * plane;
+	float sign;
+	float mag;
+	int axis;
+	int i;
+	int j;
+	
+	mmMultiplyMatrix4x4(g_perspectiveMatrix, mCamera, mClip);
+	
+	//a point is inside when -w <= x,y,z <= w in clip space, so each plane is
+	//the 4th row of the matrix plus or minus the 1st, 2nd or 3rd row
+	for(i = 0; i < 6; i++)
+	{
+		plane = g_camera_frustum.planes[i];
+		axis = i/2;
+		sign = ((i & 1) == 0) ? 1.0f : -1.0f;
+		for(j = 0; j < 4; j++)
+		{
+			plane[j] = mClip[((j*4)+3)] + (sign*mClip[((j*4)+axis)]);
+		}
+		mag = vMagnitude(plane);
+		plane[0] = plane[0]/mag;
+		plane[1] = plane[1]/mag;
+		plane[2] = plane[2]/mag;
+		plane[3] = plane[3]/mag;
+	}
+	
+	//calculate the position of the camera
+	g_camera_frustum.camera[0] = ws_camera_pos[0];
+	g_camera_frustum.camera[1] = ws_camera_pos[1];
+	g_camera_frustum.camera[2] = ws_camera_pos[2];
+}
+
+/*
+Returns 1 or 0 depending on if the Tile is in the frustum. The tile's
+box spans its x,z and its lowest to highest vert.
+Requires ClipTilesSetupFrustum be called first
+*/
+int IsTileInCameraFrustum(struct lvl_1_terrain_struct * pTerrain, struct lvl_1_tile * pTile)
+{
+	float box_min[3];
+	float box_max[3];
+	
+	box_min[0] = pTile->urcorner[0];
+	box_min[1] = pTile->min_height;
+	box_min[2] = pTile->urcorner[1];
+	box_max[0] = pTile->urcorner[0] + pTerrain->tile_len[0];
+	box_max[1] = pTile->max_height;
+	box_max[2] = pTile->urcorner[1] + pTerrain->tile_len[1];
+	if(ClassifyBoxInCameraFrustum(box_min, box_max) == QT_OUTSIDE)
+		return 0; //don't draw
+	return 1; //indicate tile is in frustum
+}
+
+/*
+ClassifyBoxInCameraFrustum
+Tests a world-space box against the camera frustum planes from
+ClipTilesSetupFrustum(). Uses the corner furthest along each plane's
+normal to reject and the nearest one to accept. A box under the water
+plane is also rejected while the camera is above the water, and one that
+only reaches under it is never accepted, since the parts of it under the
+water could be rejected on their own.
+returns QT_OUTSIDE if nothing in the box can be seen, QT_INSIDE if every
+point of the box is in the frustum, else QT_PARTIAL
+*/
+int ClassifyBoxInCameraFrustum(float * box_min, float * box_max)
+{
+	float * plane;
+	float d_far;
+	float d_near;
+	int r = QT_INSIDE;
+	int i;
+	
+	if(g_camera_frustum.camera[1] > WATER_LEVEL
+		&& box_max[1] < WATER_LEVEL
+		&& box_min[0] >= -WATER_PLANE_HALF_LEN && box_max[0] <= WATER_PLANE_HALF_LEN
+		&& box_min[2] >= -WATER_PLANE_HALF_LEN && box_max[2] <= WATER_PLANE_HALF_LEN)
+	{
+		return QT_OUTSIDE;
+	}
+	
+	for(i = 0; i < 6; i++)
+	{
+		plane = g_camera_frustum.planes[i];
+		d_far = plane[3];
+		d_near = plane[3];
+		d_far += plane[0]*((plane[0] > 0.0f) ? box_max[0] : box_min[0]);
+		d_near += plane[0]*((plane[0] > 0.0f) ? box_min[0] : box_max[0]);
+		d_far += plane[1]*((plane[1] > 0.0f) ? box_max[1] : box_min[1]);
+		d_near += plane[1]*((plane[1] > 0.0f) ? box_min[1] : box_max[1]);
+		d_far += plane[2]*((plane[2] > 0.0f) ? box_max[2] : box_min[2]);
+		d_near += plane[2]*((plane[2] > 0.0f) ? box_min[2] : box_max[2]);
+		if(d_far < 0.0f)
+			return QT_OUTSIDE;
+		if(d_near < 0.0f)
+			r = QT_PARTIAL;
+	}
+	if(r == QT_INSIDE && g_camera_frustum.camera[1] > WATER_LEVEL && box_min[1] < WATER_LEVEL)
+		r = QT_PARTIAL;
+	return r;
+}
+
+/*
+CountTilesInLeftRightFrustum
+The tile culling from before ClipTilesSetupFrustum() built all 6 planes:
+only a left and right plane turned by the camera's rotY (and opened up
+to make up for the missing pitch), tested against the 4 corners of each
+tile. It is kept to measure the 6-plane culling against
+(--count-frustum-tiles).
+returns the # of tiles in the terrain draw box that it would draw
+*/
+static int CountTilesInLeftRightFrustum(int local_tile)
 {
+	struct lvl_1_tile * ptile;
 	float r;
-	float l;
 	float t;
-	float b;
 	float ltn[4];
 	float lbn[4];
 	float rtn[4];
 	float rbn[4];
+	float left_normal[3];
+	float right_normal[3];
 	float mTransform[16];
-	float rotY;
 	float mRotate[16];
 	float mTranslate[16];
+	float corner[3];
+	float p[3];
+	int corners[4];
+	int num_tiles = 0;
+	int tile_i;
+	int i;
 	
-	//calculate right,left,bottom,top for the camera frustum (assume symmetric frustum)
 	r = g_camera_frustum.fzNear/g_perspectiveMatrix[0];
-	r = r/0.5f; //open the sides of the frustum up so that more tiles along the edges are included.
+	r = r/0.5f;
 	t = g_camera_frustum.fzNear/g_perspectiveMatrix[5];
-	l = -1.0f*r;
-	b = -1.0f*t;
-	ltn[0] = l;
+	ltn[0] = -r;
 	ltn[1] = t;
-	ltn[2] = g_camera_frustum.fzNear;
-	ltn[3] = 1.0f;
-	lbn[0] = l;
-	lbn[1] = b;
-	lbn[2] = g_camera_frustum.fzNear;
-	lbn[3] = 1.0f;
+	lbn[0] = -r;
+	lbn[1] = -t;
 	rtn[0] = r;
 	rtn[1] = t;
-	rtn[2] = g_camera_frustum.fzNear;
-	rtn[3] = 1.0f;
 	rbn[0] = r;
-	rbn[1] = b;
-	rbn[2] = g_camera_frustum.fzNear;
-	rbn[3] = 1.0f;
-	
-	//calculate the position of the camera
-	rotY = -1.0f*g_camera_rotY;
-	g_camera_frustum.camera[0] = -1.0f*g_camera_pos[0];
-	g_camera_frustum.camera[1] = -1.0f*g_camera_pos[1];
-	g_camera_frustum.camera[2] = -1.0f*g_camera_pos[2];
-	
-	//form a transform matrix using the camera's position
-	mmTranslateMatrix(mTranslate, 
-		g_camera_frustum.camera[0],
-		g_camera_frustum.camera[1],
-		g_camera_frustum.camera[2]);
-	mmRotateAboutY(mRotate, rotY);
-	//mmMultiplyMatrix4x4(mRotate, mTranslate, mTransform);
+	rbn[1] = -t;
+	ltn[2] = lbn[2] = rtn[2] = rbn[2] = g_camera_frustum.fzNear;
+	ltn[3] = lbn[3] = rtn[3] = rbn[3] = 1.0f;
+	mmTranslateMatrix(mTranslate, g_camera_frustum.camera[0], g_camera_frustum.camera[1], g_camera_frustum.camera[2]);
+	mmRotateAboutY(mRotate, (-1.0f*g_camera_rotY));
 	mmMultiplyMatrix4x4(mTranslate, mRotate, mTransform);
-	
-	//transform the near plane vertices to the camera's world position
 	mmTransformVec(mTransform, ltn);
 	mmTransformVec(mTransform, lbn);
 	mmTransformVec(mTransform, rtn);
 	mmTransformVec(mTransform, rbn);
+	vGetPlaneNormal(g_camera_frustum.camera, rtn, rbn, right_normal);
+	vGetPlaneNormal(g_camera_frustum.camera, lbn, ltn, left_normal);
+	
+	for(tile_i = 0; tile_i < g_big_terrain.num_tiles; tile_i++)
+	{
+		ptile = &(g_big_terrain.pTiles[tile_i]);
+		if(IsTileInTerrainDrawBox(ptile) == 0)
+			continue;
+		if(tile_i == local_tile)
+		{
+			num_tiles += 1;
+			continue;
+		}
+		corners[0] = 0;
+		corners[1] = ptile->num_x-1;
+		corners[2] = (ptile->num_z-1)*ptile->num_x;
+		corners[3] = (ptile->num_x*ptile->num_z)-1;
+		for(i = 0; i < 4; i++)
+		{
+			GetTileVertPos(ptile, corners[i], corner);
+			vSubtract(p, corner, g_camera_frustum.camera);
+			if(vDotProduct(p, left_normal) > 0.0f && vDotProduct(p, right_normal) > 0.0f)
+				break;
+		}
+		if(i < 4)
+			num_tiles += 1;
+	}
+	return num_tiles;
+}
+
+/*
+ClassifyTerrainQuadtreeNode
+qtCollect() test for the terrain tiles that get drawn: the tile's center
+is in the terrain draw box and the tile is in the camera frustum. The
+tile at *user (the tile the camera is in) skips the frustum test. Nodes
+with a single tile use the same tests as drawing tile by tile did.
+*/
+int ClassifyTerrainQuadtreeNode(void * user, struct qt_node_struct * node)
+{
+	int local_tile = *(int*)user;
+	float center_min[2]; //lowest and highest tile center x,z in the node
+	float center_max[2];
+	int has_local_tile;
+	int r_box;
+	int r_frustum;
+	int tile_i;
 	
-	//calculate the planes
-	vGetPlaneNormal(g_camera_frustum.camera, rtn, rbn, g_camera_frustum.right_normal);
-	vGetPlaneNormal(g_camera_frustum.camera, lbn, ltn, g_camera_frustum.left_normal);
+	if(node->num_children == 0)
+	{
+		tile_i = (node->first_row*g_big_terrain.num_cols) + node->first_col;
+		if(IsTileInTerrainDrawBox(&(g_big_terrain.pTiles[tile_i])) == 0)
+			return QT_OUTSIDE;
+		if(tile_i == local_tile || IsTileInCameraFrustum(&g_big_terrain, &(g_big_terrain.pTiles[tile_i])) == 1)
+			return QT_INSIDE;
+		return QT_OUTSIDE;
+	}
+	
+	//the draw box only looks at tile centers
+	center_min[0] = (node->first_col*g_big_terrain.tile_len[0]) + (g_big_terrain.tile_len[0]*0.5f);
+	center_min[1] = (node->first_row*g_big_terrain.tile_len[1]) + (g_big_terrain.tile_len[1]*0.5f);
+	center_max[0] = ((node->end_col-1)*g_big_terrain.tile_len[0]) + (g_big_terrain.tile_len[0]*0.5f);
+	center_max[1] = ((node->end_row-1)*g_big_terrain.tile_len[1]) + (g_big_terrain.tile_len[1]*0.5f);
+	if(center_max[0] <= g_big_terrain.nodraw_boundaries[0]
+		|| center_min[0] >= g_big_terrain.nodraw_boundaries[1]
+		|| center_max[1] <= g_big_terrain.nodraw_boundaries[2]
+		|| center_min[1] >= g_big_terrain.nodraw_boundaries[3])
+	{
+		return QT_OUTSIDE;
+	}
+	r_box = QT_PARTIAL;
+	if(center_min[0] > g_big_terrain.nodraw_boundaries[0]
+		&& center_max[0] < g_big_terrain.nodraw_boundaries[1]
+		&& center_min[1] > g_big_terrain.nodraw_boundaries[2]
+		&& center_max[1] < g_big_terrain.nodraw_boundaries[3])
+	{
+		r_box = QT_INSIDE;
+	}
+	
+	r_frustum = ClassifyBoxInCameraFrustum(node->box_min, node->box_max);
+	has_local_tile = (local_tile >= 0
+		&& (local_tile % g_big_terrain.num_cols) >= node->first_col
+		&& (local_tile % g_big_terrain.num_cols) < node->end_col
+		&& (local_tile / g_big_terrain.num_cols) >= node->first_row
+		&& (local_tile / g_big_terrain.num_cols) < node->end_row);
+	if(r_frustum == QT_OUTSIDE && has_local_tile == 0)
+		return QT_OUTSIDE;
+	if(r_frustum == QT_INSIDE && r_box == QT_INSIDE)
+		return QT_INSIDE;
+	return QT_PARTIAL;
 }
 
 /*
-Returns 1 or 0 depending on if the Tile is in the frustum.
-Requires ClipTilesSetupFrustum be called first
+UpdateVisibleTerrainTiles
+Called once a frame from DrawScene(). Fills g_terrain_quadtree.visible
+with the tiles in the terrain draw box and camera frustum. The terrain
+pass draws these and the vegetation passes pick their tiles from them.
+Requires ClipTilesSetupFrustum() and UpdateTerrainDrawBox() first.
 */
-int IsTileInCameraFrustum(struct lvl_1_terrain_struct * pTerrain, struct lvl_1_tile * pTile)
+void UpdateVisibleTerrainTiles(int local_tile)
 {
-	float p[12];     //result of corners subtracted by camera pos
-	float d[8];
-	float * corner[4];
-	int num_z;
-	int num_x;
-	int floats_per_vert;
-	int i;
-	
-	//get the coordinates of the four corners of the tile from the tile map.
-	num_z = pTile->num_z;
-	num_x = pTile->num_x;
-	floats_per_vert = pTerrain->num_floats_per_vert;
-	corner[0] = pTile->pPos; //origin corner
-	corner[1] = pTile->pPos+((num_x-1)*floats_per_vert); //+x, z=0 corner
-	corner[2] = pTile->pPos+((num_z-1)*num_x*floats_per_vert); //x=0, +z corner
-	corner[3] = pTile->pPos+(((num_x*num_z)-1)*floats_per_vert); //+x,+z corner
-	
-	//prepare the corner for checking if it is inside the frustum.
-	vSubtract(p, corner[0], g_camera_frustum.camera);
-	vSubtract((p+3), corner[1], g_camera_frustum.camera);
-	vSubtract((p+6), corner[2], g_camera_frustum.camera);
-	vSubtract((p+9), corner[3], g_camera_frustum.camera);
-	
-	//calculate dot products for the left plane
-	d[0] = vDotProduct(p, g_camera_frustum.left_normal);
-	d[1] = vDotProduct((p+3), g_camera_frustum.left_normal);
-	d[2] = vDotProduct((p+6), g_camera_frustum.left_normal);
-	d[3] = vDotProduct((p+9), g_camera_frustum.left_normal);
-	
-	//calculate dot products for the right plane
-	d[4] = vDotProduct(p, g_camera_frustum.right_normal);
-	d[5] = vDotProduct((p+3), g_camera_frustum.right_normal);
-	d[6] = vDotProduct((p+6), g_camera_frustum.right_normal);
-	d[7] = vDotProduct((p+9), g_camera_frustum.right_normal);
-	
-	//check to see if corners are in frustum. All d > 0 then in frustum
-	for(i = 0; i < 4; i++)
+	qtCollect(&g_terrain_quadtree, ClassifyTerrainQuadtreeNode, &local_tile);
+}
+
+/*
+AddTileOccluders
+Adds a tile's blocks to the horizon as solid columns up to the block's
+lowest vert, less the height error of the tile's LOD level so the
+columns stay under the triangles that are drawn. Far from the camera a
+block covers less than a horizon direction, so blocks are merged in 2x2
+steps until they are wide enough to be of use.
+*/
+void AddTileOccluders(struct horizon_struct * hz, struct lvl_1_tile * ptile)
+{
+	float rect_min[2];
+	float rect_max[2];
+	float block_len;
+	float bucket_len;
+	float lod_error;
+	float top;
+	int num_blocks_x;
+	int num_blocks_z;
+	int group;
+	int bi, bj;
+	int i, j;
+
+	block_len = TERRAIN_RAY_BLOCK*g_big_terrain.vert_spacing;
+	num_blocks_x = (ptile->num_x - 1 + (TERRAIN_RAY_BLOCK-1))/TERRAIN_RAY_BLOCK;
+	num_blocks_z = (ptile->num_z - 1 + (TERRAIN_RAY_BLOCK-1))/TERRAIN_RAY_BLOCK;
+	lod_error = ptile->lod_error[ptile->lod_level];
+
+	//width of one horizon direction at the tile's distance. a block has to span a few to fill any
+	bucket_len = GetTileCameraDist(ptile, hz->camera)*(float)((2.0*PI)/HZ_NUM_BUCKETS);
+	group = 1;
+	while((group*block_len) < (3.0f*bucket_len) && group < num_blocks_x && group < num_blocks_z)
+		group *= 2;
+
+	for(bi = 0; bi < num_blocks_z; bi += group)
+	{
+		for(bj = 0; bj < num_blocks_x; bj += group)
+		{
+			top = FLT_MAX;
+			for(i = bi; i < (bi + group) && i < num_blocks_z; i++)
+			{
+				for(j = bj; j < (bj + group) && j < num_blocks_x; j++)
+				{
+					if(ptile->pBlockMinHeights[((i*num_blocks_x) + j)] < top)
+						top = ptile->pBlockMinHeights[((i*num_blocks_x) + j)];
+				}
+			}
+			rect_min[0] = ptile->urcorner[0] + (bj*block_len);
+			rect_min[1] = ptile->urcorner[1] + (bi*block_len);
+			rect_max[0] = fminf((rect_min[0] + (group*block_len)), (ptile->urcorner[0] + g_big_terrain.tile_len[0]));
+			rect_max[1] = fminf((rect_min[1] + (group*block_len)), (ptile->urcorner[1] + g_big_terrain.tile_len[1]));
+			hzAddOccluder(hz, rect_min, rect_max, (top - lod_error));
+		}
+	}
+}
+
+/*
+UpdateTerrainOcclusion
+Called once a frame from DrawScene(), after UpdateTerrainLod(). Builds
+the horizon around camera_pos from the tiles in g_terrain_quadtree.visible,
+then sets the occluded flag of each of those tiles whose box is wholly
+under it. Only tiles that are drawn can hide others, so with need_vbo set
+tiles without a loaded vbo are left out of the horizon. The plant and
+moveable passes test their boxes with IsTerrainBoxOccluded() afterwards.
+*/
+void UpdateTerrainOcclusion(float * camera_pos, int need_vbo)
+{
+	struct horizon_struct * hz;
+	struct lvl_1_tile * ptile;
+	float box_min[3];
+	float box_max[3];
+	float xz[2];
+	float ground_y;
+	int i_visible;
+	int r;
+
+	hz = &(g_terrain_occlusion.horizon);
+	hzBegin(hz, camera_pos);
+	g_terrain_occlusion.num_occluder_tiles = 0;
+	g_terrain_occlusion.num_tested = 0;
+	g_terrain_occlusion.num_occluded = 0;
+	for(i_visible = 0; i_visible < g_terrain_quadtree.num_visible; i_visible++)
+	{
+		g_big_terrain.pTiles[g_terrain_quadtree.visible[i_visible]].occluded = 0;
+	}
+
+	//the horizon takes everything under the terrain to be solid, which is
+	//no use with the camera down there
+	xz[0] = camera_pos[0];
+	xz[1] = camera_pos[2];
+	r = GetTileSurfPointBatch(xz, 1, &ground_y, 0);
+	g_terrain_occlusion.enabled = (r == 1 && camera_pos[1] < ground_y) ? 0 : 1;
+	if(g_terrain_occlusion.enabled == 0)
+	{
+		hzFinish(hz);
+		return;
+	}
+
+	for(i_visible = 0; i_visible < g_terrain_quadtree.num_visible; i_visible++)
+	{
+		ptile = &(g_big_terrain.pTiles[g_terrain_quadtree.visible[i_visible]]);
+		if(IsTileResident(ptile) == 0 || ptile->pBlockMinHeights == 0)
+			continue;
+		if(need_vbo == 1 && ptile->vbo_loaded == 0)
+			continue;
+		AddTileOccluders(hz, ptile);
+		g_terrain_occlusion.num_occluder_tiles += 1;
+	}
+	hzFinish(hz);
+
+	for(i_visible = 0; i_visible < g_terrain_quadtree.num_visible; i_visible++)
 	{
-		if((d[i] > 0.0f) && (d[(i+4)] > 0.0f))
-			return 1; //indicate tile is in frustum
+		ptile = &(g_big_terrain.pTiles[g_terrain_quadtree.visible[i_visible]]);
+		box_min[0] = ptile->urcorner[0];
+		box_min[1] = ptile->min_height;
+		box_min[2] = ptile->urcorner[1];
+		box_max[0] = ptile->urcorner[0] + g_big_terrain.tile_len[0];
+		box_max[1] = ptile->max_height;
+		box_max[2] = ptile->urcorner[1] + g_big_terrain.tile_len[1];
+		ptile->occluded = hzIsBoxOccluded(hz, box_min, box_max);
+		g_terrain_occlusion.num_tested += 1;
+		g_terrain_occlusion.num_occluded += ptile->occluded;
 	}
-	return 0; //all corners are out of frustum, don't draw
+}
+
+/*
+IsTerrainBoxOccluded
+returns 1 if the box is hidden behind the terrain of the last
+UpdateTerrainOcclusion(), else 0
+*/
+int IsTerrainBoxOccluded(float * box_min, float * box_max)
+{
+	return hzIsBoxOccluded(&(g_terrain_occlusion.horizon), box_min, box_max);
 }
 
 /*
@@ -6111,9 +10343,9 @@ int InitPlantGrid2(struct plant_grid * p_grid)
 	char * temp_plants_type_array=0;
 	struct plant_tile * p_tile=0;
 	float * temp_plants_pos_array=0;
-	float rpos[3];
+	float * try_xz=0;
+	float * try_y=0;
 	float surf_pos[3];
-	float v3_normal[3];
 	int max_plants_per_tile = 1000;
 	int num_plants;
 	int i;
@@ -6124,9 +10356,10 @@ int InitPlantGrid2(struct plant_grid * p_grid)
 	int r;
 	char temp_plant_type;
 
-	p_grid->num_tiles = 1521; //TODO: Remove this hard-coded map info
-	p_grid->num_cols = 39;
-	p_grid->num_rows = 39;
+	//one plant tile per terrain tile
+	p_grid->num_tiles = g_big_terrain.num_tiles;
+	p_grid->num_cols = g_big_terrain.num_cols;
+	p_grid->num_rows = g_big_terrain.num_rows;
 
 	p_grid->p_tiles = (struct plant_tile*)malloc(p_grid->num_tiles*sizeof(struct plant_tile));
 	if(p_grid->p_tiles == 0)
@@ -6152,6 +10385,15 @@ int InitPlantGrid2(struct plant_grid * p_grid)
 	}
 	memset(temp_plants_type_array, 0, max_plants_per_tile);
 
+	//x,z of every try in a tile, so the terrain heights can be found in one call
+	try_xz = (float*)malloc(max_plants_per_tile*2*sizeof(float));
+	try_y = (float*)malloc(max_plants_per_tile*sizeof(float));
+	if(try_xz == 0 || try_y == 0)
+	{
+		printf("%s: error. malloc fail.\n", __func__);
+		return -1;
+	}
+
 	p_grid->draw_grid[0] = -1;
 	p_grid->draw_grid[1] = -1;
 	p_grid->draw_grid[2] = -1;
@@ -6163,6 +10405,7 @@ int InitPlantGrid2(struct plant_grid * p_grid)
 	p_grid->draw_grid[8] = -1;
 
 	//initialize some distances for when to draw plants
+	p_grid->detail_dist = 200.0f;
 	p_grid->nodraw_dist[0] = 50.0f; //bush
 	p_grid->nodraw_dist[1] = 2000.0f; //palm
 	p_grid->nodraw_dist[2] = 50.0f; //scaevola
@@ -6171,35 +10414,37 @@ int InitPlantGrid2(struct plant_grid * p_grid)
 	p_grid->nodraw_dist[5] = 2000.0f; //ironwood
 
 	//terrain map has tiles ordered row major
-	for(i = 0; i < p_grid->num_cols; i++)
+	for(i = 0; i < p_grid->num_rows; i++)
 	{
 		for(j = 0; j < p_grid->num_cols; j++)
 		{
 			p_tile = p_grid->p_tiles + (i*p_grid->num_cols) + j;
 			
 			//set the corner towards the origin (upper-right...yea idk)
-			//each tile is 990.0f x 990.0f
-			p_tile->urcorner[0] = j*990.0f;
-			p_tile->urcorner[1] = i*990.0f;
+			//each tile is the size of a terrain tile
+			p_tile->urcorner[0] = j*g_big_terrain.tile_len[0];
+			p_tile->urcorner[1] = i*g_big_terrain.tile_len[1];
 
 			num_plants = 0;
 
 			//try to get positions for at most max_plants_per_tile
 			for(k = 0; k < max_plants_per_tile; k++)
 			{
-				//get a random x,z vector in the tile
-				rpos[0] = (float)(rand() % 990);
-				rpos[1] = 0.0f;
-				rpos[2] = (float)(rand() % 990);
-
-				//add the offset from the origin, to get the global coordinates
-				rpos[0] += p_tile->urcorner[0];
-				rpos[2] += p_tile->urcorner[1];
-				
-				r = GetTileSurfPoint(rpos, surf_pos, v3_normal);
-				if(r == -1)
+				//get a random x,z vector in the tile and add the offset from the origin, to get the global coordinates
+				try_xz[(k*2)] = (float)(rand() % (int)g_big_terrain.tile_len[0]) + p_tile->urcorner[0];
+				try_xz[(k*2)+1] = (float)(rand() % (int)g_big_terrain.tile_len[1]) + p_tile->urcorner[1];
+			}
+			r = GetTileSurfPointBatch(try_xz, max_plants_per_tile, try_y, 0);
+			if(r == -1)
+				return -1;
+			for(k = 0; k < max_plants_per_tile; k++)
+			{
+				surf_pos[0] = try_xz[(k*2)];
+				surf_pos[1] = try_y[k];
+				surf_pos[2] = try_xz[(k*2)+1];
+				if(surf_pos[1] == -FLT_MAX)
 				{
-					printf("%s: error plant pos x=%f z=%f not on terrain grid.\n", __func__, rpos[0], rpos[2]);
+					printf("%s: error plant pos x=%f z=%f not on terrain grid.\n", __func__, surf_pos[0], surf_pos[2]);
 					continue;
 				}
 				if(surf_pos[1] > 0.0f)
@@ -6216,107 +10461,542 @@ int InitPlantGrid2(struct plant_grid * p_grid)
 				}
 			}
 
-			//num_plants now has the # of positions in the temp_plant_pos_array
-			//allocate memory for the plant positions and place it in a plant_tile struct
-			p_tile->num_plants = num_plants;
+			//num_plants now has the # of positions in the temp_plant_pos_array
+			//allocate memory for the plant positions and place it in a plant_tile struct
+			p_tile->num_plants = num_plants;
+
+			if(num_plants == 0)
+			{
+				p_tile->plants = 0;
+				continue;
+			}
+		
+			p_tile->plants = (struct plant_info_struct*)malloc(num_plants*sizeof(struct plant_info_struct));
+			if(p_tile->plants == 0)
+			{
+				printf("%s: malloc file on tile (%d,%d)\n", __func__, i, j);
+				return -1;
+			}
+			memset(p_tile->plants, 0, num_plants*sizeof(struct plant_info_struct));
+
+			//now loop through the temp_plants_pos_array but organize the different plant types together.
+			//so loop through the plants array looking for a plant type each iteration.
+			i_newPlant = 0;
+			for(i_type = 0; i_type < 6; i_type++) //there are 6 plant types
+			{
+				for(k = 0; k < num_plants; k++)
+				{
+					if(temp_plants_type_array[k] == i_type) //if this is the plant type we are looking for copy it
+					{
+						p_tile->plants[i_newPlant].pos[0] = temp_plants_pos_array[(k*3)];
+						p_tile->plants[i_newPlant].pos[1] = temp_plants_pos_array[(k*3)+1];
+						p_tile->plants[i_newPlant].pos[2] = temp_plants_pos_array[(k*3)+2];
+						p_tile->plants[i_newPlant].plant_type = temp_plants_type_array[k];
+						p_tile->plants[i_newPlant].yrot = 360.0f * RandomFloat();
+						i_newPlant += 1;
+					}
+				}
+			}
+			//check that i_newPlant matches the # of plants allocated for
+			if(i_newPlant != num_plants)
+			{
+				printf("%s: error. plant allocated mismatch i_newPlant=%d num_plants=%d\n", __func__, i_newPlant, num_plants);
+				return 0;
+			}
+
+			r = UpdatePlantTileCullSpheres(p_grid, p_tile);
+			if(r == 0)
+				return -1;
+		}
+	}
+
+	free(temp_plants_pos_array);
+	free(try_xz);
+	free(try_y);
+
+	p_grid->cull_tiles = (int*)malloc(p_grid->num_tiles*sizeof(int));
+	if(p_grid->cull_tiles == 0)
+	{
+		printf("%s: error. malloc fail.\n", __func__);
+		return -1;
+	}
+	p_grid->num_cull_tiles = 0;
+	p_grid->num_near_cull_tiles = 0;
+	p_grid->billboard_pos = 0;
+	p_grid->max_billboards = 0;
+	memset(p_grid->billboard_num, 0, 6*sizeof(int));
+	p_grid->detail_mats = 0;
+	p_grid->max_detail_plants = 0;
+	memset(p_grid->detail_num, 0, 6*sizeof(int));
+	p_grid->static_billboards = (int*)malloc(p_grid->num_tiles*6*2*sizeof(int));
+	if(p_grid->static_billboards == 0)
+	{
+		printf("%s: error. malloc fail.\n", __func__);
+		return -1;
+	}
+	p_grid->num_static_billboards = 0;
+	return 0;
+}
+
+/*
+This function fills in the draw_grid for plant tiles.
+*/
+void UpdatePlantDrawGrid(struct plant_grid * p_grid, int cam_tile, float * camera_pos)
+{
+	float * p_boundary=0;
+	int cam_row, cam_col;
+	int row, col;
+	int i;
+	
+	//setup camera boundaries
+	p_grid->detail_boundaries[0] = camera_pos[0] - p_grid->detail_dist;//-x
+	p_grid->detail_boundaries[1] = camera_pos[0] + p_grid->detail_dist;//+x
+	p_grid->detail_boundaries[2] = camera_pos[2] - p_grid->detail_dist;//-z
+	p_grid->detail_boundaries[3] = camera_pos[2] + p_grid->detail_dist;//+z
+
+	//setup plant no draw boundaries
+	for(i = 0; i < 6; i++)
+	{
+		p_boundary = p_grid->nodraw_boundaries + (i*4);
+		p_boundary[0] = camera_pos[0] - p_grid->nodraw_dist[i]; //-x
+		p_boundary[1] = camera_pos[0] + p_grid->nodraw_dist[i]; //+x
+		p_boundary[2] = camera_pos[2] - p_grid->nodraw_dist[i]; //-z
+		p_boundary[3] = camera_pos[2] + p_grid->nodraw_dist[i]; //+z
+	}
+	
+	p_grid->draw_grid[4] = cam_tile;
+	
+	//if the cam_tile came back invalid (-1) 
+	//then clear the draw_grid
+	if(cam_tile == -1)
+	{
+		for(i = 0; i < 9; i++)
+		{
+			p_grid->draw_grid[i] = -1;
+		}
+		return;
+	}
+	
+	//3x3 tiles around the camera tile. Neighbours off the edge of the map are -1
+	cam_row = cam_tile/p_grid->num_cols;
+	cam_col = cam_tile%p_grid->num_cols;
+	for(i = 0; i < 9; i++)
+	{
+		row = cam_row + (i/3) - 1;
+		col = cam_col + (i%3) - 1;
+		if(row < 0 || row >= p_grid->num_rows || col < 0 || col >= p_grid->num_cols)
+			p_grid->draw_grid[i] = -1;
+		else
+			p_grid->draw_grid[i] = (row*p_grid->num_cols) + col;
+	}
+}
+
+/*
+InitPlantDetailParts
+Sets up the mesh parts of each plant type's detailed model and how each
+is drawn, and points attributes 3 to 6 of every part's vao at the
+per-instance model matrices in detail_vbo. The plant models need to be
+loaded first.
+*/
+void InitPlantDetailParts(struct plant_grid * p_grid)
+{
+	struct plant_billboard * parts[6][2] = {
+		{&g_bush_billboard, 0},
+		{&g_palm_trunk, &g_palm_fronds},
+		{&g_scaevola_shrub, 0},
+		{&g_pemphis_shrub, 0},
+		{&g_tournefortia_trunk, &g_tournefortia_shrub},
+		{&g_ironwood_trunk, &g_ironwood_branches}};
+	int flags[6][2] = {
+		{0, 0},
+		{PLANT_PART_TRUNK, PLANT_PART_TWO_SIDED},
+		{PLANT_PART_TWO_SIDED, 0},
+		{PLANT_PART_TWO_SIDED, 0},
+		{PLANT_PART_TRUNK, PLANT_PART_TWO_SIDED},
+		{PLANT_PART_TRUNK, PLANT_PART_TWO_SIDED}};
+	int i;
+	int j;
+	int c;
+
+	memcpy(p_grid->detail_parts, parts, sizeof(parts));
+	memcpy(p_grid->detail_part_flags, flags, sizeof(flags));
+
+	glGenBuffers(1, &(p_grid->detail_vbo));
+	glBindBuffer(GL_ARRAY_BUFFER, p_grid->detail_vbo);
+	for(i = 0; i < 6; i++)
+	{
+		for(j = 0; j < 2; j++)
+		{
+			if(parts[i][j] == 0)
+				continue;
+			glBindVertexArray(parts[i][j]->vao);
+			for(c = 0; c < 4; c++) //a mat4 attribute is 4 vec4 columns
+			{
+				glEnableVertexAttribArray(3 + c);
+				glVertexAttribPointer((3 + c), 4, GL_FLOAT, GL_FALSE, 16*sizeof(float), (GLvoid*)(c*4*sizeof(float)));
+				glVertexAttribDivisor((3 + c), 1);
+			}
+		}
+	}
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+/*
+InitPlantCullBounds
+Finds a bounding sphere for each plant type that holds its detailed
+model(s) at any y rotation and its camera-facing billboard. Call it
+after InitPlantDetailParts() and loading the billboard sizes.
+*/
+void InitPlantCullBounds(struct plant_grid * p_grid)
+{
+	struct plant_billboard * (*models)[2] = p_grid->detail_parts;
+	float bounds[3];
+	float * size;
+	float billboard_radius;
+	float center_y;
+	float radius;
+	int i;
+	int j;
+
+	p_grid->cull_max_radius = 0.0f;
+	p_grid->cull_max_top = 0.0f;
+	for(i = 0; i < 6; i++)
+	{
+		bounds[0] = FLT_MAX;
+		bounds[1] = -FLT_MAX;
+		bounds[2] = 0.0f;
+		for(j = 0; j < 2; j++)
+		{
+			if(models[i][j] != 0 && models[i][j]->p_vertex_data != 0)
+				ocGrowAxisBounds(models[i][j]->p_vertex_data, models[i][j]->num_verts, 8, bounds);
+		}
+		ocAxisBoundsToSphere(bounds, &center_y, &radius);
+
+		//the billboard is moved off the plant's pos in camera space by up to its height
+		//and half its width, which can point any way in world space.
+		size = g_bush_smallbillboard.size + (i*2);
+		billboard_radius = sqrtf((size[1]*size[1]) + (0.25f*size[0]*size[0]));
+		if((fabsf(center_y) + billboard_radius) > radius)
+			radius = fabsf(center_y) + billboard_radius;
+
+		p_grid->cull_center_y[i] = center_y;
+		p_grid->cull_radius[i] = radius;
+		if(radius > p_grid->cull_max_radius)
+			p_grid->cull_max_radius = radius;
+		if((center_y + radius) > p_grid->cull_max_top)
+			p_grid->cull_max_top = center_y + radius;
+	}
+}
+
+/*
+UpdatePlantTileCullSpheres
+Rebuilds the culling spheres of a tile from its plants array and marks
+its static billboards for a rebuild. Call it whenever the plants array
+changes.
+returns 1 on success, 0 on failure
+*/
+int UpdatePlantTileCullSpheres(struct plant_grid * p_grid, struct plant_tile * p_tile)
+{
+	float center[3];
+	float max_dist;
+	int t;
+	int i;
+	int r;
+
+	p_tile->billboard_dirty = 1;
+	ocSpheresClear(&(p_tile->cull_spheres));
+	for(i = 0; i < p_tile->num_plants; i++)
+	{
+		t = (int)p_tile->plants[i].plant_type;
+		if(t < 0 || t > 5)
+		{
+			printf("%s: error. unknown plant_type=%d plant index=%d\n", __func__, t, i);
+			return 0;
+		}
+
+		//plants in the detail box are drawn no matter their nodraw_dist
+		max_dist = p_grid->nodraw_dist[t];
+		if(p_grid->detail_dist > max_dist)
+			max_dist = p_grid->detail_dist;
+
+		center[0] = p_tile->plants[i].pos[0];
+		center[1] = p_tile->plants[i].pos[1] + p_grid->cull_center_y[t];
+		center[2] = p_tile->plants[i].pos[2];
+		r = ocSpheresAdd(&(p_tile->cull_spheres), center, p_grid->cull_radius[t], max_dist, t);
+		if(r == 0)
+			return 0;
+	}
+	return 1;
+}
+
+/*
+UpdateVisiblePlants
+Picks the plant tiles to draw: the draw_grid tiles and the tiles in the
+plant view box whose terrain is in the camera frustum and whose plants
+aren't all hidden behind nearer terrain. Then culls every plant in them
+against the frustum and its type's draw distance, which leaves each
+tile's visible list with the plants to draw.
+-call after UpdatePlantDrawGrid() and UpdateTerrainOcclusion()
+*/
+void UpdateVisiblePlants(struct plant_grid * p_grid, float * camera_pos)
+{
+	struct plant_tile * p_tile=0;
+	struct lvl_1_tile * pterrain=0;
+	float box_min[3];
+	float box_max[3];
+	int is_near_tile;
+	int i_visible;
+	int i;
+	int k;
+	int r;
+
+	p_grid->num_cull_tiles = 0;
+	p_grid->num_cull_tests = 0;
+	p_grid->num_cull_visible = 0;
+	p_grid->num_occlusion_tests = 0;
+	p_grid->num_occluded_tiles = 0;
+
+	//tiles around the camera are always checked, since tall plants can stick up into
+	//the frustum even when the terrain under them is outside it.
+	for(k = 0; k < 9; k++)
+	{
+		i = p_grid->draw_grid[k];
+		if(i == -1 || p_grid->p_tiles[i].num_plants == 0)
+			continue;
+		p_grid->cull_tiles[p_grid->num_cull_tiles] = i;
+		p_grid->num_cull_tiles += 1;
+	}
+	p_grid->num_near_cull_tiles = p_grid->num_cull_tiles;
+
+	//plant tiles line up with terrain tiles, so use the terrain tiles that are in the camera frustum
+	for(i_visible = 0; i_visible < g_terrain_quadtree.num_visible; i_visible++)
+	{
+		i = g_terrain_quadtree.visible[i_visible];
+		if(p_grid->p_tiles[i].num_plants == 0)
+			continue;
+
+		r = IsTileInPlantViewBox(&(g_big_terrain.pTiles[i]), camera_pos);
+		if(r == 0)
+			continue;
+
+		is_near_tile = 0;
+		for(k = 0; k < p_grid->num_near_cull_tiles; k++)
+		{
+			if(i == p_grid->cull_tiles[k])
+				is_near_tile = 1;
+		}
+		if(is_near_tile == 1)
+			continue;
+
+		//the terrain tile's box grown by the largest plant
+		pterrain = &(g_big_terrain.pTiles[i]);
+		box_min[0] = pterrain->urcorner[0] - p_grid->cull_max_radius;
+		box_min[1] = pterrain->min_height;
+		box_min[2] = pterrain->urcorner[1] - p_grid->cull_max_radius;
+		box_max[0] = pterrain->urcorner[0] + g_big_terrain.tile_len[0] + p_grid->cull_max_radius;
+		box_max[1] = pterrain->max_height + p_grid->cull_max_top;
+		box_max[2] = pterrain->urcorner[1] + g_big_terrain.tile_len[1] + p_grid->cull_max_radius;
+		p_grid->num_occlusion_tests += 1;
+		r = IsTerrainBoxOccluded(box_min, box_max);
+		if(r == 1)
+		{
+			p_grid->num_occluded_tiles += 1;
+			continue;
+		}
+
+		p_grid->cull_tiles[p_grid->num_cull_tiles] = i;
+		p_grid->num_cull_tiles += 1;
+	}
+
+	for(k = 0; k < p_grid->num_cull_tiles; k++)
+	{
+		p_tile = p_grid->p_tiles + p_grid->cull_tiles[k];
+		r = ocCullSpheres(g_camera_frustum.planes, camera_pos, &(p_tile->cull_spheres), &(p_tile->visible));
+		if(r == 0)
+			continue;
+		p_grid->num_cull_tests += p_tile->visible.num_tests;
+		p_grid->num_cull_visible += p_tile->visible.num_visible;
+	}
+}
+
+/*
+UpdatePlantDrawLists
+Sorts the plants that passed UpdateVisiblePlants() into the draw lists.
+Plants in the detail box get a model matrix in detail_mats, grouped by
+plant type, for one instanced draw per model part. The rest are drawn as
+billboards. A tile that is wholly outside the
+detail box and wholly inside a plant type's draw distance draws every
+plant of the type from its static billboard_vbo, and the GPU clips the
+ones off screen. The visible plants of other tiles are gathered into
+billboard_pos, grouped by plant type, for one instanced draw per type.
+-call after UpdateVisiblePlants()
+returns 1 on success, 0 on failure (then no billboards are drawn)
+*/
+int UpdatePlantDrawLists(struct plant_grid * p_grid)
+{
+	struct plant_tile * p_tile=0;
+	float * new_pos=0;
+	float * p_boundary;
+	float * v3;
+	float * m;
+	int * p_ids;
+	int is_outside_detail;
+	int num;
+	int num_detail;
+	int t;
+	int j;
+	int k;
+
+	memset(p_grid->billboard_num, 0, 6*sizeof(int));
+	memset(p_grid->billboard_first, 0, 6*sizeof(int));
+	memset(p_grid->detail_num, 0, 6*sizeof(int));
+	memset(p_grid->detail_first, 0, 6*sizeof(int));
+	p_grid->num_near_billboards = 0;
+	p_grid->num_static_billboards = 0;
 
-			if(num_plants == 0)
-			{
-				p_tile->plants = 0;
+	//every plant that passed might be a billboard, or a detailed plant
+	if(p_grid->max_billboards < p_grid->num_cull_visible)
+	{
+		new_pos = (float*)realloc(p_grid->billboard_pos, p_grid->num_cull_visible*3*sizeof(float));
+		if(new_pos == 0)
+		{
+			printf("%s: error. realloc fail for %d plants.\n", __func__, p_grid->num_cull_visible);
+			return 0;
+		}
+		p_grid->billboard_pos = new_pos;
+		p_grid->max_billboards = p_grid->num_cull_visible;
+	}
+	if(p_grid->max_detail_plants < p_grid->num_cull_visible)
+	{
+		new_pos = (float*)realloc(p_grid->detail_mats, p_grid->num_cull_visible*16*sizeof(float));
+		if(new_pos == 0)
+		{
+			printf("%s: error. realloc fail for %d plant matrices.\n", __func__, p_grid->num_cull_visible);
+			return 0;
+		}
+		p_grid->detail_mats = new_pos;
+		p_grid->max_detail_plants = p_grid->num_cull_visible;
+	}
+
+	num = 0;
+	num_detail = 0;
+	for(t = 0; t < 6; t++)
+	{
+		p_grid->billboard_first[t] = num;
+		p_grid->detail_first[t] = num_detail;
+		p_boundary = p_grid->nodraw_boundaries + (t*4);
+		for(k = 0; k < p_grid->num_cull_tiles; k++)
+		{
+			p_tile = p_grid->p_tiles + p_grid->cull_tiles[k];
+			if(p_tile->visible.num[t] == 0)
 				continue;
-			}
-		
-			p_tile->plants = (struct plant_info_struct*)malloc(num_plants*sizeof(struct plant_info_struct));
-			if(p_tile->plants == 0)
+
+			is_outside_detail = (p_tile->urcorner[0] >= p_grid->detail_boundaries[1]
+				|| (p_tile->urcorner[0] + g_big_terrain.tile_len[0]) <= p_grid->detail_boundaries[0]
+				|| p_tile->urcorner[1] >= p_grid->detail_boundaries[3]
+				|| (p_tile->urcorner[1] + g_big_terrain.tile_len[1]) <= p_grid->detail_boundaries[2]);
+			if(is_outside_detail == 1
+				&& p_tile->urcorner[0] >= p_boundary[0]
+				&& (p_tile->urcorner[0] + g_big_terrain.tile_len[0]) <= p_boundary[1]
+				&& p_tile->urcorner[1] >= p_boundary[2]
+				&& (p_tile->urcorner[1] + g_big_terrain.tile_len[1]) <= p_boundary[3])
 			{
-				printf("%s: malloc file on tile (%d,%d)\n", __func__, i, j);
-				return -1;
+				p_grid->static_billboards[(p_grid->num_static_billboards*2)] = p_grid->cull_tiles[k];
+				p_grid->static_billboards[(p_grid->num_static_billboards*2)+1] = t;
+				p_grid->num_static_billboards += 1;
+				if(k < p_grid->num_near_cull_tiles) //draw_grid tiles come first
+					p_grid->num_near_billboards += p_tile->cull_spheres.type_count[t];
+				continue;
 			}
-			memset(p_tile->plants, 0, num_plants*sizeof(struct plant_info_struct));
 
-			//now loop through the temp_plants_pos_array but organize the different plant types together.
-			//so loop through the plants array looking for a plant type each iteration.
-			i_newPlant = 0;
-			for(i_type = 0; i_type < 6; i_type++) //there are 6 plant types
+			p_ids = p_tile->visible.ids + p_tile->visible.first[t];
+			for(j = 0; j < p_tile->visible.num[t]; j++)
 			{
-				for(k = 0; k < num_plants; k++)
+				v3 = p_tile->plants[p_ids[j]].pos;
+
+				//plants close to the camera are drawn with their models
+				if(v3[0] > p_grid->detail_boundaries[0]
+					&& v3[0] < p_grid->detail_boundaries[1]
+					&& v3[2] > p_grid->detail_boundaries[2]
+					&& v3[2] < p_grid->detail_boundaries[3])
 				{
-					if(temp_plants_type_array[k] == i_type) //if this is the plant type we are looking for copy it
-					{
-						p_tile->plants[i_newPlant].pos[0] = temp_plants_pos_array[(k*3)];
-						p_tile->plants[i_newPlant].pos[1] = temp_plants_pos_array[(k*3)+1];
-						p_tile->plants[i_newPlant].pos[2] = temp_plants_pos_array[(k*3)+2];
-						p_tile->plants[i_newPlant].plant_type = temp_plants_type_array[k];
-						p_tile->plants[i_newPlant].yrot = 360.0f * RandomFloat();
-						i_newPlant += 1;
-					}
+					m = p_grid->detail_mats + (num_detail*16);
+					mmRotateAboutY(m, p_tile->plants[p_ids[j]].yrot);
+					m[12] = v3[0];
+					m[13] = v3[1];
+					m[14] = v3[2];
+					num_detail += 1;
+					continue;
 				}
-			}
-			//check that i_newPlant matches the # of plants allocated for
-			if(i_newPlant != num_plants)
-			{
-				printf("%s: error. plant allocated mismatch i_newPlant=%d num_plants=%d\n", __func__, i_newPlant, num_plants);
-				return 0;
+
+				p_grid->billboard_pos[(num*3)] = v3[0];
+				p_grid->billboard_pos[(num*3)+1] = v3[1];
+				p_grid->billboard_pos[(num*3)+2] = v3[2];
+				num += 1;
+				if(k < p_grid->num_near_cull_tiles)
+					p_grid->num_near_billboards += 1;
 			}
 		}
+		p_grid->billboard_num[t] = num - p_grid->billboard_first[t];
+		p_grid->detail_num[t] = num_detail - p_grid->detail_first[t];
 	}
-
-	free(temp_plants_pos_array);
-	return 0;
+	return 1;
 }
 
 /*
-This function fills in the draw_grid for plant tiles.
+UpdatePlantTileBillboardVbo
+Fills a plant tile's static billboard instances from its plants array,
+grouped by plant type. Only does work if the tile is marked dirty, which
+happens when its plants change (see UpdatePlantTileCullSpheres).
+returns 1 on success, 0 on failure
 */
-void UpdatePlantDrawGrid(struct plant_grid * p_grid, int cam_tile, float * camera_pos)
+int UpdatePlantTileBillboardVbo(struct plant_tile * p_tile)
 {
-	float * p_boundary=0;
+	float * pos;
+	int next[6];
+	int t;
 	int i;
-	const float detail_dist = 200.0f; 
-	
-	//setup camera boundaries
-	p_grid->detail_boundaries[0] = camera_pos[0] - detail_dist;//-x
-	p_grid->detail_boundaries[1] = camera_pos[0] + detail_dist;//+x
-	p_grid->detail_boundaries[2] = camera_pos[2] - detail_dist;//-z
-	p_grid->detail_boundaries[3] = camera_pos[2] + detail_dist;//+z
 
-	//setup plant no draw boundaries
-	for(i = 0; i < 6; i++)
+	if(p_tile->billboard_dirty == 0)
+		return 1;
+
+	pos = (float*)malloc((p_tile->num_plants + 1)*3*sizeof(float));
+	if(pos == 0)
 	{
-		p_boundary = p_grid->nodraw_boundaries + (i*4);
-		p_boundary[0] = camera_pos[0] - p_grid->nodraw_dist[i]; //-x
-		p_boundary[1] = camera_pos[0] + p_grid->nodraw_dist[i]; //+x
-		p_boundary[2] = camera_pos[2] - p_grid->nodraw_dist[i]; //-z
-		p_boundary[3] = camera_pos[2] + p_grid->nodraw_dist[i]; //+z
+		printf("%s: error. malloc fail for %d plants.\n", __func__, p_tile->num_plants);
+		return 0;
 	}
-	
-	p_grid->draw_grid[4] = cam_tile;
-	
-	//if the cam_tile came back invalid (-1) 
-	//then clear the draw_grid
-	if(cam_tile == -1)
+	next[0] = 0;
+	for(t = 0; t < 6; t++)
 	{
-		for(i = 0; i < 9; i++)
-		{
-			p_grid->draw_grid[i] = -1;
-		}
+		p_tile->billboard_first[t] = next[t];
+		if(t < 5)
+			next[(t+1)] = next[t] + p_tile->cull_spheres.type_count[t];
 	}
-	
-	p_grid->draw_grid[0] = cam_tile - 39 - 1;
-	p_grid->draw_grid[1] = cam_tile - 39;
-	p_grid->draw_grid[2] = cam_tile - 39 + 1;
-	p_grid->draw_grid[3] = cam_tile - 1;
-	p_grid->draw_grid[5] = cam_tile + 1;
-	p_grid->draw_grid[6] = cam_tile + 39 - 1;
-	p_grid->draw_grid[7] = cam_tile + 39;
-	p_grid->draw_grid[8] = cam_tile + 39 + 1;
-	
-	//now check for tiles that are out of range
-	for(i = 0; i < 9; i++)
+	for(i = 0; i < p_tile->num_plants; i++)
 	{
-		if((p_grid->draw_grid[i] < 0) || (p_grid->draw_grid[i] > 1521))
-			p_grid->draw_grid[i] = -1;
+		t = (int)p_tile->plants[i].plant_type;
+		if(t < 0 || t > 5) //UpdatePlantTileCullSpheres() already printed an error
+			continue;
+		memcpy((pos + (next[t]*3)), p_tile->plants[i].pos, 3*sizeof(float));
+		next[t] += 1;
+	}
+
+	if(g_gl_record != 0)
+	{
+		g_gl_record->num_uploads += 1;
+	}
+	else
+	{
+		if(p_tile->billboard_vbo == 0)
+			glGenBuffers(1, &(p_tile->billboard_vbo));
+		glBindBuffer(GL_ARRAY_BUFFER, p_tile->billboard_vbo);
+		glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)(p_tile->num_plants*3*sizeof(float)), pos, GL_STATIC_DRAW);
 	}
+	free(pos);
+	p_tile->billboard_dirty = 0;
+	return 1;
 }
 
 void UpdateTerrainDrawBox(float * camera_pos)
@@ -6332,9 +11012,9 @@ int IsTileInTerrainDrawBox(struct lvl_1_tile * tile)
 	float pos[3];
 
 	//calculate center of tile
-	pos[0] = tile->urcorner[0] + 495.0f; //990/2
+	pos[0] = tile->urcorner[0] + (g_big_terrain.tile_len[0]*0.5f);
 	pos[1] = 0.0f;
-	pos[2] = tile->urcorner[1] + 495.0f; //990/2
+	pos[2] = tile->urcorner[1] + (g_big_terrain.tile_len[1]*0.5f);
 
 	if(pos[0] < g_big_terrain.nodraw_boundaries[1] //+x
 			&& pos[0] > g_big_terrain.nodraw_boundaries[0] //-x
@@ -6348,14 +11028,14 @@ int IsTileInTerrainDrawBox(struct lvl_1_tile * tile)
 
 int MakeSimpleWaveVBO(struct simple_wave_vbo_struct * p_wave)
 {
-	//The y coord is the water level which is set to 0.0
+	//The y coord is the water level
 	float init_vertex_data[] = { 
-		-10000.0f, 0.0f,  10000.0f,
-		 10000.0f, 0.0f,  10000.0f,
-		 10000.0f, 0.0f, -10000.0f,
-		-10000.0f, 0.0f,  10000.0f,
-		 10000.0f, 0.0f, -10000.0f,
-		-10000.0f, 0.0f, -10000.0f
+		-WATER_PLANE_HALF_LEN, WATER_LEVEL,  WATER_PLANE_HALF_LEN,
+		 WATER_PLANE_HALF_LEN, WATER_LEVEL,  WATER_PLANE_HALF_LEN,
+		 WATER_PLANE_HALF_LEN, WATER_LEVEL, -WATER_PLANE_HALF_LEN,
+		-WATER_PLANE_HALF_LEN, WATER_LEVEL,  WATER_PLANE_HALF_LEN,
+		 WATER_PLANE_HALF_LEN, WATER_LEVEL, -WATER_PLANE_HALF_LEN,
+		-WATER_PLANE_HALF_LEN, WATER_LEVEL, -WATER_PLANE_HALF_LEN
 	};
 	
 	p_wave->num_verts = 6;
@@ -6388,10 +11068,11 @@ int MakeSimpleWaveVBO(struct simple_wave_vbo_struct * p_wave)
 
 /*
 This function is a placeholder for where the simulation code will be, where the physics
-code will be.
+code will be. Runs on the simulation thread, see SimulationThread().
 */
 void SimulationStep(void)
 {
+	struct terrain_ray_struct wheelRays[4];
 	int i;
 
 	UpdateSoldierAI(&g_ai_soldier);
@@ -6404,7 +11085,8 @@ void SimulationStep(void)
 		UpdateCharacterSimulation(g_soldier_list.ptrsToCharacters[i]);
 	}
 
-	UpdateVehicleSimulation2(&g_b_vehicle);
+	UpdateVehicleWheelRays2(&g_b_vehicle, 1, wheelRays);
+	UpdateVehicleSimulation2(&g_b_vehicle, wheelRays);
 
 	//update the camera based on the local player
 	UpdateCameraForCharacter(g_camera_pos,	//inverse camera pos, 
@@ -6425,6 +11107,224 @@ void SimulationStep(void)
 	//printf("***\n");
 }
 
+/*
+PublishRenderSnapshot
+Copies what drawing needs out of the simulation into the back slot of
+g_render_snapshots and publishes it: the camera and its rotation, the
+vehicle's and wheels' transforms and the soldiers to draw. Called on the
+simulation thread with g_world_lock held (or before it starts).
+-only_if_changed: 1 to not publish a snapshot that is the same as the last one
+returns 1 if it was published, 0 if not
+*/
+int PublishRenderSnapshot(int only_if_changed)
+{
+	int size;
+	struct render_snapshot_struct * snap;
+	float mRotateCameraMat_X[16];
+	float mRotateCameraMat_Y[16];
+	float mModelMatrix[16];
+	float mTranslateModelMatrix[16];
+	float mRotateModelMatrix_Y[16];
+	float mRotateModelMatrix[16];
+	int i;
+
+	snap = (struct render_snapshot_struct*)tbGetBack(&g_render_snapshots);
+	snap->step = g_simulation_step;
+	snap->input_serial = g_view_input.serial;
+	memcpy(snap->camera_pos, g_camera_pos, sizeof(float)*3);
+	memcpy(snap->ws_camera_pos, g_ws_camera_pos, sizeof(float)*3);
+	memcpy(snap->player_pos, g_a_man.pos, sizeof(float)*3);
+
+	//update the camera rotation for vehicle if needed
+	if(g_keyboard_state.state == KEYBOARD_MODE_TRUCK && g_camera_state.playerCameraMode == PLAYERCAMERA_VEHICLE)
+	{
+		UpdateCharacterCameraForVehicle(&g_a_man, snap->mRotateCameraMatrix);
+	}
+	else
+	{
+		mmRotateAboutY(mRotateCameraMat_Y, g_camera_rotY);
+		mmRotateAboutX(mRotateCameraMat_X, g_camera_rotX);
+		mmMultiplyMatrix4x4(mRotateCameraMat_X, mRotateCameraMat_Y, snap->mRotateCameraMatrix);
+	}
+
+	//vehicle b, the characters in it are drawn relative to this too
+	VehicleConvertDisplacementMat3To4(g_b_vehicle.orientation, mRotateModelMatrix);
+	mmTranslateMatrix(mTranslateModelMatrix, g_b_vehicle.cg[0], g_b_vehicle.cg[1], g_b_vehicle.cg[2]);
+	mmMultiplyMatrix4x4(mTranslateModelMatrix, mRotateModelMatrix, snap->mVehicleMatrix);
+	for(i = 0; i < 4; i++)
+	{
+		mmRotateAboutXRad(mRotateModelMatrix, g_b_vehicle.wheelOrientation_X);
+		mmTranslateMatrix(mTranslateModelMatrix, g_b_vehicle.wheels[i].connectPos[0], (g_b_vehicle.wheels[i].connectPos[1]-g_b_vehicle.wheels[i].x+0.5f), g_b_vehicle.wheels[i].connectPos[2]); //adjust y pos pased on wheel displacement x
+
+		//add yaw for front wheels
+		if(i == 0 || i == 1) //front wheels
+		{
+			mmRotateAboutYRad(mRotateModelMatrix_Y, g_b_vehicle.steeringAngle);
+			mmMultiplyMatrix4x4(mRotateModelMatrix_Y, mRotateModelMatrix, mRotateModelMatrix);
+		}
+
+		//start on the right-side: R = (Car_Mat) * (wheel_pos_mat) * (wheel_rot_mat)
+		mmMultiplyMatrix4x4(mTranslateModelMatrix, mRotateModelMatrix, mModelMatrix);
+		mmMultiplyMatrix4x4(snap->mVehicleMatrix, mModelMatrix, snap->mWheelMatrices[i]);
+	}
+
+	snap->num_characters = 0;
+	for(i = 0; i < g_soldier_list.num_soldiers; i++)
+	{
+		//don't draw the local player when in the player keyboard state
+		if(g_soldier_list.ptrsToCharacters[i] == &g_a_man 
+				&& g_keyboard_state.state == KEYBOARD_MODE_PLAYER 
+				&& g_camera_state.playerCameraMode == PLAYERCAMERA_FP)
+			continue;
+		memcpy(&(snap->characters[snap->num_characters]), g_soldier_list.ptrsToCharacters[i], sizeof(struct character_struct));
+		snap->num_characters += 1;
+	}
+
+	size = (int)((char*)&(snap->characters[snap->num_characters]) - (char*)snap);
+	if(only_if_changed == 1 && memcmp(snap, &(g_sim_thread.last), size) == 0)
+		return 0;
+	memcpy(&(g_sim_thread.last), snap, size);
+	tbPublish(&g_render_snapshots);
+	return 1;
+}
+
+/*
+CopyViewInput
+Copies the camera rotation into g_view_input after the main thread
+handled input. Call with g_world_lock held.
+*/
+void CopyViewInput(void)
+{
+	g_view_input.serial += 1;
+	g_view_input.rotX = g_camera_rotX;
+	g_view_input.rotY = g_camera_rotY;
+	g_view_input.vehicle_camera = (g_keyboard_state.state == KEYBOARD_MODE_TRUCK && g_camera_state.playerCameraMode == PLAYERCAMERA_VEHICLE);
+}
+
+/*
+WakeSimulationThread
+Has a paused simulation thread publish a snapshot, after input that may
+have moved the camera or unpaused the simulation. Call with
+g_world_lock held.
+*/
+void WakeSimulationThread(void)
+{
+	g_sim_thread.wake = 1;
+	pthread_cond_signal(&(g_sim_thread.wake_cond));
+}
+
+/*
+SimulationThread
+Steps the simulation every SIM_STEP_NS and publishes a render snapshot
+after each step. While the simulation is paused it sleeps until
+WakeSimulationThread(), then publishes if something changed (so the
+camera still moves) and sleeps again. Steps are timed from when the
+first one was due, not from when the last one finished, so the rate
+holds however long drawing takes.
+*/
+void * SimulationThread(void * arg)
+{
+	struct sim_thread_struct * sim = (struct sim_thread_struct*)arg;
+	struct timespec next;
+	struct timespec now;
+	long long next_ns;
+	long long now_ns;
+	double period_ms;
+	int waited;
+	int paused;
+	int r;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	next_ns = (now.tv_sec*1000000000LL) + now.tv_nsec;
+	while(1)
+	{
+		pthread_mutex_lock(&g_world_lock);
+		waited = 0;
+		while(g_pause_simulation_step == 1 && sim->wake == 0 && sim->quit == 0)
+		{
+			pthread_cond_wait(&(sim->wake_cond), &g_world_lock);
+			waited = 1;
+		}
+		sim->wake = 0;
+		if(sim->quit == 1)
+		{
+			pthread_mutex_unlock(&g_world_lock);
+			break;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		now_ns = (now.tv_sec*1000000000LL) + now.tv_nsec;
+		if(waited == 1) //steps after unpausing are timed from now
+			next_ns = now_ns;
+		if(sim->num_steps > 0 && waited == 0)
+		{
+			period_ms = (now_ns - sim->last_ns)/1000000.0;
+			if(sim->min_period_ms == 0.0 || period_ms < sim->min_period_ms)
+				sim->min_period_ms = period_ms;
+			if(period_ms > sim->max_period_ms)
+				sim->max_period_ms = period_ms;
+		}
+		sim->last_ns = now_ns;
+		paused = g_pause_simulation_step;
+		if(paused == 0)
+			SimulationStep();
+		r = PublishRenderSnapshot(paused);
+		if(r == 0)
+			sim->num_unchanged += 1;
+		sim->num_steps += 1;
+		pthread_mutex_unlock(&g_world_lock);
+		if(paused == 1) //back to waiting for a wake
+			continue;
+
+		//wait for the next step, unless it is already due. Too far behind, start counting again from now.
+		next_ns += SIM_STEP_NS;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		now_ns = (now.tv_sec*1000000000LL) + now.tv_nsec;
+		if(now_ns - next_ns > SIM_MAX_LATE_STEPS*SIM_STEP_NS)
+		{
+			sim->num_dropped += (int)((now_ns - next_ns)/SIM_STEP_NS);
+			next_ns = now_ns;
+		}
+		next.tv_sec = (time_t)(next_ns/1000000000LL);
+		next.tv_nsec = (long)(next_ns%1000000000LL);
+		while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, 0) == EINTR);
+	}
+	return 0;
+}
+
+/*
+StartSimulationThread
+returns 1 on success, 0 on failure
+*/
+int StartSimulationThread(void)
+{
+	int r;
+
+	memset(&g_sim_thread, 0, sizeof(struct sim_thread_struct));
+	pthread_cond_init(&(g_sim_thread.wake_cond), 0);
+	r = pthread_create(&(g_sim_thread.thread), 0, SimulationThread, &g_sim_thread);
+	if(r != 0)
+	{
+		printf("StartSimulationThread: pthread_create failed (%d)\n", r);
+		pthread_cond_destroy(&(g_sim_thread.wake_cond));
+		return 0;
+	}
+	g_sim_thread.started = 1;
+	return 1;
+}
+
+void StopSimulationThread(void)
+{
+	if(g_sim_thread.started == 0)
+		return;
+	pthread_mutex_lock(&g_world_lock);
+	g_sim_thread.quit = 1;
+	pthread_cond_signal(&(g_sim_thread.wake_cond));
+	pthread_mutex_unlock(&g_world_lock);
+	pthread_join(g_sim_thread.thread, 0);
+	pthread_cond_destroy(&(g_sim_thread.wake_cond));
+	g_sim_thread.started = 0;
+}
+
 /*
 Updates the global debug stats based on time around the draw call
 */
@@ -6454,7 +11354,7 @@ void DebugUpdateDrawCallStats(struct timespec * diff, struct timespec * tdrawSta
 	{
 		g_debug_stats.max_drawcall_period.tv_sec = diff->tv_sec;
 		g_debug_stats.max_drawcall_period.tv_nsec = diff->tv_nsec;
-		g_debug_stats.step_at_max_drawcall = g_simulation_step;
+		g_debug_stats.step_at_max_drawcall = g_draw_snapshot->step;
 	}
 	
 	//check to see if the diff is the lowest drawcall period so far
@@ -6463,7 +11363,7 @@ void DebugUpdateDrawCallStats(struct timespec * diff, struct timespec * tdrawSta
 	{
 		g_debug_stats.min_drawcall_period.tv_sec = diff->tv_sec;
 		g_debug_stats.min_drawcall_period.tv_nsec = diff->tv_nsec;
-		g_debug_stats.step_at_min_drawcall = g_simulation_step;
+		g_debug_stats.step_at_min_drawcall = g_draw_snapshot->step;
 	}
 
 	//check to see if the draw duration is the greatest seen
@@ -6472,7 +11372,7 @@ void DebugUpdateDrawCallStats(struct timespec * diff, struct timespec * tdrawSta
    {
 	   g_debug_stats.max_drawcall_duration.tv_sec = tdrawDuration.tv_sec;
 	   g_debug_stats.max_drawcall_duration.tv_nsec = tdrawDuration.tv_nsec;
-	   g_debug_stats.step_atMaxDrawDuration = g_simulation_step;
+	   g_debug_stats.step_atMaxDrawDuration = g_draw_snapshot->step;
    }
 
 	//check to see if the draw duration is the smallest seen
@@ -6481,7 +11381,7 @@ void DebugUpdateDrawCallStats(struct timespec * diff, struct timespec * tdrawSta
    {
 	   g_debug_stats.min_drawcall_duration.tv_sec = tdrawDuration.tv_sec;
 	   g_debug_stats.min_drawcall_duration.tv_nsec = tdrawDuration.tv_nsec;
-	   g_debug_stats.step_atMinDrawDuration = g_simulation_step;
+	   g_debug_stats.step_atMinDrawDuration = g_draw_snapshot->step;
    }
 
 }
@@ -6737,6 +11637,10 @@ int InitCharacterPerson(struct character_struct * p_character, float * newPos)
 	//common character information
 	p_character->p_common = &g_triangle_man;
 
+	r = InitCharacterSkin(p_character);
+	if(r == 0)
+		return 0;
+
 	r = InitPlayerInventory(p_character);
 	if(r == 0)
 		return 0;
@@ -6783,6 +11687,76 @@ int InitCharacterPerson(struct character_struct * p_character, float * newPos)
 Updates the character model VBO using the bones
 */
 void UpdateCharacterBoneModel(struct character_struct * guy)
+{
+	struct character_model_struct * character=0;
+
+	character = guy->p_common;
+	SkinCharacterVerts(guy, character->new_vert_data);
+	glBindBuffer(GL_ARRAY_BUFFER, character->vbo); //there are 2 vbos, select one.
+	glBufferSubData(GL_ARRAY_BUFFER,
+			0, //offset
+			(character->num_verts*8*sizeof(float)),
+			character->new_vert_data);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+/*
+InitCharacterSkin
+Allocates the character's skinned_verts, starting as a copy of the
+model's verts, and skinned_bones. They are only written by
+SkinCharacterModel() and stay the same buffers for the character's life,
+so copies of the character (see PublishRenderSnapshot) share them.
+returns 1 on success, 0 on failure
+*/
+int InitCharacterSkin(struct character_struct * guy)
+{
+	struct character_model_struct * character=0;
+
+	character = guy->p_common;
+	guy->skinned_verts = (float*)malloc(character->num_verts*8*sizeof(float));
+	guy->skinned_bones = (float*)malloc(character->testBones.num_bones*16*sizeof(float));
+	if(guy->skinned_verts == 0 || guy->skinned_bones == 0)
+	{
+		printf("%s: error. malloc fail for %d verts and %d bones.\n", __func__, character->num_verts, character->testBones.num_bones);
+		free(guy->skinned_verts);
+		free(guy->skinned_bones);
+		guy->skinned_verts = 0;
+		guy->skinned_bones = 0;
+		return 0;
+	}
+	memcpy(guy->skinned_verts, character->new_vert_data, (character->num_verts*8*sizeof(float)));
+	memcpy(guy->skinned_bones, character->testBones.temp_bone_mat_array, (character->testBones.num_bones*16*sizeof(float)));
+	return 1;
+}
+
+/*
+SkinCharacterModel
+Poses the character's verts into its skinned_verts and keeps the bone
+transforms in skinned_bones for CharacterCalculateHandTransform(). No GL
+calls, so it can run on a worker thread, but not at the same time as
+another character with the same common model (see SkinCharacterVerts).
+returns 1 on success, 0 if InitCharacterSkin() failed
+*/
+int SkinCharacterModel(struct character_struct * guy)
+{
+	struct character_model_struct * character=0;
+
+	character = guy->p_common;
+	if(guy->skinned_verts == 0 || guy->skinned_bones == 0)
+		return 0;
+	SkinCharacterVerts(guy, guy->skinned_verts);
+	memcpy(guy->skinned_bones, character->testBones.temp_bone_mat_array, (character->testBones.num_bones*16*sizeof(float)));
+	return 1;
+}
+
+/*
+SkinCharacterVerts
+Poses the character's verts with its current animation and writes their
+positions to out_verts (8 floats per vert, the normals and uvs are left
+as they are). The bone transforms are worked out in the common model's
+scratch arrays.
+*/
+void SkinCharacterVerts(struct character_struct * guy, float * out_verts)
 {
 	struct character_model_struct * character=0;
 	struct dae_animation_struct * anim=0;
@@ -6918,17 +11892,10 @@ void UpdateCharacterBoneModel(struct character_struct * guy)
 			sum_vec[2] += new_vec[2];
 		}
 
-		character->new_vert_data[(i*8)] = sum_vec[0];
-		character->new_vert_data[(i*8)+1] = sum_vec[1];
-		character->new_vert_data[(i*8)+2] = sum_vec[2];
+		out_verts[(i*8)] = sum_vec[0];
+		out_verts[(i*8)+1] = sum_vec[1];
+		out_verts[(i*8)+2] = sum_vec[2];
 	}
-
-	glBindBuffer(GL_ARRAY_BUFFER, character->vbo); //there are 2 vbos, select one.
-	glBufferSubData(GL_ARRAY_BUFFER,
-			0, //offset
-			(character->num_verts*8*sizeof(float)),
-			character->new_vert_data);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
 /*
@@ -7894,7 +12861,7 @@ void UpdateLocalPlayerDirection(void)
 int InitCharacterList(struct character_list_struct * plist)
 {
 	plist->num_soldiers = 0;
-	plist->max_soldiers = 32;
+	plist->max_soldiers = RENDER_SNAPSHOT_MAX_CHARACTERS;
 	plist->ptrsToCharacters = (struct character_struct **)malloc(plist->max_soldiers * sizeof(struct character_struct*));
 	if(plist->ptrsToCharacters == 0)
 	{
@@ -8196,17 +13163,17 @@ int WritePlantGridToFile(struct plant_grid * p_grid, char * filename)
 IsTileInPlantViewBox() returns 1 if the center of the terrain tile is within
 a viewing box around the camera
 */
-int IsTileInPlantViewBox(struct lvl_1_tile * p_tile)
+int IsTileInPlantViewBox(struct lvl_1_tile * p_tile, float * camera_pos)
 {
 	float center_pos[2];
 	//float fboxSize = 10000.0f;
 	float fboxSize = 1000.0f;
 
-	center_pos[0] = p_tile->urcorner[0] + 495.0f;	//495 = 990/2, side of tile / 2
-	center_pos[1] = p_tile->urcorner[1] + 495.0f;
+	center_pos[0] = p_tile->urcorner[0] + (g_big_terrain.tile_len[0]*0.5f);	//side of tile / 2
+	center_pos[1] = p_tile->urcorner[1] + (g_big_terrain.tile_len[1]*0.5f);
 
-	center_pos[0] -= g_ws_camera_pos[0];
-	center_pos[1] -= g_ws_camera_pos[2];
+	center_pos[0] -= camera_pos[0];
+	center_pos[1] -= camera_pos[2];
 
 	if(center_pos[0] < fboxSize 
 			&& center_pos[0] > (-1.0f*fboxSize)
@@ -8527,6 +13494,7 @@ int InitItemCommon(struct item_common_struct * p_common, char * obj_filename, ch
 {
 	struct bush_model_struct temp_model = {0}; //borrow the bush file structure just to load a simple mesh.
 	image_t tgaFile;
+	float bounds[3];
 	int powerOfTwo;
 	int r;
 
@@ -8541,6 +13509,13 @@ int InitItemCommon(struct item_common_struct * p_common, char * obj_filename, ch
 	p_common->y_AboveGroundOffset *= -1.0f;
 	//p_common->y_AboveGroundOffset += 0.05f;
 
+	//bounding sphere for culling items on the ground, which are drawn without rotation
+	bounds[0] = FLT_MAX;
+	bounds[1] = -FLT_MAX;
+	bounds[2] = 0.0f;
+	ocGrowAxisBounds(temp_model.p_leaf_vertex_data, temp_model.num_leaf_verts, 8, bounds);
+	ocAxisBoundsToSphere(bounds, &(p_common->cull_center_y), &(p_common->cull_radius));
+
 	//setup the VBO
 	glGenBuffers(1, &(p_common->vbo));
 	glBindBuffer(GL_ARRAY_BUFFER, p_common->vbo);
@@ -8762,10 +13737,55 @@ void CharacterCalculateHandTransform(struct character_struct * this_character, s
 	//mmMultiplyMatrix4x4((p_bones->temp_bone_mat_array+(p_item->handBoneIndex*16)), mat4, outMat4);
 
 	//TODO: Test transform
-	memcpy(outMat4, (p_bones->temp_bone_mat_array+(p_item->handBoneIndex*16)), 16*sizeof(float));
+	if(this_character->skinned_bones != 0) //this character's bones, see SkinCharacterModel()
+		memcpy(outMat4, (this_character->skinned_bones+(p_item->handBoneIndex*16)), 16*sizeof(float));
+	else
+		memcpy(outMat4, (p_bones->temp_bone_mat_array+(p_item->handBoneIndex*16)), 16*sizeof(float));
+}
+
+/*
+UpdateVehicleWheelRays2
+Casts the wheel rays of every vehicle in one RaycastTileSurfBatch() call.
+wheelRays gets 4 rays per vehicle, in wheel order, for
+UpdateVehicleSimulation2().
+returns the # of rays that needed RaycastTileSurf() (see RaycastTileSurfBatch)
+*/
+int UpdateVehicleWheelRays2(struct vehicle_physics_struct2 * vehicles, int num_vehicles, struct terrain_ray_struct * wheelRays)
+{
+	struct vehicle_physics_struct2 * pvehicle;
+	struct wheel_struct2 * pwheel;
+	struct terrain_ray_struct * pray;
+	int i, j;
+
+	for(i = 0; i < num_vehicles; i++)
+	{
+		pvehicle = vehicles + i;
+		for(j = 0; j < 4; j++)
+		{
+			pwheel = pvehicle->wheels + j;
+			pray = wheelRays + (i*4) + j;
+
+			//the ray starts at the connection point of the wheel in world coords
+			memcpy(pray->pos, pwheel->connectPos, (3*sizeof(float)));
+			mmTransformVec3(pvehicle->orientation, pray->pos);
+			vAdd(pray->pos, pray->pos, pvehicle->cg);
+
+			//and goes the length of the spring along the vehicle's down axis
+			pray->ray[0] = 0.0f;
+			pray->ray[1] = 0.0f-pwheel->max_x;
+			pray->ray[2] = 0.0f;
+			mmTransformVec3(pvehicle->orientation, pray->ray);
+			pray->quad_hint = pwheel->groundQuad;
+		}
+	}
+	return RaycastTileSurfBatch(wheelRays, (num_vehicles*4));
 }
 
-void UpdateVehicleSimulation2(struct vehicle_physics_struct2 * p_vehicle)
+/*
+wheelRays has the 4 wheel rays of the vehicle cast by
+UpdateVehicleWheelRays2().
+*/
+void UpdateVehicleSimulation2(struct vehicle_physics_struct2 * p_vehicle, struct terrain_ray_struct * wheelRays)
 {
 	float newLinearVel[3];	//new linear velocity
 	float wheelForce[3];
@@ -8793,6 +13813,7 @@ void UpdateVehicleSimulation2(struct vehicle_physics_struct2 * p_vehicle)
 	{
 		CalculateWheelSpringForce2((p_vehicle->wheels+i), 
 				p_vehicle, 
+				(wheelRays+i),
 				wheelForce,
 				wheelTorque);
 		vAdd(sumForces, sumForces, wheelForce);
@@ -8978,6 +13999,8 @@ int InitSomeVehicle2(struct vehicle_physics_struct2 * p_vehicle)
 		p_vehicle->wheels[i].k_spring = 250.0f; //last good constant
 
 		p_vehicle->wheels[i].k_damp = -125.0f;	//make sign negative so that force gets applied in opposite direction of velocity
+
+		p_vehicle->wheels[i].groundQuad[0] = -1; //no terrain quad yet
 	}
 
 	p_vehicle->wheelbase = 2.81795f; //in world coords (not blender)
@@ -8994,19 +14017,19 @@ int InitSomeVehicle2(struct vehicle_physics_struct2 * p_vehicle)
 	return 1;
 }
 
-void CalculateWheelSpringForce2(struct wheel_struct2 * pwheel, struct vehicle_physics_struct2 * pvehicle, float * forceOut, float * torqueOut)
+/*
+wheelRay is the wheel's ray cast by UpdateVehicleWheelRays2().
+*/
+void CalculateWheelSpringForce2(struct wheel_struct2 * pwheel, struct vehicle_physics_struct2 * pvehicle, struct terrain_ray_struct * wheelRay, float * forceOut, float * torqueOut)
 {
 	float dir[3] = {0.0f, -1.0f, 0.0f};
-	float ray[3] = {0.0f, -1.0f, 0.0f};
 	float connectionPointInWorld[3];	//connection point of wheel spring in world coordinates	
-	float start_pos[3];
-	float surf_pos[3];
-	float surf_norm[3];
+	float * start_pos;
+	float * surf_pos;
 	float start_to_surf[3];
 	float relVel[3];	//relative velocity at spring
 	float dampForce[3];
 	float r_dot;
-	int r;
 
 	forceOut[0] = 0.0f;
 	forceOut[1] = 0.0f;
@@ -9018,18 +14041,11 @@ void CalculateWheelSpringForce2(struct wheel_struct2 * pwheel, struct vehicle_ph
 	//determine position of the connection point of the wheel in world coords
 	memcpy(connectionPointInWorld, pwheel->connectPos, (3*sizeof(float)));
 	mmTransformVec3(pvehicle->orientation, connectionPointInWorld);
-	vAdd(start_pos, connectionPointInWorld, pvehicle->cg);
 
-	//determine a ray, first calculate len of ray
-	//ray_len = pwheel->x + pwheel->radius; //ray goes from bottom of car using length of spring then uses radius of wheel.
-	ray[1] = 0.0f-pwheel->max_x;
-	mmTransformVec3(pvehicle->orientation, ray);
-
-	r = RaycastTileSurf(start_pos, 
-			ray, 
-			surf_pos, 
-			surf_norm);
-	if(r == 1)	//hit terrain surface
+	//the ray goes from the connection point the length of the spring (see UpdateVehicleWheelRays2)
+	start_pos = wheelRay->pos;
+	surf_pos = wheelRay->surf_pos;
+	if(wheelRay->result == 1)	//hit terrain surface
 	{
 		//calculate relative velocity at spring point
 		vCrossProduct(relVel, pvehicle->angularVel, connectionPointInWorld);
@@ -9449,7 +14465,7 @@ int FlattenTerrain(float * centerPos, float x_width, float z_width, float y_rot_
 	float * quad_pos_x=0;
 	float * quad_pos_z=0;
 	float * quad_opposite=0;
-	float * curVertPos=0;
+	float curVertPos[3];
 	float rotMat4[16];
 	float rotMat3[9];
 	float cornersPos[12]; 	//array of 4 vec3's, one for each corner, need vec3's because we will need to rotate them around the y-axis
@@ -9465,7 +14481,6 @@ int FlattenTerrain(float * centerPos, float x_width, float z_width, float y_rot_
 	float dot;
 	int num_plants_deleted;
 	int total_plants_deleted=0;
-	int num_floats_per_vert;
 	int i_tile;	//index of level 1 tile (lvl_1_tile struct)
 	int j_tile;
 	int i_quad;	//index of quad in a level 1 tile
@@ -9488,8 +14503,6 @@ int FlattenTerrain(float * centerPos, float x_width, float z_width, float y_rot_
 	int i;
 	int r;
 
-	num_floats_per_vert = g_big_terrain.num_floats_per_vert;
-
 	//Get an overallHeight at the center
 	r = GetTileSurfPoint(centerPos, surf_pos, surf_norm);
 	if(r != 1)
@@ -9621,7 +14634,7 @@ int FlattenTerrain(float * centerPos, float x_width, float z_width, float y_rot_
 			{
 				for(j_vert=0; j_vert < pTile->num_x; j_vert++)
 				{
-					curVertPos = pTile->pPos+(((i_vert*pTile->num_x)+j_vert)*num_floats_per_vert);
+					GetTileVertPos(pTile, ((i_vert*pTile->num_x)+j_vert), curVertPos);
 
 					//check that vertex is in bounding box
 					for(i_clipPlane = 0; i_clipPlane < 4; i_clipPlane++)
@@ -9642,7 +14655,7 @@ int FlattenTerrain(float * centerPos, float x_width, float z_width, float y_rot_
 					//set height only if vertex is in boundary box
 					if(is_in_boundary_box == 1)
 					{
-						curVertPos[1] = surf_pos[1];
+						SetTileVertHeight(pTile, ((i_vert*pTile->num_x)+j_vert), surf_pos[1]);
 						was_vert_changed = 1;
 
 						//also clear any plants around the vertex that is being changed
@@ -9661,12 +14674,16 @@ int FlattenTerrain(float * centerPos, float x_width, float z_width, float y_rot_
 			//update the tile's vbo
 			if(was_vert_changed == 1)
 			{
-				glBindBuffer(GL_ARRAY_BUFFER, pTile->vbo);
-				glBufferSubData(GL_ARRAY_BUFFER,
-						0,	//offset
-						(pTile->num_verts*num_floats_per_vert*sizeof(float)),
-						pTile->pPos);
-				glBindBuffer(GL_ARRAY_BUFFER, 0);
+				CalcTileHeightStats(pTile);
+				CalcTileLodErrors(pTile);
+				CalcTileBlockHeights(pTile);
+				qtSetTileHeights(&g_terrain_quadtree, (pTile - g_big_terrain.pTiles), pTile->min_height, pTile->max_height);
+				r = QuantizeTileHeights(pTile);
+				if(r == 0)
+					return 0;
+				r = UpdateTileVBO(pTile);
+				if(r == 0)
+					return 0;
 			}
 
 			//set index to next tile
@@ -9688,11 +14705,10 @@ int ClearPlantsAroundTerrainVert(int i_tile, int j_tile, int i_quadvert, int j_q
 	struct plant_info_struct * newPlantsArray=0;
 	struct lvl_1_tile * pTile=0;
 	struct plant_tile * plantTile=0;
-	float * pPos=0;
+	float pPos[3];
 	float boundaries[4]; //array of vec2: x0,z0 and x1,z1
 	float boundaryHalfWidth = 10.0f;
 	int plantTileCoord[2]; //0=row, 1=col
-	int num_floats_per_vert;
 	int i;
 	int r;
 
@@ -9703,11 +14719,9 @@ int ClearPlantsAroundTerrainVert(int i_tile, int j_tile, int i_quadvert, int j_q
 	if(plantTile->num_plants == 0)
 		return 1; //success
 
-	num_floats_per_vert = g_big_terrain.num_floats_per_vert;
-
 	//Get the pos of the vert
 	pTile = g_big_terrain.pTiles + (i_tile*g_big_terrain.num_cols) + j_tile;
-	pPos = pTile->pPos + (((i_quadvert*pTile->num_x) + j_quadvert)*num_floats_per_vert);
+	GetTileVertPos(pTile, ((i_quadvert*pTile->num_x) + j_quadvert), pPos);
 
 	//calculate the corner positions of a square around the vert
 	boundaries[0] = pPos[0] - boundaryHalfWidth;
@@ -9802,6 +14816,7 @@ int ClearPlantsInBoundary(struct plant_tile * plantTile, float * boundaryCoords,
 	int new_num_plants;
 	int i;
 	int i_new;
+	int r;
 
 	//check all plants in the tile and see if any are within in the box
 	//get a count of the # of plants to delete, because we have to reallocate the array
@@ -9855,6 +14870,11 @@ int ClearPlantsInBoundary(struct plant_tile * plantTile, float * boundaryCoords,
 		plantTile->num_plants = new_num_plants;
 		plantTile->plants = newPlantsArray;
 		*numPlantsRemoved += num_to_delete;
+
+		//the culling spheres are indexed like the plants array, so rebuild them
+		r = UpdatePlantTileCullSpheres(&g_bush_grid, plantTile);
+		if(r == 0)
+			return 0;
 	}
 
 	return 1;
@@ -9864,6 +14884,7 @@ int InitMoveableModelCommon(struct simple_model_struct * simpleModel, char * obj
 {
 	struct bush_model_struct temp_model;
 	image_t tgaFile;
+	float bounds[3];
 	int powerOfTwo;
 	int r;
 
@@ -9876,6 +14897,13 @@ int InitMoveableModelCommon(struct simple_model_struct * simpleModel, char * obj
 		return 0;
 	}
 
+	//moveables only rotate about y, so a sphere on the y axis holds them at any yrot
+	bounds[0] = FLT_MAX;
+	bounds[1] = -FLT_MAX;
+	bounds[2] = 0.0f;
+	ocGrowAxisBounds(temp_model.p_leaf_vertex_data, temp_model.num_leaf_verts, 8, bounds);
+	ocAxisBoundsToSphere(bounds, &(simpleModel->cull_center_y), &(simpleModel->cull_radius));
+
 	//setup the VBO
 	glGenBuffers(1, &(simpleModel->vbo));
 	glBindBuffer(GL_ARRAY_BUFFER, simpleModel->vbo);
@@ -9895,6 +14923,9 @@ int InitMoveableModelCommon(struct simple_model_struct * simpleModel, char * obj
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
 	simpleModel->num_indices = temp_model.num_leaf_elements;
+	simpleModel->num_verts = temp_model.num_leaf_verts;
+	simpleModel->p_vertex_data = temp_model.p_leaf_vertex_data;	//static moveables are merged from these, see RebuildMoveableBatches
+	simpleModel->p_elements = temp_model.p_leaf_elements;
 
 	//setup the VAO
 	glGenVertexArrays(1, &(simpleModel->vao));
@@ -9935,166 +14966,686 @@ int InitMoveableModelCommon(struct simple_model_struct * simpleModel, char * obj
 		return 0;
 	}
 
-	//check that texture size is a power of 2
-	if((tgaFile.info.width % 2) != 0)
+	//check that texture size is a power of 2
+	if((tgaFile.info.width % 2) != 0)
+	{
+		printf("%s: error. %s dimensions need to be a power of 2.\n", __func__, texture_filename);
+		return 0;
+	}
+
+	//put a reality check so we don't try to load a huge texture
+	if(tgaFile.info.width > 4096)
+	{
+		printf("%s: error. size of %s is larger than 4096.\n", __func__, texture_filename);
+		return 0;
+	}
+
+	//calculate the power of 2 of texture size to calculate the # of mipmap levels
+	powerOfTwo = (int)log2f((float)tgaFile.info.width);
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D,
+			0,
+			GL_RGB,
+			tgaFile.info.width,
+			tgaFile.info.height,
+			0,
+			GL_RGB,
+			GL_UNSIGNED_BYTE,
+			tgaFile.data);
+	free(tgaFile.data);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, powerOfTwo);
+	glGenerateMipmap(GL_TEXTURE_2D);
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	return 1;
+}
+
+int InitMoveablesGrid(struct moveables_grid_struct * p_grid)
+{
+	struct moveable_items_tile_struct * p_tile=0;
+	int i,j;
+
+	memset(p_grid, 0, sizeof(struct moveables_grid_struct));
+
+	//cover the whole terrain map, e.g. 32x1207 = 38,624 which is > 38,610
+	p_grid->tileSize = 32.0f;
+	p_grid->num_cols = (int)ceilf((g_big_terrain.num_cols*g_big_terrain.tile_len[0])/p_grid->tileSize);
+	p_grid->num_rows = (int)ceilf((g_big_terrain.num_rows*g_big_terrain.tile_len[1])/p_grid->tileSize);
+	p_grid->num_tiles = p_grid->num_rows * p_grid->num_cols;
+
+	p_grid->p_tiles = (struct moveable_items_tile_struct*)malloc(p_grid->num_tiles*sizeof(struct moveable_items_tile_struct));
+	if(p_grid->p_tiles == 0)
+	{
+		printf("%s: malloc fail\n", __func__);
+		return 0;
+	}
+
+	for(i = 0; i < p_grid->num_rows; i++)
+	{
+		for(j = 0; j < p_grid->num_cols; j++)
+		{
+			p_tile = p_grid->p_tiles + ((i*p_grid->num_cols) + j);
+			memset(p_tile, 0, sizeof(struct moveable_items_tile_struct));
+			p_tile->urcorner[0] = i * p_grid->tileSize;
+			p_tile->urcorner[1] = j * p_grid->tileSize;
+		}
+	}
+
+	//setup the working grid.
+	p_grid->localGridSize[0] = 46;
+	p_grid->localGridSize[1] = 46;
+	p_grid->numLocalTiles = 2116; //size of the local_grid array
+	for(i = 0; i < p_grid->localGridSize[0]; i++)
+	{
+		for(j = 0; j < p_grid->localGridSize[1]; j++)
+		{
+			p_grid->local_grid[(i*p_grid->localGridSize[1])+j] = -1;	//-1 = no entry. 
+		}
+	}
+
+	return 1;
+}
+
+int GetMoveablesTileIndex(float * pos)
+{
+	int i,j;
+
+	//check that position is inside the map boundary (check against terrain grid since that is the real map and the moveable grid is slightly larger)
+	if(pos[0] < 0.0f 
+		|| pos[2] < 0.0f 
+		|| pos[0] > (g_big_terrain.num_cols*g_big_terrain.tile_len[0])
+		|| pos[2] > (g_big_terrain.num_rows*g_big_terrain.tile_len[1]) )
+	{
+		return -1;
+	}
+
+	i = (int)(pos[2]/g_moveables_grid.tileSize);
+	//j = (int)(pos[1]/g_moveables_grid.tileSize);
+	j = (int)(pos[0]/g_moveables_grid.tileSize);
+
+	return ((i*g_moveables_grid.num_cols)+j);
+}
+
+/*
+-pos is a vec3
+*/
+void UpdateMoveablesLocalGrid(struct moveables_grid_struct * p_grid, float * pos)
+{
+	float relToGridCorner[2]; //rel vec2 that points from center to -x,-z grid corner
+	float tempVec[3];
+	int curTile[2];
+	int startTile[2]; //index of the first square in the grid
+	int i,j;
+
+	//check that pos is inside the map boundaries
+	if(pos[0] < 0.0f 
+			|| pos[2] < 0.0f 
+			|| pos[0] > (g_big_terrain.num_rows*g_big_terrain.tile_len[0]) 
+			|| pos[2] > (g_big_terrain.num_rows*g_big_terrain.tile_len[1]))
+	{
+		//Set all grid entries to invalid
+		for(i = 0; i < g_moveables_grid.localGridSize[0]; i++)
+		{
+			for(j = 0; j < g_moveables_grid.localGridSize[1]; j++)
+			{
+				g_moveables_grid.local_grid[(i*g_moveables_grid.localGridSize[1])+j] = -1;
+			}
+		}
+		return;
+	}
+
+	//figure out what tile pos is in
+	relToGridCorner[0] = -0.5f*(g_moveables_grid.localGridSize[1] * g_moveables_grid.tileSize);
+	relToGridCorner[1] = -0.5f*(g_moveables_grid.localGridSize[0] * g_moveables_grid.tileSize);
+	tempVec[0] = pos[0] + relToGridCorner[1];
+	tempVec[1] = 0.0f;
+	tempVec[2] = pos[2] + relToGridCorner[0];
+	startTile[0] = (int)(tempVec[2]/g_moveables_grid.tileSize); //row
+	startTile[1] = (int)(tempVec[0]/g_moveables_grid.tileSize); //col
+
+	//Loop through all local grid tiles
+	for(i = 0; i < g_moveables_grid.localGridSize[0]; i++)
+	{
+		for(j = 0; j < g_moveables_grid.localGridSize[1]; j++)
+		{
+			curTile[0] = startTile[0] + i;
+			curTile[1] = startTile[1] + j;
+
+			//check that this tile is in the map
+			if(curTile[0] < 0 || curTile[0] > g_moveables_grid.num_rows
+					|| curTile[1] < 0 || curTile[1] > g_moveables_grid.num_cols)
+			{
+				g_moveables_grid.local_grid[(i*g_moveables_grid.localGridSize[1])+j] = -1; //mark the entry invalid
+				continue;
+			}
+			else
+			{
+				g_moveables_grid.local_grid[(i*g_moveables_grid.localGridSize[1])+j] = (curTile[0]*g_moveables_grid.num_cols) + curTile[1];
+			}
+		}
+	}
+}
+
+/*
+GetMoveableModelCommon
+returns the model used to draw a moveable_type, 0 if the type is unknown
+*/
+struct simple_model_struct * GetMoveableModelCommon(int moveable_type)
+{
+	switch(moveable_type)
+	{
+	case MOVEABLE_TYPE_CRATE:
+		return &g_crate_model_common;
+	case MOVEABLE_TYPE_BARREL:
+		return &g_barrel_model_common;
+	case MOVEABLE_TYPE_DOCK:
+		return &g_dock_common;
+	case MOVEABLE_TYPE_BUNKER:
+		return &g_bunker_model_common;
+	case MOVEABLE_TYPE_WAREHOUSE:
+		return &g_warehouse_model_common;
+	}
+	return 0;
+}
+
+/*
+UpdateVisibleMoveables
+Culls the moveables in the local grid against the camera frustum and
+leaves the ones to draw in p_grid->visible, by moveable_type. Local grid
+tiles whose moveables are all hidden behind nearer terrain are skipped.
+Moveables can be pushed around, so their spheres are rebuilt every frame.
+-call after UpdateMoveablesLocalGrid() and UpdateTerrainOcclusion()
+*/
+void UpdateVisibleMoveables(struct moveables_grid_struct * p_grid, float * camera_pos)
+{
+	struct moveable_object_struct ** new_moveables=0;
+	struct moveable_object_struct * pmoveable=0;
+	struct simple_model_struct * p_model=0;
+	float center[3];
+	float box_min[3];
+	float box_max[3];
+	int i;
+	int j;
+	int k;
+	int r = 1;
+
+	ocSpheresClear(&(p_grid->cull_spheres));
+	p_grid->num_occlusion_tests = 0;
+	p_grid->num_occluded_tiles = 0;
+	for(i = 0; i < p_grid->numLocalTiles && r == 1; i++)
+	{
+		k = p_grid->local_grid[i];
+		if(k == -1 || p_grid->p_tiles[k].num_moveables == 0)
+			continue;
+
+		//box around the spheres of the tile's moveables
+		box_min[0] = FLT_MAX;
+		box_min[1] = FLT_MAX;
+		box_min[2] = FLT_MAX;
+		box_max[0] = -FLT_MAX;
+		box_max[1] = -FLT_MAX;
+		box_max[2] = -FLT_MAX;
+		pmoveable = p_grid->p_tiles[k].moveables_list;
+		for(j = 0; j < p_grid->p_tiles[k].num_moveables; j++)
+		{
+			p_model = GetMoveableModelCommon((int)pmoveable->moveable_type);
+			if(p_model != 0)
+			{
+				box_min[0] = fminf(box_min[0], (pmoveable->pos[0] - p_model->cull_radius));
+				box_min[1] = fminf(box_min[1], (pmoveable->pos[1] + p_model->cull_center_y - p_model->cull_radius));
+				box_min[2] = fminf(box_min[2], (pmoveable->pos[2] - p_model->cull_radius));
+				box_max[0] = fmaxf(box_max[0], (pmoveable->pos[0] + p_model->cull_radius));
+				box_max[1] = fmaxf(box_max[1], (pmoveable->pos[1] + p_model->cull_center_y + p_model->cull_radius));
+				box_max[2] = fmaxf(box_max[2], (pmoveable->pos[2] + p_model->cull_radius));
+			}
+			pmoveable = pmoveable->pNext;
+		}
+		if(box_min[0] <= box_max[0])
+		{
+			p_grid->num_occlusion_tests += 1;
+			if(IsTerrainBoxOccluded(box_min, box_max) == 1)
+			{
+				p_grid->num_occluded_tiles += 1;
+				continue;
+			}
+		}
+
+		//pmoveable is a linked list
+		pmoveable = p_grid->p_tiles[k].moveables_list;
+		for(j = 0; j < p_grid->p_tiles[k].num_moveables && r == 1; j++)
+		{
+			//moveables in a static batch are drawn with it
+			if(pmoveable->batch != -1)
+			{
+				pmoveable = pmoveable->pNext;
+				continue;
+			}
+
+			p_model = GetMoveableModelCommon((int)pmoveable->moveable_type);
+			if(p_model == 0)
+			{
+				printf("%s: error. %d is unknown moveable_type.\n", __func__, pmoveable->moveable_type);
+				pmoveable = pmoveable->pNext;
+				continue;
+			}
+
+			center[0] = pmoveable->pos[0];
+			center[1] = pmoveable->pos[1] + p_model->cull_center_y;
+			center[2] = pmoveable->pos[2];
+			r = ocSpheresAdd(&(p_grid->cull_spheres), center, p_model->cull_radius, FLT_MAX, (int)pmoveable->moveable_type);
+			if(r == 0)
+				break;
+
+			//keep the moveable pointers as long as the sphere arrays
+			if(p_grid->max_cull_moveables < p_grid->cull_spheres.max)
+			{
+				new_moveables = (struct moveable_object_struct**)realloc(p_grid->cull_moveables, p_grid->cull_spheres.max*sizeof(struct moveable_object_struct*));
+				if(new_moveables == 0)
+				{
+					printf("%s: error. realloc fail for %d moveables.\n", __func__, p_grid->cull_spheres.max);
+					r = 0;
+					break;
+				}
+				p_grid->cull_moveables = new_moveables;
+				p_grid->max_cull_moveables = p_grid->cull_spheres.max;
+			}
+			p_grid->cull_moveables[(p_grid->cull_spheres.num-1)] = pmoveable;
+
+			pmoveable = pmoveable->pNext; //advance the LINKED LIST
+		}
+	}
+
+	//on an error draw nothing rather than a partial list
+	if(r == 0)
+		ocSpheresClear(&(p_grid->cull_spheres));
+
+	ocCullSpheres(g_camera_frustum.planes, camera_pos, &(p_grid->cull_spheres), &(p_grid->visible));
+}
+
+/*
+InitMoveableInstancing
+Creates instance_vbo and points attributes 3 to 6 of every moveable
+model's vao at the per-instance model matrices in it, the same layout
+g_bush_instanced_shader reads. The moveable models need to be loaded
+first.
+*/
+void InitMoveableInstancing(struct moveables_grid_struct * p_grid)
+{
+	struct simple_model_struct * p_model;
+	int k;
+	int c;
+
+	glGenBuffers(1, &(p_grid->instance_vbo));
+	glBindBuffer(GL_ARRAY_BUFFER, p_grid->instance_vbo);
+	for(k = 0; k < OC_MAX_TYPES; k++)
+	{
+		p_model = GetMoveableModelCommon(k);
+		if(p_model == 0)
+			continue;
+		glBindVertexArray(p_model->vao);
+		for(c = 0; c < 4; c++) //a mat4 attribute is 4 vec4 columns
+		{
+			glEnableVertexAttribArray(3 + c);
+			glVertexAttribPointer((3 + c), 4, GL_FLOAT, GL_FALSE, 16*sizeof(float), (GLvoid*)(c*4*sizeof(float)));
+			glVertexAttribDivisor((3 + c), 1);
+		}
+	}
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+/*
+UpdateMoveableInstances
+Fills instance_mats with the model matrix of each moveable in
+p_grid->visible, grouped by moveable_type, so each type can be drawn
+with one instanced draw.
+-call after UpdateVisibleMoveables()
+returns 1 on success, 0 on failure (nothing will be drawn)
+*/
+int UpdateMoveableInstances(struct moveables_grid_struct * p_grid)
+{
+	struct moveable_object_struct * pmoveable;
+	float * new_mats;
+	float * m;
+	int * p_ids;
+	int num;
+	int j;
+	int k;
+
+	memset(p_grid->instance_first, 0, sizeof(p_grid->instance_first));
+	memset(p_grid->instance_num, 0, sizeof(p_grid->instance_num));
+	if(p_grid->max_instances < p_grid->visible.num_visible)
 	{
-		printf("%s: error. %s dimensions need to be a power of 2.\n", __func__, texture_filename);
-		return 0;
+		new_mats = (float*)realloc(p_grid->instance_mats, p_grid->visible.num_visible*16*sizeof(float));
+		if(new_mats == 0)
+		{
+			printf("%s: error. realloc fail for %d moveable matrices.\n", __func__, p_grid->visible.num_visible);
+			return 0;
+		}
+		p_grid->instance_mats = new_mats;
+		p_grid->max_instances = p_grid->visible.num_visible;
 	}
 
-	//put a reality check so we don't try to load a huge texture
-	if(tgaFile.info.width > 4096)
+	num = 0;
+	for(k = 0; k < OC_MAX_TYPES; k++)
 	{
-		printf("%s: error. size of %s is larger than 4096.\n", __func__, texture_filename);
-		return 0;
+		p_grid->instance_first[k] = num;
+		p_ids = p_grid->visible.ids + p_grid->visible.first[k];
+		for(j = 0; j < p_grid->visible.num[k]; j++)
+		{
+			pmoveable = p_grid->cull_moveables[p_ids[j]];
+			m = p_grid->instance_mats + (num*16);
+			mmRotateAboutY(m, pmoveable->yrot);
+			m[12] = pmoveable->pos[0];
+			m[13] = pmoveable->pos[1];
+			m[14] = pmoveable->pos[2];
+			num += 1;
+		}
+		p_grid->instance_num[k] = p_grid->visible.num[k];
 	}
+	return 1;
+}
 
-	//calculate the power of 2 of texture size to calculate the # of mipmap levels
-	powerOfTwo = (int)log2f((float)tgaFile.info.width);
-
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-	glTexImage2D(GL_TEXTURE_2D,
-			0,
-			GL_RGB,
-			tgaFile.info.width,
-			tgaFile.info.height,
-			0,
-			GL_RGB,
-			GL_UNSIGNED_BYTE,
-			tgaFile.data);
-	free(tgaFile.data);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, powerOfTwo);
-	glGenerateMipmap(GL_TEXTURE_2D);
+/*
+IsMoveableStatic
+returns 1 if the moveable never moves once it is placed, so it can be
+merged into a static batch
+*/
+int IsMoveableStatic(struct moveable_object_struct * pmoveable)
+{
+	//nothing pushes moveables around yet, crates and barrels are only opened
+	switch(pmoveable->moveable_type)
+	{
+	case MOVEABLE_TYPE_CRATE:
+	case MOVEABLE_TYPE_BARREL:
+	case MOVEABLE_TYPE_DOCK:
+	case MOVEABLE_TYPE_BUNKER:
+	case MOVEABLE_TYPE_WAREHOUSE:
+		return 1;
+	}
+	return 0;
+}
 
-	glBindTexture(GL_TEXTURE_2D, 0);
+static int MoveableBatchCompareKeys(const void * a, const void * b)
+{
+	const struct moveable_batch_item_struct * ia = (const struct moveable_batch_item_struct*)a;
+	const struct moveable_batch_item_struct * ib = (const struct moveable_batch_item_struct*)b;
 
-	return 1;
+	return ia->key - ib->key;
 }
 
-int InitMoveablesGrid(struct moveables_grid_struct * p_grid)
+/*
+RebuildMoveableBatches
+Merges the static moveables into one batch per moveable_type and region
+of MOVEABLE_BATCH_REGION_TILES x MOVEABLE_BATCH_REGION_TILES grid tiles,
+and marks each with its batch. The old batches are freed first. It walks
+the whole grid, so it should only run when moveables were added or
+removed (batches_dirty). Needs the GL context.
+returns 1 on success, 0 on failure (every moveable is then drawn on its own)
+*/
+int RebuildMoveableBatches(struct moveables_grid_struct * p_grid)
 {
-	struct moveable_items_tile_struct * p_tile=0;
-	int i,j;
-
-	memset(p_grid, 0, sizeof(struct moveables_grid_struct));
+	struct moveable_batch_item_struct * items=0;
+	struct moveable_batch_struct * p_batch;
+	struct moveable_object_struct * pmoveable;
+	float center[3];
+	float radius;
+	int region_cols;
+	int num_items;
+	int num_batches;
+	int first;
+	int i;
+	int j;
+	int r = 1;
 
-	p_grid->tileSize = 32.0f;
-	p_grid->num_cols = 1207;	//this is to get 32x1207 = 38,624 which is > 38,610
-	p_grid->num_rows = 1207;
-	p_grid->num_tiles = p_grid->num_rows * p_grid->num_cols;
+	p_grid->batches_dirty = 0;
+	FreeMoveableBatches(p_grid);
 
-	p_grid->p_tiles = (struct moveable_items_tile_struct*)malloc(p_grid->num_tiles*sizeof(struct moveable_items_tile_struct));
-	if(p_grid->p_tiles == 0)
+	//find the static moveables and their batch keys
+	region_cols = (p_grid->num_cols + MOVEABLE_BATCH_REGION_TILES - 1)/MOVEABLE_BATCH_REGION_TILES;
+	num_items = 0;
+	for(i = 0; i < p_grid->num_tiles; i++)
 	{
-		printf("%s: malloc fail\n", __func__);
+		num_items += p_grid->p_tiles[i].num_moveables;
+	}
+	if(num_items == 0)
+		return 1;
+	items = (struct moveable_batch_item_struct*)malloc(num_items*sizeof(struct moveable_batch_item_struct));
+	if(items == 0)
+	{
+		printf("%s: error. malloc fail for %d moveables.\n", __func__, num_items);
 		return 0;
 	}
-
-	for(i = 0; i < p_grid->num_rows; i++)
+	num_items = 0;
+	for(i = 0; i < p_grid->num_tiles; i++)
 	{
-		for(j = 0; j < p_grid->num_cols; j++)
+		pmoveable = p_grid->p_tiles[i].moveables_list;
+		for(j = 0; j < p_grid->p_tiles[i].num_moveables; j++)
 		{
-			p_tile = p_grid->p_tiles + ((i*p_grid->num_cols) + j);
-			memset(p_tile, 0, sizeof(struct moveable_items_tile_struct));
-			p_tile->urcorner[0] = i * p_grid->tileSize;
-			p_tile->urcorner[1] = j * p_grid->tileSize;
+			pmoveable->batch = -1;
+			if(IsMoveableStatic(pmoveable) == 1 && GetMoveableModelCommon((int)pmoveable->moveable_type)->p_vertex_data != 0)
+			{
+				items[num_items].key = ((((i/p_grid->num_cols)/MOVEABLE_BATCH_REGION_TILES)*region_cols) + ((i%p_grid->num_cols)/MOVEABLE_BATCH_REGION_TILES))*OC_MAX_TYPES;
+				items[num_items].key += (int)pmoveable->moveable_type;
+				items[num_items].pmoveable = pmoveable;
+				num_items += 1;
+			}
+			pmoveable = pmoveable->pNext;
 		}
 	}
+	qsort(items, num_items, sizeof(struct moveable_batch_item_struct), MoveableBatchCompareKeys);
 
-	//setup the working grid.
-	p_grid->localGridSize[0] = 46;
-	p_grid->localGridSize[1] = 46;
-	p_grid->numLocalTiles = 2116; //size of the local_grid array
-	for(i = 0; i < p_grid->localGridSize[0]; i++)
+	//one batch per run of equal keys
+	num_batches = 0;
+	for(i = 0; i < num_items; i++)
 	{
-		for(j = 0; j < p_grid->localGridSize[1]; j++)
+		if(i == 0 || items[i].key != items[(i-1)].key)
+			num_batches += 1;
+	}
+	p_grid->batches = (struct moveable_batch_struct*)calloc(num_batches, sizeof(struct moveable_batch_struct));
+	if(p_grid->batches == 0 && num_batches > 0)
+	{
+		printf("%s: error. calloc fail for %d batches.\n", __func__, num_batches);
+		free(items);
+		return 0;
+	}
+	first = 0;
+	for(i = 1; i <= num_items && r == 1; i++)
+	{
+		if(i < num_items && items[i].key == items[first].key)
+			continue;
+		p_batch = p_grid->batches + p_grid->num_batches;
+		p_grid->num_batches += 1; //so a partly built batch is freed
+		r = BuildMoveableBatch(p_batch, (items + first), (i - first));
+		if(r == 0)
+			break;
+		
+		//moveables sit still, so the sphere is only found once
+		center[0] = (p_batch->box_min[0] + p_batch->box_max[0])*0.5f;
+		center[1] = (p_batch->box_min[1] + p_batch->box_max[1])*0.5f;
+		center[2] = (p_batch->box_min[2] + p_batch->box_max[2])*0.5f;
+		radius = 0.5f*sqrtf(((p_batch->box_max[0] - p_batch->box_min[0])*(p_batch->box_max[0] - p_batch->box_min[0]))
+			+ ((p_batch->box_max[1] - p_batch->box_min[1])*(p_batch->box_max[1] - p_batch->box_min[1]))
+			+ ((p_batch->box_max[2] - p_batch->box_min[2])*(p_batch->box_max[2] - p_batch->box_min[2])));
+		
+		//as far as the local grid that the other moveables are drawn from reaches
+		r = ocSpheresAdd(&(p_grid->batch_spheres), center, radius, ((p_grid->localGridSize[0]/2)*p_grid->tileSize + radius), 0);
+		if(r == 0)
+			break;
+		for(j = first; j < i; j++)
 		{
-			p_grid->local_grid[(i*p_grid->localGridSize[1])+j] = -1;	//-1 = no entry. 
+			items[j].pmoveable->batch = p_grid->num_batches - 1;
 		}
+		p_grid->num_batched_moveables += (i - first);
+		first = i;
 	}
-
-	return 1;
+	if(r == 0)
+	{
+		for(j = 0; j < num_items; j++)
+		{
+			items[j].pmoveable->batch = -1;
+		}
+		FreeMoveableBatches(p_grid);
+	}
+	free(items);
+	return r;
 }
 
-int GetMoveablesTileIndex(float * pos)
+/*
+BuildMoveableBatch
+Transforms the models of items into world space, one after the other,
+and loads them into the batch's vbo, ebo and vao. Normals are copied as
+they are, the same as the per-moveable draw, which doesn't rotate them.
+returns 1 on success, 0 on failure
+*/
+int BuildMoveableBatch(struct moveable_batch_struct * p_batch, struct moveable_batch_item_struct * items, int num_items)
 {
-	int i,j;
+	struct simple_model_struct * p_model;
+	struct moveable_object_struct * pmoveable;
+	float mModelMatrix[16];
+	float pos[4];
+	float world_pos[4];
+	float * verts;
+	float * v;
+	float * src;
+	int * indices;
+	int num_verts;
+	int i;
+	int j;
+	int k;
 
-	//check that position is inside the map boundary (check against terrain grid since that is the real map and the moveable grid is slightly larger)
-	if(pos[0] < 0.0f 
-		|| pos[2] < 0.0f 
-		|| pos[0] > (g_big_terrain.num_cols*g_big_terrain.tile_len[0])
-		|| pos[2] > (g_big_terrain.num_rows*g_big_terrain.tile_len[1]) )
-	{
-		return -1;
+	p_batch->moveable_type = (int)items[0].pmoveable->moveable_type;
+	p_batch->num_moveables = num_items;
+	p_model = GetMoveableModelCommon(p_batch->moveable_type);
+	num_verts = num_items*p_model->num_verts;
+	p_batch->num_indices = num_items*p_model->num_indices;
+	verts = (float*)malloc(num_verts*8*sizeof(float));
+	indices = (int*)malloc(p_batch->num_indices*sizeof(int));
+	if(verts == 0 || indices == 0)
+	{
+		printf("%s: error. malloc fail for %d verts.\n", __func__, num_verts);
+		free(verts);
+		free(indices);
+		return 0;
 	}
 
-	i = (int)(pos[2]/g_moveables_grid.tileSize);
-	//j = (int)(pos[1]/g_moveables_grid.tileSize);
-	j = (int)(pos[0]/g_moveables_grid.tileSize);
+	p_batch->box_min[0] = FLT_MAX;
+	p_batch->box_min[1] = FLT_MAX;
+	p_batch->box_min[2] = FLT_MAX;
+	p_batch->box_max[0] = -FLT_MAX;
+	p_batch->box_max[1] = -FLT_MAX;
+	p_batch->box_max[2] = -FLT_MAX;
+	for(i = 0; i < num_items; i++)
+	{
+		pmoveable = items[i].pmoveable;
+		mmRotateAboutY(mModelMatrix, pmoveable->yrot);
+		mModelMatrix[12] = pmoveable->pos[0];
+		mModelMatrix[13] = pmoveable->pos[1];
+		mModelMatrix[14] = pmoveable->pos[2];
+		for(j = 0; j < p_model->num_verts; j++)
+		{
+			src = p_model->p_vertex_data + (j*8);
+			v = verts + (((i*p_model->num_verts) + j)*8);
+			memcpy(v, src, 8*sizeof(float));
+			pos[0] = src[0];
+			pos[1] = src[1];
+			pos[2] = src[2];
+			pos[3] = 1.0f;
+			mmTransformVec4Out(mModelMatrix, pos, world_pos);
+			memcpy(v, world_pos, 3*sizeof(float));
+			for(k = 0; k < 3; k++)
+			{
+				p_batch->box_min[k] = fminf(p_batch->box_min[k], v[k]);
+				p_batch->box_max[k] = fmaxf(p_batch->box_max[k], v[k]);
+			}
+		}
+		for(j = 0; j < p_model->num_indices; j++)
+		{
+			indices[((i*p_model->num_indices) + j)] = p_model->p_elements[j] + (i*p_model->num_verts);
+		}
+	}
 
-	return ((i*g_moveables_grid.num_cols)+j);
+	glGenBuffers(1, &(p_batch->vbo));
+	glBindBuffer(GL_ARRAY_BUFFER, p_batch->vbo);
+	glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)(num_verts*8*sizeof(float)), verts, GL_STATIC_DRAW);
+	glGenBuffers(1, &(p_batch->ebo));
+	glGenVertexArrays(1, &(p_batch->vao));
+	glBindVertexArray(p_batch->vao);
+	glEnableVertexAttribArray(0);	//vertex position
+	glEnableVertexAttribArray(1);	//vertex normal
+	glEnableVertexAttribArray(2);	//vertex texture coord
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8*sizeof(float), 0);
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8*sizeof(float), (GLvoid*)(3*sizeof(float)));
+	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8*sizeof(float), (GLvoid*)(6*sizeof(float)));
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, p_batch->ebo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, (GLsizeiptr)(p_batch->num_indices*sizeof(int)), indices, GL_STATIC_DRAW);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	free(verts);
+	free(indices);
+	return 1;
 }
 
 /*
--pos is a vec3
+FreeMoveableBatches
+Deletes the GL objects of every batch and empties the batch list. The
+moveables' batch indexes are left for the caller to reset.
 */
-void UpdateMoveablesLocalGrid(struct moveables_grid_struct * p_grid, float * pos)
+void FreeMoveableBatches(struct moveables_grid_struct * p_grid)
 {
-	float relToGridCorner[2]; //rel vec2 that points from center to -x,-z grid corner
-	float tempVec[3];
-	int curTile[2];
-	int startTile[2]; //index of the first square in the grid
-	int i,j;
+	struct moveable_batch_struct * p_batch;
+	int i;
 
-	//check that pos is inside the map boundaries
-	if(pos[0] < 0.0f 
-			|| pos[2] < 0.0f 
-			|| pos[0] > (g_big_terrain.num_rows*g_big_terrain.tile_len[0]) 
-			|| pos[2] > (g_big_terrain.num_rows*g_big_terrain.tile_len[1]))
+	for(i = 0; i < p_grid->num_batches; i++)
 	{
-		//Set all grid entries to invalid
-		for(i = 0; i < g_moveables_grid.localGridSize[0]; i++)
-		{
-			for(j = 0; j < g_moveables_grid.localGridSize[1]; j++)
-			{
-				g_moveables_grid.local_grid[(i*g_moveables_grid.localGridSize[1])+j] = -1;
-			}
-		}
-		return;
+		p_batch = p_grid->batches + i;
+		glDeleteVertexArrays(1, &(p_batch->vao));
+		glDeleteBuffers(1, &(p_batch->vbo));
+		glDeleteBuffers(1, &(p_batch->ebo));
 	}
+	free(p_grid->batches);
+	p_grid->batches = 0;
+	p_grid->num_batches = 0;
+	p_grid->num_batched_moveables = 0;
+	ocSpheresClear(&(p_grid->batch_spheres));
+	memset(p_grid->batch_visible.num, 0, sizeof(p_grid->batch_visible.num));
+}
 
-	//figure out what tile pos is in
-	relToGridCorner[0] = -0.5f*(g_moveables_grid.localGridSize[1] * g_moveables_grid.tileSize);
-	relToGridCorner[1] = -0.5f*(g_moveables_grid.localGridSize[0] * g_moveables_grid.tileSize);
-	tempVec[0] = pos[0] + relToGridCorner[1];
-	tempVec[1] = 0.0f;
-	tempVec[2] = pos[2] + relToGridCorner[0];
-	startTile[0] = (int)(tempVec[2]/g_moveables_grid.tileSize); //row
-	startTile[1] = (int)(tempVec[0]/g_moveables_grid.tileSize); //col
+/*
+UpdateVisibleMoveableBatches
+Culls the static batches against the camera frustum and leaves the ones
+to draw in p_grid->batch_visible, as type 0. Batches behind nearer
+terrain are dropped.
+-call after UpdateTerrainOcclusion()
+*/
+void UpdateVisibleMoveableBatches(struct moveables_grid_struct * p_grid, float * camera_pos)
+{
+	struct moveable_batch_struct * p_batch;
+	int * ids;
+	int num;
+	int i;
 
-	//Loop through all local grid tiles
-	for(i = 0; i < g_moveables_grid.localGridSize[0]; i++)
+	ocCullSpheres(g_camera_frustum.planes, camera_pos, &(p_grid->batch_spheres), &(p_grid->batch_visible));
+	p_grid->num_batches_occluded = 0;
+	ids = p_grid->batch_visible.ids + p_grid->batch_visible.first[0];
+	num = 0;
+	for(i = 0; i < p_grid->batch_visible.num[0]; i++)
 	{
-		for(j = 0; j < g_moveables_grid.localGridSize[1]; j++)
+		p_batch = p_grid->batches + ids[i];
+		if(IsTerrainBoxOccluded(p_batch->box_min, p_batch->box_max) == 1)
 		{
-			curTile[0] = startTile[0] + i;
-			curTile[1] = startTile[1] + j;
-
-			//check that this tile is in the map
-			if(curTile[0] < 0 || curTile[0] > g_moveables_grid.num_rows
-					|| curTile[1] < 0 || curTile[1] > g_moveables_grid.num_cols)
-			{
-				g_moveables_grid.local_grid[(i*g_moveables_grid.localGridSize[1])+j] = -1; //mark the entry invalid
-				continue;
-			}
-			else
-			{
-				g_moveables_grid.local_grid[(i*g_moveables_grid.localGridSize[1])+j] = (curTile[0]*g_moveables_grid.num_cols) + curTile[1];
-			}
+			p_grid->num_batches_occluded += 1;
+			continue;
 		}
+		ids[num] = ids[i];
+		num += 1;
 	}
+	p_grid->batch_visible.num[0] = num;
 }
 
 /*
@@ -10130,6 +15681,8 @@ struct moveable_object_struct * AddMoveableToTile(float * moveablePos)
 		pmoveable->pos[0] = moveablePos[0];
 		pmoveable->pos[1] = moveablePos[1];
 		pmoveable->pos[2] = moveablePos[2];
+		pmoveable->batch = -1;
+		g_moveables_grid.batches_dirty = 1;
 		g_moveables_grid.p_tiles[i].moveables_list = pmoveable;
 		g_moveables_grid.p_tiles[i].num_moveables = 1;
 		return pmoveable;
@@ -10153,6 +15706,8 @@ struct moveable_object_struct * AddMoveableToTile(float * moveablePos)
 		pmoveable->pos[0] = moveablePos[0];
 		pmoveable->pos[1] = moveablePos[1];
 		pmoveable->pos[2] = moveablePos[2];
+		pmoveable->batch = -1;
+		g_moveables_grid.batches_dirty = 1;
 		g_moveables_grid.p_tiles[i].num_moveables += 1;
 		return pmoveable;
 	}
@@ -11284,7 +16839,7 @@ int InitGUIShaders(struct gui_shader_struct * guiShader, char * vert_shader_file
 	if(vertexShaderString == 0)
 		return 0;
 	guiShader->shaderList[0] = glCreateShader(GL_VERTEX_SHADER);
-	glShaderSource(guiShader->shaderList[0], 1, &vertexShaderString, 0);
+	glShaderSource(guiShader->shaderList[0], 1, (const GLchar**)&vertexShaderString, 0);
 	glCompileShader(guiShader->shaderList[0]);
 	glGetShaderiv(guiShader->shaderList[0], GL_COMPILE_STATUS, &status);
 	free(vertexShaderString);
@@ -11309,7 +16864,7 @@ int InitGUIShaders(struct gui_shader_struct * guiShader, char * vert_shader_file
 	if(fragmentShaderString == 0)
 		return 0;
 	guiShader->shaderList[1] = glCreateShader(GL_FRAGMENT_SHADER);
-	glShaderSource(guiShader->shaderList[1], 1, &fragmentShaderString, 0);
+	glShaderSource(guiShader->shaderList[1], 1, (const GLchar**)&fragmentShaderString, 0);
 	glCompileShader(guiShader->shaderList[1]);
 	glGetShaderiv(guiShader->shaderList[1], GL_COMPILE_STATUS, &status);
 	free(fragmentShaderString);
@@ -11516,7 +17071,7 @@ void DrawInvGUI(void)
 	mmTranslateMatrix(mModelMatrix, 180.0f, 384.0f, -11.0f);
 	mmMultiplyMatrix4x4(mModelMatrix, mScaleMat, mModelMatrix);	
 	glUseProgram(g_character_shader.program);
-	glUniform3fv(g_character_shader.modelSpaceCameraPosUnif, 1, g_ws_camera_pos); //what should this be set to?
+	glUniform3fv(g_character_shader.modelSpaceCameraPosUnif, 1, g_draw_snapshot->ws_camera_pos); //what should this be set to?
 	glUniformMatrix4fv(g_character_shader.modelToCameraMatrixUnif, 1, GL_FALSE, mModelMatrix);
 	glBindSampler(g_character_shader.colorTexUnit, g_triangle_man.sampler);
 	glBindVertexArray(g_triangle_man.vao);
@@ -12143,6 +17698,131 @@ float GetItemGroundOffset(unsigned char itemType)
 	return offset;
 }
 
+/*
+GetItemCommon
+returns the model used to draw an item type, 0 if the type has no model
+*/
+struct item_common_struct * GetItemCommon(unsigned char itemType)
+{
+	switch(itemType)
+	{
+	case ITEM_TYPE_BEANS:
+		return &g_beans_common;
+	case ITEM_TYPE_CANTEEN:
+		return &g_canteen_common;
+	case ITEM_TYPE_RIFLE:
+		return &g_rifle_common;
+	case ITEM_TYPE_PISTOL:
+		return &g_pistol_common;
+	}
+	return 0;
+}
+
+/*
+UpdateVisibleItems
+Culls the items on the ground in the draw_grid tiles against the camera
+frustum and leaves the ones to draw in p_grid->visible_items, by item
+type.
+-call after UpdatePlantDrawGrid()
+*/
+void UpdateVisibleItems(struct plant_grid * p_grid, float * camera_pos)
+{
+	struct item_struct ** new_items=0;
+	struct item_struct * pitem=0;
+	struct item_common_struct * p_common=0;
+	float center[3];
+	int k;
+	int r = 1;
+
+	ocSpheresClear(&(p_grid->item_spheres));
+	for(k = 0; k < 9 && r == 1; k++)
+	{
+		if(p_grid->draw_grid[k] == -1)
+			continue;
+
+		//get the head of the linked list. This may be 0 if there are no items on the tile.
+		for(pitem = p_grid->p_tiles[p_grid->draw_grid[k]].items_list; pitem != 0; pitem = pitem->pNext)
+		{
+			p_common = GetItemCommon(pitem->type);
+			if(p_common == 0)
+			{
+				printf("%s: error. '%d' unknown item type.\n", __func__, (int)pitem->type);
+				continue;
+			}
+
+			center[0] = pitem->pos[0];
+			center[1] = pitem->pos[1] + p_common->cull_center_y;
+			center[2] = pitem->pos[2];
+			r = ocSpheresAdd(&(p_grid->item_spheres), center, p_common->cull_radius, FLT_MAX, (int)pitem->type);
+			if(r == 0)
+				break;
+
+			//keep the item pointers as long as the sphere arrays
+			if(p_grid->max_cull_items < p_grid->item_spheres.max)
+			{
+				new_items = (struct item_struct**)realloc(p_grid->cull_items, p_grid->item_spheres.max*sizeof(struct item_struct*));
+				if(new_items == 0)
+				{
+					printf("%s: error. realloc fail for %d items.\n", __func__, p_grid->item_spheres.max);
+					r = 0;
+					break;
+				}
+				p_grid->cull_items = new_items;
+				p_grid->max_cull_items = p_grid->item_spheres.max;
+			}
+			p_grid->cull_items[(p_grid->item_spheres.num-1)] = pitem;
+		}
+	}
+
+	//on an error draw nothing rather than a partial list
+	if(r == 0)
+		ocSpheresClear(&(p_grid->item_spheres));
+
+	ocCullSpheres(g_camera_frustum.planes, camera_pos, &(p_grid->item_spheres), &(p_grid->visible_items));
+}
+
+/*
+UpdateItemDrawList
+Fills item_mats with the model to camera matrix of each item in
+p_grid->visible_items, in the same order.
+-call after UpdateVisibleItems()
+returns 1 on success, 0 on failure (no items will be drawn)
+*/
+int UpdateItemDrawList(struct plant_grid * p_grid, float * mCameraMatrix)
+{
+	struct item_struct * pitem;
+	float mTranslateModelMatrix[16];
+	float * new_mats;
+	int * p_ids;
+	int j;
+	int k;
+
+	if(p_grid->max_item_mats < p_grid->visible_items.num_visible)
+	{
+		new_mats = (float*)realloc(p_grid->item_mats, p_grid->visible_items.num_visible*16*sizeof(float));
+		if(new_mats == 0)
+		{
+			printf("%s: error. realloc fail for %d item matrices.\n", __func__, p_grid->visible_items.num_visible);
+			memset(p_grid->visible_items.num, 0, sizeof(p_grid->visible_items.num));
+			return 0;
+		}
+		p_grid->item_mats = new_mats;
+		p_grid->max_item_mats = p_grid->visible_items.num_visible;
+	}
+
+	for(k = 0; k < OC_MAX_TYPES; k++)
+	{
+		p_ids = p_grid->visible_items.ids + p_grid->visible_items.first[k];
+		for(j = 0; j < p_grid->visible_items.num[k]; j++)
+		{
+			pitem = p_grid->cull_items[p_ids[j]];
+			mmTranslateMatrix(mTranslateModelMatrix, pitem->pos[0], pitem->pos[1], pitem->pos[2]);
+			mmMultiplyMatrix4x4(mCameraMatrix, mTranslateModelMatrix, (p_grid->item_mats + ((p_grid->visible_items.first[k] + j)*16)));
+		}
+	}
+	return 1;
+}
+
 int AddItemToTile(struct item_struct * newItem)
 {
 	struct item_struct * cur_item=0;
@@ -13040,7 +18720,7 @@ This function needs g_big_terrain initialized.
 int InitMapGUIVBO(struct map_gui_info_struct * mapInfo)
 {
 	struct lvl_1_tile * ptile=0;
-	float * pvert=0; //pointer to a vert in a terrain tile
+	float pvert[3]; //position of a vert in a terrain tile
 	float * positions=0; //array of vert3 positions
 	float * p_position=0; //pointer to a particular vert in the positions array
 	char * numAboveWaterVertsInTile=0;
@@ -13107,28 +18787,28 @@ int InitMapGUIVBO(struct map_gui_info_struct * mapInfo)
 
 			//account for the origin corner (we aren't going in counterclockwise order because it doesn't matter
 			//because we are just counting the # of vertices)
-			pvert = ptile->pPos;
+			GetTileVertPos(ptile, 0, pvert);
 			if(pvert[1] >= 0.0f)
 			{
 				num_verts_in_tile_above_water++;
 			}
 
 			//+x,-z corner
-			pvert = ptile->pPos + ((ptile->num_x-1)*8);
+			GetTileVertPos(ptile, (ptile->num_x-1), pvert);
 			if(pvert[1] >= 0.0f)
 			{
 				num_verts_in_tile_above_water++;
 			}
 
 			//-x,+z corner
-			pvert = ptile->pPos + (((ptile->num_z-1)*ptile->num_x)*8);
+			GetTileVertPos(ptile, ((ptile->num_z-1)*ptile->num_x), pvert);
 			if(pvert[1] >= 0.0f)
 			{
 				num_verts_in_tile_above_water++;
 			}
 
 			//+x,+z corner
-			pvert = ptile->pPos + ((ptile->num_verts-1)*8);
+			GetTileVertPos(ptile, (ptile->num_verts-1), pvert);
 			if(pvert[1] >= 0.0f)
 			{
 				num_verts_in_tile_above_water++;
@@ -13180,25 +18860,25 @@ int InitMapGUIVBO(struct map_gui_info_struct * mapInfo)
 				//go through the corners differently this time so that the vertices will be
 				//specified in a counter-clockwise order.
 				//+x,+z corner
-				pvert = ptile->pPos + ((ptile->num_verts-1)*8);
+				GetTileVertPos(ptile, (ptile->num_verts-1), pvert);
 				tempVerts[0] = pvert[0];
 				tempVerts[1] = pvert[1];
 				tempVerts[2] = pvert[2];
 
 				//+x,-z corner
-				pvert = ptile->pPos + ((ptile->num_x-1)*8);
+				GetTileVertPos(ptile, (ptile->num_x-1), pvert);
 				tempVerts[3] = pvert[0];
 				tempVerts[4] = pvert[1];
 				tempVerts[5] = pvert[2];
 
 				//origin
-				pvert = ptile->pPos;
+				GetTileVertPos(ptile, 0, pvert);
 				tempVerts[6] = pvert[0];
 				tempVerts[7] = pvert[1];
 				tempVerts[8] = pvert[2];
 
 				//-x,+z corner
-				pvert = ptile->pPos + (((ptile->num_z-1)*ptile->num_x)*8);
+				GetTileVertPos(ptile, ((ptile->num_z-1)*ptile->num_x), pvert);
 				tempVerts[9] = pvert[0];
 				tempVerts[10] = pvert[1];
 				tempVerts[11] = pvert[2];
@@ -13676,7 +19356,7 @@ vertices needed for the 2d map. This is so memory can be allocated for vertices.
 */
 void MapCountDetailedVerticesInTile(struct lvl_1_tile * ptile, int * num_land_verts)
 {
-	float * p_pos=0;
+	float p_pos[3];
 	char isCornerAboveWater[4]; //flag for each corner in the quad. 1=above water. 0=below water.
 	int i; //row index
 	int j; //column index
@@ -13691,7 +19371,7 @@ void MapCountDetailedVerticesInTile(struct lvl_1_tile * ptile, int * num_land_ve
 			quad_num_verts_above_water = 0;
 
 			//get origin corner
-			p_pos = ptile->pPos + (((i*ptile->num_x) + j)*8);
+			GetTileVertPos(ptile, ((i*ptile->num_x) + j), p_pos);
 			if(p_pos[1] >= 0.0f)
 			{
 				quad_num_verts_above_water += 1;
@@ -13699,7 +19379,7 @@ void MapCountDetailedVerticesInTile(struct lvl_1_tile * ptile, int * num_land_ve
 			}
 
 			//get +x,-z corner
-			p_pos = ptile->pPos + (((i*ptile->num_x) + j+1)*8);		
+			GetTileVertPos(ptile, ((i*ptile->num_x) + j+1), p_pos);
 			if(p_pos[1] >= 0.0f)
 			{
 				quad_num_verts_above_water += 1;
@@ -13707,7 +19387,7 @@ void MapCountDetailedVerticesInTile(struct lvl_1_tile * ptile, int * num_land_ve
 			}
 
 			//get +x,+z corner
-			p_pos = ptile->pPos + ((((i+1)*ptile->num_x) + j+1)*8);		
+			GetTileVertPos(ptile, (((i+1)*ptile->num_x) + j+1), p_pos);
 			if(p_pos[1] >= 0.0f)
 			{
 				quad_num_verts_above_water += 1;
@@ -13715,7 +19395,7 @@ void MapCountDetailedVerticesInTile(struct lvl_1_tile * ptile, int * num_land_ve
 			}
 
 			//get -x,+z corner
-			p_pos = ptile->pPos + ((((i+1)*ptile->num_x) + j)*8);		
+			GetTileVertPos(ptile, (((i+1)*ptile->num_x) + j), p_pos);
 			if(p_pos[1] >= 0.0f)
 			{
 				quad_num_verts_above_water += 1;
@@ -13746,7 +19426,7 @@ to the next free vertex in map_pos.
 int MapCreateDetailedVerticesInTile(struct lvl_1_tile * ptile, float * map_pos, int * i_map)
 {
 	int num_verts_loaded; //# of verts in the triangle_verts array
-	float * quad_pos[4]; //0=origin, 1=+z, 2=+x,+z, 3=+x
+	float quad_pos[4][3]; //0=origin, 1=+z, 2=+x,+z, 3=+x
 	float * p_map_vert=0;
 	float triangle_verts[18]; //array of 6 vec3's
 	float tempVec[3];
@@ -13775,10 +19455,10 @@ int MapCreateDetailedVerticesInTile(struct lvl_1_tile * ptile, float * map_pos,
 			num_new_verts = 0;
 
 			//get the positions of the quad corners
-			quad_pos[0] = ptile->pPos + (((i*ptile->num_x) + j)*8); 		//origin
-			quad_pos[1] = ptile->pPos + ((((i+1)*ptile->num_x) + j)*8); 	//+z
-			quad_pos[2] = ptile->pPos + ((((i+1)*ptile->num_x) + j+1)*8);	//+x,+z
-			quad_pos[3] = ptile->pPos + (((i*ptile->num_x) + j+1)*8); 		//+x
+			GetTileVertPos(ptile, ((i*ptile->num_x) + j), quad_pos[0]); 		//origin
+			GetTileVertPos(ptile, (((i+1)*ptile->num_x) + j), quad_pos[1]); 	//+z
+			GetTileVertPos(ptile, (((i+1)*ptile->num_x) + j+1), quad_pos[2]);	//+x,+z
+			GetTileVertPos(ptile, ((i*ptile->num_x) + j+1), quad_pos[3]); 		//+x
 
 			//count how many vertices are above water
 			num_corners_above_water = 0;
@@ -14053,9 +19733,9 @@ initialization. Once the line data is complete, the line verts are copied into a
 */
 int CreateElevationLinesInTile(struct lvl_1_tile * ptile, struct line_load_struct ** inLineData, float felevation, int * num_lineverts_added)
 {
-	char * hasSearchedQuad;	//byte for each quad in tile. 99 x 99 = 9801
+	char * hasSearchedQuad;	//byte for each quad in tile. e.g. 99 x 99 = 9801
 	struct line_load_struct * curLineData=0;
-	float * quad_pos[4]; //array of pointers. each pointer points to a vec3 that represents a corner.
+	float quad_pos[4][3]; //each is a vec3 that represents a corner.
 	float * ptopPos;
 	float * pbottomPos;
 	float curLinePos[3];
@@ -14071,6 +19751,7 @@ int CreateElevationLinesInTile(struct lvl_1_tile * ptile, struct line_load_struc
 	int curQuad[2]; //0=row, 1=col. current quad when following a line.
 	int isLineStart; //set to 1 if the vert is a start of a new line.
 	int isFollowingLine;
+	int num_quads; //# of quads in the tile
 	int i; //row index
 	int j; //col index
 	int k; //arbitrary index
@@ -14078,13 +19759,14 @@ int CreateElevationLinesInTile(struct lvl_1_tile * ptile, struct line_load_struc
 
 	*num_lineverts_added = 0;
 
-	hasSearchedQuad = (char*)malloc(9801);
+	num_quads = g_big_terrain.tile_num_quads[0]*g_big_terrain.tile_num_quads[1];
+	hasSearchedQuad = (char*)malloc(num_quads);
 	if(hasSearchedQuad == 0)
 	{
 		printf("%s: error line %d\n", __func__, __LINE__);
 		return 0;
 	}
-	memset(hasSearchedQuad, 0, 9801);
+	memset(hasSearchedQuad, 0, num_quads);
 
 	//if the line_load_struct is uninitialized, allocate one block of data.
 	if((*inLineData)->positions == 0)
@@ -14118,10 +19800,10 @@ int CreateElevationLinesInTile(struct lvl_1_tile * ptile, struct line_load_struc
 			isLineStart = 1;
 
 			//get the positions of the corners of the quad
-			quad_pos[0] = ptile->pPos + (((i*ptile->num_x) + j)*8);			//origin
-			quad_pos[1] = ptile->pPos + ((((i+1)*ptile->num_x) + j)*8);		//+z
-			quad_pos[2] = ptile->pPos + ((((i+1)*ptile->num_x) + j+1)*8);	//+x,+z
-			quad_pos[3] = ptile->pPos + (((i*ptile->num_x) + j+1)*8);		//+x
+			GetTileVertPos(ptile, ((i*ptile->num_x) + j), quad_pos[0]);			//origin
+			GetTileVertPos(ptile, (((i+1)*ptile->num_x) + j), quad_pos[1]);		//+z
+			GetTileVertPos(ptile, (((i+1)*ptile->num_x) + j+1), quad_pos[2]);	//+x,+z
+			GetTileVertPos(ptile, ((i*ptile->num_x) + j+1), quad_pos[3]);		//+x
 
 			//create isAboveHeight array so it has flags for each corner
 			for(i_corner = 0; i_corner < 4; i_corner++)
@@ -14196,7 +19878,7 @@ int CreateElevationLinesInTile(struct lvl_1_tile * ptile, struct line_load_struc
 			while(1)
 			{
 				//This is a check to make sure the loop didn't run too many times
-				if(tripCounter > 9801)
+				if(tripCounter > num_quads)
 				{
 					printf("%s: error. while loop stuck in loop.\n", __func__);
 					return 0;
@@ -14224,12 +19906,12 @@ int CreateElevationLinesInTile(struct lvl_1_tile * ptile, struct line_load_struc
 
 				//check that quad we want to move to is in the tile. If it isn't then
 				//move on.
-				if(curQuad[0] < 0 || curQuad[0] > 98)
+				if(curQuad[0] < 0 || curQuad[0] > (g_big_terrain.tile_num_quads[1]-1))
 				{
 					isLineStart = 1; //reset start of line flag.
 					break;
 				}
-				if(curQuad[1] < 0 || curQuad[1] > 98)
+				if(curQuad[1] < 0 || curQuad[1] > (g_big_terrain.tile_num_quads[0]-1))
 				{
 					isLineStart = 1;
 					break;
@@ -14261,10 +19943,10 @@ int CreateElevationLinesInTile(struct lvl_1_tile * ptile, struct line_load_struc
 				}
 
 				//fill in the corner positions for the new quad
-				quad_pos[0] = ptile->pPos + (((curQuad[0]*ptile->num_x) + curQuad[1])*8); 			//origin
-				quad_pos[1] = ptile->pPos + ((((curQuad[0]+1)*ptile->num_x) + curQuad[1])*8); 		//+z
-				quad_pos[2] = ptile->pPos + ((((curQuad[0]+1)*ptile->num_x) + curQuad[1] + 1)*8); 	//+x,+z
-				quad_pos[3] = ptile->pPos + (((curQuad[0]*ptile->num_x) + curQuad[1] + 1)*8);		//+x
+				GetTileVertPos(ptile, ((curQuad[0]*ptile->num_x) + curQuad[1]), quad_pos[0]); 			//origin
+				GetTileVertPos(ptile, (((curQuad[0]+1)*ptile->num_x) + curQuad[1]), quad_pos[1]); 		//+z
+				GetTileVertPos(ptile, (((curQuad[0]+1)*ptile->num_x) + curQuad[1] + 1), quad_pos[2]); 	//+x,+z
+				GetTileVertPos(ptile, ((curQuad[0]*ptile->num_x) + curQuad[1] + 1), quad_pos[3]);		//+x
 				memset(isAboveHeight, 0, 4);
 				for(i_corner = 0; i_corner < 4; i_corner++)
 				{
@@ -14495,9 +20177,9 @@ void DrawMapGUI(void)
 	color[1] = 0.6078f;
 	color[2] = 0.1450f;
 	glUniform3fv(g_gui_shaders.uniforms[1], 1, color);
-	tempVec4[0] = g_a_man.pos[0];
+	tempVec4[0] = g_draw_snapshot->player_pos[0];
 	tempVec4[1] = 0.0f;
-	tempVec4[2] = g_a_man.pos[2];
+	tempVec4[2] = g_draw_snapshot->player_pos[2];
 	tempVec4[3] = 1.0f;
 	mmTransformVec(mCameraMat, tempVec4); //we only want to transform the translation not the model(model is sized for the screen). use model mat from earlier which is mapScaleMat x CameraTranslateMat
 	mmTranslateMatrix(mTranslateMat, tempVec4[0], 0.0f, tempVec4[2]);  